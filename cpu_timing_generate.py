@@ -19,7 +19,7 @@ print ("""/*
 
 with open ('opcode_timings.txt', 'r') as f:
 
-    print ('static const unsigned noprefix_cycles_true[256]\n    = {')
+    print ('static const unsigned noprefix_cycles_false[256]\n    = {')
 
     linecounter = 0x00
     while linecounter < 0x100:
@@ -38,7 +38,7 @@ with open ('opcode_timings.txt', 'r') as f:
     while line == '\n':
         line = f.readline()
 
-    print ('static const unsigned noprefix_cycles_false[256]\n  = {')
+    print ('static const unsigned noprefix_cycles_true[256]\n  = {')
 
     linecounter = 0x00
     while linecounter < 0x100:
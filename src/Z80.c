@@ -3,64 +3,60 @@
  *
  */
 
-#include <time.h>   /* clock_gettime, timespec */
 #include <getopt.h> /* getopt */
 #include <string.h> /* strlen */
-#include <unistd.h> /* usleep */
 
 /* TODO: rejig for fewer interdependencies */
 #include "Z80.h"
+#include "gb.h"
 #include "cpu.h"
-#include "low.h"
 #include "io.h"
+#include "rewind.h"
 #include "mem.h"
 #include "common.h"
 #include "display.h"
+#include "apu.h"
+#include "serial.h"
+#include "sync.h"
 #include "logging.h"
-#include "debugger.h"
 #include "registers.h"
 #include "alarm.h"
 
 
 
 static const unsigned CPU_FREQUENCY = 4194304;
+static const double   vbl_freq      = 59.73;
 
 
 
 /* timer */
-static AlarmID timer_alarm;
-static void timer_update(void);
 static const unsigned timer_cycles[4] = { 1024, 16, 64, 256 };
-
-static AlarmID divider_alarm;
-static void divider_update(void);
 static const unsigned divider_cycles = 256;
 
-static bool use_bios = false;
+static void timer_overflow (gb_t *gb);
 
 
 
-struct emustate G_state
-    = { .running=true,
-        .state=EMUSTATE_NORMAL,
-        .debug={ .enabled=false,
-                 .breakpoint=-1
-               },
-      };
+/* add_input_option: keep an input option for the frontend, as "OPTION VALUE" */
+static void add_input_option (gb_t *gb, const char *option, const char *value) {
 
+    char **options = realloc (gb->input_options, (gb->input_option_count + 1) * sizeof(*options));
+    if (!options)
+        fatal ("failed to allocate the input options");
+    gb->input_options = options;
 
+    char *line = malloc (strlen (option) + strlen (value) + 2);
+    if (!line)
+        fatal ("failed to allocate the input options");
+    sprintf (line, "%s %s", option, value);
 
-/* millis:  */
-static long double millis(void) {
-    struct timespec spec;
-    clock_gettime (CLOCK_MONOTONIC, &spec);
-    return spec.tv_sec + (spec.tv_nsec / 1000000000.0L);
+    gb->input_options[gb->input_option_count++] = line;
 }
 
 
 
 /* Z80_args: handle argv */
-char *Z80_args (int argc, char *argv[]) {
+char *Z80_args (gb_t *gb, int argc, char *argv[]) {
 
     bool forcecpulogging = false;
 
@@ -71,6 +67,22 @@ char *Z80_args (int argc, char *argv[]) {
          { "break"  , required_argument, NULL, 'k' },
          { "disassemble", no_argument  , NULL, 'd' },
          { "bios"   , no_argument      , NULL, 'b' },
+         { "rewind" , required_argument, NULL, 'r' },
+         { "runahead", optional_argument, NULL, 'a' },
+         { "runahead-thread", no_argument, NULL, 't' },
+         { "deterministic", no_argument, NULL, 'D' },
+         { "record" , required_argument, NULL, 'R' },
+         { "play"   , required_argument, NULL, 'P' },
+         { "config" , required_argument, NULL, 'c' },
+         { "bind"   , required_argument, NULL, 'B' },
+         { "padbind", required_argument, NULL, 'G' },
+         { "input"  , required_argument, NULL, 'I' },
+         { "audio"  , required_argument, NULL, 'A' },
+         { "sample-rate", required_argument, NULL, 'S' },
+         { "audio-latency", required_argument, NULL, 'L' },
+         { "link"   , required_argument, NULL, 'C' },
+         { "stop-on", required_argument, NULL, 'O' },
+         { "stop-on-magic", no_argument, NULL, 'M' },
          { NULL     , no_argument      , NULL,  0  }
        };
 
@@ -134,15 +146,15 @@ char *Z80_args (int argc, char *argv[]) {
             if (breakpoint < 0 || breakpoint > (2 << 15) || end == optarg)
                 fatal ("invalid breakpoint %li", breakpoint);
 
-            G_state.debug.enabled    = true;
-            G_state.debug.breakpoint = breakpoint;
+            gb->state.debug.enabled    = true;
+            gb->state.debug.breakpoint = breakpoint;
 
             cpu_logging (true);
             forcecpulogging = true;
           } break;
 
         case 'd':
-            G_state.state |= EMUSTATE_DISASSEMBLE;
+            gb->state.state |= EMUSTATE_DISASSEMBLE;
             cpu_logging (true);
             forcecpulogging = true;
 
@@ -152,7 +164,85 @@ char *Z80_args (int argc, char *argv[]) {
             break;
 
         case 'b':
-            use_bios = true;
+            gb->use_bios = true;
+            break;
+
+        case 'r':
+          { char *end;
+            long megabytes = strtol (optarg, &end, 10);
+            if (megabytes < 0 || *end || end == optarg)
+                fatal ("invalid rewind buffer size %s", optarg);
+
+            gb->rewind_budget = (size_t)megabytes << 20;
+          } break;
+
+        case 'a':
+          { char *end;
+            long frames = optarg? strtol (optarg, &end, 10) : 1;
+            if (optarg && (frames < 0 || frames > 10 || *end || end == optarg))
+                fatal ("invalid number of frames to run ahead %s", optarg);
+
+            gb->runahead = frames;
+          } break;
+
+        case 't':
+            gb->runahead_thread = true;
+            break;
+
+        case 'D':
+            gb->deterministic = true;
+            break;
+
+        case 'R':
+        case 'P':
+            gb->deterministic   = true;
+            gb->movie_name      = optarg;
+            gb->movie_recording = opt == 'R';
+            break;
+
+        case 'c':
+            gb->input_config = optarg;
+            break;
+
+        case 'B':
+        case 'G':
+        case 'I':
+            add_input_option (gb, opt == 'B'? "bind" : opt == 'G'? "padbind" : "input", optarg);
+            break;
+
+        case 'A':
+            gb->audio_name = optarg;
+            break;
+
+        case 'S':
+          { char *end;
+            long rate = strtol (optarg, &end, 10);
+            if (rate < 1000 || rate > APU_MAX_RATE || *end || end == optarg)
+                fatal ("invalid sample rate %s", optarg);
+
+            gb->sample_rate = rate;
+          } break;
+
+        case 'L':
+          { char *end;
+            long ms = strtol (optarg, &end, 10);
+            if (ms < SYNC_MIN_LATENCY * 1000 || ms > SYNC_MAX_LATENCY * 1000 || *end || end == optarg)
+                fatal ("invalid sound latency %s", optarg);
+
+            gb->audio_latency = ms / 1000.0;
+          } break;
+
+        case 'C':
+            gb->link_address = optarg;
+            break;
+
+        case 'O':
+            if (!serial_stop_on (gb, optarg))
+                fatal ("invalid text to stop on '%s' (up to %i bytes)", optarg, SERIAL_STOP_MAX);
+            break;
+
+        case 'M':
+            gb->serial.stop_magic = true;
             break;
                             
         case '?':
@@ -176,151 +266,291 @@ char *Z80_args (int argc, char *argv[]) {
     return in_file;
 }
 
-/* Z80_init:  */
-void Z80_init(void) {
+/* Z80_init: power on, once the program's loaded -- returns false if it can't */
+bool Z80_init (gb_t *gb) {
 
-    srand (time (NULL));
+    init_alarms (gb, CPU_FREQUENCY);
 
-    init_alarms (CPU_FREQUENCY);
+    cpu_init (gb);
+    if (!mem_init (gb, gb->use_bios))
+        return false;
+    display_init (gb);
+    apu_init (gb);
+    serial_init (gb);
 
-    cpu_init();
-    mem_init (use_bios);
-    display_init();
-    debug_init();
-
-    sp = 0x0000;
-    pc = 0x0000;
+    gb->cpu.sp = 0x0000;
+    gb->cpu.pc = 0x0000;
 
 
     /*  set registers to the values they would
      *  have had if we had run the BIOS */
-    if (!use_bios) {
-
-        pc = 0x0100;
-       *AF = 0x0000;
-       *BC = 0x0013;
-       *DE = 0x00D8;
-       *HL = 0x014D;
-        sp = 0xFFFE;
-
-        memsval (0xFF10, 0x80);
-        memsval (0xFF11, 0xBF);
-        memsval (0xFF12, 0xF3);
-        memsval (0xFF14, 0xBF);
-        memsval (0xFF16, 0x3F);
-        memsval (0xFF19, 0xBF);
-        memsval (0xFF1A, 0x7F);
-        memsval (0xFF1B, 0xFF);
-        memsval (0xFF1C, 0x9F);
-        memsval (0xFF1E, 0xBF);
-        memsval (0xFF20, 0xFF);
-        memsval (0xFF23, 0xBF);
-        memsval (0xFF24, 0x77);
-        memsval (0xFF25, 0xF3);
-        memsval (0xFF26, 0xF1);
-        memsval (0xFF40, 0x91);
-        memsval (0xFF47, 0xFC);
-        memsval (0xFF48, 0xFF);
-        memsval (0xFF49, 0xFF);
+    if (!gb->use_bios) {
+
+        gb->cpu.pc = 0x0100;
+       *gb->cpu.AF = 0x0000;
+       *gb->cpu.BC = 0x0013;
+       *gb->cpu.DE = 0x00D8;
+       *gb->cpu.HL = 0x014D;
+        gb->cpu.sp = 0xFFFE;
+
+        /* (the sound has to be on for its registers to be written) */
+        memsval (gb, 0xFF26, 0xF1);
+        memsval (gb, 0xFF10, 0x80);
+        memsval (gb, 0xFF11, 0xBF);
+        memsval (gb, 0xFF12, 0xF3);
+        memsval (gb, 0xFF14, 0xBF);
+        memsval (gb, 0xFF16, 0x3F);
+        memsval (gb, 0xFF19, 0xBF);
+        memsval (gb, 0xFF1A, 0x7F);
+        memsval (gb, 0xFF1B, 0xFF);
+        memsval (gb, 0xFF1C, 0x9F);
+        memsval (gb, 0xFF1E, 0xBF);
+        memsval (gb, 0xFF20, 0xFF);
+        memsval (gb, 0xFF23, 0xBF);
+        memsval (gb, 0xFF24, 0x77);
+        memsval (gb, 0xFF25, 0xF3);
+        memsval (gb, 0xFF40, 0x91);
+        memsval (gb, 0xFF47, 0xFC);
+        memsval (gb, 0xFF48, 0xFF);
+        memsval (gb, 0xFF49, 0xFF);
+
+        /* the BIOS's chime has faded out by the time it's done */
+        gb->apu.ch[0].volume = 0;
     }
 
     /* set up alarms */
-    BYTE TIMECONT = memgval (R_TIMCONT);
-    timer_alarm = mkalarm_cycle (timer_cycles[TIMECONT & 3], timer_update);
+    gb->timer.divider_base = get_cycle_count (gb);
+    gb->timer.base         = gb->timer.divider_base;
+    gb->timer.value        = 0;
+    gb->timer.control      = 0;
+    gb->timer.alarm = mkalarm_cycle (gb, -1, timer_overflow);
+
+    /* (this is the last alarm made, so if there was room for it there was for all of them) */
+    return mkalarm_cycle (gb, 456, display_scanline) != ALARM_NONE;
+}
 
-    divider_alarm = mkalarm_cycle (divider_cycles, divider_update);
+/* timer_ticks: TIMECNT increments since gb->timer.base */
+static uint64_t timer_ticks (gb_t *gb, uint64_t now) {
+    return (now - gb->timer.base) / timer_cycles[gb->timer.control & 3];
 }
 
-/* Z80_update_timer_frequency:  */
-void Z80_update_timer_frequency (bool hard) {
-    void (*set_cycles)(AlarmID, long);
+/* timer_current: compute the current value of TIMECNT */
+static BYTE timer_current (gb_t *gb, uint64_t now) {
 
-    if (hard)
-        set_cycles = set_alarm_cycles;
+    if (!GETBIT(gb->timer.control, 2))
+        return gb->timer.value;
+
+    uint64_t ticks = timer_ticks (gb, now);
+    unsigned to_overflow = 256 - gb->timer.value;
+    if (ticks < to_overflow)
+        return gb->timer.value + ticks;
+
+    /* the overflow alarm hasn't run yet (it only runs between
+     * instructions), so wrap around through TIMEMOD ourselves */
+    BYTE timemod = memgval (gb, R_TIMEMOD);
+    return timemod + ((ticks - to_overflow) % (256 - timemod));
+}
+
+/* timer_sync: fold elapsed ticks into gb->timer.value, keeping the phase */
+static void timer_sync (gb_t *gb, uint64_t now) {
+
+    if (GETBIT(gb->timer.control, 2)) {
+        BYTE value = timer_current (gb, now);
+        gb->timer.base += timer_ticks (gb, now) * timer_cycles[gb->timer.control & 3];
+        gb->timer.value = value;
+    }
     else
-        set_cycles = set_alarm_cycles_clean;
+        gb->timer.base = now;
+}
+
+/* timer_schedule: set the alarm for the next TIMECNT overflow */
+static void timer_schedule (gb_t *gb, uint64_t now) {
 
-    set_cycles (timer_alarm, timer_cycles[memgval (R_TIMCONT) & 3]);
+    if (GETBIT(gb->timer.control, 2)) {
+        uint64_t overflow = gb->timer.base
+                          + (256 - gb->timer.value) * timer_cycles[gb->timer.control & 3];
+        set_alarm_cycles (gb, gb->timer.alarm, overflow - now);
+    }
+    else
+        set_alarm_cycles (gb, gb->timer.alarm, -1);
 }
 
-/* timer_update:  */
-static void timer_update(void) {
+/* timer_overflow: TIMECNT overflowed, so reload it and interrupt */
+static void timer_overflow (gb_t *gb) {
 
-    BYTE TIMECONT = memgval (R_TIMCONT);
+    uint64_t now    = get_cycle_count (gb);
+    unsigned period = timer_cycles[gb->timer.control & 3];
+    BYTE timemod    = memgval (gb, R_TIMEMOD);
 
-    if (GETBIT(TIMECONT, 2)) {
+    /* the overflow happened at a known cycle, which may have been a few cycles
+     * before the end of the instruction that crossed it -- with a short period
+     * and TIMEMOD near $FF, that's long enough for it to have overflowed again
+     * (reloading each time), and the next overflow has to be after now */
+    do {
+        gb->timer.base += (256 - gb->timer.value) * period;
+        gb->timer.value = timemod;
+    } while (gb->timer.base + ((256 - timemod) * period) <= now);
 
-        BYTE timecount = memgval (R_TIMECNT);
+    cpu_interrupt (gb, INT_TIMER);
+    timer_schedule (gb, now);
+}
 
-        if (timecount + 1 > 255) {
-            memsval (R_TIMECNT, memgval (R_TIMEMOD));
-            cpu_interrupt (INT_TIMER);
-        }
-        else {
-            timecount++;
-            memsval (R_TIMECNT, timecount);
-        }
-    }
+/* Z80_timer_read: get the value of DIVIDER/TIMECNT */
+BYTE Z80_timer_read (gb_t *gb, WORD location) {
+
+    uint64_t now = get_cycle_count (gb);
+
+    if (location == R_DIVIDER)
+        return (now - gb->timer.divider_base) / divider_cycles;
+    else
+        return timer_current (gb, now);
 }
 
-/* divider_update:  */
-static void divider_update(void) {
-    BYTE divider = memgval (R_DIVIDER);
-    mem_set_register (R_DIVIDER, divider + 1);
+/* Z80_timer_write: re-base the timer after a write to $FF04-$FF07 */
+void Z80_timer_write (gb_t *gb, WORD location, BYTE byte) {
+
+    uint64_t now = get_cycle_count (gb);
+
+    switch (location) {
+    /* writing to DIVIDER resets it and TIMECNT */
+    case R_DIVIDER:
+        gb->timer.divider_base = now;
+        gb->timer.base         = now;
+        gb->timer.value        = 0;
+        break;
+
+    /* TIMECNT/TIMEMOD immediately set TIMECNT */
+    case R_TIMECNT:
+    case R_TIMEMOD:
+        timer_sync (gb, now);
+        gb->timer.value = byte;
+        break;
+
+    /* TIMCONT immediately sets timer frequency */
+    case R_TIMCONT:
+        timer_sync (gb, now);
+        gb->timer.control = byte & 7;
+        gb->timer.base    = now;
+        break;
+
+    default:
+        break;
+    }
+    timer_schedule (gb, now);
 }
 
-/* Z80_cleanup: clean up */
-void Z80_cleanup(void) {
-    /* unused */
+/* Z80_create: a new emulator instance, ready for Z80_args/Z80_load -- NULL if it can't be allocated */
+gb_t *Z80_create(void) {
+
+    gb_t *gb = calloc (1, sizeof(*gb));
+    if (!gb)
+        return NULL;
+
+    gb->state = (struct emustate)
+      { .running=true,
+        .state=EMUSTATE_NORMAL,
+        .debug={ .enabled=false,
+                 .breakpoint=-1
+               },
+      };
+    gb->rewind_budget = REWIND_DEFAULT_BUDGET;
+    gb->runahead      = -1;
+
+    return gb;
 }
 
-/* Z80_load: load the program */
-void Z80_load (char *fname) {
-    mem_loadcart (fname);
+/* Z80_cleanup: clean up + free the instance (the frontend cleans up its own stuff first) */
+void Z80_cleanup (gb_t *gb) {
+
+    mem_cleanup (gb);
+    serial_cleanup (gb);
+
+    for (unsigned i = 0; i < gb->input_option_count; ++i)
+        free (gb->input_options[i]);
+    free (gb->input_options);
+
+    free (gb);
 }
 
+/* Z80_load: load the program -- returns false if it can't be */
+bool Z80_load (gb_t *gb, char *fname) {
+    return mem_loadcart (gb, fname);
+}
 
-/* Z80_frame: emulate one frame */
-void Z80_frame(void) {
 
-    static const double vbl_freq = 59.73;
+/* Z80_run: emulate at least cycles cycles, returning how many were run */
+unsigned long Z80_run (gb_t *gb, unsigned long cycles) {
 
-    long double start = millis(),
-                waste = 0.0L;
-    unsigned long cycles_this_frame = 0;
+    unsigned long cycles_run = 0;
 
-    while (cycles_this_frame < CPU_FREQUENCY / vbl_freq && G_state.running) {
+    while (cycles_run < cycles && gb->state.running) {
 
         /* program is not paused */
-        if (G_state.state & EMUSTATE_NORMAL) {
+        if (gb->state.state & EMUSTATE_NORMAL) {
 
-            unsigned num_cycles = cpu_cycle();
-            cycles_this_frame += num_cycles;
+            unsigned num_cycles = cpu_cycle (gb);
+            cycles_run += num_cycles;
+            gb->display.frame_cycles += num_cycles;
 
             /* update/run alarms */
-            update_alarms (num_cycles);
+            update_alarms (gb, num_cycles);
+
+            /* a byte's gone out over serial (or the link cable has to sync up) */
+            if (get_cycle_count (gb) >= gb->serial.due)
+                serial_event (gb);
+
+            /* end of the frame */
+            if (gb->display.frame_cycles >= CPU_FREQUENCY / vbl_freq) {
+                display_update (gb);
+                apu_frame (gb);
+                mem_tick (gb, gb->display.frame_cycles);
+                gb->display.frame_cycles = 0;
+            }
         }
 
-        /* run the debugger if requested */
-        if (G_state.state & EMUSTATE_DEBUG) {
-            long double dbg_st = millis();
-            debug_prompt();
-            waste += millis() - dbg_st;
+        /* run the debugger if requested -- without one, just carry on */
+        if (gb->state.state & EMUSTATE_DEBUG) {
+            if (gb->debugger)
+                gb->debugger (gb);
+            else {
+                gb->state.debug.enabled = false;
+                gb->state.state = EMUSTATE_NORMAL;
+            }
         }
     }
+    return cycles_run;
+}
+
+/* Z80_frame_left: the cycles left until the end of the current frame */
+unsigned long Z80_frame_left (gb_t *gb) {
+
+    /* (the frame ends as soon as a whole number of cycles gets past this) */
+    double left = CPU_FREQUENCY / vbl_freq - gb->display.frame_cycles;
+    unsigned long cycles = left;
+    if (cycles < left)
+        cycles++;
+
+    return cycles;
+}
+
+/* Z80_run_frame: emulate up to the end of the current frame */
+unsigned long Z80_run_frame (gb_t *gb) {
+    return Z80_run (gb, Z80_frame_left (gb));
+}
+
+/* Z80_frame: emulate one frame in real time */
+void Z80_frame (gb_t *gb) {
+
+    long double start = millis();
 
-    display_update();
+    Z80_run_frame (gb);
 
-    long double frametime = (millis() - start) - waste;
+    long double frametime = millis() - start;
     debug ("frame took %Lf seconds (%Lf FPS)", frametime, 1.0L / frametime);
 
-/* NOTE: can be disabled for unlimited framerate */
-#if 1
-    /* sleep for any extra time */
-    long sleeptime = (long)(((1.0/vbl_freq) - frametime) * 1000000.0);
-    if (sleeptime > 0)
-        usleep (sleeptime);
-#endif
+    /* (without any pacing, the framerate is unlimited) */
+    if (gb->sync)
+        sync_frame (gb->sync, gb, 1.0 / vbl_freq);
 }
 
 /* Z80_logging:  */
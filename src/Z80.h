@@ -7,22 +7,45 @@
 #define __Z80_H
 
 
+#include "common.h"
+#include "alarm.h"
+
 #include <stdbool.h>
 
 
 
-char *Z80_args (int argc, char *argv[]);
+/* timer:
+ *  the timer state of an emulator instance
+ */
+/* NOTE: DIVIDER and TIMECNT are computed from the cycle counter when
+ *       they are read, so the only alarm needed is for TIMECNT overflow */
+struct timer {
+    AlarmID  alarm;
+    uint64_t divider_base;  /* cycle when DIVIDER was last reset */
+    uint64_t base;          /* cycle when TIMECNT was value */
+    BYTE     value;
+    BYTE     control;
+};
+
+
 
-void Z80_init(void);
-void Z80_cleanup(void);
+gb_t *Z80_create(void);
+char *Z80_args (gb_t *gb, int argc, char *argv[]);
 
-void Z80_load (char *fname);
-void Z80_frame(void);
+bool Z80_init (gb_t *gb);
+void Z80_cleanup (gb_t *gb);
 
-void Z80_update_timer_frequency (bool hard);
+bool Z80_load (gb_t *gb, char *fname);
+
+unsigned long Z80_run (gb_t *gb, unsigned long cycles);
+unsigned long Z80_frame_left (gb_t *gb);
+unsigned long Z80_run_frame (gb_t *gb);
+void Z80_frame (gb_t *gb);
+
+BYTE Z80_timer_read (gb_t *gb, WORD location);
+void Z80_timer_write (gb_t *gb, WORD location, BYTE byte);
 
 void Z80_logging (bool enable);
 
 
 #endif
-
@@ -4,6 +4,8 @@
  */
 
 #include "alarm.h"
+#include "arena.h"
+#include "gb.h"
 #include "logging.h"
 
 #include <stdlib.h>
@@ -12,55 +14,47 @@
 
 
 
-static AlarmID  next_id     =    1;
-static unsigned alarm_count =    0;
-static Alarm   *alarms      = NULL;
+/* the alarms (and the master clock, in cycles since init_alarms) are kept in the arena */
+#define sched       (&gb->arena->sched)
+#define alarms      (sched->alarms)
+#define alarm_count (sched->alarm_count)
 
-static unsigned cpu_frequency;
 
 
-
-/* free_alarms:  */
-void free_alarms(void) {
-    free (alarms);
-    alarms      = NULL;
-    alarm_count = 0;
-    next_id     = 0;
-}
-
 /* init_alarms:  */
-void init_alarms(unsigned f) {
-    next_id     = 0;
-    alarm_count = 0;
-    alarms      = NULL;
+/* NOTE: the arena has to have been created */
+void init_alarms (gb_t *gb, unsigned f) {
+    memset (sched, 0, sizeof(*sched));
 
-    cpu_frequency = f;
-
-    atexit (free_alarms);
+    sched->frequency = f;
 }
 
 /* mkalarm_freq: create an alarm that triggers n times per second */
-AlarmID mkalarm_freq (double frequency, void (*fn)()) {
+AlarmID mkalarm_freq (gb_t *gb, double frequency, void (*fn)(gb_t *)) {
 
-    long cycles = cpu_frequency / frequency;
-    return mkalarm_cycle (cycles, fn);
+    long cycles = sched->frequency / frequency;
+    return mkalarm_cycle (gb, cycles, fn);
 }
 
-/* mkalarm_cycle: create an alarm that triggers every n cycles */
-AlarmID mkalarm_cycle (long cycles, void (*fn)()) {
+/* mkalarm_cycle: create an alarm that triggers every n cycles -- ALARM_NONE if
+ *                there's no room for it (which is an alarm that never runs) */
+AlarmID mkalarm_cycle (gb_t *gb, long cycles, void (*fn)(gb_t *)) {
 
-    alarm_count++;
-    alarms = realloc (alarms, alarm_count * sizeof(Alarm));
-    memset (alarms + alarm_count-1, 0, sizeof(Alarm));
+    if (alarm_count == ALARM_SLOTS) {
+        error ("out of alarm slots");
+        return ALARM_NONE;
+    }
 
+    alarm_count++;
     Alarm *a = &alarms[alarm_count - 1];
+    memset (a, 0, sizeof(Alarm));
 
-    a->id          = next_id;
+    a->id          = sched->next_id;
     a->cyclecount  = cycles;
     a->to_next_run = a->cyclecount;
     a->run = fn;
 
-    next_id++;
+    sched->next_id++;
 
     //debug ("created alarm %llu, triggers after %li cycles", a->id, a->cyclecount);
 
@@ -68,7 +62,7 @@ AlarmID mkalarm_cycle (long cycles, void (*fn)()) {
 }
 
 /* rmalarm: remove an alarm */
-void rmalarm (AlarmID id) {
+void rmalarm (gb_t *gb, AlarmID id) {
 
     bool found = false;
     for (unsigned i = 0; !found && i < alarm_count; ++i)
@@ -81,16 +75,16 @@ void rmalarm (AlarmID id) {
             found = true;
         }
 
-    if (found) {
+    if (found)
         alarm_count--;
-        alarms = realloc (alarms, sizeof(Alarm) * alarm_count);
-    }
     else
         error ("AlarmID %llu does not exist!", id);
 }
 
 /* update_alarms:  */
-void update_alarms (unsigned num_cycles) {
+void update_alarms (gb_t *gb, unsigned num_cycles) {
+
+    sched->cycle_count += num_cycles;
 
     for (unsigned i = 0; i < alarm_count; ++i) {
         Alarm *a = &alarms[i];
@@ -101,25 +95,30 @@ void update_alarms (unsigned num_cycles) {
             if (a->to_next_run <= 0) {
                 a->to_next_run += a->cyclecount;
                 if (a->run != NULL)
-                    a->run();
+                    a->run (gb);
             }
         }
     }
 }
 
+/* get_cycle_count: return the master cycle counter */
+uint64_t get_cycle_count (gb_t *gb) {
+    return gb->arena? sched->cycle_count : 0;
+}
+
 /* set_alarm_freq:  */
-void set_alarm_freq (AlarmID id, double frequency) {
+void set_alarm_freq (gb_t *gb, AlarmID id, double frequency) {
 
     for (unsigned i = 0; i < alarm_count; ++i)
         if (alarms[i].id == id) {
-            alarms[i].cyclecount = cpu_frequency / frequency;
+            alarms[i].cyclecount = sched->frequency / frequency;
             alarms[i].to_next_run = alarms[i].cyclecount;
             break;
         }
 }
 
 /* set_alarm_cycles: set cyclecount, resetting to_next_run */
-void set_alarm_cycles (AlarmID id, long cycles) {
+void set_alarm_cycles (gb_t *gb, AlarmID id, long cycles) {
 
 
     for (unsigned i = 0; i < alarm_count; ++i)
@@ -132,7 +131,7 @@ void set_alarm_cycles (AlarmID id, long cycles) {
 }
 
 /* set_alarm_cycles_clean: set cyclecount, without resetting to_next_run */
-void set_alarm_cycles_clean (AlarmID id, long cycles) {
+void set_alarm_cycles_clean (gb_t *gb, AlarmID id, long cycles) {
 
 
     for (unsigned i = 0; i < alarm_count; ++i)
@@ -144,7 +143,7 @@ void set_alarm_cycles_clean (AlarmID id, long cycles) {
 }
 
 /* set_alarm_func:  */
-void set_alarm_func (AlarmID id, void (*fn)()) {
+void set_alarm_func (gb_t *gb, AlarmID id, void (*fn)(gb_t *)) {
 
     for (unsigned i = 0; i < alarm_count; ++i)
         if (alarms[i].id == id) {
@@ -153,8 +152,18 @@ void set_alarm_func (AlarmID id, void (*fn)()) {
         }
 }
 
+/* get_alarm_func:  */
+void (*get_alarm_func (gb_t *gb, AlarmID id))(gb_t *) {
+    for (unsigned i = 0; i < alarm_count; ++i)
+        if (alarms[i].id == id)
+            return alarms[i].run;
+
+    error ("Alarm %llu does not exist!", id);
+    return NULL;
+}
+
 /* get_alarm_remaining: return to_next_run */
-long get_alarm_remaining (AlarmID id) {
+long get_alarm_remaining (gb_t *gb, AlarmID id) {
     for (unsigned i = 0; i < alarm_count; ++i)
         if (alarms[i].id == id)
             return alarms[i].to_next_run;
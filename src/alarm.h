@@ -7,32 +7,43 @@
 #define __ALARM_HPP
 
 
+#include "common.h"
+
+#include <stdint.h>
+
+
+
 typedef unsigned long long AlarmID;
 
+/* (what mkalarm_cycle returns when it's out of slots) */
+#define ALARM_NONE  ((AlarmID)-1)
+
 typedef struct Alarm {
     AlarmID id;
 
     long   to_next_run;
     long   cyclecount;
-    void (*run)();
+    void (*run)(gb_t *gb);
 } Alarm;
 
 
 
-void init_alarms (unsigned f);
-void update_alarms (unsigned num_cycles);
+void init_alarms (gb_t *gb, unsigned f);
+void update_alarms (gb_t *gb, unsigned num_cycles);
+uint64_t get_cycle_count (gb_t *gb);
 
-AlarmID mkalarm_freq (double frequency, void (*fn)());
-AlarmID mkalarm_cycle (long cycles, void (*fn)());
+AlarmID mkalarm_freq (gb_t *gb, double frequency, void (*fn)(gb_t *));
+AlarmID mkalarm_cycle (gb_t *gb, long cycles, void (*fn)(gb_t *));
 
-void rmalarm (AlarmID id);
+void rmalarm (gb_t *gb, AlarmID id);
 
-void set_alarm_freq (AlarmID id, double frequency);
-void set_alarm_cycles (AlarmID id, long cycles);
-void set_alarm_cycles_clean (AlarmID id, long cycles);
-void set_alarm_func (AlarmID id, void (*fn)());
+void set_alarm_freq (gb_t *gb, AlarmID id, double frequency);
+void set_alarm_cycles (gb_t *gb, AlarmID id, long cycles);
+void set_alarm_cycles_clean (gb_t *gb, AlarmID id, long cycles);
+void set_alarm_func (gb_t *gb, AlarmID id, void (*fn)(gb_t *));
+void (*get_alarm_func (gb_t *gb, AlarmID id))(gb_t *);
 
-long get_alarm_remaining (AlarmID id);
+long get_alarm_remaining (gb_t *gb, AlarmID id);
 
 
 #endif
@@ -0,0 +1,699 @@
+/*
+ * Sound for Gameboy
+ *
+ */
+
+#include "apu.h"
+#include "gb.h"
+#include "arena.h"
+#include "alarm.h"      /* get_cycle_count */
+#include "registers.h"
+
+#include <string.h>     /* memset, memmove */
+
+
+
+/*          HOW THE SOUND IS MADE
+ *          =====================
+ *
+ * Nothing is done per instruction: the channels are run in one go from when
+ * they were last run (apu.synced) up to now, whenever a sound register is
+ * read or written and at the end of every frame.  The registers only change
+ * at those times, so in between them each channel is just a timer stepping
+ * through a waveform, broken up at the frame sequencer's steps (which clock
+ * the lengths, the envelopes and the sweep).
+ *
+ * The mixer is only told when a channel's output changes, as a step in the
+ * amplitude at the exact cycle -- which is added to the block as a band-limited
+ * step (from a table of APU_PHASES windowed sincs, APU_TAPS samples wide), so
+ * square waves at any pitch don't alias.  The block holds the differences
+ * between samples, which are summed (through a high-pass filter, like the
+ * capacitor on the real thing) into the ring at the end of each block.
+ *
+ * Running ahead (gb->speculative) runs the channels without telling the
+ * mixer anything, so the samples only ever come from real frames.
+ */
+
+/* the frame sequencer steps at 512 Hz */
+#define SEQUENCER_CYCLES    8192
+
+/* a block is ended once it's this close to full (a step of the frame
+ * sequencer is at most 375 samples, at APU_MAX_RATE) */
+#define BLOCK_SLACK         512
+
+/* the kernel sums to 1 << KERNEL_BITS */
+#define KERNEL_BITS         13
+#define PHASE_BITS          5
+
+/* a channel outputting 15, on both sides, at full volume is AMP_UNIT * 15 * 8 --
+ * so all four come to at most 30720 */
+#define AMP_UNIT            64
+
+/* the high-pass filter's cutoff is about rate / (2 pi 2^BASS_SHIFT) (15 Hz at 48kHz) */
+#define BASS_SHIFT          9
+
+_Static_assert (APU_PHASES == 1 << PHASE_BITS, "APU_PHASES doesn't match PHASE_BITS");
+
+
+/* read back (OR'd with what was written) -- the bits which can't be read, or aren't there */
+static const BYTE read_masks[R_SNDREG52 - R_SNDREG10] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,   /* NR10-NR14 */
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,   /* (unused), NR21-NR24 */
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,   /* NR30-NR34 */
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,   /* (unused), NR41-NR44 */
+    0x00, 0x00,                     /* NR50, NR51 */
+};
+
+/* the square waves, left to right */
+static const BYTE duty_cycles[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+/* the wave channel's output level -> the shift to the samples (4 is muted) */
+static const BYTE wave_shifts[4] = { 4, 0, 1, 2 };
+
+static const BYTE noise_divisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+/* band-limited steps: kernel[phase] is added to the APU_TAPS samples after a
+ * step that far (phase / APU_PHASES of a sample) into its first sample --
+ * made by sampling sinc(0.9 x) under a Blackman window, so each row sums to
+ * 1 << KERNEL_BITS */
+static const int16_t kernel[APU_PHASES][APU_TAPS] = {
+    {     1,    -6,     8,    23,  -150,   492, -1342,  5069,  5071, -1342,   492,  -150,    23,     8,    -6,     1 },
+    {     1,    -5,     4,    34,  -171,   522, -1360,  4810,  5322, -1311,   457,  -127,    10,    13,    -8,     1 },
+    {     1,    -4,    -1,    45,  -190,   545, -1367,  4543,  5564, -1268,   417,  -101,    -3,    19,    -9,     1 },
+    {     0,    -2,    -5,    54,  -206,   564, -1362,  4269,  5795, -1211,   371,   -73,   -17,    24,   -11,     2 },
+    {     0,    -1,    -9,    63,  -220,   577, -1346,  3991,  6014, -1141,   319,   -43,   -31,    30,   -13,     2 },
+    {     0,     0,   -12,    70,  -232,   585, -1321,  3711,  6220, -1058,   263,   -11,   -46,    35,   -14,     2 },
+    {     0,     1,   -16,    77,  -240,   587, -1286,  3429,  6411,  -960,   202,    22,   -62,    41,   -16,     2 },
+    {     0,     1,   -18,    82,  -247,   585, -1243,  3145,  6587,  -848,   136,    57,   -78,    47,   -17,     3 },
+    {     0,     2,   -21,    87,  -251,   578, -1191,  2861,  6748,  -723,    66,    93,   -94,    53,   -19,     3 },
+    {     0,     3,   -23,    90,  -253,   566, -1133,  2581,  6891,  -583,    -8,   130,  -110,    58,   -20,     3 },
+    {     0,     3,   -24,    93,  -252,   551, -1068,  2301,  7017,  -430,   -86,   168,  -126,    64,   -22,     3 },
+    {     0,     4,   -26,    95,  -250,   532,  -998,  2025,  7125,  -264,  -166,   206,  -141,    69,   -23,     4 },
+    {     0,     4,   -27,    95,  -245,   509,  -923,  1757,  7214,   -84,  -249,   244,  -157,    74,   -24,     4 },
+    {     0,     4,   -27,    95,  -239,   483,  -844,  1495,  7283,   108,  -334,   282,  -172,    79,   -25,     4 },
+    {     0,     4,   -28,    94,  -231,   454,  -763,  1242,  7333,   313,  -420,   319,  -186,    83,   -26,     4 },
+    {     0,     4,   -28,    92,  -222,   423,  -679,   996,  7363,   529,  -506,   355,  -199,    87,   -27,     4 },
+    {     0,     4,   -27,    90,  -211,   390,  -593,   756,  7374,   756,  -593,   390,  -211,    90,   -27,     4 },
+    {     0,     4,   -27,    87,  -199,   355,  -506,   529,  7365,   994,  -679,   423,  -222,    92,   -28,     4 },
+    {     0,     4,   -26,    83,  -186,   319,  -420,   313,  7335,  1240,  -763,   454,  -231,    94,   -28,     4 },
+    {     0,     4,   -25,    79,  -172,   282,  -334,   108,  7283,  1495,  -844,   483,  -239,    95,   -27,     4 },
+    {     0,     4,   -24,    74,  -157,   244,  -249,   -84,  7213,  1758,  -923,   509,  -245,    95,   -27,     4 },
+    {     0,     4,   -23,    69,  -141,   206,  -166,  -264,  7123,  2027,  -998,   532,  -250,    95,   -26,     4 },
+    {     0,     3,   -22,    64,  -126,   168,   -86,  -430,  7017,  2301, -1068,   551,  -252,    93,   -24,     3 },
+    {     0,     3,   -20,    58,  -110,   130,    -8,  -583,  6893,  2579, -1133,   566,  -253,    90,   -23,     3 },
+    {     0,     3,   -19,    53,   -94,    93,    66,  -723,  6748,  2861, -1191,   578,  -251,    87,   -21,     2 },
+    {     0,     3,   -17,    47,   -78,    57,   136,  -848,  6588,  3144, -1243,   585,  -247,    82,   -18,     1 },
+    {     0,     2,   -16,    41,   -62,    22,   202,  -960,  6412,  3428, -1286,   587,  -240,    77,   -16,     1 },
+    {     0,     2,   -14,    35,   -46,   -11,   263, -1058,  6220,  3711, -1321,   585,  -232,    70,   -12,     0 },
+    {     0,     2,   -13,    30,   -31,   -43,   319, -1141,  6012,  3993, -1346,   577,  -220,    63,    -9,    -1 },
+    {     0,     2,   -11,    24,   -17,   -73,   371, -1212,  5795,  4270, -1362,   564,  -206,    54,    -5,    -2 },
+    {     0,     1,    -9,    19,    -3,  -101,   417, -1268,  5564,  4544, -1367,   545,  -190,    45,    -1,    -4 },
+    {     0,     1,    -8,    13,    10,  -127,   457, -1312,  5323,  4811, -1360,   522,  -171,    34,     4,    -5 },
+};
+
+
+
+/* reg: a sound register, as it was last written */
+static inline BYTE *reg (gb_t *gb, WORD location) {
+    return &gb->arena->high[location - 0xFE00];
+}
+
+/* channel_reg: register NRnx of channel n (0-3) -- x is 0-4 */
+static inline BYTE channel_reg (gb_t *gb, unsigned n, unsigned x) {
+    return *reg (gb, R_SNDREG10 + (n * 5) + x);
+}
+
+/* powered: whether NR52 has the sound on */
+static inline bool powered (gb_t *gb) {
+    return GETBIT(*reg (gb, R_SNDREG52), 7);
+}
+
+/* frequency: the 11-bit frequency of channel n (0-2) */
+static inline unsigned frequency (gb_t *gb, unsigned n) {
+    return channel_reg (gb, n, 3) | ((channel_reg (gb, n, 4) & 7) << 8);
+}
+
+/* period: cycles between the steps of channel n's waveform */
+static unsigned period (gb_t *gb, unsigned n) {
+
+    switch (n) {
+    case 0:
+    case 1:
+        return (2048 - frequency (gb, n)) * 4;
+    case 2:
+        return (2048 - frequency (gb, n)) * 2;
+    default:
+      { BYTE nr43 = channel_reg (gb, 3, 3);
+        return noise_divisors[nr43 & 7] << (nr43 >> 4);
+      }
+    }
+}
+
+/* dac_on: whether channel n's DAC is on (if it isn't, the channel can't be) */
+static bool dac_on (gb_t *gb, unsigned n) {
+    if (n == 2)
+        return GETBIT(channel_reg (gb, 2, 0), 7);
+    return (channel_reg (gb, n, 2) & 0xF8) != 0;
+}
+
+
+
+/* add_step: step the output by left/right at time (a cycle) */
+static inline void add_step (gb_t *gb, uint64_t time, int left, int right) {
+
+    struct apu *apu = &gb->apu;
+
+    uint64_t pos = ((time - apu->block_start) * apu->factor) + apu->block_frac;
+    const int16_t *k = kernel[(pos >> (32 - PHASE_BITS)) & (APU_PHASES - 1)];
+    int32_t *l = &apu->block[0][pos >> 32],
+            *r = &apu->block[1][pos >> 32];
+
+    for (unsigned i = 0; i < APU_TAPS; ++i) {
+        l[i] += k[i] * left;
+        r[i] += k[i] * right;
+    }
+}
+
+/* mix: tell the mixer what channel n is outputting at time */
+static inline void mix (gb_t *gb, unsigned n, uint64_t time) {
+
+    struct channel *ch = &gb->apu.ch[n];
+    int left  = ch->output * gb->apu.scale[n][0],
+        right = ch->output * gb->apu.scale[n][1];
+
+    if (left != ch->amp[0] || right != ch->amp[1]) {
+        add_step (gb, time, left - ch->amp[0], right - ch->amp[1]);
+        ch->amp[0] = left;
+        ch->amp[1] = right;
+    }
+}
+
+/* set_output: channel n starts outputting output (0-15) at time */
+static inline void set_output (gb_t *gb, unsigned n, uint64_t time, BYTE output) {
+
+    struct channel *ch = &gb->apu.ch[n];
+    if (output == ch->output)
+        return;
+
+    ch->output = output;
+    if (!gb->speculative)
+        mix (gb, n, time);
+}
+
+/* remix: take NR50/NR51 (the volume + which side each channel is on) into account */
+static void remix (gb_t *gb) {
+
+    BYTE nr50 = *reg (gb, R_SNDREG50),
+         nr51 = *reg (gb, R_SNDREG51);
+
+    for (unsigned n = 0; n < 4; ++n) {
+        gb->apu.scale[n][0] = GETBIT(nr51, n + 4)? (((nr50 >> 4) & 7) + 1) * AMP_UNIT : 0;
+        gb->apu.scale[n][1] = GETBIT(nr51, n    )? (( nr50       & 7) + 1) * AMP_UNIT : 0;
+
+        if (!gb->speculative)
+            mix (gb, n, gb->apu.synced);
+    }
+}
+
+/* end_block: turn the block up to time into samples, and put them in the ring */
+static void end_block (gb_t *gb, uint64_t time) {
+
+    struct apu *apu = &gb->apu;
+
+    uint64_t pos = ((time - apu->block_start) * apu->factor) + apu->block_frac;
+    size_t count = pos >> 32;
+    apu->block_start = time;
+    apu->block_frac  = (uint32_t)pos;
+
+    for (size_t i = 0; i < count; ++i) {
+
+        if (apu->ring_count == APU_RING_FRAMES) {
+            apu->ring_head = (apu->ring_head + 1) % APU_RING_FRAMES;
+            apu->ring_count--;
+            apu->dropped++;
+        }
+        int16_t *out = &apu->ring[((apu->ring_head + apu->ring_count++) % APU_RING_FRAMES) * 2];
+
+        for (unsigned side = 0; side < 2; ++side) {
+            int32_t s = apu->integrator[side] >> KERNEL_BITS;
+            out[side] = s < INT16_MIN? INT16_MIN : s > INT16_MAX? INT16_MAX : s;
+
+            apu->integrator[side] += apu->block[side][i];
+            apu->integrator[side] -= s << (KERNEL_BITS - BASS_SHIFT);
+        }
+    }
+
+    /* the ends of the steps are the start of the next block */
+    for (unsigned side = 0; side < 2; ++side) {
+        memmove (apu->block[side], apu->block[side] + count, APU_TAPS * sizeof(int32_t));
+        memset (apu->block[side] + APU_TAPS, 0, count * sizeof(int32_t));
+    }
+}
+
+
+
+/* run_square: run channel n (0 or 1) from from up to to */
+static void run_square (gb_t *gb, unsigned n, uint64_t from, uint64_t to) {
+
+    struct channel *ch = &gb->apu.ch[n];
+    BYTE volume = ch->volume;
+
+    if (!ch->on) {
+        set_output (gb, n, from, 0);
+        return;
+    }
+
+    BYTE duty = duty_cycles[channel_reg (gb, n, 1) >> 6];
+    unsigned p = period (gb, n);
+    uint64_t t = from + ch->timer;
+
+    set_output (gb, n, from, GETBIT(duty, 7 - ch->step) * volume);
+
+    /* (silent, so just keep its place) */
+    if (volume == 0) {
+        if (t < to) {
+            uint64_t steps = ((to - t - 1) / p) + 1;
+            ch->step = (ch->step + steps) & 7;
+            t += steps * p;
+        }
+        ch->timer = t - to;
+        return;
+    }
+
+    for (; t < to; t += p) {
+        ch->step = (ch->step + 1) & 7;
+        set_output (gb, n, t, GETBIT(duty, 7 - ch->step) * volume);
+    }
+    ch->timer = t - to;
+}
+
+/* run_wave: run channel 3 from from up to to */
+static void run_wave (gb_t *gb, uint64_t from, uint64_t to) {
+
+    struct channel *ch = &gb->apu.ch[2];
+    const BYTE *wave = reg (gb, 0xFF30);
+    BYTE shift = wave_shifts[(channel_reg (gb, 2, 2) >> 5) & 3];
+
+    if (!ch->on) {
+        set_output (gb, 2, from, 0);
+        return;
+    }
+
+    unsigned p = period (gb, 2);
+    uint64_t t = from + ch->timer;
+
+#define SAMPLE(step)    ((((wave[(step) >> 1] >> (GETBIT(step, 0)? 0 : 4)) & 15) >> shift))
+    set_output (gb, 2, from, SAMPLE(ch->step));
+
+    if (shift == 4) {
+        if (t < to) {
+            uint64_t steps = ((to - t - 1) / p) + 1;
+            ch->step = (ch->step + steps) & 31;
+            t += steps * p;
+        }
+        ch->timer = t - to;
+        return;
+    }
+
+    for (; t < to; t += p) {
+        ch->step = (ch->step + 1) & 31;
+        set_output (gb, 2, t, SAMPLE(ch->step));
+    }
+    ch->timer = t - to;
+#undef SAMPLE
+}
+
+/* run_noise: run channel 4 from from up to to */
+static void run_noise (gb_t *gb, uint64_t from, uint64_t to) {
+
+    struct channel *ch = &gb->apu.ch[3];
+    BYTE nr43 = channel_reg (gb, 3, 3);
+
+    if (!ch->on) {
+        set_output (gb, 3, from, 0);
+        return;
+    }
+
+    set_output (gb, 3, from, (~ch->lfsr & 1) * ch->volume);
+
+    /* (the LFSR isn't clocked at all with shifts of 14 and 15) */
+    if ((nr43 >> 4) >= 14)
+        return;
+
+    unsigned p = period (gb, 3);
+    uint64_t t = from + ch->timer;
+    WORD lfsr = ch->lfsr;
+    bool narrow = GETBIT(nr43, 3);
+
+    for (; t < to; t += p) {
+        WORD bit = (lfsr ^ (lfsr >> 1)) & 1;
+        lfsr = (lfsr >> 1) | (bit << 14);
+        if (narrow)
+            lfsr = (lfsr & ~0x40) | (bit << 6);
+        set_output (gb, 3, t, (~lfsr & 1) * ch->volume);
+    }
+    ch->lfsr  = lfsr;
+    ch->timer = t - to;
+}
+
+/* sweep_calc: channel 1's next frequency, turning it off if that overflows */
+static unsigned sweep_calc (gb_t *gb) {
+
+    struct channel *ch = &gb->apu.ch[0];
+    BYTE nr10 = channel_reg (gb, 0, 0);
+
+    unsigned delta = ch->shadow >> (nr10 & 7);
+    unsigned next  = GETBIT(nr10, 3)? ch->shadow - delta : ch->shadow + delta;
+
+    if (next > 2047)
+        ch->on = false;
+    return next;
+}
+
+/* sequencer_step: clock the lengths (every other step), the sweep
+ *                 (every fourth) and the envelopes (every eighth) */
+static void sequencer_step (gb_t *gb) {
+
+    struct apu *apu = &gb->apu;
+    BYTE step = apu->seq_step;
+    apu->seq_step = (step + 1) & 7;
+
+    if (step % 2 == 0)
+        for (unsigned n = 0; n < 4; ++n) {
+            struct channel *ch = &apu->ch[n];
+            if (GETBIT(channel_reg (gb, n, 4), 6) && ch->length > 0 && --ch->length == 0)
+                ch->on = false;
+        }
+
+    if (step == 2 || step == 6) {
+        struct channel *ch = &apu->ch[0];
+        BYTE nr10 = channel_reg (gb, 0, 0),
+             sweep_period = (nr10 >> 4) & 7;
+
+        if (ch->sweep_timer > 0)
+            ch->sweep_timer--;
+        if (ch->sweep_timer == 0) {
+            ch->sweep_timer = sweep_period? sweep_period : 8;
+
+            if (ch->on && ch->sweep_on && sweep_period) {
+                unsigned next = sweep_calc (gb);
+                if (ch->on && next <= 2047 && (nr10 & 7)) {
+                    ch->shadow = next;
+                    *reg (gb, R_SNDREG13) = next & 0xFF;
+                    *reg (gb, R_SNDREG14) = (*reg (gb, R_SNDREG14) & ~7) | (next >> 8);
+                    sweep_calc (gb);
+                }
+            }
+        }
+    }
+
+    if (step == 7)
+        for (unsigned n = 0; n < 4; ++n) {
+            if (n == 2)
+                continue;
+            struct channel *ch = &apu->ch[n];
+            BYTE nrx2 = channel_reg (gb, n, 2),
+                 env_period = nrx2 & 7;
+            if (!ch->on || env_period == 0)
+                continue;
+
+            if (ch->env_timer > 0)
+                ch->env_timer--;
+            if (ch->env_timer == 0) {
+                ch->env_timer = env_period;
+                if (GETBIT(nrx2, 3) && ch->volume < 15)
+                    ch->volume++;
+                else if (!GETBIT(nrx2, 3) && ch->volume > 0)
+                    ch->volume--;
+            }
+        }
+}
+
+/* run_to: catch the channels up to cycle now */
+static void run_to (gb_t *gb, uint64_t now) {
+
+    struct apu *apu = &gb->apu;
+
+    while (apu->synced < now) {
+
+        uint64_t from = apu->synced,
+                 to   = now < apu->seq_next? now : apu->seq_next;
+
+        run_square (gb, 0, from, to);
+        run_square (gb, 1, from, to);
+        run_wave   (gb, from, to);
+        run_noise  (gb, from, to);
+        apu->synced = to;
+
+        if (to == apu->seq_next) {
+            if (powered (gb))
+                sequencer_step (gb);
+            apu->seq_next += SEQUENCER_CYCLES;
+        }
+
+        /* (a long catch-up doesn't fit in one block) */
+        if (!gb->speculative
+         && ((((to - apu->block_start) * apu->factor) + apu->block_frac) >> 32) > APU_BLOCK_SIZE - BLOCK_SLACK)
+            end_block (gb, to);
+    }
+}
+
+/* trigger: (re)start channel n */
+static void trigger (gb_t *gb, unsigned n) {
+
+    struct channel *ch = &gb->apu.ch[n];
+
+    ch->on = dac_on (gb, n);
+    if (ch->length == 0)
+        ch->length = n == 2? 256 : 64;
+    ch->timer = period (gb, n);
+
+    BYTE nrx2 = channel_reg (gb, n, 2);
+    ch->volume    = nrx2 >> 4;
+    ch->env_timer = nrx2 & 7;
+
+    if (n == 2)
+        ch->step = 0;
+    if (n == 3)
+        ch->lfsr = 0x7FFF;
+
+    if (n == 0) {
+        BYTE nr10 = channel_reg (gb, 0, 0),
+             sweep_period = (nr10 >> 4) & 7;
+        ch->shadow      = frequency (gb, 0);
+        ch->sweep_timer = sweep_period? sweep_period : 8;
+        ch->sweep_on    = sweep_period || (nr10 & 7);
+        if (nr10 & 7)
+            sweep_calc (gb);
+    }
+}
+
+/* power: turn the sound on or off -- off clears all the registers, and stops every channel */
+static void power (gb_t *gb, bool on) {
+
+    struct apu *apu = &gb->apu;
+
+    if (on && !powered (gb))
+        apu->seq_step = 0;
+
+    if (!on && powered (gb)) {
+        memset (reg (gb, R_SNDREG10), 0, R_SNDREG52 - R_SNDREG10);
+        for (unsigned n = 0; n < 4; ++n) {
+            apu->ch[n].on = false;
+            set_output (gb, n, apu->synced, 0);
+        }
+        remix (gb);
+    }
+
+    *reg (gb, R_SNDREG52) = on? 0x80 : 0x00;
+}
+
+
+
+/* set_factor: work out the samples a cycle, from the rate and the adjustment */
+static void set_factor (gb_t *gb) {
+
+    struct apu *apu = &gb->apu;
+
+    /* (exactly, when there's no adjustment) */
+    if (apu->adjust == 0)
+        apu->factor = ((uint64_t)apu->rate << 32) / gb->arena->sched.frequency;
+    else
+        apu->factor = apu->rate * (1.0 + apu->adjust) * 4294967296.0 / gb->arena->sched.frequency;
+}
+
+
+
+/* PUBLIC API */
+/* apu_init: set up an instance's sound, which starts off (as on power on) */
+void apu_init (gb_t *gb) {
+
+    struct apu *apu = &gb->apu;
+
+    memset (apu, 0, sizeof(*apu));
+    apu_reset (gb);
+    apu_set_rate (gb, gb->sample_rate? gb->sample_rate : APU_RATE);
+}
+
+/* apu_set_rate: set the samples a second, throwing away any that haven't been taken --
+ *               returns false if it's not a rate that can be made */
+bool apu_set_rate (gb_t *gb, unsigned rate) {
+
+    struct apu *apu = &gb->apu;
+
+    if (rate < 1000 || rate > APU_MAX_RATE)
+        return false;
+
+    apu->rate = rate;
+    set_factor (gb);
+
+    apu->block_start = apu->synced;
+    apu->block_frac  = 0;
+    memset (apu->integrator, 0, sizeof(apu->integrator));
+    memset (apu->block, 0, sizeof(apu->block));
+    apu->ring_head = apu->ring_count = 0;
+
+    for (unsigned n = 0; n < 4; ++n)
+        apu->ch[n].amp[0] = apu->ch[n].amp[1] = 0;
+    remix (gb);
+
+    return true;
+}
+
+/* apu_set_adjust: make the samples as if the rate were (1 + adjust) times what it is,
+ *                 for up to APU_MAX_ADJUST either way -- the ones already made stay as they are */
+void apu_set_adjust (gb_t *gb, double adjust) {
+
+    struct apu *apu = &gb->apu;
+
+    if (adjust < -APU_MAX_ADJUST)
+        adjust = -APU_MAX_ADJUST;
+    if (adjust > APU_MAX_ADJUST)
+        adjust = APU_MAX_ADJUST;
+    if (adjust == apu->adjust)
+        return;
+
+    /* (the block's positions are worked out with the old factor) */
+    apu_sync (gb);
+    if (!gb->speculative)
+        end_block (gb, apu->synced);
+
+    apu->adjust = adjust;
+    set_factor (gb);
+}
+
+/* apu_read: read a sound register */
+BYTE apu_read (gb_t *gb, WORD location) {
+
+    if (location >= 0xFF30)
+        return *reg (gb, location);
+
+    if (location == R_SNDREG52) {
+        apu_sync (gb);
+        BYTE status = 0;
+        for (unsigned n = 0; n < 4; ++n)
+            status |= gb->apu.ch[n].on << n;
+        return (*reg (gb, location) & 0x80) | 0x70 | status;
+    }
+
+    return *reg (gb, location) | read_masks[location - R_SNDREG10];
+}
+
+/* apu_write: write a sound register, once the channels have caught up to the write */
+void apu_write (gb_t *gb, WORD location, BYTE byte) {
+
+    struct apu *apu = &gb->apu;
+    apu_sync (gb);
+
+    /* (wave RAM can be written with the sound off) */
+    if (location >= 0xFF30) {
+        *reg (gb, location) = byte;
+        return;
+    }
+    if (location == R_SNDREG52) {
+        power (gb, GETBIT(byte, 7));
+        return;
+    }
+    if (!powered (gb))
+        return;
+
+    *reg (gb, location) = byte;
+
+    if (location == R_SNDREG50 || location == R_SNDREG51) {
+        remix (gb);
+        return;
+    }
+
+    unsigned n = (location - R_SNDREG10) / 5;
+    struct channel *ch = &apu->ch[n];
+
+    switch ((location - R_SNDREG10) % 5) {
+    case 0:
+    case 2:
+        if (!dac_on (gb, n))
+            ch->on = false;
+        break;
+
+    case 1:
+        ch->length = n == 2? 256 - byte : 64 - (byte & 0x3F);
+        break;
+
+    case 4:
+        if (GETBIT(byte, 7))
+            trigger (gb, n);
+        break;
+    }
+}
+
+/* apu_sync: catch the channels up to now */
+void apu_sync (gb_t *gb) {
+    run_to (gb, get_cycle_count (gb));
+}
+
+/* apu_frame: at the end of a frame, catch up and make the frame's samples */
+void apu_frame (gb_t *gb) {
+
+    apu_sync (gb);
+    if (!gb->speculative)
+        end_block (gb, gb->apu.synced);
+}
+
+/* apu_samples: take up to frames stereo frames (left then right) of the
+ *              oldest samples, returning how many were taken */
+size_t apu_samples (gb_t *gb, int16_t *buf, size_t frames) {
+
+    struct apu *apu = &gb->apu;
+
+    size_t count = frames < apu->ring_count? frames : apu->ring_count;
+    for (size_t i = 0; i < count; ++i) {
+        buf[(i * 2)    ] = apu->ring[(apu->ring_head * 2)    ];
+        buf[(i * 2) + 1] = apu->ring[(apu->ring_head * 2) + 1];
+        apu->ring_head = (apu->ring_head + 1) % APU_RING_FRAMES;
+    }
+    apu->ring_count -= count;
+
+    return count;
+}
+
+/* apu_loaded: after a state has been loaded, carry on making samples from where it is */
+void apu_loaded (gb_t *gb) {
+
+    gb->apu.block_start = gb->apu.synced;
+    remix (gb);
+}
+
+/* apu_reset: stop every channel, and start the frame sequencer over (for states without the sound) */
+void apu_reset (gb_t *gb) {
+
+    struct apu *apu = &gb->apu;
+
+    for (unsigned n = 0; n < 4; ++n) {
+        int amp[2] = { apu->ch[n].amp[0], apu->ch[n].amp[1] };
+        apu->ch[n] = (struct channel){ .lfsr=0x7FFF, .amp={ amp[0], amp[1] } };
+    }
+    apu->synced   = get_cycle_count (gb);
+    apu->seq_next = apu->synced + SEQUENCER_CYCLES;
+    apu->seq_step = 0;
+
+    apu_loaded (gb);
+}
@@ -0,0 +1,102 @@
+/*
+ * Sound for Gameboy
+ *
+ */
+
+#ifndef __APU_H
+#define __APU_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/* the default output rate (samples a second, per side) */
+#define APU_RATE            48000
+#define APU_MAX_RATE        192000
+
+/* how far the rate can be nudged, to keep up with a sound card's clock (see sync.c) */
+#define APU_MAX_ADJUST      0.005
+
+/* the band-limited steps are APU_TAPS samples wide, at one of APU_PHASES
+ * offsets between samples */
+#define APU_TAPS            16
+#define APU_PHASES          32
+
+/* samples are made into a block of this many (which is ended well before it's full)... */
+#define APU_BLOCK_SIZE      2048
+/* ...then go into a ring of this many stereo frames, for the frontend to take */
+#define APU_RING_FRAMES     16384
+
+/* channel:
+ *  a sound channel -- they're all the same, with the parts
+ *  a channel doesn't have left alone
+ */
+struct channel {
+    bool     on;            /* (NR52's status bit) */
+    unsigned length;        /* length counter (counting down) */
+    unsigned timer;         /* cycles to the next step of the waveform */
+    BYTE     step;          /* position in the duty cycle/wave RAM */
+    BYTE     output;        /* the value being output, 0-15 */
+
+    BYTE     volume;        /* envelope */
+    BYTE     env_timer;
+
+    BYTE     sweep_timer;   /* frequency sweep (channel 1) */
+    bool     sweep_on;
+    WORD     shadow;
+
+    WORD     lfsr;          /* noise (channel 4) */
+
+    int      amp[2];        /* what the mixer was last told is being output, left and right */
+};
+
+/* apu:
+ *  the sound of an emulator instance -- it isn't ticked, but catches up
+ *  (see apu_sync) when its registers are touched and at the end of a frame
+ */
+struct apu {
+    struct channel ch[4];
+
+    uint64_t synced;        /* the cycle the channels have been run up to */
+    uint64_t seq_next;      /* the cycle of the next frame sequencer step */
+    BYTE     seq_step;
+
+    /* synthesis -- none of this is part of a state */
+    unsigned rate;
+    double   adjust;        /* how far off rate the samples are really made (see apu_set_adjust) */
+    uint64_t factor;        /* samples a cycle, in 32.32 fixed point */
+    uint64_t block_start;   /* the cycle the block starts at... */
+    uint32_t block_frac;    /* ...and the fraction of a sample it's into its first sample */
+    int      scale[4][2];   /* each channel's volume on each side (from NR50/NR51) */
+    int32_t  integrator[2];
+    int32_t  block[2][APU_BLOCK_SIZE + APU_TAPS];
+
+    int16_t  ring[APU_RING_FRAMES * 2];
+    size_t   ring_head,     /* the oldest frame */
+             ring_count;
+    uint64_t dropped;       /* frames the ring was too full for */
+};
+
+
+
+void apu_init (gb_t *gb);
+bool apu_set_rate (gb_t *gb, unsigned rate);
+void apu_set_adjust (gb_t *gb, double adjust);
+
+BYTE apu_read (gb_t *gb, WORD location);
+void apu_write (gb_t *gb, WORD location, BYTE byte);
+
+void apu_sync (gb_t *gb);
+void apu_frame (gb_t *gb);
+size_t apu_samples (gb_t *gb, int16_t *buf, size_t frames);
+
+void apu_loaded (gb_t *gb);
+void apu_reset (gb_t *gb);
+
+
+#endif
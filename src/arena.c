@@ -0,0 +1,55 @@
+/*
+ * per-instance emulator memory
+ *
+ */
+
+#include "arena.h"
+#include "gb.h"
+#include "logging.h"
+
+#include <unistd.h>     /* sysconf */
+#include <sys/mman.h>   /* mmap */
+
+
+
+/* cart_RAM_offset: where the cart RAM starts (the first page after the arena) */
+static size_t cart_RAM_offset(void) {
+    size_t page = sysconf (_SC_PAGESIZE);
+    return (sizeof(struct arena) + page - 1) & ~(page - 1);
+}
+
+
+
+/* PUBLIC API */
+/* arena_create: map a zeroed arena, with room for cart_RAM_size bytes of cart RAM --
+ *               returns false if it can't */
+bool arena_create (gb_t *gb, size_t cart_RAM_size) {
+
+    size_t page = sysconf (_SC_PAGESIZE);
+    size_t total_size = cart_RAM_offset() + ((cart_RAM_size + page - 1) & ~(page - 1));
+
+    /* anonymous mappings are zeroed, and page aligned (so cache line aligned too) */
+    void *mapping = mmap (NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        error ("failed to allocate %zu bytes", total_size);
+        return false;
+    }
+
+    gb->arena      = mapping;
+    gb->arena_size = total_size;
+    return true;
+}
+
+/* arena_destroy:  */
+void arena_destroy (gb_t *gb) {
+
+    if (gb->arena)
+        munmap (gb->arena, gb->arena_size);
+    gb->arena      = NULL;
+    gb->arena_size = 0;
+}
+
+/* arena_cart_RAM: the (page aligned) cart RAM after the arena */
+BYTE *arena_cart_RAM (gb_t *gb) {
+    return (BYTE *)gb->arena + cart_RAM_offset();
+}
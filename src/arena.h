@@ -0,0 +1,57 @@
+/*
+ * per-instance emulator memory
+ *
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+
+#include "common.h"
+#include "alarm.h"
+
+#include <stddef.h>
+
+
+
+/* more than the emulator ever uses at once */
+#define ALARM_SLOTS     8
+
+/* everything an emulator instance writes to lives in one zeroed, page aligned
+ * mapping with this layout (followed by the cart RAM, on a page boundary so
+ * the .sav file can be mapped over it) -- so a snapshot is just a memcpy */
+struct arena {
+    BYTE VRAM[0x2000];          /* $8000-$9FFF */
+    BYTE WRAM[0x2000];          /* $C000-$DFFF (echoed at $E000-$FDFF) */
+
+    /* $FE00-$FFFF */
+    union {
+        BYTE high[0x200];
+        struct {
+            BYTE OAM [0x100];   /* $FE00-$FE9F (+ the unusable $FEA0-$FEFF) */
+            BYTE IO  [0x80];    /* $FF00-$FF7F */
+            BYTE HRAM[0x80];    /* $FF80-$FFFE, + IE at $FFFF */
+        };
+    };
+
+    /* CPU registers */
+    WORD AF, BC, DE, HL;
+
+    /* scheduler */
+    struct scheduler {
+        uint64_t cycle_count;
+        unsigned frequency;     /* cycles per second */
+        AlarmID  next_id;
+        unsigned alarm_count;
+        Alarm    alarms[ALARM_SLOTS];
+    } sched;
+} __attribute__((aligned(64)));
+
+
+
+bool   arena_create (gb_t *gb, size_t cart_RAM_size);
+void   arena_destroy (gb_t *gb);
+BYTE  *arena_cart_RAM (gb_t *gb);
+
+
+#endif
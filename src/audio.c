@@ -0,0 +1,258 @@
+/*
+ * sound output, to a WAV file or a stream of samples
+ *
+ */
+
+#include "audio.h"
+#include "gb.h"
+#include "apu.h"
+#include "logging.h"
+
+#include <stdio.h>      /* fopen, fwrite, fdopen */
+#include <string.h>     /* memcpy, strcmp, strncmp */
+#include <endian.h>     /* htole16, htole32 */
+#include <unistd.h>     /* dup, dup2 */
+#include <sys/ioctl.h>  /* ioctl, FIONREAD */
+#include <sys/stat.h>   /* fstat, S_ISFIFO */
+
+
+
+/*  The samples are 16-bit signed stereo (left then right), little endian.
+ *  A file gets a WAV header -- which has the length in it, so that's
+ *  filled in by audio_close -- but "-" is just the samples, on stdout (and
+ *  anything else which would have gone to stdout goes to stderr instead,
+ *  so the stream can be piped straight into a player).
+ *
+ *  "sim:RATE" is a pretend sound card, which plays (throws away) RATE frames
+ *  a second in real time from a SIM_CAPACITY second buffer, blocking when
+ *  it's full -- so the pacing (see sync.c) can be tried against a card
+ *  whose clock is a little off.  Its real time can be a pretend clock's
+ *  too (see audio_set_clock), so that's done without waiting for it.
+ *
+ *  Only the pretend card and a stream into a pipe can say how much of what's
+ *  been written hasn't been played yet (see audio_queued) -- a pipe doesn't
+ *  know about the player's own buffer, but once that's full, the pipe
+ *  fills up behind it.
+ */
+#define WAV_HEADER_SIZE     44
+
+#define FRAME_SIZE          4
+
+#define SIM_CAPACITY        0.5
+
+
+enum audio_kind { AUDIO_WAV, AUDIO_STREAM, AUDIO_SIM };
+
+struct audio {
+    FILE           *file;       /* (NULL for the pretend card) */
+    enum audio_kind kind;
+    bool            pipe;       /* streaming into a pipe */
+    unsigned        rate;
+    unsigned long   frames;     /* written so far */
+
+    /* the pretend card (and the clock it plays by -- see clock_now) */
+    long double    *sim_clock;
+    double          sim_rate,
+                    sim_queued, /* frames it hasn't played */
+                    sim_time;   /* when sim_queued was worked out */
+    unsigned long   underruns;
+};
+
+
+/* wav_header: fill in a WAV header for frames frames */
+static void wav_header (BYTE header[WAV_HEADER_SIZE], unsigned rate, unsigned long frames) {
+
+    uint32_t data_size = frames * FRAME_SIZE;
+    uint32_t fields32[] = { htole32 (36 + data_size), htole32 (16), htole32 (rate),
+                            htole32 (rate * FRAME_SIZE), htole32 (data_size) };
+    uint16_t format   = htole16 (1),            /* PCM */
+             channels = htole16 (2),
+             align    = htole16 (FRAME_SIZE),
+             bits     = htole16 (16);
+
+    memcpy (header     , "RIFF", 4);
+    memcpy (header +  4, &fields32[0], 4);
+    memcpy (header +  8, "WAVEfmt ", 8);
+    memcpy (header + 16, &fields32[1], 4);
+    memcpy (header + 20, &format, 2);
+    memcpy (header + 22, &channels, 2);
+    memcpy (header + 24, &fields32[2], 4);
+    memcpy (header + 28, &fields32[3], 4);
+    memcpy (header + 32, &align, 2);
+    memcpy (header + 34, &bits, 2);
+    memcpy (header + 36, "data", 4);
+    memcpy (header + 40, &fields32[4], 4);
+}
+
+/* sim_play: play what the pretend card would have by now */
+static void sim_play (struct audio *out) {
+
+    double t = clock_now (out->sim_clock);
+    out->sim_queued -= (t - out->sim_time) * out->sim_rate;
+    out->sim_time = t;
+
+    if (out->sim_queued < 0) {
+        if (out->frames)
+            out->underruns++;
+        out->sim_queued = 0;
+    }
+}
+
+
+
+/* PUBLIC API */
+/* audio_open: start writing samples at rate to fname (or stdout for "-", or a
+ *             pretend card for "sim:RATE"), returning NULL on failure */
+struct audio *audio_open (const char *fname, unsigned rate) {
+
+    struct audio *out = calloc (1, sizeof(*out));
+    if (!out)
+        return NULL;
+    out->rate = rate;
+
+    if (strncmp (fname, "sim:", 4) == 0) {
+        char *end;
+        out->kind     = AUDIO_SIM;
+        out->sim_rate = strtod (fname + 4, &end);
+        out->sim_time = millis();
+        if (*end != '\0' || !(out->sim_rate >= 1000 && out->sim_rate <= APU_MAX_RATE)) {
+            error ("invalid pretend sound card '%s'", fname);
+            free (out);
+            return NULL;
+        }
+        return out;
+    }
+
+    if (strcmp (fname, "-") == 0) {
+        fflush (stdout);
+        int fd = dup (STDOUT_FILENO);
+        if (fd < 0 || dup2 (STDERR_FILENO, STDOUT_FILENO) < 0 || !(out->file = fdopen (fd, "wb"))) {
+            error ("failed to stream the sound to stdout");
+            free (out);
+            return NULL;
+        }
+        struct stat info;
+        out->kind = AUDIO_STREAM;
+        out->pipe = fstat (fd, &info) == 0 && S_ISFIFO(info.st_mode);
+        return out;
+    }
+
+    out->file = fopen (fname, "wb");
+    if (!out->file) {
+        error ("failed to open '%s'", fname);
+        free (out);
+        return NULL;
+    }
+    out->kind = AUDIO_WAV;
+
+    /* (the length is filled in by audio_close) */
+    BYTE header[WAV_HEADER_SIZE];
+    wav_header (header, rate, 0);
+    if (fwrite (header, WAV_HEADER_SIZE, 1, out->file) != 1) {
+        error ("failed to write '%s'", fname);
+        fclose (out->file);
+        free (out);
+        return NULL;
+    }
+    return out;
+}
+
+/* audio_close: finish the file */
+void audio_close (struct audio *out) {
+
+    if (!out)
+        return;
+
+    if (out->kind == AUDIO_WAV) {
+        BYTE header[WAV_HEADER_SIZE];
+        wav_header (header, out->rate, out->frames);
+        if (fseek (out->file, 0, SEEK_SET) != 0 || fwrite (header, WAV_HEADER_SIZE, 1, out->file) != 1)
+            error ("failed to finish the WAV file");
+    }
+
+    if (out->file)
+        fclose (out->file);
+    free (out);
+}
+
+/* audio_write: write frames stereo frames, returning false on failure */
+bool audio_write (struct audio *out, const int16_t *samples, size_t frames) {
+
+    /* (blocking until there's room, like a real card) */
+    if (out->kind == AUDIO_SIM) {
+        sim_play (out);
+        out->frames += frames;
+        double over = out->sim_queued + frames - (out->sim_rate * SIM_CAPACITY);
+        if (over > 0) {
+            clock_sleep (out->sim_clock, over / out->sim_rate);
+            sim_play (out);
+        }
+        out->sim_queued += frames;
+        return true;
+    }
+
+    out->frames += frames;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    return fwrite (samples, FRAME_SIZE, frames, out->file) == frames;
+#else
+    for (size_t i = 0; i < frames * 2; ++i) {
+        uint16_t sample = htole16 (samples[i]);
+        if (fwrite (&sample, 2, 1, out->file) != 1)
+            return false;
+    }
+    return true;
+#endif
+}
+
+/* audio_take: write all the samples gb has made, returning false on failure */
+bool audio_take (struct audio *out, gb_t *gb) {
+
+    int16_t buf[1024 * 2];
+    size_t frames;
+
+    while ((frames = apu_samples (gb, buf, LEN(buf) / 2)) > 0)
+        if (!audio_write (out, buf, frames))
+            return false;
+
+    /* (a stream is played as it comes) */
+    if (out->kind == AUDIO_STREAM && fflush (out->file) != 0)
+        return false;
+    return true;
+}
+
+/* audio_set_clock: play the pretend card by clk (see clock_now), starting from now on it */
+void audio_set_clock (struct audio *out, long double *clk) {
+    out->sim_clock = clk;
+    out->sim_time  = clock_now (clk);
+}
+
+/* audio_queued: how many frames have been written but not played yet --
+ *               -1 if there's no way to tell (eg. for a file) */
+long audio_queued (struct audio *out) {
+
+    int bytes;
+
+    switch (out->kind) {
+    case AUDIO_SIM:
+        sim_play (out);
+        return out->sim_queued;
+
+    case AUDIO_STREAM:
+        if (out->pipe && ioctl (fileno (out->file), FIONREAD, &bytes) == 0)
+            return bytes / FRAME_SIZE;
+        return -1;
+
+    default:
+        return -1;
+    }
+}
+
+/* audio_length: how many frames have been written */
+unsigned long audio_length (struct audio *out) {
+    return out->frames;
+}
+
+/* audio_underruns: how many times the pretend card has run out of frames to play */
+unsigned long audio_underruns (struct audio *out) {
+    return out->underruns;
+}
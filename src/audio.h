@@ -0,0 +1,32 @@
+/*
+ * sound output, to a WAV file or a stream of samples
+ *
+ */
+
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+/* a file (or stdout, or a pretend sound card) the samples are being written to (see audio.c) */
+struct audio;
+
+
+struct audio *audio_open (const char *fname, unsigned rate);
+void audio_close (struct audio *out);
+
+bool audio_write (struct audio *out, const int16_t *samples, size_t frames);
+bool audio_take (struct audio *out, gb_t *gb);
+void audio_set_clock (struct audio *out, long double *clk);
+long audio_queued (struct audio *out);
+unsigned long audio_length (struct audio *out);
+unsigned long audio_underruns (struct audio *out);
+
+
+#endif
@@ -0,0 +1,592 @@
+/*
+ * gb-batch -- run a manifest of ROMs headless, on all the cores
+ *
+ */
+
+#include "libgb.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>      /* errno */
+#include <fcntl.h>      /* open */
+#include <getopt.h>     /* getopt */
+#include <pthread.h>    /* pthread_create, etc. */
+#include <string.h>     /* strerror, strtok_r */
+#include <time.h>       /* clock_gettime, timespec */
+#include <unistd.h>     /* sysconf */
+#include <sys/mman.h>   /* mmap */
+#include <sys/stat.h>   /* fstat */
+
+
+
+/* a line of the manifest: "ROM FRAMES [INPUT_SCRIPT]" */
+struct job {
+    char         *rom;
+    unsigned long frames;
+    char         *script;   /* NULL if no buttons are pressed */
+};
+
+/* each worker has a deque of jobs: it takes them from the bottom of its own,
+ * and when that runs out, steals them from the top of everyone else's */
+struct deque {
+    pthread_mutex_t lock;
+    size_t         *jobs;
+    size_t          top,
+                    bottom;
+};
+
+struct pool {
+    const struct job *jobs;
+    size_t            job_count;
+
+    struct deque     *deques;
+    unsigned          workers;
+
+    size_t            rewind_budget;    /* 0 unless benchmarking rewinding */
+    const char       *audio_dir;        /* where to write each job's sound (NULL for nowhere) */
+
+    /* a job stops early once its serial output ends with one of these (or
+     * a mooneye test says it's done) -- see gb_stop_on_serial */
+    char            **stop;
+    unsigned          stop_count;
+    bool              stop_magic;
+
+    pthread_mutex_t   output_lock;
+};
+
+struct worker {
+    struct pool  *pool;
+    unsigned      id;
+    pthread_t     thread;
+    unsigned long frames;   /* run by this worker */
+};
+
+
+
+/* now: seconds on the monotonic clock */
+static double now(void) {
+    struct timespec spec;
+    clock_gettime (CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + (spec.tv_nsec / 1000000000.0);
+}
+
+/* fnv1a: hash some more bytes */
+static uint64_t fnv1a (uint64_t hash, uint8_t byte) {
+    return (hash ^ byte) * 0x100000001B3ULL;
+}
+#define FNV1A_START     0xCBF29CE484222325ULL
+
+/* print_json_bytes: print length bytes as a JSON string (anything that isn't
+ *                   ASCII as the character with its value) */
+static void print_json_bytes (FILE *out, const char *bytes, size_t length) {
+
+    fputc ('"', out);
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char byte = bytes[i];
+        if (byte == '"' || byte == '\\')
+            fprintf (out, "\\%c", byte);
+        else if (byte < 0x20 || byte >= 0x7F)
+            fprintf (out, "\\u%.4x", byte);
+        else
+            fputc (byte, out);
+    }
+    fputc ('"', out);
+}
+
+/* print_json_string: print str as a JSON string */
+static void print_json_string (FILE *out, const char *str) {
+    print_json_bytes (out, str, strlen (str));
+}
+
+/* read_file: map a whole file, returning NULL (+ setting errno) on failure */
+static uint8_t *read_file (const char *fname, size_t *size) {
+
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if (fstat (fd, &info) < 0) {
+        close (fd);
+        return NULL;
+    }
+    if (info.st_size == 0) {
+        errno = EINVAL;
+        close (fd);
+        return NULL;
+    }
+
+    void *map = mmap (NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *size = info.st_size;
+    return map;
+}
+
+/* is_movie: whether fname is a movie (recorded with gb --record) rather than a script */
+static bool is_movie (const char *fname) {
+
+    FILE *file = fopen (fname, "rb");
+    if (!file)
+        return false;
+
+    char magic[4];
+    bool movie = fread (magic, sizeof(magic), 1, file) == 1 && memcmp (magic, GB_MOVIE_MAGIC, 4) == 0;
+
+    fclose (file);
+    return movie;
+}
+
+/* report_error: print a failed job */
+static void report_error (struct pool *pool, size_t index, const char *err) {
+
+    pthread_mutex_lock (&pool->output_lock);
+    printf ("{\"job\":%zu,\"rom\":", index);
+    print_json_string (stdout, pool->jobs[index].rom);
+    printf (",\"error\":");
+    print_json_string (stdout, err);
+    printf ("}\n");
+    fflush (stdout);
+    pthread_mutex_unlock (&pool->output_lock);
+}
+
+/* run_job: run one job + print the result, returning the frames run */
+static unsigned long run_job (struct pool *pool, size_t index) {
+
+    const struct job *job = &pool->jobs[index];
+    gb_input_t *inputs = NULL;
+    size_t input_count = 0;
+    bool movie = job->script && is_movie (job->script);
+    if (job->script && !movie) {
+        char err[4096 + 64];
+        if (!(inputs = gb_load_script (job->script, &input_count, err, sizeof(err)))) {
+            report_error (pool, index, err);
+            return 0;
+        }
+    }
+
+    size_t rom_size;
+    uint8_t *rom = read_file (job->rom, &rom_size);
+    if (!rom) {
+        report_error (pool, index, strerror (errno));
+        free (inputs);
+        return 0;
+    }
+
+    gb_t *gb = gb_create (rom, rom_size);
+    munmap (rom, rom_size);
+    if (!gb) {
+        report_error (pool, index, "unsupported ROM (or out of memory)");
+        free (inputs);
+        return 0;
+    }
+
+    for (unsigned i = 0; i < pool->stop_count; ++i)
+        if (!gb_stop_on_serial (gb, pool->stop[i])) {
+            report_error (pool, index, "failed to set the text to stop on");
+            gb_destroy (gb);
+            free (inputs);
+            return 0;
+        }
+    gb_stop_on_magic (gb, pool->stop_magic);
+
+    gb_movie_t *mv = NULL;
+    if (movie && !(mv = gb_movie_play (gb, job->script))) {
+        report_error (pool, index, "the movie is for another ROM");
+        gb_destroy (gb);
+        return 0;
+    }
+
+
+    gb_rewind_t *rw = NULL;
+    if (pool->rewind_budget && !(rw = gb_rewind_create (gb, pool->rewind_budget))) {
+        report_error (pool, index, "failed to allocate the rewind buffer");
+        gb_movie_close (mv);
+        gb_destroy (gb);
+        free (inputs);
+        return 0;
+    }
+    double push_time = 0;
+
+    gb_audio_t *out = NULL;
+    if (pool->audio_dir) {
+        char fname[4096];
+        snprintf (fname, sizeof(fname), "%s/job%zu.wav", pool->audio_dir, index);
+        if (!(out = gb_audio_open (fname, GB_SAMPLE_RATE))) {
+            report_error (pool, index, "failed to open the WAV file");
+            gb_rewind_destroy (rw);
+            gb_movie_close (mv);
+            gb_destroy (gb);
+            free (inputs);
+            return 0;
+        }
+    }
+
+
+    double start = now();
+
+    uint64_t cycles = 0;
+    size_t next_input = 0;
+    uint64_t audio_hash = FNV1A_START;
+    unsigned long audio_frames = 0;
+    unsigned long frame;
+    for (frame = 0; frame < job->frames && !gb_stopped (gb); ++frame) {
+        if (mv)
+            gb_movie_frame (mv, gb);
+        while (next_input < input_count && inputs[next_input].frame <= frame)
+            gb_set_input (gb, inputs[next_input++].buttons);
+        cycles += gb_run_frame (gb);
+
+        /* the frame's sound, as the little endian bytes of a WAV file */
+        int16_t samples[2048 * 2];
+        size_t count;
+        while ((count = gb_audio_samples (gb, samples, 2048)) > 0) {
+            for (size_t i = 0; i < count * 2; ++i) {
+                audio_hash = fnv1a (audio_hash, (uint16_t)samples[i] & 0xFF);
+                audio_hash = fnv1a (audio_hash, (uint16_t)samples[i] >> 8);
+            }
+            audio_frames += count;
+            if (out)
+                gb_audio_write (out, samples, count);
+        }
+
+        if (rw) {
+            double push_start = now();
+            gb_rewind_push (rw, gb);
+            push_time += now() - push_start;
+        }
+    }
+
+    double wall = now() - start;
+
+
+    /* the screen... */
+    const uint8_t *framebuffer = gb_framebuffer (gb);
+    uint64_t fb_hash = FNV1A_START;
+    for (unsigned y = 0; y < GB_SCREEN_H; ++y)
+        for (unsigned x = 0; x < GB_SCREEN_W; ++x)
+            fb_hash = fnv1a (fb_hash, framebuffer[(y * GB_FB_STRIDE) + x]);
+
+    /* ...and the RAM: VRAM, internal RAM, OAM and HRAM */
+    static const uint16_t RAM_areas[][2] = { { 0x8000, 0x9FFF }, { 0xC000, 0xDFFF },
+                                             { 0xFE00, 0xFE9F }, { 0xFF80, 0xFFFE } };
+    uint64_t RAM_hash = FNV1A_START;
+    for (unsigned i = 0; i < sizeof(RAM_areas) / sizeof(*RAM_areas); ++i)
+        for (unsigned address = RAM_areas[i][0]; address <= RAM_areas[i][1]; ++address)
+            RAM_hash = fnv1a (RAM_hash, gb_read (gb, address));
+
+    /* how much the frames took up, then how long it takes to rewind all of them */
+    size_t rewind_frames = 0, rewind_size = 0;
+    double pop_time = 0;
+    if (rw) {
+        rewind_frames = gb_rewind_frames (rw);
+        rewind_size   = gb_rewind_size (rw);
+
+        double pop_start = now();
+        while (gb_rewind_pop (rw, gb))
+            ;
+        pop_time = now() - pop_start;
+
+        gb_rewind_destroy (rw);
+    }
+
+    gb_audio_close (out);
+    gb_movie_close (mv);
+    free (inputs);
+
+
+    pthread_mutex_lock (&pool->output_lock);
+    printf ("{\"job\":%zu,\"rom\":", index);
+    print_json_string (stdout, job->rom);
+    printf (",\"frames\":%lu,\"cycles\":%llu,\"wall_ms\":%.3f,\"fb_hash\":\"%.16llx\",\"ram_hash\":\"%.16llx\"",
+            frame, (unsigned long long)cycles, wall * 1000.0,
+            (unsigned long long)fb_hash, (unsigned long long)RAM_hash);
+    printf (",\"audio_frames\":%lu,\"audio_hash\":\"%.16llx\"", audio_frames, (unsigned long long)audio_hash);
+    if (rewind_frames)
+        printf (",\"rewind_frames\":%zu,\"rewind_bytes_per_frame\":%.1f,\"rewind_ns_per_push\":%.0f,\"rewind_ns_per_pop\":%.0f",
+                rewind_frames, (double)rewind_size / rewind_frames,
+                push_time * 1e9 / frame, pop_time * 1e9 / rewind_frames);
+    size_t serial_length;
+    const char *serial = gb_serial_output (gb, &serial_length);
+    if (serial) {
+        printf (",\"serial\":");
+        print_json_bytes (stdout, serial, serial_length);
+    }
+    if (gb_stopped (gb)) {
+        printf (gb_locked_up (gb)? ",\"error\":" : ",\"stopped\":");
+        print_json_string (stdout, gb_stopped (gb));
+    }
+    printf ("}\n");
+    fflush (stdout);
+    pthread_mutex_unlock (&pool->output_lock);
+
+    gb_destroy (gb);
+    return frame;
+}
+
+/* take_job: the next job for worker id, from its own deque or someone else's --
+ *           returns false when there are none left anywhere */
+static bool take_job (struct pool *pool, unsigned id, size_t *index) {
+
+    /* our own, from the bottom */
+    struct deque *own = &pool->deques[id];
+    pthread_mutex_lock (&own->lock);
+    bool found = own->top < own->bottom;
+    if (found)
+        *index = own->jobs[--own->bottom];
+    pthread_mutex_unlock (&own->lock);
+    if (found)
+        return true;
+
+    /* steal from the top of the others (jobs never get added, so once
+     * every deque has been seen empty, they stay empty) */
+    for (unsigned i = 1; i < pool->workers; ++i) {
+        struct deque *victim = &pool->deques[(id + i) % pool->workers];
+        pthread_mutex_lock (&victim->lock);
+        found = victim->top < victim->bottom;
+        if (found)
+            *index = victim->jobs[victim->top++];
+        pthread_mutex_unlock (&victim->lock);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+/* worker_main:  */
+static void *worker_main (void *arg) {
+
+    struct worker *worker = arg;
+    size_t index;
+
+    while (take_job (worker->pool, worker->id, &index))
+        worker->frames += run_job (worker->pool, index);
+
+    return NULL;
+}
+
+/* load_manifest: read the jobs, exiting on errors */
+static struct job *load_manifest (const char *fname, size_t *count) {
+
+    FILE *file = strcmp (fname, "-") == 0? stdin : fopen (fname, "r");
+    if (!file) {
+        fprintf (stderr, "gb-batch: %s: %s\n", fname, strerror (errno));
+        exit (EXIT_FAILURE);
+    }
+
+    struct job *jobs = NULL;
+    size_t allocated = 0;
+    *count = 0;
+
+    char line[4096];
+    for (unsigned lineno = 1; fgets (line, sizeof(line), file); ++lineno) {
+
+        char *hash = strchr (line, '#');
+        if (hash)
+            *hash = '\0';
+
+        char *save;
+        char *rom    = strtok_r (line, " \t\r\n", &save);
+        char *frames = strtok_r (NULL, " \t\r\n", &save);
+        char *script = strtok_r (NULL, " \t\r\n", &save);
+        if (!rom)
+            continue;
+
+        char *end = NULL;
+        unsigned long frame_count = frames? strtoul (frames, &end, 0) : 0;
+        if (!frames || *end != '\0' || strtok_r (NULL, " \t\r\n", &save)) {
+            fprintf (stderr, "gb-batch: %s:%u: expected ROM FRAMES [INPUT_SCRIPT]\n", fname, lineno);
+            exit (EXIT_FAILURE);
+        }
+
+        if (*count == allocated) {
+            allocated = allocated? allocated * 2 : 64;
+            jobs = realloc (jobs, allocated * sizeof(*jobs));
+            if (!jobs) {
+                fputs ("gb-batch: out of memory\n", stderr);
+                exit (EXIT_FAILURE);
+            }
+        }
+        jobs[(*count)++] = (struct job)
+          { .rom    = strdup (rom),
+            .frames = frame_count,
+            .script = script? strdup (script) : NULL,
+          };
+    }
+
+    if (file != stdin)
+        fclose (file);
+    return jobs;
+}
+
+/* print_help:  */
+static void print_help (const char *name) {
+    printf ("Usage: %s [-j THREADS] [-r MB] [-a DIR] [-s TEXT]... [-m] MANIFEST\n", name);
+    puts ("Runs each line of MANIFEST (- for stdin) headless, and prints a line of JSON per job.");
+    puts ("A line of MANIFEST is:  ROM FRAMES [INPUT_SCRIPT]");
+    puts ("A line of INPUT_SCRIPT is:  FRAME BUTTONS  (eg. 120 A+START, or 130 - for none)");
+    puts ("  -- or INPUT_SCRIPT can be a movie, recorded with gb --record");
+    puts ("");
+    puts (" -j, --threads N\trun N jobs at once (default: one per core)");
+    puts (" -r, --rewind MB\tkeep every frame in an MB megabyte rewind buffer, and report its size + speed");
+    puts (" -a, --audio DIR\twrite each job's sound to DIR/jobN.wav (N is its \"job\" in the output)");
+    puts (" -s, --stop-on TEXT\tstop a job as soon as TEXT (eg. Passed) is sent over serial");
+    puts (" -m, --stop-on-magic\tstop a job when a mooneye test ROM says it's passed or failed");
+    puts ("  -- FRAMES is then how long to give it, and what it sent is in \"serial\"");
+    puts (" -h, --help\t\tdisplay this help and exit");
+}
+
+
+
+/* gb-batch */
+int main (int argc, char *argv[]) {
+
+    long threads = sysconf (_SC_NPROCESSORS_ONLN);
+
+    const struct option longopts[]
+     = { { "help"   , no_argument      , NULL, 'h' },
+         { "threads", required_argument, NULL, 'j' },
+         { "rewind" , required_argument, NULL, 'r' },
+         { "audio"  , required_argument, NULL, 'a' },
+         { "stop-on", required_argument, NULL, 's' },
+         { "stop-on-magic", no_argument, NULL, 'm' },
+         { NULL     , no_argument      , NULL,  0  }
+       };
+
+    size_t rewind_budget = 0;
+    const char *audio_dir = NULL;
+    char **stop = NULL;
+    unsigned stop_count = 0;
+    bool stop_magic = false;
+
+    int opt;
+    while ((opt = getopt_long (argc, argv, "hj:r:a:s:m", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help (argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'j':
+            threads = strtol (optarg, NULL, 0);
+            if (threads < 1) {
+                fprintf (stderr, "gb-batch: invalid thread count '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'r':
+          { char *end;
+            long megabytes = strtol (optarg, &end, 10);
+            if (megabytes < 1 || *end) {
+                fprintf (stderr, "gb-batch: invalid rewind buffer size '%s'\n", optarg);
+                return EXIT_FAILURE;
+            }
+            rewind_budget = (size_t)megabytes << 20;
+          } break;
+
+        case 'a':
+            audio_dir = optarg;
+            break;
+
+        case 's':
+            if (*optarg == '\0' || strlen (optarg) > GB_STOP_MAX) {
+                fprintf (stderr, "gb-batch: invalid text to stop on '%s' (up to %d bytes)\n", optarg, GB_STOP_MAX);
+                return EXIT_FAILURE;
+            }
+            stop = realloc (stop, (stop_count + 1) * sizeof(*stop));
+            if (!stop) {
+                fputs ("gb-batch: out of memory\n", stderr);
+                return EXIT_FAILURE;
+            }
+            stop[stop_count++] = optarg;
+            break;
+
+        case 'm':
+            stop_magic = true;
+            break;
+
+        default:
+            print_help (argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        print_help (argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (threads < 1)
+        threads = 1;
+
+
+    struct pool pool;
+    pool.jobs = load_manifest (argv[optind], &pool.job_count);
+    pool.rewind_budget = rewind_budget;
+    pool.audio_dir     = audio_dir;
+    pool.stop          = stop;
+    pool.stop_count    = stop_count;
+    pool.stop_magic    = stop_magic;
+    pool.workers = (size_t)threads < pool.job_count? (unsigned)threads : pool.job_count;
+    if (pool.workers == 0)
+        return EXIT_SUCCESS;
+
+    pthread_mutex_init (&pool.output_lock, NULL);
+
+    /* deal the jobs out round robin */
+    pool.deques = calloc (pool.workers, sizeof(*pool.deques));
+    for (unsigned i = 0; i < pool.workers; ++i) {
+        struct deque *deque = &pool.deques[i];
+        pthread_mutex_init (&deque->lock, NULL);
+
+        size_t count = (pool.job_count - i + pool.workers - 1) / pool.workers;
+        deque->jobs   = malloc (count * sizeof(size_t));
+        deque->bottom = count;
+
+        /* the bottom is taken first, so the first jobs go there */
+        for (size_t j = 0; j < count; ++j)
+            deque->jobs[count - 1 - j] = i + (j * pool.workers);
+    }
+
+
+    double start = now();
+
+    struct worker *workers = calloc (pool.workers, sizeof(*workers));
+    for (unsigned i = 0; i < pool.workers; ++i) {
+        workers[i] = (struct worker){ .pool=&pool, .id=i };
+        if (pthread_create (&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            fputs ("gb-batch: failed to start a worker\n", stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned long frames = 0;
+    for (unsigned i = 0; i < pool.workers; ++i) {
+        pthread_join (workers[i].thread, NULL);
+        frames += workers[i].frames;
+    }
+
+    double wall = now() - start;
+    fprintf (stderr, "gb-batch: %zu jobs, %lu frames in %.3f seconds on %u threads (%.0f frames/second)\n",
+             pool.job_count, frames, wall, pool.workers, frames / wall);
+
+
+    for (unsigned i = 0; i < pool.workers; ++i) {
+        pthread_mutex_destroy (&pool.deques[i].lock);
+        free (pool.deques[i].jobs);
+    }
+    free (pool.deques);
+    free (workers);
+    pthread_mutex_destroy (&pool.output_lock);
+
+    for (size_t i = 0; i < pool.job_count; ++i) {
+        free (pool.jobs[i].rom);
+        free (pool.jobs[i].script);
+    }
+    free ((struct job *)pool.jobs);
+    free (stop);
+
+    return EXIT_SUCCESS;
+}
@@ -10,6 +10,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* usleep */
 
 
 #define LEN(arr)    (sizeof(arr)/sizeof(*arr))
@@ -24,6 +26,9 @@ typedef uint8_t  BYTE;
 typedef  int8_t  SIGNED_BYTE;
 typedef uint16_t WORD;
 
+/* an emulator instance, see gb.h */
+typedef struct gb gb_t;
+
 
 struct debugger {
     bool     enabled;
@@ -42,15 +47,36 @@ struct emustate {
     struct debugger debug;
 };
 
-/* defined in Z80.c */
-extern struct emustate G_state;
-
 
 
 static inline bool between (int n, int min, int max) {
     return min <= n && n <= max;
 }
 
+/* millis: seconds on the monotonic clock */
+static inline long double millis (void) {
+    struct timespec spec;
+    clock_gettime (CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec + (spec.tv_nsec / 1000000000.0L);
+}
+
+/* clock_now: seconds on clk -- a pretend clock, which only moves on when it's slept
+ *            on (so pacing can be tried without waiting for it), or the monotonic
+ *            clock if clk is NULL */
+static inline long double clock_now (const long double *clk) {
+    return clk? *clk : millis();
+}
+
+/* clock_sleep: sleep for seconds on clk (as for clock_now) */
+static inline void clock_sleep (long double *clk, long double seconds) {
+    if (seconds <= 0)
+        return;
+    if (clk)
+        *clk += seconds;
+    else
+        usleep ((useconds_t)(seconds * 1000000.0L));
+}
+
 
 
 #endif
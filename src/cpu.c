@@ -9,7 +9,9 @@
 #include "cpu_timing.h"
 #include "cpu_print_arg.h"
 
+#include "gb.h"
 #include "mem.h"
+#include "arena.h"
 #include "common.h"
 #include "logging.h"
 #include "registers.h"
@@ -30,41 +32,43 @@
 
 
 
-static bool cpu_halted = false;
-static const char *interrupt_names[] = { "VBLANK", "LCD CONTROLLER", "TIMER OVERFLOW", "SERIAL I/O ENDED", "BUTTON RELEASE" };
+/* the CPU state of the instance being run (every function here has a gb) --
+ * the register pointers are copied into locals where they're used */
+#define pc                  (gb->cpu.pc)
+#define sp                  (gb->cpu.sp)
+#define IME                 (gb->cpu.IME)
+#define cpu_halted          (gb->cpu.halted)
+#define interrupts_ready    (gb->cpu.interrupts_ready)
 
+static const char *const interrupt_names[] = { "VBLANK", "LCD CONTROLLER", "TIMER OVERFLOW", "SERIAL I/O ENDED", "BUTTON RELEASE" };
 
 
-static void memset16 (WORD addr, WORD val) {
-    memsval (addr    , val & 255);
-    memsval (addr + 1, val >> 8 );
-}
-
 
-static BYTE next(void)
-{ return memgval (pc++); }
+static BYTE next (gb_t *gb)
+{ return memgval (gb, pc++); }
 
-static WORD next16(void) {
-    WORD val = memgval (pc) | (memgval (pc+1) << 8);
+static WORD next16 (gb_t *gb) {
+    WORD val = memgval16 (gb, pc);
     pc += 2;
     return val;
 }
 
 
-static WORD pop(void) {
-    WORD val = memgval (sp) | (memgval (sp+1) << 8);
+static WORD pop (gb_t *gb) {
+    WORD val = memgval16 (gb, sp);
     sp += 2;
     return val;
 }
-static void push (WORD val) {
+static void push (gb_t *gb, WORD val) {
     sp -= 2;
-    memset16 (sp, val);
+    memsval16 (gb, sp, val);
 }
 
 
 
 /* easy addition, sets appropriate flags */
-static BYTE cpu_add (BYTE a, BYTE b) {
+static BYTE cpu_add (gb_t *gb, BYTE a, BYTE b) {
+    BYTE *F = gb->cpu.F;
 
     BYTE result = a + b;
 
@@ -77,7 +81,8 @@ static BYTE cpu_add (BYTE a, BYTE b) {
 
     return result;
 }
-static WORD cpu_add16 (WORD a, WORD b) {
+static WORD cpu_add16 (gb_t *gb, WORD a, WORD b) {
+    BYTE *F = gb->cpu.F;
     WORD result = a + b;
 
     SETFLAGC( ((a + b) & 0x10000) != 0 );
@@ -89,7 +94,8 @@ static WORD cpu_add16 (WORD a, WORD b) {
 }
 
 /* easy subtraction, sets appropriate flags */
-static BYTE cpu_sub (BYTE a, BYTE b) {
+static BYTE cpu_sub (gb_t *gb, BYTE a, BYTE b) {
+    BYTE *F = gb->cpu.F;
 
     BYTE result = a - b;
 
@@ -104,77 +110,92 @@ static BYTE cpu_sub (BYTE a, BYTE b) {
 }
 
 
-static void cpu_restart (BYTE offset) {
-    push (pc);
+static void cpu_restart (gb_t *gb, BYTE offset) {
+    push (gb, pc);
     pc = 0x0000 + offset;
 };
 
+/* lock_up: an illegal instruction hangs the CPU for good (the rest of the
+ *          machine carries on) -- it's left at it, with interrupts off, and
+ *          the run stops (a run ahead of the real one is just cut short) */
+static void lock_up (gb_t *gb, BYTE opcode) {
+    pc--;
+    IME = false;
+    cpu_update_interrupts (gb);
+
+    if (!gb->speculative && !gb->cpu.lockup[0])
+        snprintf (gb->cpu.lockup, sizeof(gb->cpu.lockup), "illegal instruction $%.2hhX at $%.4hX", opcode, pc);
+    gb->state.running = false;
+}
+
 
 
 /* PUBLIC API */
-void cpu_cleanup(void);
 /* cpu_init:  */
-void cpu_init(void) {
+void cpu_init (gb_t *gb) {
+
+    struct cpu *cpu = &gb->cpu;
 
     pc = 0x0100;
     sp = 0xFFFE;
 
-    AF = calloc (2, 1);
-    BC = calloc (2, 1);
-    DE = calloc (2, 1);
-    HL = calloc (2, 1);
+    /* the registers live in the arena */
+    cpu->AF = &gb->arena->AF;
+    cpu->BC = &gb->arena->BC;
+    cpu->DE = &gb->arena->DE;
+    cpu->HL = &gb->arena->HL;
 
-    A = ((BYTE *)AF) + 1;
-    F = ((BYTE *)AF);
+    cpu->A = ((BYTE *)cpu->AF) + 1;
+    cpu->F = ((BYTE *)cpu->AF);
 
-    B = ((BYTE *)BC) + 1;
-    C = ((BYTE *)BC);
+    cpu->B = ((BYTE *)cpu->BC) + 1;
+    cpu->C = ((BYTE *)cpu->BC);
 
-    D = ((BYTE *)DE) + 1;
-    E = ((BYTE *)DE);
+    cpu->D = ((BYTE *)cpu->DE) + 1;
+    cpu->E = ((BYTE *)cpu->DE);
 
-    H = ((BYTE *)HL) + 1;
-    L = ((BYTE *)HL);
+    cpu->H = ((BYTE *)cpu->HL) + 1;
+    cpu->L = ((BYTE *)cpu->HL);
 
     IME = true;
-
-    atexit (cpu_cleanup);
+    cpu_halted = false;
+    interrupts_ready = 0;
 }
 
-static bool exec_op (BYTE opcode);
-static void cpu_ack_interrupts(void);
+static bool exec_op (gb_t *gb, BYTE opcode);
+static void cpu_ack_interrupts (gb_t *gb);
 /* cpu_cycle:  */
-unsigned cpu_cycle(void) {
+unsigned cpu_cycle (gb_t *gb) {
 
     unsigned cyclecount = 4;
 
     /* when we hit a breakpoint, halt */
-    if (G_state.debug.enabled && pc == G_state.debug.breakpoint)
-        G_state.state = (G_state.state | EMUSTATE_DEBUG) & ~EMUSTATE_NORMAL;
+    if (gb->state.debug.enabled && pc == gb->state.debug.breakpoint)
+        gb->state.state = (gb->state.state | EMUSTATE_DEBUG) & ~EMUSTATE_NORMAL;
 
     /* if we are disassembling, don't go past the end of memory */
-    if (G_state.state & EMUSTATE_DISASSEMBLE && pc+1 == 0x10000)
-        G_state.running = false;
+    if (gb->state.state & EMUSTATE_DISASSEMBLE && pc+1 == 0x10000)
+        gb->state.running = false;
 
     /* acknowledge interrupts */
-    if ((IME || cpu_halted) && !(G_state.state & EMUSTATE_DISASSEMBLE))
-        cpu_ack_interrupts();
+    if (interrupts_ready && !(gb->state.state & EMUSTATE_DISASSEMBLE))
+        cpu_ack_interrupts(gb);
 
 
     if (!cpu_halted) {
 
         debugl ("%.4hX  ", pc);
 
-        BYTE op = next();
+        BYTE op = next(gb);
         WORD old_pc = pc;
 
         bool extra_cycles = false;
-        if (!(G_state.state & EMUSTATE_DISASSEMBLE)) {
-            extra_cycles = exec_op (op);
-            print_op_arg (op, old_pc);
+        if (!(gb->state.state & EMUSTATE_DISASSEMBLE)) {
+            extra_cycles = exec_op (gb, op);
+            print_op_arg (gb, op, old_pc);
         }
         else
-            pc = print_op (op, old_pc);
+            pc = print_op (gb, op, old_pc);
 
         BYTE prefix = (op == 0xCB)? op : 0x00;
         cyclecount = op_cycles (prefix, op, extra_cycles);
@@ -183,11 +204,25 @@ unsigned cpu_cycle(void) {
 }
 
 /* cpu_interrupt: raise an interrupt */
-void cpu_interrupt (enum interrupt int_type) {
-    BYTE IFLAGS = memgval (R_IFLAGS);
+void cpu_interrupt (gb_t *gb, enum interrupt int_type) {
+    BYTE IFLAGS = memgval (gb, R_IFLAGS);
     IFLAGS |= int_type;
-    debug ("interrupt %i (%s) requested", int_type, interrupt_names[int_type]);
-    memsval (R_IFLAGS, IFLAGS);
+    debug ("interrupt %i (%s) requested", int_type, interrupt_names[__builtin_ctz (int_type)]);
+    mem_set_register (gb, R_IFLAGS, IFLAGS);
+    cpu_update_interrupts(gb);
+}
+
+/* cpu_update_interrupts: recompute interrupts_ready -- this has to be called
+ *                        whenever IFLAGS, ISWITCH, IME or cpu_halted change */
+void cpu_update_interrupts (gb_t *gb) {
+    BYTE pending = memgval (gb, R_IFLAGS) & memgval (gb, R_ISWITCH) & 0x1F;
+    interrupts_ready = (IME || cpu_halted)? pending : 0;
+}
+
+/* cpu_locked_up: the illegal instruction the CPU's locked up on (eg. "illegal
+ *                instruction $D3 at $0150") -- NULL if it hasn't */
+const char *cpu_locked_up (gb_t *gb) {
+    return gb->cpu.lockup[0]? gb->cpu.lockup : NULL;
 }
 
 /* cpu_logging: turn on/off CPU logging */
@@ -204,7 +239,13 @@ bool cpu_logging_enabled(void) {
 
 /* INTERNAL FUNCs */
 /* exec_op: decode + execute an opcode */
-bool exec_op (BYTE opcode) {
+bool exec_op (gb_t *gb, BYTE opcode) {
+
+    WORD *AF = gb->cpu.AF, *BC = gb->cpu.BC, *DE = gb->cpu.DE, *HL = gb->cpu.HL;
+    BYTE *A  = gb->cpu.A , *F  = gb->cpu.F ,
+         *B  = gb->cpu.B , *C  = gb->cpu.C ,
+         *D  = gb->cpu.D , *E  = gb->cpu.E ,
+         *H  = gb->cpu.H , *L  = gb->cpu.L ;
 
     /* for conditional instructions timing */
     bool condition_true = false;
@@ -213,7 +254,7 @@ bool exec_op (BYTE opcode) {
 
     /* $CB Prefix */
     case 0xCB:
-        opcode = next();
+        opcode = next(gb);
         switch (opcode) {
         /* Miscellaneous */
         /* SWAP r */
@@ -225,9 +266,9 @@ bool exec_op (BYTE opcode) {
         case 0x34: *H = ((*H) << 4) | ((*H) >> 4); SETFLAGS(*H == 0, 0,0,0); break;
         case 0x35: *L = ((*L) << 4) | ((*L) >> 4); SETFLAGS(*L == 0, 0,0,0); break;
         case 0x36:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             m = (m << 4) | (m >> 4);
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0,0);
          }  break;
         /* Rotates and Shifts (registers) */
@@ -240,9 +281,9 @@ bool exec_op (BYTE opcode) {
         case 0x04: *H = ((*H) << 1) | ((*H) >> 7); SETFLAGS(*H == 0, 0,0, (*H) & 1); break;
         case 0x05: *L = ((*L) << 1) | ((*L) >> 7); SETFLAGS(*L == 0, 0,0, (*L) & 1); break;
         case 0x06:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             m = (m << 1) | (m >> 7);
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0, m & 1);
          }  break;
 
@@ -257,7 +298,7 @@ bool exec_op (BYTE opcode) {
         case 0x13: *E = RL(*E); break;
         case 0x14: *H = RL(*H); break;
         case 0x15: *L = RL(*L); break;
-        case 0x16: memsval (*HL, RL(memgval (*HL))); break;
+        case 0x16: memsval (gb, *HL, RL(memgval (gb, *HL))); break;
 #undef RL
 
         /* RRC r */
@@ -269,9 +310,9 @@ bool exec_op (BYTE opcode) {
         case 0x0C: *H = ((*H) >> 1) | ((*H) << 7); SETFLAGS(*H == 0, 0,0, (*H) >> 7); break;
         case 0x0D: *L = ((*L) >> 1) | ((*L) << 7); SETFLAGS(*L == 0, 0,0, (*L) >> 7); break;
         case 0x0E:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             m = (m >> 1) | (m << 7);
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0, m >> 7);
          }  break;
 
@@ -286,7 +327,7 @@ bool exec_op (BYTE opcode) {
         case 0x1B: *E = RR(*E); break;
         case 0x1C: *H = RR(*H); break;
         case 0x1D: *L = RR(*L); break;
-        case 0x1E: memsval (*HL, RR(memgval (*HL))); break;
+        case 0x1E: memsval (gb, *HL, RR(memgval (gb, *HL))); break;
 #undef RR
 
         /* SLA r */
@@ -298,10 +339,10 @@ bool exec_op (BYTE opcode) {
         case 0x24: SETFLAGC((*H) >> 7); *H = (*H) << 1; SETFLAGS(*H == 0, 0,0, FLAGC); break;
         case 0x25: SETFLAGC((*L) >> 7); *L = (*L) << 1; SETFLAGS(*L == 0, 0,0, FLAGC); break;
         case 0x26:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             SETFLAGC(m >> 7);
             m <<= 1;
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0, FLAGC);
          }  break;
 
@@ -314,10 +355,10 @@ bool exec_op (BYTE opcode) {
         case 0x2C: SETFLAGC((*H) & 1); *H = ((*H) >> 1) | ((*H) & 128); SETFLAGS(*H == 0, 0,0, FLAGC); break;
         case 0x2D: SETFLAGC((*L) & 1); *L = ((*L) >> 1) | ((*L) & 128); SETFLAGS(*L == 0, 0,0, FLAGC); break;
         case 0x2E:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             SETFLAGC(m & 1);
             m = (m >> 1) | (m & 128);
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0, FLAGC);
          }  break;
 
@@ -330,10 +371,10 @@ bool exec_op (BYTE opcode) {
         case 0x3C: SETFLAGC((*H) & 1); *H = ((*H) >> 1); SETFLAGS(*H == 0, 0,0, FLAGC); break;
         case 0x3D: SETFLAGC((*L) & 1); *L = ((*L) >> 1); SETFLAGS(*L == 0, 0,0, FLAGC); break;
         case 0x3E:
-         {  BYTE m = memgval (*HL);
+         {  BYTE m = memgval (gb, *HL);
             SETFLAGC(m & 1);
             m = (m >> 1);
-            memsval (*HL, m);
+            memsval (gb, *HL, m);
             SETFLAGS(m == 0, 0,0, FLAGC);
          }  break;
 
@@ -342,7 +383,7 @@ bool exec_op (BYTE opcode) {
         /* Bit Opcodes */
         /* BIT b, r */
         case 0x40 ... 0x7F:
-         {  BYTE register_values[8] = { *B, *C, *D, *E, *H, *L, memgval (*HL), *A };
+         {  BYTE register_values[8] = { *B, *C, *D, *E, *H, *L, memgval (gb, *HL), *A };
 
             SETFLAGS(!GETBIT(register_values[opcode & 7], (opcode >> 3) & 7), 0,1, FLAGC);
          }  break;
@@ -358,8 +399,8 @@ bool exec_op (BYTE opcode) {
     case 7: *A = fn(*A, ##__VA_ARGS__); break;\
     \
     case 6:\
-     {  BYTE tmp = memgval (*HL);\
-        memsval (*HL, fn(tmp, ##__VA_ARGS__));\
+     {  BYTE tmp = memgval (gb, *HL);\
+        memsval (gb, *HL, fn(tmp, ##__VA_ARGS__));\
      }  break;\
     }
 
@@ -377,12 +418,6 @@ bool exec_op (BYTE opcode) {
 #pragma GCC diagnostic pop
 
 #undef DO_FOR_REGISTER
-
-
-        default:
-            /* this should never happen, but just in case... */
-            fatal ("ILLEGAL INSTRUCTION: Invalid instruction `$CB $%.2hhX'", opcode);
-            break;
         }
         break;
     /* END $CB Prefix */
@@ -390,13 +425,13 @@ bool exec_op (BYTE opcode) {
 
     /* 8-Bit Loads */
     /* LD r, n */
-    case 0x3E: *A = next(); break;
-    case 0x06: *B = next(); break;
-    case 0x0E: *C = next(); break;
-    case 0x16: *D = next(); break;
-    case 0x1E: *E = next(); break;
-    case 0x26: *H = next(); break;
-    case 0x2E: *L = next(); break;
+    case 0x3E: *A = next(gb); break;
+    case 0x06: *B = next(gb); break;
+    case 0x0E: *C = next(gb); break;
+    case 0x16: *D = next(gb); break;
+    case 0x1E: *E = next(gb); break;
+    case 0x26: *H = next(gb); break;
+    case 0x2E: *L = next(gb); break;
 
 
     /* LD r, r */
@@ -408,17 +443,18 @@ bool exec_op (BYTE opcode) {
     case 0x7B: *A = *E; break;
     case 0x7C: *A = *H; break;
     case 0x7D: *A = *L; break;
-    case 0x7E: *A = memgval (*HL); break;
+    case 0x7E: *A = memgval (gb, *HL); break;
 
     /* LD B, r */
     case 0x47: *B = *A; break;
-    case 0x40: *B = *B; break;
+    /* (LD B,B does nothing -- but mooneye's tests use it to say they're done) */
+    case 0x40: if (gb->serial.stop_magic) serial_magic (gb); break;
     case 0x41: *B = *C; break;
     case 0x42: *B = *D; break;
     case 0x43: *B = *E; break;
     case 0x44: *B = *H; break;
     case 0x45: *B = *L; break;
-    case 0x46: *B = memgval (*HL); break;
+    case 0x46: *B = memgval (gb, *HL); break;
 
     /* LD C, r */
     case 0x4F: *C = *A; break;
@@ -428,7 +464,7 @@ bool exec_op (BYTE opcode) {
     case 0x4B: *C = *E; break;
     case 0x4C: *C = *H; break;
     case 0x4D: *C = *L; break;
-    case 0x4E: *C = memgval (*HL); break;
+    case 0x4E: *C = memgval (gb, *HL); break;
 
     /* LD D, r */
     case 0x57: *D = *A; break;
@@ -438,7 +474,7 @@ bool exec_op (BYTE opcode) {
     case 0x53: *D = *E; break;
     case 0x54: *D = *H; break;
     case 0x55: *D = *L; break;
-    case 0x56: *D = memgval (*HL); break;
+    case 0x56: *D = memgval (gb, *HL); break;
 
     /* LD E, r */
     case 0x5F: *E = *A; break;
@@ -448,7 +484,7 @@ bool exec_op (BYTE opcode) {
     case 0x5B: *E = *E; break;
     case 0x5C: *E = *H; break;
     case 0x5D: *E = *L; break;
-    case 0x5E: *E = memgval (*HL); break;
+    case 0x5E: *E = memgval (gb, *HL); break;
 
     /* LD H, r */
     case 0x67: *H = *A; break;
@@ -458,7 +494,7 @@ bool exec_op (BYTE opcode) {
     case 0x63: *H = *E; break;
     case 0x64: *H = *H; break;
     case 0x65: *H = *L; break;
-    case 0x66: *H = memgval (*HL); break;
+    case 0x66: *H = memgval (gb, *HL); break;
 
     /* LD L, r */
     case 0x6F: *L = *A; break;
@@ -468,104 +504,104 @@ bool exec_op (BYTE opcode) {
     case 0x6B: *L = *E; break;
     case 0x6C: *L = *H; break;
     case 0x6D: *L = *L; break;
-    case 0x6E: *L = memgval (*HL); break;
+    case 0x6E: *L = memgval (gb, *HL); break;
 
     /* LD (HL), r */
-    case 0x77: memsval (*HL, *A); break;
-    case 0x70: memsval (*HL, *B); break;
-    case 0x71: memsval (*HL, *C); break;
-    case 0x72: memsval (*HL, *D); break;
-    case 0x73: memsval (*HL, *E); break;
-    case 0x74: memsval (*HL, *H); break;
-    case 0x75: memsval (*HL, *L); break;
+    case 0x77: memsval (gb, *HL, *A); break;
+    case 0x70: memsval (gb, *HL, *B); break;
+    case 0x71: memsval (gb, *HL, *C); break;
+    case 0x72: memsval (gb, *HL, *D); break;
+    case 0x73: memsval (gb, *HL, *E); break;
+    case 0x74: memsval (gb, *HL, *H); break;
+    case 0x75: memsval (gb, *HL, *L); break;
     /* LD (HL), n */
-    case 0x36: memsval (*HL,  next()); break;
+    case 0x36: memsval (gb, *HL,  next(gb)); break;
 
     /* LD A, (rr) */
-    case 0x0A: *A = memgval (*BC); break;
-    case 0x1A: *A = memgval (*DE); break;
+    case 0x0A: *A = memgval (gb, *BC); break;
+    case 0x1A: *A = memgval (gb, *DE); break;
     /* LD A, (nn) */
-    case 0xFA: *A = memgval (next16()); break;
+    case 0xFA: *A = memgval (gb, next16(gb)); break;
 
     /* LD (rr), A */
-    case 0x02: memsval (*BC, *A); break;
-    case 0x12: memsval (*DE, *A); break;
+    case 0x02: memsval (gb, *BC, *A); break;
+    case 0x12: memsval (gb, *DE, *A); break;
     /* LD (nn), A */
-    case 0xEA: memsval (next16(), *A); break;
+    case 0xEA: memsval (gb, next16(gb), *A); break;
 
     /* LD A, (C) aka LD A, ($FF00+C) */
-    case 0xF2: *A = memgval (0xFF00 + (*C)); break;
+    case 0xF2: *A = memgval (gb, 0xFF00 + (*C)); break;
     /* LD (C), A */
-    case 0xE2: memsval (0xFF00 + (*C),  *A); break;
+    case 0xE2: memsval (gb, 0xFF00 + (*C),  *A); break;
 
     /* LD A,(HL-) aka LD A,(HLD) aka LDD A,(HL) */
-    case 0x3A: *A = memgval ((*HL)--); break;
+    case 0x3A: *A = memgval (gb, (*HL)--); break;
     /* LD (HL-),A aka LD (HLD),A aka LDD (HL),A */
-    case 0x32: memsval ((*HL)--,  *A); break;
+    case 0x32: memsval (gb, (*HL)--,  *A); break;
 
     /* LD A,(HL+) aka LD A,(HLI) aka LDI A,(HL) */
-    case 0x2A: *A = memgval ((*HL)++); break;
+    case 0x2A: *A = memgval (gb, (*HL)++); break;
     /* LD (HL+),A aka LD (HLI),A aka LDI (HL),A */
-    case 0x22: memsval ((*HL)++,  *A); break;
+    case 0x22: memsval (gb, (*HL)++,  *A); break;
 
     /* LDH (n), A aka LD ($FF00+n), A */
-    case 0xE0: memsval (0xFF00+next(),  *A); break;
+    case 0xE0: memsval (gb, 0xFF00+next(gb),  *A); break;
     /* LDH A, (n) aka LD A, ($FF00+n) */
-    case 0xF0: *A = memgval (0xFF00+next()); break;
+    case 0xF0: *A = memgval (gb, 0xFF00+next(gb)); break;
 
 
     /* 16-Bit Loads */
     /* LD rr, nn */
-    case 0x01: *BC = next16(); break;
-    case 0x11: *DE = next16(); break;
-    case 0x21: *HL = next16(); break;
-    case 0x31:  sp = next16(); break;
+    case 0x01: *BC = next16(gb); break;
+    case 0x11: *DE = next16(gb); break;
+    case 0x21: *HL = next16(gb); break;
+    case 0x31:  sp = next16(gb); break;
 
     /* LD SP, HL */
     case 0xF9: sp = *HL; break;
 
     /* LD HL, SP+n aka LDHL SP,n*/
     case 0xF8:
-      { SIGNED_BYTE n = next();
+      { SIGNED_BYTE n = next(gb);
         *HL = (WORD)(sp + (SIGNED_BYTE)n);
         SETFLAGS(0, 0, HALF_CARRY(sp, n), FULL_CARRY(sp, n));
       } break;
 
     /* LD (nn), SP */
-    case 0x08: memset16 (next16(), sp); break;
+    case 0x08: memsval16 (gb, next16(gb), sp); break;
 
     /* PUSH rr */
-    case 0xF5: push (*AF); break;
-    case 0xC5: push (*BC); break;
-    case 0xD5: push (*DE); break;
-    case 0xE5: push (*HL); break;
+    case 0xF5: push (gb, *AF); break;
+    case 0xC5: push (gb, *BC); break;
+    case 0xD5: push (gb, *DE); break;
+    case 0xE5: push (gb, *HL); break;
 
     /* POP rr */
     /* NOTE: because only the 4 high bits of F are used (as the flags) we have to mask with $F0 */
-    case 0xF1: *AF = pop(); *F &= 0xF0; break;
-    case 0xC1: *BC = pop(); break;
-    case 0xD1: *DE = pop(); break;
-    case 0xE1: *HL = pop(); break;
+    case 0xF1: *AF = pop(gb); *F &= 0xF0; break;
+    case 0xC1: *BC = pop(gb); break;
+    case 0xD1: *DE = pop(gb); break;
+    case 0xE1: *HL = pop(gb); break;
 
 
     /* 8-Bit ALU */
     /* ADD A, r */
-    case 0x87: *A = cpu_add (*A, *A); break;
-    case 0x80: *A = cpu_add (*A, *B); break;
-    case 0x81: *A = cpu_add (*A, *C); break;
-    case 0x82: *A = cpu_add (*A, *D); break;
-    case 0x83: *A = cpu_add (*A, *E); break;
-    case 0x84: *A = cpu_add (*A, *H); break;
-    case 0x85: *A = cpu_add (*A, *L); break;
-    case 0x86: *A = cpu_add (*A, memgval (*HL)); break;
+    case 0x87: *A = cpu_add (gb, *A, *A); break;
+    case 0x80: *A = cpu_add (gb, *A, *B); break;
+    case 0x81: *A = cpu_add (gb, *A, *C); break;
+    case 0x82: *A = cpu_add (gb, *A, *D); break;
+    case 0x83: *A = cpu_add (gb, *A, *E); break;
+    case 0x84: *A = cpu_add (gb, *A, *H); break;
+    case 0x85: *A = cpu_add (gb, *A, *L); break;
+    case 0x86: *A = cpu_add (gb, *A, memgval (gb, *HL)); break;
     /* ADD A, n */
-    case 0xC6: *A = cpu_add (*A, next()); break;
+    case 0xC6: *A = cpu_add (gb, *A, next(gb)); break;
 
     /* ADC A, r */
 #define ADC(value)  \
         ({\
             bool old_c = FLAGC;\
-            (*A) = cpu_add (*A, value);\
+            (*A) = cpu_add (gb, *A, value);\
             if (HALF_CARRY(*A, old_c))   SETFLAGH(1);\
             if (FULL_CARRY(*A, old_c))   SETFLAGC(1);\
             (*A) += old_c;\
@@ -578,30 +614,30 @@ bool exec_op (BYTE opcode) {
     case 0x8B: ADC(*E); break;
     case 0x8C: ADC(*H); break;
     case 0x8D: ADC(*L); break;
-    case 0x8E: ADC(memgval (*HL)); break;
+    case 0x8E: ADC(memgval (gb, *HL)); break;
     /* ADC A, n */
     case 0xCE:
-        ADC (next());
+        ADC (next(gb));
         break;
 #undef ADC
 
     /* SUB A, r */
-    case 0x97: *A = cpu_sub (*A, *A); break;
-    case 0x90: *A = cpu_sub (*A, *B); break;
-    case 0x91: *A = cpu_sub (*A, *C); break;
-    case 0x92: *A = cpu_sub (*A, *D); break;
-    case 0x93: *A = cpu_sub (*A, *E); break;
-    case 0x94: *A = cpu_sub (*A, *H); break;
-    case 0x95: *A = cpu_sub (*A, *L); break;
-    case 0x96: *A = cpu_sub (*A, memgval (*HL)); break;
+    case 0x97: *A = cpu_sub (gb, *A, *A); break;
+    case 0x90: *A = cpu_sub (gb, *A, *B); break;
+    case 0x91: *A = cpu_sub (gb, *A, *C); break;
+    case 0x92: *A = cpu_sub (gb, *A, *D); break;
+    case 0x93: *A = cpu_sub (gb, *A, *E); break;
+    case 0x94: *A = cpu_sub (gb, *A, *H); break;
+    case 0x95: *A = cpu_sub (gb, *A, *L); break;
+    case 0x96: *A = cpu_sub (gb, *A, memgval (gb, *HL)); break;
     /* SUB A, n */
-    case 0xD6: *A = cpu_sub (*A, next()); break;
+    case 0xD6: *A = cpu_sub (gb, *A, next(gb)); break;
 
     /* SBC A, r */
 #define SBC(value)  \
         ({\
             bool old_c = FLAGC;\
-            (*A) = cpu_sub (*A, value);\
+            (*A) = cpu_sub (gb, *A, value);\
             if (HALF_BORROW(*A, old_c))    SETFLAGH(1);\
             if (FULL_BORROW(*A, old_c))    SETFLAGC(1);\
             (*A) -= old_c;\
@@ -614,9 +650,9 @@ bool exec_op (BYTE opcode) {
     case 0x9B: SBC(*E); break;
     case 0x9C: SBC(*H); break;
     case 0x9D: SBC(*L); break;
-    case 0x9E: SBC(memgval (*HL)); break;
+    case 0x9E: SBC(memgval (gb, *HL)); break;
     /* SBC A, n */
-    case 0xDE: SBC(next()); break;
+    case 0xDE: SBC(next(gb)); break;
 #undef SBC
 
     /* AND A, r */
@@ -627,9 +663,9 @@ bool exec_op (BYTE opcode) {
     case 0xA3: *A &= *E; SETFLAGS(*A == 0, 0,1,0); break;
     case 0xA4: *A &= *H; SETFLAGS(*A == 0, 0,1,0); break;
     case 0xA5: *A &= *L; SETFLAGS(*A == 0, 0,1,0); break;
-    case 0xA6: *A &= memgval (*HL); SETFLAGS(*A == 0, 0,1,0); break;
+    case 0xA6: *A &= memgval (gb, *HL); SETFLAGS(*A == 0, 0,1,0); break;
     /* AND A, n */
-    case 0xE6: *A &= next(); SETFLAGS(*A == 0, 0,1,0); break;
+    case 0xE6: *A &= next(gb); SETFLAGS(*A == 0, 0,1,0); break;
 
     /* OR A, r */
     case 0xB7: *A |= *A; SETFLAGS(*A == 0, 0,0,0); break;
@@ -639,9 +675,9 @@ bool exec_op (BYTE opcode) {
     case 0xB3: *A |= *E; SETFLAGS(*A == 0, 0,0,0); break;
     case 0xB4: *A |= *H; SETFLAGS(*A == 0, 0,0,0); break;
     case 0xB5: *A |= *L; SETFLAGS(*A == 0, 0,0,0); break;
-    case 0xB6: *A |= memgval (*HL); SETFLAGS(*A == 0, 0,0,0); break;
+    case 0xB6: *A |= memgval (gb, *HL); SETFLAGS(*A == 0, 0,0,0); break;
     /* OR A, n */
-    case 0xF6: *A |= next(); SETFLAGS(*A == 0, 0,0,0); break;
+    case 0xF6: *A |= next(gb); SETFLAGS(*A == 0, 0,0,0); break;
 
     /* XOR A, r */
     case 0xAF: *A ^= *A; SETFLAGS(*A == 0, 0,0,0); break;
@@ -651,53 +687,53 @@ bool exec_op (BYTE opcode) {
     case 0xAB: *A ^= *E; SETFLAGS(*A == 0, 0,0,0); break;
     case 0xAC: *A ^= *H; SETFLAGS(*A == 0, 0,0,0); break;
     case 0xAD: *A ^= *L; SETFLAGS(*A == 0, 0,0,0); break;
-    case 0xAE: *A ^= memgval (*HL); SETFLAGS(*A == 0, 0,0,0); break;
+    case 0xAE: *A ^= memgval (gb, *HL); SETFLAGS(*A == 0, 0,0,0); break;
     /* XOR A, n */
-    case 0xEE: *A ^= next(); SETFLAGS(*A == 0, 0,0,0); break;
+    case 0xEE: *A ^= next(gb); SETFLAGS(*A == 0, 0,0,0); break;
 
     /* CP A, r */
-    case 0xBF: cpu_sub (*A, *A); break;
-    case 0xB8: cpu_sub (*A, *B); break;
-    case 0xB9: cpu_sub (*A, *C); break;
-    case 0xBA: cpu_sub (*A, *D); break;
-    case 0xBB: cpu_sub (*A, *E); break;
-    case 0xBC: cpu_sub (*A, *H); break;
-    case 0xBD: cpu_sub (*A, *L); break;
-    case 0xBE: cpu_sub (*A, memgval (*HL)); break;
+    case 0xBF: cpu_sub (gb, *A, *A); break;
+    case 0xB8: cpu_sub (gb, *A, *B); break;
+    case 0xB9: cpu_sub (gb, *A, *C); break;
+    case 0xBA: cpu_sub (gb, *A, *D); break;
+    case 0xBB: cpu_sub (gb, *A, *E); break;
+    case 0xBC: cpu_sub (gb, *A, *H); break;
+    case 0xBD: cpu_sub (gb, *A, *L); break;
+    case 0xBE: cpu_sub (gb, *A, memgval (gb, *HL)); break;
     /* CP A, n */
-    case 0xFE: cpu_sub (*A, next()); break;
+    case 0xFE: cpu_sub (gb, *A, next(gb)); break;
 
     /* INC r */
-    case 0x3C: { bool old_c = FLAGC; *A = cpu_add (*A, 1); SETFLAGC(old_c) ; } break;
-    case 0x04: { bool old_c = FLAGC; *B = cpu_add (*B, 1); SETFLAGC(old_c) ; } break;
-    case 0x0C: { bool old_c = FLAGC; *C = cpu_add (*C, 1); SETFLAGC(old_c) ; } break;
-    case 0x14: { bool old_c = FLAGC; *D = cpu_add (*D, 1); SETFLAGC(old_c) ; } break;
-    case 0x1C: { bool old_c = FLAGC; *E = cpu_add (*E, 1); SETFLAGC(old_c) ; } break;
-    case 0x24: { bool old_c = FLAGC; *H = cpu_add (*H, 1); SETFLAGC(old_c) ; } break;
-    case 0x2C: { bool old_c = FLAGC; *L = cpu_add (*L, 1); SETFLAGC(old_c) ; } break;
-    case 0x34: { bool old_c = FLAGC; memsval (*HL, cpu_add (memgval (*HL), 1)); SETFLAGC(old_c) ; } break;
+    case 0x3C: { bool old_c = FLAGC; *A = cpu_add (gb, *A, 1); SETFLAGC(old_c) ; } break;
+    case 0x04: { bool old_c = FLAGC; *B = cpu_add (gb, *B, 1); SETFLAGC(old_c) ; } break;
+    case 0x0C: { bool old_c = FLAGC; *C = cpu_add (gb, *C, 1); SETFLAGC(old_c) ; } break;
+    case 0x14: { bool old_c = FLAGC; *D = cpu_add (gb, *D, 1); SETFLAGC(old_c) ; } break;
+    case 0x1C: { bool old_c = FLAGC; *E = cpu_add (gb, *E, 1); SETFLAGC(old_c) ; } break;
+    case 0x24: { bool old_c = FLAGC; *H = cpu_add (gb, *H, 1); SETFLAGC(old_c) ; } break;
+    case 0x2C: { bool old_c = FLAGC; *L = cpu_add (gb, *L, 1); SETFLAGC(old_c) ; } break;
+    case 0x34: { bool old_c = FLAGC; memsval (gb, *HL, cpu_add (gb, memgval (gb, *HL), 1)); SETFLAGC(old_c) ; } break;
 
     /* DEC r */
-    case 0x3D: { bool old_c = FLAGC; *A = cpu_sub (*A, 1); SETFLAGC(old_c); } break;
-    case 0x05: { bool old_c = FLAGC; *B = cpu_sub (*B, 1); SETFLAGC(old_c); } break;
-    case 0x0D: { bool old_c = FLAGC; *C = cpu_sub (*C, 1); SETFLAGC(old_c); } break;
-    case 0x15: { bool old_c = FLAGC; *D = cpu_sub (*D, 1); SETFLAGC(old_c); } break;
-    case 0x1D: { bool old_c = FLAGC; *E = cpu_sub (*E, 1); SETFLAGC(old_c); } break;
-    case 0x25: { bool old_c = FLAGC; *H = cpu_sub (*H, 1); SETFLAGC(old_c); } break;
-    case 0x2D: { bool old_c = FLAGC; *L = cpu_sub (*L, 1); SETFLAGC(old_c); } break;
-    case 0x35: { bool old_c = FLAGC; memsval (*HL, cpu_sub (memgval (*HL), 1)); SETFLAGC(old_c); } break;
+    case 0x3D: { bool old_c = FLAGC; *A = cpu_sub (gb, *A, 1); SETFLAGC(old_c); } break;
+    case 0x05: { bool old_c = FLAGC; *B = cpu_sub (gb, *B, 1); SETFLAGC(old_c); } break;
+    case 0x0D: { bool old_c = FLAGC; *C = cpu_sub (gb, *C, 1); SETFLAGC(old_c); } break;
+    case 0x15: { bool old_c = FLAGC; *D = cpu_sub (gb, *D, 1); SETFLAGC(old_c); } break;
+    case 0x1D: { bool old_c = FLAGC; *E = cpu_sub (gb, *E, 1); SETFLAGC(old_c); } break;
+    case 0x25: { bool old_c = FLAGC; *H = cpu_sub (gb, *H, 1); SETFLAGC(old_c); } break;
+    case 0x2D: { bool old_c = FLAGC; *L = cpu_sub (gb, *L, 1); SETFLAGC(old_c); } break;
+    case 0x35: { bool old_c = FLAGC; memsval (gb, *HL, cpu_sub (gb, memgval (gb, *HL), 1)); SETFLAGC(old_c); } break;
 
 
     /* 16-Bit Arithmetic */
     /* ADD HL, rr */
-    case 0x09: { bool old = FLAGZ; *HL = cpu_add16 (*HL, *BC); SETFLAGZ(old); } break;
-    case 0x19: { bool old = FLAGZ; *HL = cpu_add16 (*HL, *DE); SETFLAGZ(old); } break;
-    case 0x29: { bool old = FLAGZ; *HL = cpu_add16 (*HL, *HL); SETFLAGZ(old); } break;
-    case 0x39: { bool old = FLAGZ; *HL = cpu_add16 (*HL,  sp); SETFLAGZ(old); } break;
+    case 0x09: { bool old = FLAGZ; *HL = cpu_add16 (gb, *HL, *BC); SETFLAGZ(old); } break;
+    case 0x19: { bool old = FLAGZ; *HL = cpu_add16 (gb, *HL, *DE); SETFLAGZ(old); } break;
+    case 0x29: { bool old = FLAGZ; *HL = cpu_add16 (gb, *HL, *HL); SETFLAGZ(old); } break;
+    case 0x39: { bool old = FLAGZ; *HL = cpu_add16 (gb, *HL,  sp); SETFLAGZ(old); } break;
 
     /* ADD SP, n */
     case 0xE8:
-     {  SIGNED_BYTE n = next();
+     {  SIGNED_BYTE n = next(gb);
 
         SETFLAGC(FULL_CARRY(sp, n));
         SETFLAGH(HALF_CARRY(sp, n));
@@ -758,19 +794,20 @@ bool exec_op (BYTE opcode) {
 
     /* HALT */
     /* TODO: HALT instruction repeating */
-    case 0x76: cpu_halted = true; break;
+    case 0x76: cpu_halted = true; cpu_update_interrupts(gb); break;
 
     /* STOP */
     case 0x10:
         cpu_halted = true;
-        memsval (R_LCDCONT, memgval (R_LCDCONT) | (1 << 7));
+        cpu_update_interrupts(gb);
+        memsval (gb, R_LCDCONT, memgval (gb, R_LCDCONT) | (1 << 7));
         break;
 
 
     /* DI */
-    case 0xF3: IME = false; break;
+    case 0xF3: IME = false; cpu_update_interrupts(gb); break;
     /* EI */
-    case 0xFB: IME = true; break;
+    case 0xFB: IME = true; cpu_update_interrupts(gb); break;
 
 
     /* Rotates and Shifts */
@@ -805,119 +842,101 @@ bool exec_op (BYTE opcode) {
 
     /* Jumps */
     /* JP nn */
-    case 0xC3: pc = next16(); break;
+    case 0xC3: pc = next16(gb); break;
 
     /* JP cc, nn */
-    case 0xC2: { WORD nn = next16(); if (!FLAGZ) { pc = nn; condition_true = true; }} break;
-    case 0xCA: { WORD nn = next16(); if ( FLAGZ) { pc = nn; condition_true = true; }} break;
-    case 0xD2: { WORD nn = next16(); if (!FLAGC) { pc = nn; condition_true = true; }} break;
-    case 0xDA: { WORD nn = next16(); if ( FLAGC) { pc = nn; condition_true = true; }} break;
+    case 0xC2: { WORD nn = next16(gb); if (!FLAGZ) { pc = nn; condition_true = true; }} break;
+    case 0xCA: { WORD nn = next16(gb); if ( FLAGZ) { pc = nn; condition_true = true; }} break;
+    case 0xD2: { WORD nn = next16(gb); if (!FLAGC) { pc = nn; condition_true = true; }} break;
+    case 0xDA: { WORD nn = next16(gb); if ( FLAGC) { pc = nn; condition_true = true; }} break;
 
     /* JP (HL) */
     case 0xE9: pc = *HL; break;
 
     /* JR n */
-    case 0x18: pc += (SIGNED_BYTE)next(); break;
+    case 0x18: pc += (SIGNED_BYTE)next(gb); break;
 
     /* JR cc, n */
-    case 0x20: { SIGNED_BYTE offset = next(); if (!FLAGZ) { pc += offset; condition_true = true; }} break;
-    case 0x28: { SIGNED_BYTE offset = next(); if ( FLAGZ) { pc += offset; condition_true = true; }} break;
-    case 0x30: { SIGNED_BYTE offset = next(); if (!FLAGC) { pc += offset; condition_true = true; }} break;
-    case 0x38: { SIGNED_BYTE offset = next(); if ( FLAGC) { pc += offset; condition_true = true; }} break;
+    case 0x20: { SIGNED_BYTE offset = next(gb); if (!FLAGZ) { pc += offset; condition_true = true; }} break;
+    case 0x28: { SIGNED_BYTE offset = next(gb); if ( FLAGZ) { pc += offset; condition_true = true; }} break;
+    case 0x30: { SIGNED_BYTE offset = next(gb); if (!FLAGC) { pc += offset; condition_true = true; }} break;
+    case 0x38: { SIGNED_BYTE offset = next(gb); if ( FLAGC) { pc += offset; condition_true = true; }} break;
 
 
     /* Calls */
     /* CALL nn */
     case 0xCD:
-      { WORD addr = next16();
-        push (pc);
+      { WORD addr = next16(gb);
+        push (gb, pc);
         pc = addr;
       } break;
 
     /* CALL cc, nn */
-    case 0xC4: { WORD addr = next16(); if (!FLAGZ) { push (pc); pc = addr; condition_true = true; }} break;
-    case 0xCC: { WORD addr = next16(); if ( FLAGZ) { push (pc); pc = addr; condition_true = true; }} break;
-    case 0xD4: { WORD addr = next16(); if (!FLAGC) { push (pc); pc = addr; condition_true = true; }} break;
-    case 0xDC: { WORD addr = next16(); if ( FLAGC) { push (pc); pc = addr; condition_true = true; }} break;
+    case 0xC4: { WORD addr = next16(gb); if (!FLAGZ) { push (gb, pc); pc = addr; condition_true = true; }} break;
+    case 0xCC: { WORD addr = next16(gb); if ( FLAGZ) { push (gb, pc); pc = addr; condition_true = true; }} break;
+    case 0xD4: { WORD addr = next16(gb); if (!FLAGC) { push (gb, pc); pc = addr; condition_true = true; }} break;
+    case 0xDC: { WORD addr = next16(gb); if ( FLAGC) { push (gb, pc); pc = addr; condition_true = true; }} break;
 
 
     /* Restarts */
     /* RST n */
-    case 0xC7: cpu_restart (0x00); break;
-    case 0xCF: cpu_restart (0x08); break;
-    case 0xD7: cpu_restart (0x10); break;
-    case 0xDF: cpu_restart (0x18); break;
-    case 0xE7: cpu_restart (0x20); break;
-    case 0xEF: cpu_restart (0x28); break;
-    case 0xF7: cpu_restart (0x30); break;
-    case 0xFF: cpu_restart (0x38); break;
+    case 0xC7: cpu_restart (gb, 0x00); break;
+    case 0xCF: cpu_restart (gb, 0x08); break;
+    case 0xD7: cpu_restart (gb, 0x10); break;
+    case 0xDF: cpu_restart (gb, 0x18); break;
+    case 0xE7: cpu_restart (gb, 0x20); break;
+    case 0xEF: cpu_restart (gb, 0x28); break;
+    case 0xF7: cpu_restart (gb, 0x30); break;
+    case 0xFF: cpu_restart (gb, 0x38); break;
 
 
     /* Returns */
     /* RET */
-    case 0xC9: pc = pop(); break;
+    case 0xC9: pc = pop(gb); break;
 
     /* RET cc */
-    case 0xC0: if (!FLAGZ) { pc = pop(); condition_true = true; } break;
-    case 0xC8: if ( FLAGZ) { pc = pop(); condition_true = true; } break;
-    case 0xD0: if (!FLAGC) { pc = pop(); condition_true = true; } break;
-    case 0xD8: if ( FLAGC) { pc = pop(); condition_true = true; } break;
+    case 0xC0: if (!FLAGZ) { pc = pop(gb); condition_true = true; } break;
+    case 0xC8: if ( FLAGZ) { pc = pop(gb); condition_true = true; } break;
+    case 0xD0: if (!FLAGC) { pc = pop(gb); condition_true = true; } break;
+    case 0xD8: if ( FLAGC) { pc = pop(gb); condition_true = true; } break;
 
     /* RETI */
-    case 0xD9: pc = pop(); IME = true; break;
+    case 0xD9: pc = pop(gb); IME = true; cpu_update_interrupts(gb); break;
 
 
 
     /* unknown opcode */
     default:
-        fatal ("ILLEGAL INSTRUCTION: Invalid instruction `$%.2hhX'", opcode);
+        lock_up (gb, opcode);
         break;
     }
     return condition_true;
 }
 
 /* cpu_ack_interrupts: acknowledge any interrupts */
-static void cpu_ack_interrupts(void) {
+/* NOTE: only called when interrupts_ready is nonzero, ie. an interrupt
+ *       has occurred and is enabled */
+static void cpu_ack_interrupts (gb_t *gb) {
 
-    BYTE IFLAGS  = memgval (R_IFLAGS);
-    BYTE ISWITCH = memgval (R_ISWITCH);
+    /* any pending interrupt wakes the CPU from HALT */
+    cpu_halted = false;
 
-    /* check if an interrupt has occurred and is enabled */
-    for (unsigned i = 0; i < 5; ++i) {
-        if (GETBIT(IFLAGS, i)) {
-            cpu_halted = false;
-            if (GETBIT(ISWITCH, i) && IME) {
+    if (IME) {
+        /* lowest bit has the highest priority */
+        unsigned i = __builtin_ctz (interrupts_ready);
 
-                debug ("===%s INTERRUPT ACKNOWLEDGE===", interrupt_names[i]);
+        debug ("===%s INTERRUPT ACKNOWLEDGE===", interrupt_names[i]);
 
-                push (pc);
+        push (gb, pc);
 
-                pc = 0x40 + (8 * i);
+        pc = 0x40 + (8 * i);
 
-                IME = false;
-                RESBIT(IFLAGS, i);
+        IME = false;
 
-                memsval (R_IFLAGS, IFLAGS);
-                break;
-            }
-            //else
-            //    debug ("%s interrupt requested, but disabled", interrupt_names[i]);
-        }
+        BYTE IFLAGS = memgval (gb, R_IFLAGS);
+        RESBIT(IFLAGS, i);
+        mem_set_register (gb, R_IFLAGS, IFLAGS);
     }
-}
-
-/* cpu_cleanup:  */
-void cpu_cleanup(void) {
-    free (AF);
-
-    /* FIXME: for some reason, GNU
-     *  readline has a pointer that
-     *  overlaps BC, causing an invalid
-     *  free() error at exit */
-//    if (!G_state.debug.enabled)
-        free (BC);
-
-    free (DE);
-    free (HL);
+    cpu_update_interrupts(gb);
 }
 
@@ -20,35 +20,48 @@
 
 
 
-/* REGISTERS */
-/* program counter (NEXT byte in the program) */
-WORD pc;
-
-/* stack pointer (decrements BEFORE pushing) */
-WORD sp;
-
-
-/* registers 4 16-bit/8 8-bit */
-WORD *AF,
-     *BC,
-     *DE,
-     *HL;
-
-/* Flag register F:
- *
- *  7 Z - zero flag       : math op returns 0
- *  6 N - subtract flag   : last math op was a sub
- *  5 H - half-carry flag : carry from lower nibble in last math op
- *  4 C - carry flag      : carry in last math op
- * 3-0  - unused
+/* cpu:
+ *  the CPU state of an emulator instance
  */
-BYTE  *A, *F,
-      *B, *C,
-      *D, *E,
-      *H, *L;
-
-/* interrupt master enable */
-bool IME;
+struct cpu {
+    /* program counter (NEXT byte in the program) */
+    WORD pc;
+
+    /* stack pointer (decrements BEFORE pushing) */
+    WORD sp;
+
+    /* registers 4 16-bit/8 8-bit (which live in the arena) */
+    WORD *AF,
+         *BC,
+         *DE,
+         *HL;
+
+    /* Flag register F:
+     *
+     *  7 Z - zero flag       : math op returns 0
+     *  6 N - subtract flag   : last math op was a sub
+     *  5 H - half-carry flag : carry from lower nibble in last math op
+     *  4 C - carry flag      : carry in last math op
+     * 3-0  - unused
+     */
+    BYTE  *A, *F,
+          *B, *C,
+          *D, *E,
+          *H, *L;
+
+    /* interrupt master enable */
+    bool IME;
+
+    bool halted;
+
+    /* IFLAGS & ISWITCH, or 0 while interrupts can't be taken (see
+     * cpu_update_interrupts) -- this is the only thing cpu_cycle checks */
+    BYTE interrupts_ready;
+
+    /* what an illegal instruction locked the CPU up with (see cpu_locked_up) --
+     * it's stuck there for good, so this isn't part of a state */
+    char lockup[40];
+};
 
 
 /* interrupt:
@@ -64,9 +77,11 @@ enum interrupt {
 
 
 
-void cpu_init(void);
-unsigned cpu_cycle(void);
-void cpu_interrupt (enum interrupt int_type);
+void cpu_init (gb_t *gb);
+unsigned cpu_cycle (gb_t *gb);
+void cpu_interrupt (gb_t *gb, enum interrupt int_type);
+void cpu_update_interrupts (gb_t *gb);
+const char *cpu_locked_up (gb_t *gb);
 
 void cpu_logging (bool enable);
 bool cpu_logging_enabled(void);
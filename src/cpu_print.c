@@ -5,6 +5,7 @@
 
 #include "cpu_print.h"
 #include "cpu.h"
+#include "gb.h"
 
 #include "common.h"
 #include "registers.h"
@@ -13,16 +14,12 @@
 
 
 
-static WORD print_pc;
+static BYTE next (gb_t *gb, WORD *print_pc)
+{ return memgval (gb, (*print_pc)++); }
 
-
-
-static BYTE next(void)
-{ return memgval (print_pc++); }
-
-static WORD next16(void) {
-    WORD val = (memgval (print_pc + 1) << 8) | memgval (print_pc);
-    print_pc += 2;
+static WORD next16 (gb_t *gb, WORD *print_pc) {
+    WORD val = memgval16 (gb, *print_pc);
+    *print_pc += 2;
     return val;
 }
 
@@ -30,18 +27,19 @@ static WORD next16(void) {
 
 /* PUBLIC API */
 /* print_op: print an opcode */
-WORD print_op (BYTE opcode, WORD _pc) {
+WORD print_op (gb_t *gb, BYTE opcode, WORD _pc) {
     LOG_DOLOG = cpu_logging_enabled();
 
-    print_pc = _pc;
+    WORD print_pc = _pc;
+    WORD *HL = gb->cpu.HL;
     debugl ("%.2hhX  ", opcode);
 
-    static const char *r[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+    static const char *const r[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
 
     switch (opcode) {
     /* $10 Prefix */
     case 0x10:
-        opcode = next();
+        opcode = next (gb, &print_pc);
         debugl ("%.2hhX  ", opcode);
         switch (opcode) {
         /* STOP */
@@ -56,7 +54,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
 
     /* $CB Prefix */
     case 0xCB:
-        opcode = next();
+        opcode = next (gb, &print_pc);
         debugl ("%.2hhX  ", opcode);
         switch (opcode) {
         /* Miscellaneous */
@@ -193,7 +191,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
     case 0x1E:
     case 0x26:
     case 0x2E:
-        debug ("LD %s $%.2hhX", r[(opcode >> 3) & 7], next());
+        debug ("LD %s $%.2hhX", r[(opcode >> 3) & 7], next (gb, &print_pc));
         break;
 
 
@@ -294,20 +292,20 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* LD (HL), n */
     case 0x36:
-        debug ("LD (HL), $%.2hhX", next());
+        debug ("LD (HL), $%.2hhX", next (gb, &print_pc));
         break;
 
     /* LD A, (rr) */
     case 0x0A: debug ("LD A, (BC)"); break;
     case 0x1A: debug ("LD A, (DE)"); break;
     /* LD A, (nn) */
-    case 0xFA: debug ("LD A, ($%.4hX)", next16()); break;
+    case 0xFA: debug ("LD A, ($%.4hX)", next16 (gb, &print_pc)); break;
 
     /* LD (rr), A */
     case 0x02: debug ("LD (BC), A"); break;
     case 0x12: debug ("LD (DE), A"); break;
     /* LD (nn), A */
-    case 0xEA: debug ("LD ($%.4hX), A", next16()); break;
+    case 0xEA: debug ("LD ($%.4hX), A", next16 (gb, &print_pc)); break;
 
     /* LD A, (C) aka LD A, ($FF00+C) */
     case 0xF2: debug ("LD A, ($FF00+C)"); break;
@@ -326,31 +324,31 @@ WORD print_op (BYTE opcode, WORD _pc) {
 
     /* LDH (n), A aka LD ($FF00+n), A */
     case 0xE0:
-  { BYTE n = next();
+  { BYTE n = next (gb, &print_pc);
     debug ("LD ($FF00+$%.2hhX)(%s), A", n, register_name (n));
   } break;
     /* LDH A, (n) aka LD A, ($FF00+n) */
     case 0xF0:
-  { BYTE n = next();
+  { BYTE n = next (gb, &print_pc);
     debug ("LD A, ($FF00+$%.2hhX)(%s)", n, register_name (n));
   } break;
 
 
     /* 16-Bit Loads */
     /* LD rr, nn */
-    case 0x01: debug ("LD BC, $%.4hX", next16()); break;
-    case 0x11: debug ("LD DE, $%.4hX", next16()); break;
-    case 0x21: debug ("LD HL, $%.4hX", next16()); break;
-    case 0x31: debug ("LD SP, $%.4hX", next16()); break;
+    case 0x01: debug ("LD BC, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x11: debug ("LD DE, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x21: debug ("LD HL, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x31: debug ("LD SP, $%.4hX", next16 (gb, &print_pc)); break;
 
     /* LD SP, HL */
     case 0xF9: debug ("LD SP, HL"); break;
 
     /* LD HL, SP+n aka LDHL SP,n*/
-    case 0xF8: debug ("LD HL, SP+$%.2hhX", next()); break;
+    case 0xF8: debug ("LD HL, SP+$%.2hhX", next (gb, &print_pc)); break;
 
     /* LD (nn), SP */
-    case 0x08: debug ("LD ($%.4hX), SP", next16()); break;
+    case 0x08: debug ("LD ($%.4hX), SP", next16 (gb, &print_pc)); break;
 
     /* PUSH rr */
     case 0xF5: debug ("PUSH AF"); break;
@@ -379,7 +377,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* ADD A, n */
     case 0xC6:
-        debug ("ADD A, $%.2hhX", next());
+        debug ("ADD A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* ADC A, r */
@@ -395,7 +393,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* ADC A, n */
     case 0xCE:
-        debug ("ADC A, $%.2hhX", next());
+        debug ("ADC A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* SUB A, r */
@@ -411,7 +409,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* SUB A, n */
     case 0xD6:
-        debug ("SUB A, $%.2hhX", next());
+        debug ("SUB A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* SBC A, r */
@@ -426,7 +424,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         debug ("SBC A, %s", r[opcode & 7]);
         break;
     /* SBC A, n   NOTE: undocumented */
-    //case 0xDE?: *A = cpu_add (*A, next() + FLAGC); break;
+    //case 0xDE?: *A = cpu_add (*A, next (gb, &print_pc) + FLAGC); break;
 
     /* AND A, r */
     case 0xA7:
@@ -441,7 +439,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* AND A, n */
     case 0xE6:
-        debug ("AND A, $%.2hhX", next());
+        debug ("AND A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* OR A, r */
@@ -457,7 +455,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* OR A, n */
     case 0xF6:
-        debug ("OR A, $%.2hhX", next());
+        debug ("OR A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* XOR A, r */
@@ -473,7 +471,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* XOR A, n */
     case 0xEE:
-        debug ("XOR A, $%.2hhX", next());
+        debug ("XOR A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* CP A, r */
@@ -489,7 +487,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
         break;
     /* CP A, n */
     case 0xFE:
-        debug ("CP A, $%.2hhX", next());
+        debug ("CP A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* INC r */
@@ -521,7 +519,7 @@ WORD print_op (BYTE opcode, WORD _pc) {
     case 0x39: debug ("ADD HL, SP"); break;
 
     /* ADD SP, n */
-    case 0xE8: debug ("ADD SP, $%.2hhX", next()); break;
+    case 0xE8: debug ("ADD SP, $%.2hhX", next (gb, &print_pc)); break;
 
     /* INC rr */
     case 0x03: debug ("INC BC"); break;
@@ -577,36 +575,36 @@ WORD print_op (BYTE opcode, WORD _pc) {
 
     /* Jumps */
     /* JP nn */
-    case 0xC3: debug ("JP $%.4hX", next16()); break;
+    case 0xC3: debug ("JP $%.4hX", next16 (gb, &print_pc)); break;
 
     /* JP cc, nn */
-    case 0xC2: debug ("JP NZ, $%.4hX", next16()); break;
-    case 0xCA: debug ("JP Z, $%.4hX", next16()); break;
-    case 0xD2: debug ("JP NC, $%.4hX", next16()); break;
-    case 0xDA: debug ("JP C, $%.4hX", next16()); break;
+    case 0xC2: debug ("JP NZ, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xCA: debug ("JP Z, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xD2: debug ("JP NC, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xDA: debug ("JP C, $%.4hX", next16 (gb, &print_pc)); break;
 
     /* JP (HL) */
     case 0xE9: debug ("JP (HL)($%.4hX)", *HL); break;
 
     /* JR n */
-    case 0x18: debug ("JR Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next())); break;
+    case 0x18: debug ("JR Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
 
     /* JR cc, n */
-    case 0x20: debug ("JR NZ, Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x28: debug ("JR Z, Addr_%.4hX",  (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x30: debug ("JR NC, Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x38: debug ("JR C, Addr_%.4hX",  (WORD)(print_pc + (SIGNED_BYTE)next())); break;
+    case 0x20: debug ("JR NZ, Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x28: debug ("JR Z, Addr_%.4hX",  (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x30: debug ("JR NC, Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x38: debug ("JR C, Addr_%.4hX",  (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
 
 
     /* Calls */
     /* CALL nn */
-    case 0xCD: debug ("CALL $%.4hX", next16()); break;
+    case 0xCD: debug ("CALL $%.4hX", next16 (gb, &print_pc)); break;
 
     /* CALL cc, nn */
-    case 0xC4: debug ("CALL NZ, $%.4hX", next16()); break;
-    case 0xCC: debug ("CALL Z, $%.4hX", next16()); break;
-    case 0xD4: debug ("CALL NC, $%.4hX", next16()); break;
-    case 0xDC: debug ("CALL C, $%.4hX", next16()); break;
+    case 0xC4: debug ("CALL NZ, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xCC: debug ("CALL Z, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xD4: debug ("CALL NC, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xDC: debug ("CALL C, $%.4hX", next16 (gb, &print_pc)); break;
 
 
     /* Restarts */
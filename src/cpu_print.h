@@ -10,7 +10,7 @@
 #include "common.h"
 
 
-WORD print_op (BYTE opcode, WORD _pc);
+WORD print_op (gb_t *gb, BYTE opcode, WORD _pc);
 
 
 #endif
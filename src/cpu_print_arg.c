@@ -5,6 +5,7 @@
 
 #include "cpu_print_arg.h"
 #include "cpu.h"
+#include "gb.h"
 
 #include "common.h"
 #include "registers.h"
@@ -13,16 +14,12 @@
 
 
 
-static WORD print_pc;
+static BYTE next (gb_t *gb, WORD *print_pc)
+{ return memgval (gb, (*print_pc)++); }
 
-
-
-static BYTE next(void)
-{ return memgval (print_pc++); }
-
-static WORD next16(void) {
-    WORD val = (memgval (print_pc + 1) << 8) | memgval (print_pc);
-    print_pc += 2;
+static WORD next16 (gb_t *gb, WORD *print_pc) {
+    WORD val = memgval16 (gb, *print_pc);
+    *print_pc += 2;
     return val;
 }
 
@@ -30,12 +27,18 @@ static WORD next16(void) {
 
 /* PUBLIC API */
 /* print_op_arg: print an opcode and its results */
-WORD print_op_arg (BYTE opcode, WORD _pc) {
+WORD print_op_arg (gb_t *gb, BYTE opcode, WORD _pc) {
     LOG_DOLOG = cpu_logging_enabled();
 
-    print_pc = _pc;
+    WORD print_pc = _pc;
+    WORD *AF = gb->cpu.AF, *BC = gb->cpu.BC, *DE = gb->cpu.DE, *HL = gb->cpu.HL;
+    BYTE *A  = gb->cpu.A , *F  = gb->cpu.F ,
+         *B  = gb->cpu.B , *C  = gb->cpu.C ,
+         *D  = gb->cpu.D , *E  = gb->cpu.E ,
+         *H  = gb->cpu.H , *L  = gb->cpu.L ;
+    WORD  sp = gb->cpu.sp;
 
-    static const char *r[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+    static const char *const r[8] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
 
     BYTE rval (int n) {
         switch(n) {
@@ -46,10 +49,8 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         case 3: return *E; break;
         case 4: return *H; break;
         case 5: return *L; break;
-        case 6: return memgval (*HL); break;
-        default:
-            fatal ("invalid register %i!", n);
-            break;
+        case 6: return memgval (gb, *HL); break;
+        default: return 0; /* (n is always 0-7) */
         }
     }
 
@@ -59,7 +60,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
 
     /* $CB Prefix */
     case 0xCB:
-        opcode = next();
+        opcode = next (gb, &print_pc);
         debugl ("%.2hhX  ", opcode);
         switch (opcode) {
         /* Miscellaneous */
@@ -196,7 +197,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
     case 0x1E:
     case 0x26:
     case 0x2E:
-        debug ("LD %s, $%.2hhX", r[(opcode >> 3) & 7], next());
+        debug ("LD %s, $%.2hhX", r[(opcode >> 3) & 7], next (gb, &print_pc));
         break;
 
 
@@ -297,20 +298,20 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* LD (HL), n */
     case 0x36:
-        debug ("LD (HL), $%.2hhX", next());
+        debug ("LD (HL), $%.2hhX", next (gb, &print_pc));
         break;
 
     /* LD A, (rr) */
-    case 0x0A: debug ("LD A, (BC)[$%.2hhX]", memgval (*BC)); break;
-    case 0x1A: debug ("LD A, (DE)[$%.2hhX]", memgval (*DE)); break;
+    case 0x0A: debug ("LD A, (BC)[$%.2hhX]", memgval (gb, *BC)); break;
+    case 0x1A: debug ("LD A, (DE)[$%.2hhX]", memgval (gb, *DE)); break;
     /* LD A, (nn) */
-    case 0xFA: { WORD nn = next16(); debug ("LD A, ($%.4hX)[$%.2hhX]", nn, memgval (nn)); } break;
+    case 0xFA: { WORD nn = next16 (gb, &print_pc); debug ("LD A, ($%.4hX)[$%.2hhX]", nn, memgval (gb, nn)); } break;
 
     /* LD (rr), A */
     case 0x02: debug ("LD (BC), A[$%.2hhX]", *A); break;
     case 0x12: debug ("LD (DE), A[$%.2hhX]", *A); break;
     /* LD (nn), A */
-    case 0xEA: debug ("LD ($%.4hX), A[$%.2hhX]", next16(), *A); break;
+    case 0xEA: debug ("LD ($%.4hX), A[$%.2hhX]", next16 (gb, &print_pc), *A); break;
 
     /* LD A, (C) aka LD A, ($FF00+C) */
     case 0xF2: debug ("LD A, ($FF00+C[$%.2hhX])", *C); break;
@@ -323,40 +324,40 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
     case 0x32: debug ("LD (HL-)[$%.4hX], A[$%.2hhX]", (*HL) + 1, *A); break;
 
     /* LD A,(HL+) aka LD A,(HLI) aka LDI A,(HL) */
-    case 0x2A: debug ("LD A, (HL+)[$%.2hhX]", memgval((*HL) - 1)); break;
+    case 0x2A: debug ("LD A, (HL+)[$%.2hhX]", memgval (gb, (*HL) - 1)); break;
     /* LD (HL+),A aka LD (HLI),A aka LDI (HL),A */
     case 0x22: debug ("LD (HL+), A[$%.2hhX]", *A); break;
 
     /* LDH (n), A aka LD ($FF00+n), A */
     case 0xE0:
-  { BYTE n = next();
+  { BYTE n = next (gb, &print_pc);
     debug ("LDH ($FF%.2hhX)(%s), A[$%.2hhX]", n, register_name (n), *A);
   } break;
     /* LDH A, (n) aka LD A, ($FF00+n) */
     case 0xF0:
-  { BYTE n = next();
-    debug ("LDH A, ($FF%.2hhX)(%s)[$%.2hhX]", n, register_name (n), memgval (0xFF00 + n));
+  { BYTE n = next (gb, &print_pc);
+    debug ("LDH A, ($FF%.2hhX)(%s)[$%.2hhX]", n, register_name (n), memgval (gb, 0xFF00 + n));
   } break;
 
 
     /* 16-Bit Loads */
     /* LD rr, nn */
-    case 0x01: debug ("LD BC, $%.4hX", next16()); break;
-    case 0x11: debug ("LD DE, $%.4hX", next16()); break;
-    case 0x21: debug ("LD HL, $%.4hX", next16()); break;
-    case 0x31: debug ("LD SP, $%.4hX", next16()); break;
+    case 0x01: debug ("LD BC, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x11: debug ("LD DE, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x21: debug ("LD HL, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0x31: debug ("LD SP, $%.4hX", next16 (gb, &print_pc)); break;
 
     /* LD SP, HL */
     case 0xF9: debug ("LD SP, HL[$%.4hX]", *HL); break;
 
     /* LD HL, SP+n aka LDHL SP,n*/
     case 0xF8:
-      { SIGNED_BYTE n = next();
+      { SIGNED_BYTE n = next (gb, &print_pc);
         debug ("LD HL, SP+%hhi($%.4hX)", n, sp + n);
       } break;
 
     /* LD (nn), SP */
-    case 0x08: debug ("LD ($%.4hX), SP[$%.4hX]", next16(), sp); break;
+    case 0x08: debug ("LD ($%.4hX), SP[$%.4hX]", next16 (gb, &print_pc), sp); break;
 
     /* PUSH rr */
     case 0xF5: debug ("PUSH AF[$%.4hX]", *AF); break;
@@ -385,7 +386,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* ADD A, n */
     case 0xC6:
-        debug ("ADD A, $%.2hhX", next());
+        debug ("ADD A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* ADC A, r */
@@ -401,7 +402,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* ADC A, n */
     case 0xCE:
-        debug ("ADC A, $%.2hhX", next());
+        debug ("ADC A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* SUB A, r */
@@ -417,7 +418,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* SUB A, n */
     case 0xD6:
-        debug ("SUB A, $%.2hhX", next());
+        debug ("SUB A, $%.2hhX", next (gb, &print_pc));
         break;
 
     /* SBC A, r */
@@ -432,7 +433,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         debug ("SBC A, %s[$%.2hhX]", r[opcode & 7], rval(opcode & 7));
         break;
     /* SBC A, n   NOTE: undocumented */
-    //case 0xDE?: *A = cpu_add (*A, next() + FLAGC); break;
+    //case 0xDE?: *A = cpu_add (*A, next (gb, &print_pc) + FLAGC); break;
 
     /* AND A, r */
     case 0xA7:
@@ -447,7 +448,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* AND A, n */
     case 0xE6:
-        debug ("AND A, $%.2hhX[$%.2hhX]", next(), *A);
+        debug ("AND A, $%.2hhX[$%.2hhX]", next (gb, &print_pc), *A);
         break;
 
     /* OR A, r */
@@ -463,7 +464,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* OR A, n */
     case 0xF6:
-        debug ("OR A, $%.2hhX[$%.2hhX]", next(), *A);
+        debug ("OR A, $%.2hhX[$%.2hhX]", next (gb, &print_pc), *A);
         break;
 
     /* XOR A, r */
@@ -479,7 +480,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* XOR A, n */
     case 0xEE:
-        debug ("XOR A, $%.2hhX[$%.2hhX]", next(), *A);
+        debug ("XOR A, $%.2hhX[$%.2hhX]", next (gb, &print_pc), *A);
         break;
 
     /* CP A, r */
@@ -495,7 +496,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
         break;
     /* CP A, n */
     case 0xFE:
-        debug ("CP A[$%.2hhX], $%.2hhX", *A, next());
+        debug ("CP A[$%.2hhX], $%.2hhX", *A, next (gb, &print_pc));
         break;
 
     /* INC r */
@@ -506,7 +507,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
     case 0x1C: debug ("INC E[$%.2hhX]", *E); break;
     case 0x24: debug ("INC H[$%.2hhX]", *H); break;
     case 0x2C: debug ("INC L[$%.2hhX]", *L); break;
-    case 0x34: debug ("INC (HL)[$%.4hX]", memgval (*HL)); break;
+    case 0x34: debug ("INC (HL)[$%.4hX]", memgval (gb, *HL)); break;
 
     /* DEC r */
     case 0x3D: debug ("DEC A[$%.2hhX]", *A); break;
@@ -516,7 +517,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
     case 0x1D: debug ("DEC E[$%.2hhX]", *E); break;
     case 0x25: debug ("DEC H[$%.2hhX]", *H); break;
     case 0x2D: debug ("DEC L[$%.2hhX]", *L); break;
-    case 0x35: debug ("DEC (HL)[$%.4hX]", memgval (*HL)); break;
+    case 0x35: debug ("DEC (HL)[$%.4hX]", memgval (gb, *HL)); break;
 
 
     /* 16-Bit Arithmetic */
@@ -527,7 +528,7 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
     case 0x39: debug ("ADD HL, SP[$%.4hX]",  sp); break;
 
     /* ADD SP, n */
-    case 0xE8: debug ("ADD SP, $%.2hhX", next()); break;
+    case 0xE8: debug ("ADD SP, $%.2hhX", next (gb, &print_pc)); break;
 
     /* INC rr */
     case 0x03: debug ("INC BC[$%.4hX]", *BC); break;
@@ -586,36 +587,36 @@ WORD print_op_arg (BYTE opcode, WORD _pc) {
 
     /* Jumps */
     /* JP nn */
-    case 0xC3: debug ("JP $%.4hX", next16()); break;
+    case 0xC3: debug ("JP $%.4hX", next16 (gb, &print_pc)); break;
 
     /* JP cc, nn */
-    case 0xC2: debug ("JP NZ[%i], $%.4hX", !FLAGZ, next16()); break;
-    case 0xCA: debug ("JP Z[%i], $%.4hX",  FLAGZ, next16()); break;
-    case 0xD2: debug ("JP NC[%i], $%.4hX", !FLAGC, next16()); break;
-    case 0xDA: debug ("JP C[%i], $%.4hX",  FLAGC, next16()); break;
+    case 0xC2: debug ("JP NZ[%i], $%.4hX", !FLAGZ, next16 (gb, &print_pc)); break;
+    case 0xCA: debug ("JP Z[%i], $%.4hX",  FLAGZ, next16 (gb, &print_pc)); break;
+    case 0xD2: debug ("JP NC[%i], $%.4hX", !FLAGC, next16 (gb, &print_pc)); break;
+    case 0xDA: debug ("JP C[%i], $%.4hX",  FLAGC, next16 (gb, &print_pc)); break;
 
     /* JP (HL) */
     case 0xE9: debug ("JP (HL)($%.4hX)", *HL); break;
 
     /* JR n */
-    case 0x18: debug ("JR Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next())); break;
+    case 0x18: debug ("JR Addr_%.4hX", (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
 
     /* JR cc, n */
-    case 0x20: debug ("JR NZ[%i], Addr_%.4hX", !FLAGZ, (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x28: debug ("JR Z[%i], Addr_%.4hX",   FLAGZ, (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x30: debug ("JR NC[%i], Addr_%.4hX", !FLAGC, (WORD)(print_pc + (SIGNED_BYTE)next())); break;
-    case 0x38: debug ("JR C[%i], Addr_%.4hX",   FLAGC, (WORD)(print_pc + (SIGNED_BYTE)next())); break;
+    case 0x20: debug ("JR NZ[%i], Addr_%.4hX", !FLAGZ, (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x28: debug ("JR Z[%i], Addr_%.4hX",   FLAGZ, (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x30: debug ("JR NC[%i], Addr_%.4hX", !FLAGC, (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
+    case 0x38: debug ("JR C[%i], Addr_%.4hX",   FLAGC, (WORD)(print_pc + (SIGNED_BYTE)next (gb, &print_pc))); break;
 
 
     /* Calls */
     /* CALL nn */
-    case 0xCD: debug ("CALL $%.4hX", next16()); break;
+    case 0xCD: debug ("CALL $%.4hX", next16 (gb, &print_pc)); break;
 
     /* CALL cc, nn */
-    case 0xC4: debug ("CALL NZ, $%.4hX", next16()); break;
-    case 0xCC: debug ("CALL Z, $%.4hX", next16()); break;
-    case 0xD4: debug ("CALL NC, $%.4hX", next16()); break;
-    case 0xDC: debug ("CALL C, $%.4hX", next16()); break;
+    case 0xC4: debug ("CALL NZ, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xCC: debug ("CALL Z, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xD4: debug ("CALL NC, $%.4hX", next16 (gb, &print_pc)); break;
+    case 0xDC: debug ("CALL C, $%.4hX", next16 (gb, &print_pc)); break;
 
 
     /* Restarts */
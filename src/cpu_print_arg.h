@@ -10,7 +10,7 @@
 #include "common.h"
 
 
-WORD print_op_arg (BYTE opcode, WORD _pc);
+WORD print_op_arg (gb_t *gb, BYTE opcode, WORD _pc);
 
 
 #endif
@@ -6,7 +6,7 @@
 #include "common.h"
 
 
-static const unsigned noprefix_cycles_true[256]
+static const unsigned noprefix_cycles_false[256]
     = {
         /* 0x00 */
         4, 12, 8, 8, 4, 4, 8, 4, 20, 8, 8, 8, 4, 4, 8, 4, 
@@ -42,7 +42,7 @@ static const unsigned noprefix_cycles_true[256]
         12, 12, 8, 4, 0, 16, 8, 16, 12, 8, 16, 4, 0, 0, 8, 16, 
 };
 
-static const unsigned noprefix_cycles_false[256]
+static const unsigned noprefix_cycles_true[256]
   = {
         /* 0x00 */
         4, 12, 8, 8, 4, 4, 8, 4, 20, 8, 8, 8, 4, 4, 8, 4, 
@@ -101,6 +101,10 @@ unsigned op_cycles (BYTE prefix, BYTE opcode, bool yes) {
             cycles = noprefix_cycles_false[opcode];
     }
 
+    /* (an illegal instruction locks the CPU up, but the clock keeps going) */
+    if (cycles == 0)
+        cycles = 4;
+
     return cycles;
 }
 
@@ -4,10 +4,13 @@
  */
 
 #include "debugger.h"
+#include "gb.h"
 #include "mem.h"
 #include "cpu.h"
 #include "common.h"
 #include "logging.h"
+#include "registers.h"
+#include "state.h"
 
 #include <stdio.h>
 #include <stdint.h>
@@ -16,46 +19,47 @@
 #include <ctype.h>  /* isspace */
 #include <stdlib.h> /* free */
 #include <string.h> /* strerror */
+#include <time.h>   /* clock_gettime */
 
 #include <readline/history.h>
 #include <readline/readline.h>
 
 
 
-void debug_printreg (char *name);
-void debug_printmem (uint16_t loc);
-void debug_dumpregs(void);
-void debug_dumpmem (uint16_t start, uint16_t end);
+void debug_printreg (gb_t *gb, char *name);
+void debug_printmem (gb_t *gb, uint16_t loc);
+void debug_dumpregs (gb_t *gb);
+void debug_dumpmem (gb_t *gb, uint16_t start, uint16_t end);
+void debug_dumpio (gb_t *gb);
+void debug_savestate (gb_t *gb, const char *fname);
+void debug_loadstate (gb_t *gb, const char *fname);
 uint16_t strtoword (char *str);
 
 char **debug_command_complete (const char *text, int start, int end);
 
 
-static char *previouscommand = NULL;
-
-
 
 /* debug_init:  */
-void debug_init(void) {
+void debug_init (gb_t *gb) {
+    (void)gb;
 
     using_history();
     rl_attempted_completion_function = debug_command_complete;
-    atexit (debug_cleanup);
 }
 
 /* debug_cleanup:  */
-void debug_cleanup(void) {
+void debug_cleanup (gb_t *gb) {
 
-    free (previouscommand);
-    previouscommand = NULL;
+    free (gb->previous_command);
+    gb->previous_command = NULL;
 
     clear_history();
 }
 
 /* debug_prompt: interactive debugger */
-void debug_prompt(void) {
+void debug_prompt (gb_t *gb) {
 
-    G_state.state = (G_state.state | EMUSTATE_DEBUG) & ~EMUSTATE_NORMAL;
+    gb->state.state = (gb->state.state | EMUSTATE_DEBUG) & ~EMUSTATE_NORMAL;
 
     char *command = NULL;
     size_t cmdlen = 0;
@@ -67,9 +71,9 @@ void debug_prompt(void) {
         cmdlen = strlen (command);
 
     /* no input means just use the previous input */
-    if (cmdlen == 0 && command != NULL && previouscommand != NULL) {
+    if (cmdlen == 0 && command != NULL && gb->previous_command != NULL) {
         free (command);
-        command = strdup (previouscommand);
+        command = strdup (gb->previous_command);
         cmdlen = strlen (command);
         newcommand = false;
     }
@@ -77,7 +81,7 @@ void debug_prompt(void) {
 
     /* error/EOI occurred */
     if (command == NULL) {
-        G_state.running = false;
+        gb->state.running = false;
         return;
     }
     else {
@@ -121,10 +125,10 @@ void debug_prompt(void) {
             if (l == 2) {
                 /* $NNNN -> print memory */
                 if (tokn[1][0] == '$')
-                    debug_printmem (strtoword (tokn[1]));
+                    debug_printmem (gb, strtoword (tokn[1]));
                 /* print register */
                 else if (isalpha (tokn[1][0]) && (strlen (tokn[1]) == 1 || strlen (tokn[1]) == 2))
-                    debug_printreg (tokn[1]);
+                    debug_printreg (gb, tokn[1]);
                 else
                     error ("invalid argument to print: `%s'", tokn[1]);
             }
@@ -135,23 +139,43 @@ void debug_prompt(void) {
         else if (!strcasecmp (tokn[0], "dump")) {
             /* dump registers */
             if (l == 1)
-                debug_dumpregs();
+                debug_dumpregs (gb);
             /* dump memory range */
             else if (l == 3)
-                debug_dumpmem (strtoword (tokn[1]), strtoword (tokn[2]));
+                debug_dumpmem (gb, strtoword (tokn[1]), strtoword (tokn[2]));
             else
                 error ("dump takes 0 or 2 arguments");
         }
+        /* io: print IO registers */
+        else if (!strcasecmp (tokn[0], "io")) {
+            if (l == 1)
+                debug_dumpio (gb);
+            else
+                error ("io takes 0 arguments");
+        }
+        /* save/load: save/load the state to/from a file */
+        else if (!strcasecmp (tokn[0], "save")) {
+            if (l == 2)
+                debug_savestate (gb, tokn[1]);
+            else
+                error ("save takes 1 argument");
+        }
+        else if (!strcasecmp (tokn[0], "load")) {
+            if (l == 2)
+                debug_loadstate (gb, tokn[1]);
+            else
+                error ("load takes 1 argument");
+        }
         /* break: set a new breakpoint */
         else if (!strcasecmp (tokn[0], "break")) {
             if (l == 2) {
-                G_state.debug.enabled = true;
+                gb->state.debug.enabled = true;
                 printf ("set breakpoint at %.4hX\n",
-                    G_state.debug.breakpoint = strtoword (tokn[1]));
+                    gb->state.debug.breakpoint = strtoword (tokn[1]));
             }
             else if (l == 1) {
                 printf ("enabled breakpoints\n");
-                G_state.debug.enabled = true;
+                gb->state.debug.enabled = true;
             }
             else
                 error ("break takes 0 or 1 arguments");
@@ -159,17 +183,17 @@ void debug_prompt(void) {
         /* nobreak: clear breakpoint */
         else if (!strcasecmp (tokn[0], "nobreak")) {
             printf ("disabled breakpoints\n");
-            G_state.debug.enabled = false;
+            gb->state.debug.enabled = false;
         }
         /* step: step one instruction forward */
         else if (!strcasecmp (tokn[0], "step"))
-            G_state.state = (EMUSTATE_NORMAL | EMUSTATE_DEBUG);
+            gb->state.state = (EMUSTATE_NORMAL | EMUSTATE_DEBUG);
         /* run: continue running the program */
         else if (!strcasecmp (tokn[0], "run"))
-            G_state.state = (G_state.state | EMUSTATE_NORMAL) & ~EMUSTATE_DEBUG;
+            gb->state.state = (gb->state.state | EMUSTATE_NORMAL) & ~EMUSTATE_DEBUG;
         /* quit: exit program */
         else if (!strcasecmp (tokn[0], "quit"))
-            G_state.running = false;
+            gb->state.running = false;
         else {
             /* TODO: calculator, etc. */
             error ("unknown command");
@@ -180,11 +204,11 @@ void debug_prompt(void) {
     }
 
 
-    if (previouscommand)
-        free (previouscommand);
+    if (gb->previous_command)
+        free (gb->previous_command);
 
     if (command) {
-        previouscommand = strdup (command);
+        gb->previous_command = strdup (command);
         free (command);
     }
 }
@@ -192,7 +216,7 @@ void debug_prompt(void) {
 
 /* INTERNAL FNs */
 /* debug_printreg: print register value */
-void debug_printreg (char *name) {
+void debug_printreg (gb_t *gb, char *name) {
 
     uint16_t value = -1;
 
@@ -205,46 +229,46 @@ void debug_printreg (char *name) {
     if (strlen (name) == 2) {
         wordreg = true;
         if      (!strcasecmp (name, "AF")) {
-            value = *AF;
+            value = *gb->cpu.AF;
             comboreg = true;
         }
         else if (!strcasecmp (name, "BC")) {
-            value = *BC;
+            value = *gb->cpu.BC;
             comboreg = true;
         }
         else if (!strcasecmp (name, "DE")) {
-            value = *DE;
+            value = *gb->cpu.DE;
             comboreg = true;
         }
         else if (!strcasecmp (name, "HL")) {
-            value = *HL;
+            value = *gb->cpu.HL;
             comboreg = true;
         }
         else if (!strcasecmp (name, "PC"))
-            value = pc;
+            value = gb->cpu.pc;
         else if (!strcasecmp (name, "SP"))
-            value = sp;
+            value = gb->cpu.sp;
 
         else
             fail = true;
     }
     else if (strlen (name) == 1) {
         if      (!strcasecmp (name, "A"))
-            value = *A;
+            value = *gb->cpu.A;
         else if (!strcasecmp (name, "F"))
-            value = *F;
+            value = *gb->cpu.F;
         else if (!strcasecmp (name, "B"))
-            value = *B;
+            value = *gb->cpu.B;
         else if (!strcasecmp (name, "C"))
-            value = *C;
+            value = *gb->cpu.C;
         else if (!strcasecmp (name, "D"))
-            value = *D;
+            value = *gb->cpu.D;
         else if (!strcasecmp (name, "E"))
-            value = *E;
+            value = *gb->cpu.E;
         else if (!strcasecmp (name, "H"))
-            value = *H;
+            value = *gb->cpu.H;
         else if (!strcasecmp (name, "L"))
-            value = *L;
+            value = *gb->cpu.L;
         else
             fail = true;
     }
@@ -267,26 +291,94 @@ void debug_printreg (char *name) {
 }
 
 /* debug_printmem: print a memory location */
-void debug_printmem (uint16_t loc) {
-    printf ("%.4hX  $%.2hhX\n", loc, memgval (loc));
+void debug_printmem (gb_t *gb, uint16_t loc) {
+    printf ("%.4hX  $%.2hhX\n", loc, memgval (gb, loc));
 }
 
 /* debug_dumpregs: dump registers */
-void debug_dumpregs(void) {
+void debug_dumpregs (gb_t *gb) {
 
-    debug_printreg ("AF");
-    debug_printreg ("BC");
-    debug_printreg ("DE");
-    debug_printreg ("HL");
+    debug_printreg (gb, "AF");
+    debug_printreg (gb, "BC");
+    debug_printreg (gb, "DE");
+    debug_printreg (gb, "HL");
 
-    debug_printreg ("PC");
-    debug_printreg ("SP");
+    debug_printreg (gb, "PC");
+    debug_printreg (gb, "SP");
 }
 
 /* debug_dumpmem: dump memory region */
-void debug_dumpmem (uint16_t start, uint16_t end) {
+void debug_dumpmem (gb_t *gb, uint16_t start, uint16_t end) {
     for (int i = start; i <= end && i < 0x10000; ++i)
-        debug_printmem (i);
+        debug_printmem (gb, i);
+}
+
+/* debug_dumpio: dump the named IO registers, marking ones with side-effects */
+void debug_dumpio (gb_t *gb) {
+    for (unsigned i = 0; i < 0x100; ++i) {
+        const struct io_register *reg = register_info (i);
+
+        if (!strcmp (reg->name, "IO") || !strcmp (reg->name, "HRAM"))
+            continue;
+
+        printf ("%.4hX  %-8s $%.2hhX%s\n", 0xFF00 + i, reg->name, memgval (gb, 0xFF00 + i),
+                reg->side_effects? "  *" : "");
+    }
+}
+
+/* micros: microseconds on the monotonic clock */
+static double micros(void) {
+    struct timespec spec;
+    clock_gettime (CLOCK_MONOTONIC, &spec);
+    return (spec.tv_sec * 1000000.0) + (spec.tv_nsec / 1000.0);
+}
+
+/* debug_savestate: save the state to a file, printing how long it took */
+void debug_savestate (gb_t *gb, const char *fname) {
+
+    size_t size = state_size (gb);
+    BYTE *buf = malloc (size);
+    if (!buf)
+        return;
+
+    double start = micros();
+    size = state_save (gb, buf, size);
+    double took = micros() - start;
+
+    FILE *file = fopen (fname, "wb");
+    if (file && fwrite (buf, 1, size, file) == size)
+        printf ("saved %zu bytes to %s (in %.1f us)\n", size, fname, took);
+    else
+        printf ("failed to save to %s: %s\n", fname, strerror (errno));
+    if (file)
+        fclose (file);
+    free (buf);
+}
+
+/* debug_loadstate: load the state from a file, printing how long it took */
+void debug_loadstate (gb_t *gb, const char *fname) {
+
+    FILE *file = fopen (fname, "rb");
+    if (!file) {
+        printf ("failed to open %s: %s\n", fname, strerror (errno));
+        return;
+    }
+
+    /* a state is never bigger than this instance's biggest */
+    size_t size = state_size (gb);
+    BYTE *buf = malloc (size);
+    size = buf? fread (buf, 1, size, file) : 0;
+    fclose (file);
+
+    double start = micros();
+    bool loaded = buf && state_load (gb, buf, size);
+    double took = micros() - start;
+
+    if (loaded)
+        printf ("loaded %s (in %.1f us)\n", fname, took);
+    else
+        printf ("%s isn't a save state of this ROM\n", fname);
+    free (buf);
 }
 
 /* strtoword: convert str to a 16-bit unsigned */
@@ -342,9 +434,12 @@ long i_strtol (const char *str) {
 
 
 /* AUTOCOMPLETE STUFF */
-char *command_names[]
+static const char *const command_names[]
  = {    "print",
         "dump",
+        "io",
+        "save",
+        "load",
         "break",
         "nobreak",
         "step",
@@ -369,7 +464,7 @@ char **debug_command_complete (const char *text, int start, int end) {
 char *debug_command_generator (const char *text, int state) {
 
     static int list_index, len;
-    char *command;
+    const char *command;
 
     if (!state) {
         list_index = 0;
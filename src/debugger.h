@@ -7,9 +7,12 @@
 #define __DEBUGGER_H
 
 
-void debug_init(void);
-void debug_cleanup(void);
-void debug_prompt(void);
+#include "common.h"
+
+
+void debug_init (gb_t *gb);
+void debug_cleanup (gb_t *gb);
+void debug_prompt (gb_t *gb);
 
 
 #endif
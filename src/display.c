@@ -2,12 +2,11 @@
  * Display for Gameboy
  *
  */
-/* TODO: maybe pull the colour palette out of low.c? */
 /* FIXME: at startup, there are 3 frames drawn with no scanlines, then 1 frame drawn at scanline 138, then 1 frame drawn at scanline 154 */
 /* FIXME: issues with opus5 */
 
 #include "display.h"
-#include "low.h"
+#include "gb.h"
 #include "mem.h"
 #include "cpu.h"
 #include "logging.h"
@@ -21,43 +20,47 @@
 #define TILESIZE    16
 #define SPRITESIZE  16
 
-static AlarmID scanline_alarm;
-static WORD sprites_to_draw[10];
+/* the display state of the instance being run (every function here has a gb) */
+#define scanline_alarm      (gb->display.scanline_alarm)
+#define sprites_to_draw     (gb->display.sprites_to_draw)
+#define framebuffer         (gb->display.framebuffer)
 
 
-static void searchOAM(void);
-static void write_scanline(void);
-static void hblank_start(void);
+static void searchOAM (gb_t *gb);
+static void write_scanline (gb_t *gb);
+static void hblank_start (gb_t *gb);
 
-static void drawtile   (WORD tiledata_startaddr, int xpos, int ypos, int line);
-static void drawsprite (WORD OAMaddr, int line, bool doublehigh);
+static void drawtile   (gb_t *gb, WORD tiledata_startaddr, int xpos, int ypos, int line);
+static void drawsprite (gb_t *gb, WORD OAMaddr, int line, bool doublehigh);
+static inline void drawpixel (gb_t *gb, unsigned x, unsigned y, BYTE shade);
 
 
 
 /* display_init:  */
-void display_init(void) {
-
-    low_initdisplay();
-
-    scanline_alarm = mkalarm_cycle (-1, NULL);
+void display_init (gb_t *gb) {
+    scanline_alarm = mkalarm_cycle (gb, -1, NULL);
 }
 
 /* display_drawline: draw one scanline */
-void display_scanline(void) {
+void display_scanline (gb_t *gb) {
 
-    BYTE scanline = memgval (R_CURLINE);
+    /* the frontend has had the last frame, start a new one */
+    if (gb->display.stale)
+        display_clear (gb);
 
-    BYTE LCDSTAT  = memgval (R_LCDSTAT);
-    BYTE LCDC = memgval (R_LCDCONT);
+    BYTE scanline = memgval (gb, R_CURLINE);
+
+    BYTE LCDSTAT  = memgval (gb, R_LCDSTAT);
+    BYTE LCDC = memgval (gb, R_LCDCONT);
 
     /* check for scanline coincidence */
-    if (memgval (R_CMPLINE) == scanline) {
+    if (memgval (gb, R_CMPLINE) == scanline) {
 
         SETBIT(LCDSTAT, 2);
-        memsval (R_LCDSTAT, LCDSTAT);
+        mem_set_register (gb, R_LCDSTAT, LCDSTAT);
 
         if (GETBIT(LCDSTAT, 6)) {
-            cpu_interrupt (INT_LCDC);
+            cpu_interrupt (gb, INT_LCDC);
             debug ("SCANLINE COINC INTERRUPT (%u)", scanline);
         }
     }
@@ -65,36 +68,36 @@ void display_scanline(void) {
     /* LCDC bit 7 = LCD enable */
     if (GETBIT(LCDC, 7)) {
         if (scanline <= 144) {
-            searchOAM();
+            searchOAM (gb);
         }
         else {
             debug ("scanline %u", scanline);
-            memsval (R_CURLINE, scanline + 1);
+            mem_set_register (gb, R_CURLINE, scanline + 1);
         }
     }
 }
 
 /* searchOAM: search for sprites that are on the current scanline */
-static void searchOAM(void) {
+static void searchOAM (gb_t *gb) {
 
     /* searching the OAM takes 80 cycles... */
-    set_alarm_cycles (scanline_alarm, 80);
-    set_alarm_func (scanline_alarm, write_scanline);
+    set_alarm_cycles (gb, scanline_alarm, 80);
+    set_alarm_func (gb, scanline_alarm, write_scanline);
 
 
-    BYTE scroll_y = memgval (R_SCROLLY);
-    BYTE scanline = memgval (R_CURLINE);
+    BYTE scroll_y = memgval (gb, R_SCROLLY);
+    BYTE scanline = memgval (gb, R_CURLINE);
 
-    BYTE LCDC     = memgval (R_LCDCONT);
-    BYTE LCDSTAT  = memgval (R_LCDSTAT);
+    BYTE LCDC     = memgval (gb, R_LCDCONT);
+    BYTE LCDSTAT  = memgval (gb, R_LCDSTAT);
 
     /* LCDSTAT mode 10 = searching OAM */
     if (GETBIT(LCDSTAT, 5)) {
-        cpu_interrupt (INT_LCDC);
+        cpu_interrupt (gb, INT_LCDC);
         debug ("LCDSTAT MODE 10 (oam search) INTERRUPT");
     }
     LCDSTAT = (LCDSTAT & ~3) | 2;
-    memsval (R_LCDSTAT, LCDSTAT);
+    mem_set_register (gb, R_LCDSTAT, LCDSTAT);
 
 
     bool doublehigh = GETBIT(LCDC, 2);
@@ -105,7 +108,7 @@ static void searchOAM(void) {
     /*  NOTE: there can only be 10 sprites per scanline */
     unsigned sprites_this_line = 0;
     for (unsigned i = 0; i < 40 && sprites_this_line < 10; ++i) {
-        BYTE spr_y = memgval (0xFE00 + (i * 4));
+        BYTE spr_y = memgval (gb, 0xFE00 + (i * 4));
 
         if (between (scanline+scroll_y, spr_y, spr_y+spr_height))
             sprites_to_draw[sprites_this_line++] = 0xFE00 + (i * 4);
@@ -113,23 +116,23 @@ static void searchOAM(void) {
 }
 
 /* write_scanline: write the scanline to the screen */
-static void write_scanline(void) {
+static void write_scanline (gb_t *gb) {
 
     /* ...and drawing the scanline takes 172 cycles */
-    set_alarm_cycles (scanline_alarm, 172);
-    set_alarm_func  (scanline_alarm, hblank_start);
+    set_alarm_cycles (gb, scanline_alarm, 172);
+    set_alarm_func  (gb, scanline_alarm, hblank_start);
 
 
-    BYTE scroll_y = memgval (R_SCROLLY);
-    BYTE scanline = memgval (R_CURLINE);
+    BYTE scroll_y = memgval (gb, R_SCROLLY);
+    BYTE scanline = memgval (gb, R_CURLINE);
 
-    BYTE LCDSTAT  = memgval (R_LCDSTAT);
-    BYTE LCDC     = memgval (R_LCDCONT);
+    BYTE LCDSTAT  = memgval (gb, R_LCDSTAT);
+    BYTE LCDC     = memgval (gb, R_LCDCONT);
 
 
     /* LCDSTAT mode 11 = writing to screen */
     LCDSTAT = (LCDSTAT & ~3) | 3;
-    memsval (R_LCDSTAT, LCDSTAT);
+    mem_set_register (gb, R_LCDSTAT, LCDSTAT);
 
 
     /* LCDC bit 3 = which Background Tile Table to use */
@@ -146,7 +149,7 @@ static void write_scanline(void) {
         for (int tile = 0; tile < 32; ++tile) {
 
             /* each row in the BTT is 32 bytes */
-            BYTE tilenumber = memgval (BTT_addr + (BTT_row * 32) + tile);
+            BYTE tilenumber = memgval (gb, BTT_addr + (BTT_row * 32) + tile);
 
             WORD tiledata_addr;
 
@@ -159,7 +162,7 @@ static void write_scanline(void) {
                 tiledata_addr = TPT_addr + ((SIGNED_BYTE)tilenumber * TILESIZE);
             }
 
-            drawtile (tiledata_addr,
+            drawtile (gb, tiledata_addr,
                       tile * 8, scanline + scroll_y,
                       (scanline + scroll_y) % 8);
         }
@@ -178,11 +181,11 @@ static void write_scanline(void) {
         for (int tile = 0; tile < 32; ++tile) {
 
             /* each row in the WTT is 32 bytes */
-            BYTE tilenumber = memgval (WTT_addr + (WTT_row * 32) + tile);
+            BYTE tilenumber = memgval (gb, WTT_addr + (WTT_row * 32) + tile);
 
             WORD tiledata_addr = TPT_addr + (tilenumber * TILESIZE);
 
-            drawtile (tiledata_addr,
+            drawtile (gb, tiledata_addr,
                       tile * 8, scanline,
                       scanline % 8);
         }
@@ -198,52 +201,83 @@ static void write_scanline(void) {
 
         for (unsigned i = 0; i < 10; ++i)
             if (sprites_to_draw[i] != 0x0000)
-                drawsprite (sprites_to_draw[i],
+                drawsprite (gb, sprites_to_draw[i],
                             (scanline + scroll_y) % spr_height,
                             doublehigh);
     }
 }
 
 /* hblank_start:  */
-static void hblank_start(void) {
+static void hblank_start (gb_t *gb) {
 
-    set_alarm_func (scanline_alarm, NULL);
+    set_alarm_func (gb, scanline_alarm, NULL);
 
-    BYTE scanline = memgval (R_CURLINE);
-    BYTE LCDSTAT  = memgval (R_LCDSTAT);
+    BYTE scanline = memgval (gb, R_CURLINE);
+    BYTE LCDSTAT  = memgval (gb, R_LCDSTAT);
 
     /* LCDSTAT mode 00 = hblank */
     if (GETBIT(LCDSTAT, 3)) {
-        cpu_interrupt (INT_LCDC);
+        cpu_interrupt (gb, INT_LCDC);
         debug ("LCDSTAT MODE 00 (hblank) INTERRUPT");
     }
     LCDSTAT = LCDSTAT & ~3;
-    memsval (R_LCDSTAT, LCDSTAT);
+    mem_set_register (gb, R_LCDSTAT, LCDSTAT);
 
     debug ("scanline %u drawn", scanline);
-    memsval (R_CURLINE, scanline + 1);
+    mem_set_register (gb, R_CURLINE, scanline + 1);
 }
 
 
 /* display_update: update the screen */
-void display_update(void) {
+void display_update (gb_t *gb) {
 
-    BYTE LCDSTAT = memgval (R_LCDSTAT);
+    BYTE LCDSTAT = memgval (gb, R_LCDSTAT);
 
     /* LCDSTAT mode 01 = vblank */
     if (GETBIT(LCDSTAT, 4)) {
-        cpu_interrupt (INT_LCDC);
+        cpu_interrupt (gb, INT_LCDC);
         debug ("LCDSTAT MODE 01 (vblank) INTERRUPT");
     }
     LCDSTAT = (LCDSTAT & ~3) | 1;
-    memsval (R_LCDSTAT, LCDSTAT);
-    memsval (R_CURLINE, 0);
+    mem_set_register (gb, R_LCDSTAT, LCDSTAT);
+    mem_set_register (gb, R_CURLINE, 0);
 
-    cpu_interrupt (INT_VBLANK);
+    cpu_interrupt (gb, INT_VBLANK);
 
     debug ("frame drawn");
 
-    low_update();
+    /* the framebuffer is left alone until the next scanline, so
+     * whoever is running the frame gets to see it */
+    gb->display.stale = true;
+}
+
+/* display_clear: clear the framebuffer */
+void display_clear (gb_t *gb) {
+    memset (framebuffer, 0, sizeof(framebuffer));
+    gb->display.stale = false;
+}
+
+/* the steps of a visible scanline, in the order the scanline alarm runs them */
+static void (*const scanline_steps[DISPLAY_STEPS])(gb_t *) = { NULL, write_scanline, hblank_start };
+
+/* display_get_step: which step the scanline alarm runs next (for save states) */
+unsigned display_get_step (gb_t *gb) {
+
+    void (*fn)(gb_t *) = get_alarm_func (gb, scanline_alarm);
+    for (unsigned i = 0; i < LEN(scanline_steps); ++i)
+        if (scanline_steps[i] == fn)
+            return i;
+    return 0;
+}
+
+/* display_set_step: set the next step of the scanline alarm, returning false if it isn't valid */
+bool display_set_step (gb_t *gb, unsigned step) {
+
+    if (step >= LEN(scanline_steps))
+        return false;
+
+    set_alarm_func (gb, scanline_alarm, scanline_steps[step]);
+    return true;
 }
 
 /* dis_logging:  */
@@ -253,13 +287,13 @@ void dis_logging (bool enable) {
 
 /* INTERNAL FUNCTIONS */
 /* drawsprite:  */
-static void drawsprite (WORD spriteOAMaddr, int line, bool doublehigh) {
+static void drawsprite (gb_t *gb, WORD spriteOAMaddr, int line, bool doublehigh) {
 #define PALETTE_GETCOLOUR(pal, index)   (((pal) >> (2 * (index))) & 3)
 
-    BYTE yoff  = memgval (spriteOAMaddr + 0),
-         xoff  = memgval (spriteOAMaddr + 1),
-         index = memgval (spriteOAMaddr + 2),
-         flags = memgval (spriteOAMaddr + 3);
+    BYTE yoff  = memgval (gb, spriteOAMaddr + 0),
+         xoff  = memgval (gb, spriteOAMaddr + 1),
+         index = memgval (gb, spriteOAMaddr + 2),
+         flags = memgval (gb, spriteOAMaddr + 3);
 
     bool above_window    = GETBIT(flags, 7),    /* TODO: figure out how to handle this */
          y_flip          = GETBIT(flags, 6),
@@ -270,18 +304,18 @@ static void drawsprite (WORD spriteOAMaddr, int line, bool doublehigh) {
     if (doublehigh)
         index &= ~1;
 
-    BYTE palette = using_palette_1? memgval (R_OBJ1PAL) : memgval (R_OBJ0PAL);
+    BYTE palette = using_palette_1? memgval (gb, R_OBJ1PAL) : memgval (gb, R_OBJ0PAL);
     WORD sprdata_addr = 0x8000 + (index * SPRITESIZE);
 
     BYTE byte1,
          byte2;
     if (y_flip) {
-        byte1 = memgval (sprdata_addr + ((7 - line) * 2) + 0),
-        byte2 = memgval (sprdata_addr + ((7 - line) * 2) + 1);
+        byte1 = memgval (gb, sprdata_addr + ((7 - line) * 2) + 0),
+        byte2 = memgval (gb, sprdata_addr + ((7 - line) * 2) + 1);
     }
     else {
-        byte1 = memgval (sprdata_addr + (line * 2) + 0),
-        byte2 = memgval (sprdata_addr + (line * 2) + 1);
+        byte1 = memgval (gb, sprdata_addr + (line * 2) + 0),
+        byte2 = memgval (gb, sprdata_addr + (line * 2) + 1);
     }
 
 
@@ -296,22 +330,23 @@ static void drawsprite (WORD spriteOAMaddr, int line, bool doublehigh) {
         if (pixel == 0)
             continue;
 
-        low_drawpixel ((xoff -  8) + x,
-                       (yoff - 16) + line,
-                       pixel);
+        drawpixel (gb,
+                   (xoff -  8) + x,
+                   (yoff - 16) + line,
+                   pixel);
     }
 }
 
 /* drawtile: draw a line of a tile */
-static void drawtile (WORD tiledata_startaddr, int xpos, int ypos, int line) {
+static void drawtile (gb_t *gb, WORD tiledata_startaddr, int xpos, int ypos, int line) {
 
-    BYTE palette = memgval (R_BGRDPAL);
+    BYTE palette = memgval (gb, R_BGRDPAL);
 
-    int xoff = xpos - memgval (R_SCROLLX),
-        yoff = ypos - memgval (R_SCROLLY);
+    int xoff = xpos - memgval (gb, R_SCROLLX),
+        yoff = ypos - memgval (gb, R_SCROLLY);
 
-    BYTE byte1 = memgval (tiledata_startaddr + (line*2) + 0),
-         byte2 = memgval (tiledata_startaddr + (line*2) + 1);
+    BYTE byte1 = memgval (gb, tiledata_startaddr + (line*2) + 0),
+         byte2 = memgval (gb, tiledata_startaddr + (line*2) + 1);
 
     for (int x = 0; x < 8; ++x) {
 
@@ -319,10 +354,16 @@ static void drawtile (WORD tiledata_startaddr, int xpos, int ypos, int line) {
 
         BYTE pixel = PALETTE_GETCOLOUR(palette, palette_index);
 
-        low_drawpixel ((xoff + x) % 256,
-                        yoff      % 256,
-                       pixel);
+        drawpixel (gb,
+                   (xoff + x) % 256,
+                    yoff      % 256,
+                   pixel);
     }
 #undef PALETTE_GETCOLOUR
 }
 
+/* drawpixel: draw a pixel into the framebuffer */
+static inline void drawpixel (gb_t *gb, unsigned x, unsigned y, BYTE shade) {
+    framebuffer[((y % FB_HEIGHT) * FB_WIDTH) + (x % FB_WIDTH)] = shade;
+}
+
@@ -7,19 +7,52 @@
 #define __DISPLAY_H
 
 
+#include "common.h"
+#include "alarm.h"
+
 #include <stdbool.h>
 
 
 
-void display_init(void);
+/* the screen */
+#define SCR_W       160
+#define SCR_H       144
+
+/* the LCD draws into a 256x256 framebuffer (wrapping around at the edges),
+ * one shade (0 = lightest, 3 = darkest) per byte -- the screen is the top
+ * left SCR_W x SCR_H of it */
+#define FB_WIDTH    256
+#define FB_HEIGHT   256
+
+/* display:
+ *  the display state of an emulator instance
+ */
+struct display {
+    AlarmID  scanline_alarm;
+    WORD     sprites_to_draw[10];
+
+    unsigned long frame_cycles;     /* cycles into the current frame */
+    bool     stale;                 /* the framebuffer still has the last frame */
+
+    BYTE     framebuffer[FB_WIDTH * FB_HEIGHT];
+};
+
+
+
+void display_init (gb_t *gb);
 
-void display_scanline(void);
+void display_scanline (gb_t *gb);
 
-void display_update(void);
-void display_clear(void);
+void display_update (gb_t *gb);
+void display_clear (gb_t *gb);
+
+/* the steps of a scanline (see display_get_step) */
+#define DISPLAY_STEPS   3
+
+unsigned display_get_step (gb_t *gb);
+bool display_set_step (gb_t *gb, unsigned step);
 
 void dis_logging (bool enable);
 
 
 #endif
-
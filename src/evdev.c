@@ -0,0 +1,238 @@
+/*
+ * gamepads, through the kernel's evdev interface
+ *
+ */
+
+#include "evdev.h"
+
+#include <stdio.h>      /* snprintf */
+#include <string.h>     /* memcpy, memset, strncmp */
+#include <strings.h>    /* strcasecmp */
+#include <errno.h>
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* read, close */
+#include <dirent.h>     /* opendir, readdir */
+#include <sys/ioctl.h>
+
+/* (this isn't in a file which sees io.h, as the names clash -- BTN_A, BTN_LEFT, ...) */
+#include <linux/input.h>
+
+
+
+/* the d-pad bits (the same as io.h's) */
+enum { PAD_RIGHT, PAD_LEFT, PAD_UP, PAD_DOWN };
+
+#define DPAD_BITS   0x0F
+
+/* the buttons which can be bound by name (others can be by number) */
+static const struct { const char *name; unsigned code; } code_names[] = {
+    { "BTN_SOUTH"     , BTN_SOUTH      }, { "BTN_EAST"      , BTN_EAST       },
+    { "BTN_NORTH"     , BTN_NORTH      }, { "BTN_WEST"      , BTN_WEST       },
+    { "BTN_TL"        , BTN_TL         }, { "BTN_TR"        , BTN_TR         },
+    { "BTN_TL2"       , BTN_TL2        }, { "BTN_TR2"       , BTN_TR2        },
+    { "BTN_SELECT"    , BTN_SELECT     }, { "BTN_START"     , BTN_START      },
+    { "BTN_MODE"      , BTN_MODE       }, { "BTN_THUMBL"    , BTN_THUMBL     },
+    { "BTN_THUMBR"    , BTN_THUMBR     },
+    { "BTN_DPAD_UP"   , BTN_DPAD_UP    }, { "BTN_DPAD_DOWN" , BTN_DPAD_DOWN  },
+    { "BTN_DPAD_LEFT" , BTN_DPAD_LEFT  }, { "BTN_DPAD_RIGHT", BTN_DPAD_RIGHT },
+};
+
+/* in the order of the gameboy's buttons: right, left, up, down, a, b, select, start
+ * (a and b are the right and bottom face buttons, where they are on a gameboy) */
+static const unsigned default_codes[EVDEV_BUTTONS] = {
+    BTN_DPAD_RIGHT, BTN_DPAD_LEFT, BTN_DPAD_UP, BTN_DPAD_DOWN,
+    BTN_EAST, BTN_SOUTH, BTN_SELECT, BTN_START,
+};
+
+
+/* an axis which works as two directions of the d-pad */
+struct axis {
+    int  low,           /* at or past these is held */
+         high;
+    BYTE minus,         /* the d-pad bits for each way */
+         plus;
+};
+
+struct evdev {
+    int  fd;
+    char name[64];
+
+    /* button code -> the gameboy's button (-1 if it isn't bound), made once */
+    SIGNED_BYTE codemap[KEY_CNT];
+
+    struct axis axes[ABS_CNT];  /* (minus = plus = 0 for axes which aren't used) */
+
+    BYTE buttons,       /* from buttons */
+         axis_bits[ABS_CNT];
+};
+
+
+
+/* has_bit: whether bit n is set in an evdev bitmask */
+static bool has_bit (const unsigned long *bits, unsigned n) {
+    return (bits[n / (8 * sizeof(long))] >> (n % (8 * sizeof(long)))) & 1;
+}
+
+/* is_gamepad: whether a device has a gamepad's (or a joystick's) buttons */
+static bool is_gamepad (int fd) {
+    unsigned long keys[(KEY_CNT + (8 * sizeof(long)) - 1) / (8 * sizeof(long))] = { 0 };
+    if (ioctl (fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0)
+        return false;
+    return has_bit (keys, BTN_GAMEPAD) || has_bit (keys, BTN_JOYSTICK);
+}
+
+/* setup_axis: have an axis (if the pad has it) work as two directions of the d-pad */
+static void setup_axis (struct evdev *pad, unsigned code, BYTE minus, BYTE plus) {
+
+    struct input_absinfo info;
+    if (ioctl (pad->fd, EVIOCGABS(code), &info) < 0 || info.maximum <= info.minimum)
+        return;
+
+    /* a stick has to be pushed halfway; a hat is -1, 0 or 1 */
+    int centre = info.minimum + ((info.maximum - info.minimum) / 2),
+        slack  = (info.maximum - info.minimum) / 4;
+
+    pad->axes[code] = (struct axis){ .low=centre - slack, .high=centre + slack,
+                                     .minus=minus, .plus=plus };
+    if (slack == 0) {
+        pad->axes[code].low  = info.minimum;
+        pad->axes[code].high = info.maximum;
+    }
+}
+
+
+
+/* PUBLIC API */
+/* evdev_code: look up a button by name (eg. BTN_EAST) or number, returning false if there isn't one */
+bool evdev_code (const char *name, unsigned *code) {
+
+    for (unsigned i = 0; i < sizeof(code_names) / sizeof(*code_names); ++i)
+        if (strcasecmp (name, code_names[i].name) == 0) {
+            *code = code_names[i].code;
+            return true;
+        }
+
+    char *end;
+    unsigned long n = strtoul (name, &end, 0);
+    if (*name == '\0' || *end != '\0' || n == 0 || n >= KEY_CNT)
+        return false;
+
+    *code = n;
+    return true;
+}
+
+/* evdev_default_codes: the buttons the gameboy's buttons are on, by default */
+void evdev_default_codes (unsigned codes[EVDEV_BUTTONS]) {
+    memcpy (codes, default_codes, sizeof(default_codes));
+}
+
+/* evdev_open: open a gamepad (eg. /dev/input/event3), returning NULL (+ errno) on failure */
+struct evdev *evdev_open (const char *device, const unsigned codes[EVDEV_BUTTONS]) {
+
+    struct evdev *pad = calloc (1, sizeof(*pad));
+    if (!pad)
+        return NULL;
+
+    pad->fd = open (device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (pad->fd < 0) {
+        free (pad);
+        return NULL;
+    }
+
+    if (ioctl (pad->fd, EVIOCGNAME(sizeof(pad->name) - 1), pad->name) < 0)
+        snprintf (pad->name, sizeof(pad->name), "%s", device);
+
+    memset (pad->codemap, -1, sizeof(pad->codemap));
+    for (unsigned i = 0; i < EVDEV_BUTTONS; ++i)
+        if (codes[i] > 0 && codes[i] < KEY_CNT)
+            pad->codemap[codes[i]] = i;
+
+    setup_axis (pad, ABS_HAT0X, 1 << PAD_LEFT, 1 << PAD_RIGHT);
+    setup_axis (pad, ABS_HAT0Y, 1 << PAD_UP  , 1 << PAD_DOWN );
+    setup_axis (pad, ABS_X    , 1 << PAD_LEFT, 1 << PAD_RIGHT);
+    setup_axis (pad, ABS_Y    , 1 << PAD_UP  , 1 << PAD_DOWN );
+
+    return pad;
+}
+
+/* evdev_open_all: open every gamepad under /dev/input (up to max), returning how many there are */
+unsigned evdev_open_all (const unsigned codes[EVDEV_BUTTONS], struct evdev **pads, unsigned max) {
+
+    DIR *dir = opendir ("/dev/input");
+    if (!dir)
+        return 0;
+
+    unsigned count = 0;
+    struct dirent *entry;
+    while (count < max && (entry = readdir (dir))) {
+        if (strncmp (entry->d_name, "event", 5) != 0)
+            continue;
+
+        char device[280];
+        snprintf (device, sizeof(device), "/dev/input/%s", entry->d_name);
+
+        /* (devices which can't be opened are someone else's) */
+        struct evdev *pad = evdev_open (device, codes);
+        if (!pad)
+            continue;
+        if (!is_gamepad (pad->fd)) {
+            evdev_close (pad);
+            continue;
+        }
+        pads[count++] = pad;
+    }
+
+    closedir (dir);
+    return count;
+}
+
+/* evdev_close:  */
+void evdev_close (struct evdev *pad) {
+
+    if (!pad)
+        return;
+
+    close (pad->fd);
+    free (pad);
+}
+
+/* evdev_name: the gamepad's name */
+const char *evdev_name (struct evdev *pad) {
+    return pad->name;
+}
+
+/* evdev_read: catch up on the gamepad's events, returning false if it's gone (unplugged) */
+bool evdev_read (struct evdev *pad, BYTE *buttons) {
+
+    struct input_event events[64];
+    ssize_t size;
+
+    while ((size = read (pad->fd, events, sizeof(events))) > 0)
+        for (size_t i = 0; i < size / sizeof(*events); ++i) {
+            const struct input_event *e = &events[i];
+
+            if (e->type == EV_KEY && e->code < KEY_CNT && pad->codemap[e->code] >= 0) {
+                /* (1 is down, 2 is a repeat) */
+                if (e->value)
+                    SETBIT(pad->buttons, pad->codemap[e->code]);
+                else
+                    RESBIT(pad->buttons, pad->codemap[e->code]);
+            }
+            else if (e->type == EV_ABS && e->code < ABS_CNT) {
+                const struct axis *axis = &pad->axes[e->code];
+                pad->axis_bits[e->code] = e->value <= axis->low ? axis->minus :
+                                          e->value >= axis->high? axis->plus  : 0;
+            }
+        }
+
+    bool gone = size < 0 && errno != EAGAIN && errno != EINTR;
+    if (gone)
+        memset (pad->axis_bits, 0, sizeof(pad->axis_bits));
+
+    BYTE dpad = 0;
+    for (unsigned i = 0; i < ABS_CNT; ++i)
+        dpad |= pad->axis_bits[i];
+
+    *buttons = gone? 0 : pad->buttons | (dpad & DPAD_BITS);
+    return !gone;
+}
@@ -0,0 +1,36 @@
+/*
+ * gamepads, through the kernel's evdev interface
+ *
+ */
+
+#ifndef __EVDEV_H
+#define __EVDEV_H
+
+
+#include "common.h"
+
+#include <stdbool.h>
+
+
+
+/* a gamepad's buttons are read as the gameboy's: bit n = button n (as in io.h) --
+ * codes[n] is the evdev button (BTN_*) for button n, and the d-pad, hat and left
+ * stick always work as the gameboy's d-pad */
+#define EVDEV_BUTTONS   8
+
+/* an open gamepad (see evdev.c) */
+struct evdev;
+
+
+bool evdev_code (const char *name, unsigned *code);
+void evdev_default_codes (unsigned codes[EVDEV_BUTTONS]);
+
+struct evdev *evdev_open (const char *device, const unsigned codes[EVDEV_BUTTONS]);
+unsigned evdev_open_all (const unsigned codes[EVDEV_BUTTONS], struct evdev **pads, unsigned max);
+void evdev_close (struct evdev *pad);
+
+const char *evdev_name (struct evdev *pad);
+bool evdev_read (struct evdev *pad, BYTE *buttons);
+
+
+#endif
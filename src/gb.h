@@ -0,0 +1,88 @@
+/*
+ * an emulator instance
+ *
+ */
+
+#ifndef __GB_H
+#define __GB_H
+
+
+#include "common.h"
+#include "cpu.h"
+#include "mem.h"
+#include "mbc.h"
+#include "Z80.h"
+#include "display.h"
+#include "apu.h"
+#include "serial.h"
+#include "io.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+/* gb:
+ *  everything an emulator instance has -- every subsystem takes one of these,
+ *  so any number of instances can run side by side (the memory the emulated
+ *  machine itself writes to is all in the arena, see arena.h)
+ */
+struct gb {
+    struct arena   *arena;
+    size_t          arena_size;
+
+    struct emustate state;
+    bool            use_bios;
+    size_t          rewind_budget;  /* bytes (0 for no rewinding) */
+    int             runahead;       /* frames (-1 for off) */
+    bool            runahead_thread;
+
+    /* the same buttons give the same run: the .sav file (+ the clock in it) isn't
+     * loaded, and the buttons can be recorded to or played from a movie */
+    bool            deterministic;
+    const char     *movie_name;
+    bool            movie_recording;
+    bool            replaying;      /* the movie sets the buttons, not the frontend */
+
+    /* the frontend's key bindings + input sources: a config file, then the
+     * --bind/--padbind/--input options, as "OPTION VALUE" (see input.c) */
+    const char     *input_config;
+    char          **input_options;
+    unsigned        input_option_count;
+
+    /* the sound: samples a second (0 for APU_RATE), where they go (a WAV
+     * file, "-" for stdout, "sim:RATE" for a pretend sound card, or NULL
+     * for nowhere), and the seconds of it to keep waiting to be played
+     * (0 for SYNC_DEFAULT_LATENCY) */
+    unsigned        sample_rate;
+    const char     *audio_name;
+    double          audio_latency;
+
+    /* where the link cable goes (see link.c), or NULL for nowhere */
+    const char     *link_address;
+
+    /* running ahead, so anything sent out (eg. over serial) gets thrown away */
+    bool            speculative;
+
+    struct cpu      cpu;
+    struct mem      mem;
+    struct mapper   mapper;
+    struct timer    timer;
+    struct display  display;
+    struct apu      apu;
+    struct serial   serial;
+    struct io       io;
+
+    /* the frontend -- the window (NULL if there isn't one), and
+     * the debugger run at breakpoints (NULL to ignore them) */
+    struct low     *low;
+    struct input   *input;
+    struct sync    *sync;           /* the pacing (NULL to run flat out) */
+    void          (*debugger) (gb_t *gb);
+
+    /* the debugger repeats the last command on an empty line */
+    char           *previous_command;
+};
+
+
+#endif
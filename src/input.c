@@ -0,0 +1,573 @@
+/*
+ * the frontend's input -- key bindings, and input sources
+ * other than the keyboard (scripts, sockets, gamepads)
+ *
+ */
+
+#include "input.h"
+#include "gb.h"
+#include "evdev.h"
+#include "script.h"
+
+#include <stdio.h>      /* fopen, fgets, snprintf */
+#include <string.h>     /* strchr, strdup, strerror */
+#include <strings.h>    /* strcasecmp */
+#include <ctype.h>      /* isspace */
+#include <errno.h>
+#include <unistd.h>     /* close, unlink */
+#include <sys/stat.h>   /* lstat */
+#include <sys/socket.h>
+#include <sys/un.h>     /* sockaddr_un */
+
+
+
+/*  The config file (--config) has an option on each line, the same as
+ *  on the command line but without the dashes, eg.
+ *
+ *    bind UP=Up          # the arrow keys, not WASD
+ *    bind QUIT=none
+ *    padbind A=BTN_SOUTH
+ *    input socket:/tmp/gb.sock
+ *
+ *  bind puts a button (or emulator control) on a key, by its X keysym name
+ *  (<X11/keysym.h> without the XK_), and padbind puts a button on a gamepad
+ *  button (see evdev.c).  input adds a source, whose buttons are held
+ *  along with the keyboard's:
+ *
+ *    script:FILE     lines of FRAME BUTTONS (eg. 120 A+START, or 130 - to let
+ *                    go), which hold the buttons from that frame on (see script.c)
+ *    socket:PATH     a UNIX socket, which takes the same lines (or just BUTTONS,
+ *                    for the next frame on), and answers "frame" with the
+ *                    number of the next frame
+ *    evdev[:DEVICE]  a gamepad (eg. /dev/input/event3), or every gamepad there is
+ *
+ *  Frames are counted from power on, as in gb-batch's scripts.  Each source
+ *  is looked at once a frame, between frames, and never waited on.
+ */
+#define MAX_SOURCES     16
+#define MAX_PADS        8
+#define MAX_CLIENTS     8
+
+/* (longer lines are cut short) */
+#define LINE_SIZE       256
+
+
+/* what can be bound, by name */
+static const char *const key_names[_NUM_KEYS] = {
+    [BTN_UP]      = "UP",
+    [BTN_DOWN]    = "DOWN",
+    [BTN_LEFT]    = "LEFT",
+    [BTN_RIGHT]   = "RIGHT",
+
+    [BTN_A]       = "A",
+    [BTN_B]       = "B",
+    [BTN_START]   = "START",
+    [BTN_SELECT]  = "SELECT",
+
+    [KEY_ZOOMIN]  = "ZOOMIN",
+    [KEY_ZOOMOUT] = "ZOOMOUT",
+    [KEY_QUIT]    = "QUIT",
+    [KEY_REWIND]  = "REWIND",
+
+    [KEY_FULLSCREEN] = "FULLSCREEN",
+};
+
+/* ...and the keys it's on by default */
+static const char *const default_keysyms[_NUM_KEYS] = {
+    [BTN_UP]      = "W",
+    [BTN_DOWN]    = "S",
+    [BTN_LEFT]    = "A",
+    [BTN_RIGHT]   = "D",
+
+    [BTN_A]       = "M",
+    [BTN_B]       = "N",
+    [BTN_START]   = "space",
+    [BTN_SELECT]  = "Alt_R",
+
+    [KEY_ZOOMIN]  = "plus",
+    [KEY_ZOOMOUT] = "minus",
+    [KEY_QUIT]    = "Escape",
+    [KEY_REWIND]  = "BackSpace",
+
+    [KEY_FULLSCREEN] = "F",
+};
+
+
+/* someone connected to a socket */
+struct client {
+    int    fd;      /* (-1 for none) */
+    char   line[LINE_SIZE];
+    size_t length;
+};
+
+enum source_type {
+    SOURCE_SCRIPT,
+    SOURCE_SOCKET,
+    SOURCE_EVDEV,
+};
+
+struct source {
+    enum source_type type;
+    char            *path;      /* (NULL for every gamepad) */
+    BYTE             held;
+
+    /* script + socket: the changes still to come, in order */
+    struct script_change *changes;
+    size_t           count,
+                     allocated,
+                     next;
+
+    /* socket */
+    int              listener;
+    struct client    clients[MAX_CLIENTS];
+
+    /* evdev (NULL once unplugged) */
+    struct evdev    *pads[MAX_PADS];
+    unsigned         pad_count;
+};
+
+struct input {
+    char          *keysyms[_NUM_KEYS];      /* (NULL if it isn't bound) */
+    unsigned       pad_codes[EVDEV_BUTTONS];
+
+    struct source  sources[MAX_SOURCES];
+    unsigned       source_count;
+
+    unsigned long  frame;       /* the next one to run */
+};
+
+
+
+/* find_key: the key called name (out of the first count), or -1 if there isn't one */
+static int find_key (const char *name, unsigned count) {
+    for (unsigned i = 0; i < count; ++i)
+        if (strcasecmp (name, key_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/* add_change: add a change (after any for the same frame), returning false if out of memory */
+static bool add_change (struct source *src, struct script_change change) {
+
+    if (src->count == src->allocated) {
+        size_t allocated = src->allocated? src->allocated * 2 : 16;
+        struct script_change *changes = realloc (src->changes, allocated * sizeof(*changes));
+        if (!changes)
+            return false;
+        src->changes   = changes;
+        src->allocated = allocated;
+    }
+
+    size_t i = src->count++;
+    for (; i > src->next && src->changes[i - 1].frame > change.frame; --i)
+        src->changes[i] = src->changes[i - 1];
+    src->changes[i] = change;
+    return true;
+}
+
+/* apply_changes: hold the buttons of the changes up to frame */
+static void apply_changes (struct source *src, unsigned long frame) {
+
+    while (src->next < src->count && src->changes[src->next].frame <= frame)
+        src->held = src->changes[src->next++].buttons;
+
+    if (src->next == src->count)
+        src->next = src->count = 0;
+}
+
+/* trim: cut the comment + whitespace off a line */
+static char *trim (char *line) {
+
+    char *hash = strchr (line, '#');
+    if (hash)
+        *hash = '\0';
+
+    while (isspace ((unsigned char)*line))
+        line++;
+    size_t length = strlen (line);
+    while (length > 0 && isspace ((unsigned char)line[length - 1]))
+        line[--length] = '\0';
+
+    return line;
+}
+
+
+
+/* SOURCES */
+/* load_script: read a script's changes (see script.c), returning false (+ a message) on failure */
+static bool load_script (struct source *src) {
+
+    char err[LINE_SIZE + 64];
+    if (!(src->changes = script_load (src->path, &src->count, err, sizeof(err)))) {
+        fprintf (stderr, "failed to load the input script -- %s\n", err);
+        return false;
+    }
+    src->allocated = src->count;
+    return true;
+}
+
+/* open_socket: listen on a socket, returning false (+ a message) on failure */
+static bool open_socket (struct source *src) {
+
+    for (unsigned i = 0; i < MAX_CLIENTS; ++i)
+        src->clients[i].fd = -1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen (src->path) >= sizeof(addr.sun_path)) {
+        fprintf (stderr, "the socket path '%s' is too long\n", src->path);
+        return false;
+    }
+    strcpy (addr.sun_path, src->path);
+
+    src->listener = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (src->listener < 0) {
+        fprintf (stderr, "failed to make the socket '%s': %s\n", src->path, strerror (errno));
+        return false;
+    }
+
+    /* a socket left behind by a run which didn't clean up (nothing's listening on it) */
+    struct stat info;
+    if (lstat (src->path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        int probe = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect (probe, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno == ECONNREFUSED)
+            unlink (src->path);
+        if (probe >= 0)
+            close (probe);
+    }
+
+    if (bind (src->listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+     || listen (src->listener, MAX_CLIENTS) < 0) {
+        fprintf (stderr, "failed to listen on the socket '%s': %s\n", src->path, strerror (errno));
+        close (src->listener);
+        src->listener = -1;
+        return false;
+    }
+    return true;
+}
+
+/* reply: answer a client (who's dropped if they aren't reading) */
+static void reply (struct client *client, const char *text) {
+    if (send (client->fd, text, strlen (text), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+        close (client->fd);
+        client->fd = -1;
+    }
+}
+
+/* socket_command: handle a line from a client */
+static void socket_command (struct input *in, struct source *src, struct client *client) {
+
+    char *text = trim (client->line);
+    if (*text == '\0')
+        return;
+
+    if (strcasecmp (text, "frame") == 0) {
+        char answer[32];
+        snprintf (answer, sizeof(answer), "%lu\n", in->frame);
+        reply (client, answer);
+        return;
+    }
+
+    /* (a frame which has gone by means the next one) */
+    struct script_change change;
+    if (!script_parse_line (text, &change, &in->frame) || !add_change (src, change))
+        reply (client, "error\n");
+}
+
+/* poll_socket: take new clients, and catch up on what they've sent */
+static void poll_socket (struct input *in, struct source *src) {
+
+    int fd;
+    while ((fd = accept (src->listener, NULL, NULL)) >= 0) {
+        struct client *client = NULL;
+        for (unsigned i = 0; i < MAX_CLIENTS && !client; ++i)
+            if (src->clients[i].fd < 0)
+                client = &src->clients[i];
+
+        if (client) {
+            client->fd     = fd;
+            client->length = 0;
+        }
+        else
+            close (fd);
+    }
+
+    for (unsigned i = 0; i < MAX_CLIENTS; ++i) {
+        struct client *client = &src->clients[i];
+
+        char buffer[LINE_SIZE];
+        ssize_t size = -1;
+        while (client->fd >= 0 && (size = recv (client->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+            for (ssize_t j = 0; j < size && client->fd >= 0; ++j) {
+                if (buffer[j] == '\n') {
+                    client->line[client->length] = '\0';
+                    socket_command (in, src, client);
+                    client->length = 0;
+                }
+                else if (client->length < LINE_SIZE - 1)
+                    client->line[client->length++] = buffer[j];
+            }
+
+        /* hung up */
+        if (client->fd >= 0 && (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))) {
+            close (client->fd);
+            client->fd = -1;
+        }
+    }
+}
+
+/* open_pads: open a gamepad, or every gamepad, returning false (+ a message) on failure */
+static bool open_pads (struct input *in, struct source *src) {
+
+    if (!src->path) {
+        src->pad_count = evdev_open_all (in->pad_codes, src->pads, MAX_PADS);
+        if (src->pad_count == 0)
+            fputs ("no gamepads found under /dev/input\n", stderr);
+        for (unsigned i = 0; i < src->pad_count; ++i)
+            fprintf (stderr, "using the gamepad '%s'\n", evdev_name (src->pads[i]));
+        return true;
+    }
+
+    src->pads[0] = evdev_open (src->path, in->pad_codes);
+    if (!src->pads[0]) {
+        fprintf (stderr, "failed to open the gamepad '%s': %s\n", src->path, strerror (errno));
+        return false;
+    }
+    src->pad_count = 1;
+    return true;
+}
+
+/* read_pads: the buttons held on a source's gamepads */
+static BYTE read_pads (struct source *src) {
+
+    BYTE held = 0;
+    for (unsigned i = 0; i < src->pad_count; ++i) {
+        BYTE buttons;
+        if (!src->pads[i])
+            continue;
+        if (!evdev_read (src->pads[i], &buttons)) {
+            fprintf (stderr, "the gamepad '%s' is gone\n", evdev_name (src->pads[i]));
+            evdev_close (src->pads[i]);
+            src->pads[i] = NULL;
+        }
+        held |= buttons;
+    }
+    return held;
+}
+
+
+
+/* OPTIONS */
+/* parse_option: handle a config option, returning an error (or NULL) */
+static const char *parse_option (struct input *in, const char *option, char *value) {
+
+    if (strcmp (option, "bind") == 0 || strcmp (option, "padbind") == 0) {
+        bool pad = option[0] == 'p';
+
+        char *equals = strchr (value, '=');
+        if (!equals)
+            return "expected BUTTON=KEY";
+        *equals = '\0';
+        const char *name = equals + 1;
+
+        int key = find_key (value, pad? _NUM_BTNS : _NUM_KEYS);
+        if (key < 0)
+            return "unknown button";
+
+        if (!pad) {
+            free (in->keysyms[key]);
+            in->keysyms[key] = NULL;
+            if (strcasecmp (name, "none") != 0 && !(in->keysyms[key] = strdup (name)))
+                return "out of memory";
+        }
+        else if (strcasecmp (name, "none") == 0)
+            in->pad_codes[key] = 0;
+        else if (!evdev_code (name, &in->pad_codes[key]))
+            return "unknown gamepad button";
+
+        return NULL;
+    }
+
+    if (strcmp (option, "input") == 0) {
+        if (in->source_count == MAX_SOURCES)
+            return "too many input sources";
+
+        char *colon = strchr (value, ':');
+        if (colon)
+            *colon = '\0';
+        const char *path = colon? colon + 1 : "";
+
+        struct source src = { .listener=-1 };
+        if (strcmp (value, "script") == 0)
+            src.type = SOURCE_SCRIPT;
+        else if (strcmp (value, "socket") == 0)
+            src.type = SOURCE_SOCKET;
+        else if (strcmp (value, "evdev") == 0)
+            src.type = SOURCE_EVDEV;
+        else
+            return "unknown input source";
+
+        if (*path == '\0' && src.type != SOURCE_EVDEV)
+            return "expected TYPE:PATH";
+        if (*path != '\0' && !(src.path = strdup (path)))
+            return "out of memory";
+
+        in->sources[in->source_count++] = src;
+        return NULL;
+    }
+
+    return "unknown option";
+}
+
+/* read_config: read a config file, returning false (+ a message) on failure */
+static bool read_config (struct input *in, const char *fname) {
+
+    FILE *file = fopen (fname, "r");
+    if (!file) {
+        fprintf (stderr, "failed to open the config '%s': %s\n", fname, strerror (errno));
+        return false;
+    }
+
+    char line[LINE_SIZE];
+    for (unsigned number = 1; fgets (line, sizeof(line), file); ++number) {
+        char *option = trim (line);
+        if (*option == '\0')
+            continue;
+
+        char *value = option;
+        while (*value && !isspace ((unsigned char)*value))
+            value++;
+        if (*value)
+            *value++ = '\0';
+        while (isspace ((unsigned char)*value))
+            value++;
+
+        const char *err = parse_option (in, option, value);
+        if (err) {
+            fprintf (stderr, "%s:%u: %s\n", fname, number, err);
+            fclose (file);
+            return false;
+        }
+    }
+
+    fclose (file);
+    return true;
+}
+
+
+
+/* PUBLIC API */
+/* input_create: the bindings + sources from gb's config file and options,
+ *               returning NULL (+ a message) if they're no good */
+struct input *input_create (gb_t *gb) {
+
+    struct input *in = calloc (1, sizeof(*in));
+    if (!in) {
+        fputs ("failed to allocate the input\n", stderr);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < _NUM_KEYS; ++i)
+        if (!(in->keysyms[i] = strdup (default_keysyms[i]))) {
+            fputs ("failed to allocate the input\n", stderr);
+            input_destroy (in);
+            return NULL;
+        }
+    evdev_default_codes (in->pad_codes);
+
+    if (gb->input_config && !read_config (in, gb->input_config)) {
+        input_destroy (in);
+        return NULL;
+    }
+
+    /* (the options are "OPTION VALUE", and come after the config file so they win) */
+    for (unsigned i = 0; i < gb->input_option_count; ++i) {
+        char option[LINE_SIZE];
+        snprintf (option, sizeof(option), "%s", gb->input_options[i]);
+
+        char *value = strchr (option, ' ');
+        *value++ = '\0';
+
+        const char *err = parse_option (in, option, value);
+        if (err) {
+            fprintf (stderr, "--%s: %s\n", option, err);
+            input_destroy (in);
+            return NULL;
+        }
+    }
+
+    for (unsigned i = 0; i < in->source_count; ++i) {
+        struct source *src = &in->sources[i];
+
+        bool ok = src->type == SOURCE_SCRIPT? load_script (src) :
+                  src->type == SOURCE_SOCKET? open_socket (src) :
+                                              open_pads (in, src);
+        if (!ok) {
+            input_destroy (in);
+            return NULL;
+        }
+    }
+
+    return in;
+}
+
+/* input_destroy:  */
+void input_destroy (struct input *in) {
+
+    if (!in)
+        return;
+
+    for (unsigned i = 0; i < in->source_count; ++i) {
+        struct source *src = &in->sources[i];
+
+        if (src->type == SOURCE_SOCKET && src->listener >= 0) {
+            for (unsigned j = 0; j < MAX_CLIENTS; ++j)
+                if (src->clients[j].fd >= 0)
+                    close (src->clients[j].fd);
+            close (src->listener);
+            unlink (src->path);
+        }
+        for (unsigned j = 0; j < src->pad_count; ++j)
+            evdev_close (src->pads[j]);
+
+        free (src->changes);
+        free (src->path);
+    }
+
+    for (unsigned i = 0; i < _NUM_KEYS; ++i)
+        free (in->keysyms[i]);
+    free (in);
+}
+
+/* input_keysym: the name of the X keysym key is bound to (NULL if it isn't) */
+const char *input_keysym (struct input *in, unsigned key) {
+    return in? in->keysyms[key] : default_keysyms[key];
+}
+
+/* input_frame: between frames, the buttons the sources hold for the next one */
+BYTE input_frame (struct input *in) {
+
+    if (!in)
+        return 0;
+
+    BYTE buttons = 0;
+    for (unsigned i = 0; i < in->source_count; ++i) {
+        struct source *src = &in->sources[i];
+
+        switch (src->type) {
+        case SOURCE_SOCKET:
+            poll_socket (in, src);
+            /* fall through */
+        case SOURCE_SCRIPT:
+            apply_changes (src, in->frame);
+            break;
+
+        case SOURCE_EVDEV:
+            src->held = read_pads (src);
+            break;
+        }
+        buttons |= src->held;
+    }
+
+    in->frame++;
+    return buttons;
+}
@@ -0,0 +1,41 @@
+/*
+ * the frontend's input -- key bindings, and input sources
+ * other than the keyboard (scripts, sockets, gamepads)
+ *
+ */
+
+#ifndef __INPUT_H
+#define __INPUT_H
+
+
+#include "common.h"
+#include "io.h"
+
+#include <stdbool.h>
+
+
+
+/* keys which control the emulator, after the gameboy's buttons */
+enum {
+    KEY_ZOOMIN = _NUM_BTNS,
+    KEY_ZOOMOUT,
+    KEY_QUIT,
+    KEY_REWIND,
+    KEY_FULLSCREEN,     /* TEMP */
+    _NUM_KEYS
+};
+
+
+/* the bindings + sources of an emulator instance (see input.c) */
+struct input;
+
+
+struct input *input_create (gb_t *gb);
+void input_destroy (struct input *in);
+
+const char *input_keysym (struct input *in, unsigned key);
+
+BYTE input_frame (struct input *in);
+
+
+#endif
@@ -4,54 +4,25 @@
  */
 
 #include "io.h"
-#include "Z80.h"
+#include "gb.h"
 #include "common.h"
-#include "low.h"
-#include "logging.h"
 
+#include <stdio.h>     /* printf, puts */
 
-static bool old_btn_states[_NUM_BTNS];
 
-/* IO_keydown: returns key pressed state */
-bool IO_btndown (Keyname key, bool *oldstate) {
 
-    if (key > _NUM_BTNS)
-        fatal ("IO_keydown - invalid key %u\n", key);
-
-    bool state = controller[key];
-
-    if (oldstate != NULL)
-        *oldstate = old_btn_states[key];
-
-    return state;
+/* IO_buttons: which buttons are held down (bit n = button n) */
+BYTE IO_buttons (gb_t *gb) {
+    return atomic_load_explicit (&gb->io.pad, memory_order_relaxed);
 }
 
-/* IO_update:  */
-void IO_update(void) {
-#define PRESSED_THIS_FRAME(key) (!old_btn_states[key] && controller[key])
-    /* update old states */
-    for (unsigned i = 0; i < _NUM_BTNS; ++i)
-        old_btn_states[i] = controller[i];
-
-    low_wholeboard();
-
-    /* exit when quit button is pressed */
-    G_state.running = !controller[_QUIT];
-
-    /* zoom in/out */
-    /* FIXME: zooms in real fast */
-    if (PRESSED_THIS_FRAME(_ZOOMIN) && G_scale < 10)
-        G_scale++;
-    if (PRESSED_THIS_FRAME(_ZOOMOUT) && G_scale > 1)
-        G_scale--;
-
-#undef PRESSED_THIS_FRAME
+/* IO_set_buttons: set which buttons are held down -- this can be called from any thread */
+void IO_set_buttons (gb_t *gb, BYTE buttons) {
+    atomic_store_explicit (&gb->io.pad, buttons, memory_order_relaxed);
 }
 
 /* IO_print_help: print help */
 void IO_print_help (char *name, bool help) {
-    keybinds[0] = keybinds[0];  /* to shut the compiler up */
-
     printf ("Usage: %s [OPTIONS] ROMNAME\n", name);
     printf ("Try '%s --help' for more information.\n", name);
 
@@ -65,6 +36,23 @@ void IO_print_help (char *name, bool help) {
         puts ("     --break N\t\tset a breakpoint at address");
         puts ("     --disassemble\tprint a disassembly of ROM");
         puts ("     --bios\t\trun the BIOS (scrolling Nintendo logo)");
+        puts ("     --rewind MB\t\tkeep MB megabytes of frames to rewind (0 for none)");
+        puts ("     --runahead=N\tshow the frame N frames ahead, to hide the game's input lag");
+        puts ("     --runahead-thread\trun ahead on a second instance, on another thread");
+        puts ("     --deterministic\tdon't load the .sav file, so the same buttons give the same run");
+        puts ("     --record FILE\trecord the buttons to a movie (deterministic)");
+        puts ("     --play FILE\t\tplay the buttons back from a movie (deterministic)");
+        puts ("     --config FILE\tread key bindings + input sources from FILE");
+        puts ("     --bind BUTTON=KEY\tput BUTTON (eg. A, START, QUIT) on an X key (eg. Return)");
+        puts ("     --padbind BUTTON=B\tput BUTTON on a gamepad button (eg. BTN_SOUTH)");
+        puts ("     --input TYPE:PATH\tadd an input source -- script:FILE, socket:PATH or evdev[:DEVICE]");
+        puts ("     --audio FILE\twrite the sound to a WAV file (- for raw 16-bit stereo on stdout,\n"
+              "                 \tsim:RATE for a pretend sound card playing RATE samples a second)");
+        puts ("     --sample-rate N\tmake N samples a second (default: 48000)");
+        puts ("     --audio-latency MS\tkeep MS ms of sound waiting to be played (32-200, default: 64)");
+        puts ("     --link ADDRESS\tplug a link cable into another gb, at unix:PATH, tcp:PORT or tcp:HOST:PORT");
+        puts ("     --stop-on TEXT\tquit as soon as TEXT (eg. Passed) is sent over serial");
+        puts ("     --stop-on-magic\tquit when a mooneye test ROM says it's passed or failed (with LD B,B)");
         puts (" -h, --help\t\tdisplay this help and exit\n\n");
     }
 }
@@ -7,8 +7,10 @@
 #define __IO_H
 
 
-#include "low.h"
+#include "common.h"
+
 #include <stdbool.h>
+#include <stdatomic.h>  /* _Atomic */
 
 
 
@@ -23,20 +25,23 @@ enum _keynums {
     BTN_SELECT  = 6,
     BTN_START   = 7,
 
-    _ZOOMIN        ,
-    _ZOOMOUT       ,
-    _QUIT          ,
     _NUM_BTNS
 };
 
 typedef enum _keynums Keyname;
 
-KeyID keybinds[_NUM_BTNS];
-bool  controller[_NUM_BTNS];
+/* io:
+ *  the input state of an emulator instance -- the buttons held, as
+ *  bit n = button n (the frontend sets them, see IO_set_buttons)
+ */
+struct io {
+    _Atomic BYTE pad;
+    BYTE         seen;      /* pad as of the last $FF00 write */
+};
 
 
-bool IO_btndown (Keyname key, bool *oldstate);
-void IO_update(void);
+BYTE IO_buttons (gb_t *gb);
+void IO_set_buttons (gb_t *gb, BYTE buttons);
 
 void IO_log (int log_lvl, char *format, ...);
 
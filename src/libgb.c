@@ -0,0 +1,237 @@
+/*
+ * libgb -- the emulator core as a library, without a window
+ *
+ */
+
+#include "libgb.h"
+#include "gb.h"
+#include "Z80.h"
+#include "cpu.h"
+#include "mem.h"
+#include "io.h"
+#include "state.h"
+#include "rewind.h"
+#include "movie.h"
+#include "apu.h"
+#include "audio.h"
+#include "link.h"
+#include "serial.h"
+#include "script.h"
+#include "display.h"
+#include "common.h"
+
+
+
+_Static_assert (GB_SCREEN_W  == SCR_W && GB_SCREEN_H == SCR_H
+             && GB_FB_STRIDE == FB_WIDTH, "libgb.h is out of date");
+_Static_assert (GB_RIGHT == 1 << BTN_RIGHT && GB_A     == 1 << BTN_A
+             && GB_START == 1 << BTN_START && GB_DOWN  == 1 << BTN_DOWN, "libgb.h is out of date");
+_Static_assert (GB_SAMPLE_RATE == APU_RATE, "libgb.h is out of date");
+_Static_assert (sizeof(gb_input_t) == sizeof(struct script_change)
+             && offsetof (gb_input_t, frame)   == offsetof (struct script_change, frame)
+             && offsetof (gb_input_t, buttons) == offsetof (struct script_change, buttons), "libgb.h is out of date");
+_Static_assert (SERIAL_STOP_MAX == GB_STOP_MAX && SERIAL_OUTPUT_MAX == 1 << 20, "libgb.h is out of date");
+
+
+
+/* gb_create:  */
+gb_t *gb_create (const uint8_t *rom, size_t size) {
+
+    if (!rom || !mem_ROM_supported (rom, size))
+        return NULL;
+
+    gb_t *gb = Z80_create();
+    if (!gb)
+        return NULL;
+    if (!mem_loadROM (gb, rom, size) || !Z80_init (gb)) {
+        Z80_cleanup (gb);
+        return NULL;
+    }
+    return gb;
+}
+
+/* gb_destroy:  */
+void gb_destroy (gb_t *gb) {
+    if (gb)
+        Z80_cleanup (gb);
+}
+
+/* gb_run_frame:  */
+uint64_t gb_run_frame (gb_t *gb) {
+    return Z80_run_frame (gb);
+}
+
+/* gb_run_cycles:  */
+uint64_t gb_run_cycles (gb_t *gb, uint64_t cycles) {
+    return Z80_run (gb, cycles);
+}
+
+/* gb_set_input:  */
+void gb_set_input (gb_t *gb, uint8_t buttons) {
+    IO_set_buttons (gb, buttons);
+}
+
+/* gb_load_script:  */
+gb_input_t *gb_load_script (const char *fname, size_t *count, char *err, size_t err_size) {
+    return (gb_input_t *)script_load (fname, count, err, err_size);
+}
+
+/* gb_read:  */
+uint8_t gb_read (gb_t *gb, uint16_t address) {
+    return memgval (gb, address);
+}
+
+/* gb_framebuffer:  */
+const uint8_t *gb_framebuffer (gb_t *gb) {
+    return gb->display.framebuffer;
+}
+
+/* gb_serial_output:  */
+const char *gb_serial_output (gb_t *gb, size_t *length) {
+    return serial_output (gb, length);
+}
+
+/* gb_stop_on_serial:  */
+bool gb_stop_on_serial (gb_t *gb, const char *text) {
+    return serial_stop_on (gb, text);
+}
+
+/* gb_stop_on_magic:  */
+void gb_stop_on_magic (gb_t *gb, bool on) {
+    gb->serial.stop_magic = on;
+}
+
+/* gb_stopped:  */
+const char *gb_stopped (gb_t *gb) {
+    return cpu_locked_up (gb)? cpu_locked_up (gb) : serial_stopped (gb);
+}
+
+/* gb_locked_up:  */
+bool gb_locked_up (gb_t *gb) {
+    return cpu_locked_up (gb) != NULL;
+}
+
+/* gb_set_sample_rate:  */
+bool gb_set_sample_rate (gb_t *gb, unsigned rate) {
+    return apu_set_rate (gb, rate);
+}
+
+/* gb_set_rate_adjust:  */
+void gb_set_rate_adjust (gb_t *gb, double adjust) {
+    apu_set_adjust (gb, adjust);
+}
+
+/* gb_audio_samples:  */
+size_t gb_audio_samples (gb_t *gb, int16_t *buf, size_t frames) {
+    return apu_samples (gb, buf, frames);
+}
+
+/* gb_state_size:  */
+size_t gb_state_size (gb_t *gb) {
+    return state_size (gb);
+}
+
+/* gb_save_state:  */
+size_t gb_save_state (gb_t *gb, void *buf, size_t size) {
+    return state_save (gb, buf, size);
+}
+
+/* gb_load_state:  */
+bool gb_load_state (gb_t *gb, const void *buf, size_t size) {
+    return state_load (gb, buf, size);
+}
+
+/* gb_rewind_create:  */
+gb_rewind_t *gb_rewind_create (gb_t *gb, size_t budget) {
+    return rewind_create (gb, budget);
+}
+
+/* gb_rewind_destroy:  */
+void gb_rewind_destroy (gb_rewind_t *rw) {
+    rewind_destroy (rw);
+}
+
+/* gb_rewind_push:  */
+void gb_rewind_push (gb_rewind_t *rw, gb_t *gb) {
+    rewind_push (rw, gb);
+}
+
+/* gb_rewind_pop:  */
+bool gb_rewind_pop (gb_rewind_t *rw, gb_t *gb) {
+    return rewind_pop (rw, gb);
+}
+
+/* gb_rewind_frames:  */
+size_t gb_rewind_frames (gb_rewind_t *rw) {
+    return rewind_frames (rw);
+}
+
+/* gb_rewind_size:  */
+size_t gb_rewind_size (gb_rewind_t *rw) {
+    return rewind_size (rw);
+}
+
+/* gb_movie_record:  */
+gb_movie_t *gb_movie_record (gb_t *gb, const char *fname) {
+    return movie_record (gb, fname);
+}
+
+/* gb_movie_play:  */
+gb_movie_t *gb_movie_play (gb_t *gb, const char *fname) {
+    return movie_play (gb, fname);
+}
+
+/* gb_movie_frame:  */
+bool gb_movie_frame (gb_movie_t *mv, gb_t *gb) {
+    return movie_frame (mv, gb);
+}
+
+/* gb_movie_length:  */
+unsigned long gb_movie_length (gb_movie_t *mv) {
+    return movie_length (mv);
+}
+
+/* gb_movie_close:  */
+void gb_movie_close (gb_movie_t *mv) {
+    movie_close (mv);
+}
+
+/* gb_audio_open:  */
+gb_audio_t *gb_audio_open (const char *fname, unsigned rate) {
+    return audio_open (fname, rate);
+}
+
+/* gb_audio_write:  */
+bool gb_audio_write (gb_audio_t *out, const int16_t *samples, size_t frames) {
+    return audio_write (out, samples, frames);
+}
+
+/* gb_audio_close:  */
+void gb_audio_close (gb_audio_t *out) {
+    audio_close (out);
+}
+
+/* gb_link_create:  */
+gb_link_t *gb_link_create (gb_t *a, gb_t *b) {
+    return link_create (a, b);
+}
+
+/* gb_link_open:  */
+gb_link_t *gb_link_open (gb_t *gb, const char *address) {
+    return link_open (gb, address);
+}
+
+/* gb_link_run_frame:  */
+uint64_t gb_link_run_frame (gb_link_t *ln) {
+    return link_run_frame (ln);
+}
+
+/* gb_link_connected:  */
+bool gb_link_connected (gb_link_t *ln) {
+    return link_connected (ln);
+}
+
+/* gb_link_destroy:  */
+void gb_link_destroy (gb_link_t *ln) {
+    link_destroy (ln);
+}
@@ -0,0 +1,191 @@
+/*
+ * libgb -- the emulator core as a library, without a window
+ *
+ * Build it with `make libgb.a` or `make libgb.so`, and link with -pthread.
+ *
+ */
+
+#ifndef __LIBGB_H
+#define __LIBGB_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define GB_API  __attribute__((visibility ("default")))
+
+
+
+/* an emulator instance */
+typedef struct gb gb_t;
+
+/* buttons, for gb_set_input */
+enum gb_buttons {
+    GB_RIGHT  = 1 << 0,
+    GB_LEFT   = 1 << 1,
+    GB_UP     = 1 << 2,
+    GB_DOWN   = 1 << 3,
+    GB_A      = 1 << 4,
+    GB_B      = 1 << 5,
+    GB_SELECT = 1 << 6,
+    GB_START  = 1 << 7,
+};
+
+/* the framebuffer has a byte per pixel, which is a shade from 0 (lightest) to
+ * 3 (darkest) -- the screen is the top left GB_SCREEN_W x GB_SCREEN_H of it,
+ * and each row is GB_FB_STRIDE bytes */
+#define GB_SCREEN_W     160
+#define GB_SCREEN_H     144
+#define GB_FB_STRIDE    256
+
+
+
+/* gb_create: a new instance running rom (which is copied) -- NULL if it can't be run, or
+ * there isn't the memory for it */
+GB_API gb_t *gb_create (const uint8_t *rom, size_t size);
+/* gb_destroy: free the instance */
+GB_API void gb_destroy (gb_t *gb);
+
+/* gb_run_frame: run up to the end of the frame, returning the cycles run */
+GB_API uint64_t gb_run_frame (gb_t *gb);
+/* gb_run_cycles: run for at least cycles (4194304 a second), returning the cycles run */
+GB_API uint64_t gb_run_cycles (gb_t *gb, uint64_t cycles);
+
+/* gb_set_input: set which buttons are held down (enum gb_buttons) */
+GB_API void gb_set_input (gb_t *gb, uint8_t buttons);
+
+/* a line of an input script, "FRAME BUTTONS" -- from frame FRAME on (counting from power
+ * on), hold BUTTONS (eg. A+START, or - for none) -- which is the same as gb --input script:FILE */
+typedef struct gb_input {
+    unsigned long frame;
+    uint8_t       buttons;      /* (enum gb_buttons) */
+} gb_input_t;
+
+/* gb_load_script: read an input script's lines (# starts a comment), which can't go
+ * back in time, into an array to be freed -- NULL (+ why in err) on failure */
+GB_API gb_input_t *gb_load_script (const char *fname, size_t *count, char *err, size_t err_size);
+
+/* gb_read: read a byte of memory, as the CPU would see it */
+GB_API uint8_t gb_read (gb_t *gb, uint16_t address);
+
+/* gb_framebuffer: the framebuffer, which stays at the same address for the life of the
+ * instance -- after gb_run_frame it has the whole frame, until the next one starts */
+GB_API const uint8_t *gb_framebuffer (gb_t *gb);
+
+/* what the game sends over the serial port is kept (up to a megabyte) -- it's how test
+ * ROMs give their results, and the run can stop as soon as they have */
+
+/* gb_serial_output: everything that's been sent, with a '\0' after it (NULL if nothing has) --
+ * which can move when more is */
+GB_API const char *gb_serial_output (gb_t *gb, size_t *length);
+/* the longest text gb_stop_on_serial can stop on */
+#define GB_STOP_MAX     64
+
+/* gb_stop_on_serial: stop running as soon as what's been sent ends with text (eg. "Passed",
+ * up to GB_STOP_MAX bytes) -- returns false if it can't */
+GB_API bool gb_stop_on_serial (gb_t *gb, const char *text);
+/* gb_stop_on_magic: stop running when a mooneye test ROM says it's passed or failed (by
+ * running LD B,B with B, C, D, E, H, L = 3, 5, 8, 13, 21, 34, or all $42) */
+GB_API void gb_stop_on_magic (gb_t *gb, bool on);
+/* gb_stopped: why the run stopped -- the text, "LD B,B passed"/"LD B,B failed", or what the
+ * game locked up on (see gb_locked_up) -- or NULL if it hasn't; once it has, gb_run_frame
+ * and gb_run_cycles run nothing */
+GB_API const char *gb_stopped (gb_t *gb);
+/* gb_locked_up: whether the game's crashed, by running an illegal instruction (eg. "illegal
+ * instruction $D3 at $0150") -- which locks the CPU up for good, and stops the run */
+GB_API bool gb_locked_up (gb_t *gb);
+
+/* the sound is 16-bit signed stereo samples (left then right), GB_SAMPLE_RATE
+ * a second unless it's changed -- each gb_run_frame makes a frame's worth,
+ * which are kept (up to about a third of a second) until they're taken */
+#define GB_SAMPLE_RATE  48000
+
+/* gb_set_sample_rate: change the samples a second (up to 192000), throwing away any
+ * that haven't been taken -- returns false if it can't be made at that rate */
+GB_API bool gb_set_sample_rate (gb_t *gb, unsigned rate);
+/* gb_set_rate_adjust: make the samples as if the rate were (1 + adjust) times what it is
+ * (up to 0.005 either way), to keep the amount waiting in a sound card's buffer steady
+ * when its clock is a little off -- the pitch changes by as much, which can't be heard */
+GB_API void gb_set_rate_adjust (gb_t *gb, double adjust);
+/* gb_audio_samples: take up to frames of the oldest stereo samples into buf (which
+ * has room for frames * 2), returning how many there were */
+GB_API size_t gb_audio_samples (gb_t *gb, int16_t *buf, size_t frames);
+
+/* gb_state_size: the buffer size gb_save_state needs */
+GB_API size_t gb_state_size (gb_t *gb);
+/* gb_save_state: save the instance into buf, returning the size (0 if buf is too small) --
+ * the format is versioned and portable, see state.c */
+GB_API size_t gb_save_state (gb_t *gb, void *buf, size_t size);
+/* gb_load_state: restore a state saved from the same ROM (the instance is
+ * left alone if it can't be loaded) */
+GB_API bool gb_load_state (gb_t *gb, const void *buf, size_t size);
+
+/* a ring of the last however many frames, which can be stepped back through */
+typedef struct rewind gb_rewind_t;
+
+/* gb_rewind_create: a rewind buffer for gb using about budget bytes (NULL on failure) */
+GB_API gb_rewind_t *gb_rewind_create (gb_t *gb, size_t budget);
+/* gb_rewind_destroy: free the rewind buffer */
+GB_API void gb_rewind_destroy (gb_rewind_t *rw);
+/* gb_rewind_push: keep the state at the end of a frame, dropping the oldest if it's full */
+GB_API void gb_rewind_push (gb_rewind_t *rw, gb_t *gb);
+/* gb_rewind_pop: go back to the newest kept state, returning false if there aren't any --
+ * as the framebuffer isn't kept, run a frame afterwards to see it */
+GB_API bool gb_rewind_pop (gb_rewind_t *rw, gb_t *gb);
+/* gb_rewind_frames: how many frames are kept */
+GB_API size_t gb_rewind_frames (gb_rewind_t *rw);
+/* gb_rewind_size: how many bytes they're taking up */
+GB_API size_t gb_rewind_size (gb_rewind_t *rw);
+
+/* the buttons held on each frame from power on, which replay a run exactly */
+typedef struct movie gb_movie_t;
+
+/* the first bytes of a movie file */
+#define GB_MOVIE_MAGIC  "GBmv"
+
+/* gb_movie_record: start recording the buttons of gb (NULL on failure) */
+GB_API gb_movie_t *gb_movie_record (gb_t *gb, const char *fname);
+/* gb_movie_play: start playing a movie into gb (NULL on failure, or if it's for another ROM) */
+GB_API gb_movie_t *gb_movie_play (gb_t *gb, const char *fname);
+/* gb_movie_frame: before each frame, record the buttons (or set them) -- returns
+ * false once a movie being played is over */
+GB_API bool gb_movie_frame (gb_movie_t *mv, gb_t *gb);
+/* gb_movie_length: how many frames have been recorded (or are being played) */
+GB_API unsigned long gb_movie_length (gb_movie_t *mv);
+/* gb_movie_close: finish recording (or playing) */
+GB_API void gb_movie_close (gb_movie_t *mv);
+
+/* a WAV file (or a stream of raw samples) being written */
+typedef struct audio gb_audio_t;
+
+/* gb_audio_open: start writing samples at rate to a WAV file -- or for "-", as raw
+ * little endian samples to stdout, moving stdout's other output to stderr (NULL on failure) */
+GB_API gb_audio_t *gb_audio_open (const char *fname, unsigned rate);
+/* gb_audio_write: write frames stereo samples, returning false on failure */
+GB_API bool gb_audio_write (gb_audio_t *out, const int16_t *samples, size_t frames);
+/* gb_audio_close: finish the file */
+GB_API void gb_audio_close (gb_audio_t *out);
+
+/* a link cable between the serial ports of two instances */
+typedef struct link gb_link_t;
+
+/* gb_link_create: plug a and b (in this process) into each other (NULL on failure) --
+ * from then on, they're run together with gb_link_run_frame */
+GB_API gb_link_t *gb_link_create (gb_t *a, gb_t *b);
+/* gb_link_open: plug gb into an instance in another process, at "unix:PATH", "tcp:PORT"
+ * (localhost) or "tcp:HOST:PORT" -- which waits for the other end to turn up, unless it's
+ * already there (NULL on failure) -- gb keeps being run with gb_run_frame, and waits
+ * for the other end now and then, so don't run ahead or load states while it's plugged in */
+GB_API gb_link_t *gb_link_open (gb_t *gb, const char *address);
+/* gb_link_run_frame: run both ends (in this process) to the end of the first's
+ * frame, returning the cycles that took */
+GB_API uint64_t gb_link_run_frame (gb_link_t *ln);
+/* gb_link_connected: whether both ends are still plugged in (the other process hasn't gone) */
+GB_API bool gb_link_connected (gb_link_t *ln);
+/* gb_link_destroy: unplug the cable */
+GB_API void gb_link_destroy (gb_link_t *ln);
+
+
+#endif
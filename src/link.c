@@ -0,0 +1,449 @@
+/*
+ * the link cable
+ *
+ */
+
+#include "link.h"
+#include "gb.h"
+#include "Z80.h"        /* Z80_run, Z80_frame_left */
+#include "serial.h"
+#include "mem.h"        /* memgval */
+#include "alarm.h"      /* get_cycle_count */
+#include "registers.h"
+
+#include <stdio.h>      /* fprintf */
+#include <stdlib.h>     /* calloc */
+#include <string.h>     /* memcpy, strchr, strerror */
+#include <errno.h>      /* errno */
+#include <endian.h>     /* htole32, htole64, etc. */
+#include <unistd.h>     /* close, unlink */
+#include <netdb.h>      /* getaddrinfo */
+#include <sys/socket.h> /* socket, connect, etc. */
+#include <sys/stat.h>   /* lstat */
+#include <sys/un.h>     /* sockaddr_un */
+#include <netinet/in.h> /* sockaddr_in */
+#include <netinet/tcp.h>/* TCP_NODELAY */
+#include <arpa/inet.h>  /* htonl, htons */
+
+
+
+/*  The two ends of the cable are run in steps, and sync up after each
+ *  one: they swap what their serial ports are doing, and any transfer that
+ *  finishes then gets the other end's byte (if it was waiting for one --
+ *  otherwise, 1s).  A transfer can't finish any sooner than SERIAL_CYCLES
+ *  after it starts, so a step can be that long without a transfer being
+ *  seen late -- and when one of the ends has a transfer going, the step
+ *  ends right when it finishes.
+ *
+ *  In the same process, link_run runs the ends one after the other, a step
+ *  at a time.  Over a socket, each end runs on its own (as usual), and at
+ *  the end of each step (see serial_event) sends the other end
+ *
+ *    u64  when its transfer finishes (SERIAL_NEVER if there isn't one)
+ *    u8   SIODATA
+ *    u8   whether it's waiting for the other end to clock a transfer
+ *    u8   (padding, to MESSAGE_SIZE)
+ *
+ *  and waits for the other end's -- cycles are counted from when the
+ *  cable was plugged in, and numbers are little endian.  Before that,
+ *  both ends send LINK_MAGIC + a u32 LINK_VERSION, to check they match.
+ *
+ *  ADDRESS is
+ *    unix:PATH       a UNIX socket -- whichever end gets there first
+ *                    waits for the other
+ *    tcp:PORT        wait for the other end on PORT (of localhost -- or
+ *                    tcp::PORT)
+ *    tcp:HOST:PORT   connect to the other end, on HOST
+ */
+#define LINK_MAGIC      "GBlk"
+#define LINK_VERSION    1
+
+#define MESSAGE_SIZE    16
+
+
+struct link {
+    gb_t    *gb[2];         /* the instances plugged in (just gb[0] over a socket) */
+    uint64_t base[2];       /* their cycle counts when they were */
+    int      fd;            /* the socket (-1 in the same process) */
+
+    uint64_t next;          /* the end of the step, in cycles since the cable was plugged in */
+    uint64_t syncs;
+};
+
+/* what an end's serial port is doing, at the end of a step */
+struct end {
+    uint64_t finish;        /* (cycles since the cable was plugged in) */
+    BYTE     data;
+    bool     waiting;
+};
+
+
+
+/* elapsed: cycles since the cable was plugged into end i */
+static inline uint64_t elapsed (struct link *ln, unsigned i) {
+    return get_cycle_count (ln->gb[i]) - ln->base[i];
+}
+
+/* plug: plug gb into end i */
+static void plug (struct link *ln, unsigned i, gb_t *gb) {
+    ln->gb[i]   = gb;
+    ln->base[i] = get_cycle_count (gb);
+    gb->serial.link = ln;
+    gb->serial.due  = ln->fd >= 0? ln->base[i] + ln->next : SERIAL_NEVER;
+}
+
+/* unplug: pull the cable out of gb */
+static void unplug (struct link *ln, gb_t *gb) {
+    if (gb && gb->serial.link == ln) {
+        gb->serial.link = NULL;
+        serial_schedule (gb);
+    }
+}
+
+/* snapshot: what end i is doing */
+static struct end snapshot (struct link *ln, unsigned i) {
+
+    gb_t *gb = ln->gb[i];
+    return (struct end) {
+        .finish  = gb->serial.end == SERIAL_NEVER? SERIAL_NEVER : gb->serial.end - ln->base[i],
+        .data    = memgval (gb, R_SIODATA),
+        .waiting = serial_waiting (gb),
+    };
+}
+
+/* settle: finish gb's transfer, if it's done at time */
+static void settle (gb_t *gb, struct end mine, struct end theirs, uint64_t time) {
+
+    /* this end clocked it, so it gets whatever the other end had waiting... */
+    if (mine.finish <= time)
+        serial_finish (gb, theirs.waiting? theirs.data : 0xFF);
+
+    /* ...and the other end gets this end's, if it was waiting */
+    else if (theirs.finish <= time && mine.waiting)
+        serial_finish (gb, theirs.data);
+}
+
+/* next_step: when the step after the one ending at time ends */
+static uint64_t next_step (uint64_t time, struct end a, struct end b) {
+
+    uint64_t next = time + SERIAL_CYCLES;
+    if (a.finish > time && a.finish < next)
+        next = a.finish;
+    if (b.finish > time && b.finish < next)
+        next = b.finish;
+    return next;
+}
+
+
+
+/* send_all/recv_all: the whole of buf, returning false if the other end's gone */
+static bool send_all (int fd, const void *buf, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = send (fd, (const BYTE *)buf + done, size - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+static bool recv_all (int fd, void *buf, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = recv (fd, (BYTE *)buf + done, size - done, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+/* handshake: check the other end is the same kind of cable */
+static bool handshake (int fd) {
+
+    BYTE hello[8], theirs[8];
+    uint32_t version = htole32 (LINK_VERSION);
+    memcpy (hello, LINK_MAGIC, 4);
+    memcpy (hello + 4, &version, 4);
+
+    if (!send_all (fd, hello, sizeof(hello)) || !recv_all (fd, theirs, sizeof(theirs))) {
+        fprintf (stderr, "the other end of the link cable hung up\n");
+        return false;
+    }
+    if (memcmp (hello, theirs, sizeof(hello)) != 0) {
+        fprintf (stderr, "the other end of the link cable isn't another gb (of the same version)\n");
+        return false;
+    }
+    return true;
+}
+
+/* wait_for: accept the other end on listener (which is closed) */
+static int wait_for (int listener, const char *address) {
+
+    fprintf (stderr, "waiting for the other end of the link cable on %s\n", address);
+
+    int fd;
+    while ((fd = accept (listener, NULL, NULL)) < 0 && errno == EINTR)
+        ;
+    if (fd < 0)
+        fprintf (stderr, "failed to plug in the link cable on %s: %s\n", address, strerror (errno));
+
+    close (listener);
+    return fd;
+}
+
+/* open_unix: connect to the other end at path, or wait for it there */
+static int open_unix (const char *path, const char *address) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen (path) >= sizeof(addr.sun_path)) {
+        fprintf (stderr, "the socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+
+    /* (if both ends get there at once, one of them loses the race to listen) */
+    for (unsigned tries = 0; tries < 3; ++tries) {
+
+        int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        if (connect (fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+
+        /* nobody's at the other end, so this end waits there instead
+         * (clearing away the old socket, if there is one, to listen on --
+         * but anything else that's there is somebody's file) */
+        bool refused = errno == ECONNREFUSED;
+        close (fd);
+        struct stat st;
+        if (refused && lstat (path, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                fprintf (stderr, "failed to plug in the link cable on %s: '%s' isn't a socket\n", address, path);
+                return -1;
+            }
+            unlink (path);
+        }
+
+        fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        if (bind (fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen (fd, 1) == 0) {
+            fd = wait_for (fd, address);
+            unlink (path);
+            return fd;
+        }
+        close (fd);
+    }
+
+    fprintf (stderr, "failed to plug in the link cable on %s: %s\n", address, strerror (errno));
+    return -1;
+}
+
+/* open_tcp: wait for the other end on port (of localhost), or connect to it on host */
+static int open_tcp (const char *host, const char *port, const char *address) {
+
+    int fd = -1;
+
+    if (!host) {
+        char *end;
+        unsigned long number = strtoul (port, &end, 10);
+        if (*end || end == port || number == 0 || number > 65535) {
+            fprintf (stderr, "invalid port '%s'\n", port);
+            return -1;
+        }
+
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons (number),
+                                    .sin_addr.s_addr = htonl (INADDR_LOOPBACK) };
+        int on = 1;
+        if ((fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+         || setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+         || bind (fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+         || listen (fd, 1) < 0) {
+            fprintf (stderr, "failed to listen on %s: %s\n", address, strerror (errno));
+            if (fd >= 0)
+                close (fd);
+            return -1;
+        }
+        fd = wait_for (fd, address);
+    }
+    else {
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *info;
+        int err = getaddrinfo (host, port, &hints, &info);
+        if (err) {
+            fprintf (stderr, "failed to find %s: %s\n", address, gai_strerror (err));
+            return -1;
+        }
+        for (struct addrinfo *ai = info; ai && fd < 0; ai = ai->ai_next) {
+            fd = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd >= 0 && connect (fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+                close (fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo (info);
+        if (fd < 0)
+            fprintf (stderr, "failed to connect to %s: %s\n", address, strerror (errno));
+    }
+
+    /* (the messages are tiny, and each one is waited for) */
+    int on = 1;
+    if (fd >= 0)
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+
+
+/* PUBLIC API */
+/* link_create: plug a and b (in the same process) into each other --
+ *              they have to be run with link_run from then on */
+struct link *link_create (gb_t *a, gb_t *b) {
+
+    if (a == b || a->serial.link || b->serial.link)
+        return NULL;
+
+    struct link *ln = calloc (1, sizeof(*ln));
+    if (!ln)
+        return NULL;
+
+    ln->fd   = -1;
+    ln->next = SERIAL_CYCLES;
+    plug (ln, 0, a);
+    plug (ln, 1, b);
+    return ln;
+}
+
+/* link_open: plug gb into another process's instance, at address (see above) --
+ *            which can wait for the other end to turn up, and returns NULL
+ *            (+ a message) on failure */
+struct link *link_open (gb_t *gb, const char *address) {
+
+    if (gb->serial.link)
+        return NULL;
+
+    int fd = -1;
+    if (strncmp (address, "unix:", 5) == 0)
+        fd = open_unix (address + 5, address);
+
+    else if (strncmp (address, "tcp:", 4) == 0) {
+        char host[256];
+        const char *port = strrchr (address + 4, ':');
+        if (port && (size_t)(port - (address + 4)) < sizeof(host)) {
+            memcpy (host, address + 4, port - (address + 4));
+            host[port - (address + 4)] = '\0';
+            fd = open_tcp (*host? host : NULL, port + 1, address);
+        }
+        else if (!port)
+            fd = open_tcp (NULL, address + 4, address);
+    }
+    else
+        fprintf (stderr, "the link cable goes to unix:PATH, tcp:PORT or tcp:HOST:PORT -- not '%s'\n", address);
+
+    if (fd < 0)
+        return NULL;
+    if (!handshake (fd)) {
+        close (fd);
+        return NULL;
+    }
+
+    struct link *ln = calloc (1, sizeof(*ln));
+    if (!ln) {
+        close (fd);
+        return NULL;
+    }
+    ln->fd   = fd;
+    ln->next = SERIAL_CYCLES;
+    plug (ln, 0, gb);
+    return ln;
+}
+
+/* link_destroy: unplug the cable */
+void link_destroy (struct link *ln) {
+
+    if (!ln)
+        return;
+
+    unplug (ln, ln->gb[0]);
+    unplug (ln, ln->gb[1]);
+    if (ln->fd >= 0)
+        close (ln->fd);
+    free (ln);
+}
+
+/* link_run: run both ends (in the same process) for at least cycles cycles, a step
+ *           at a time -- or over a socket, just this end -- returning how many were run */
+uint64_t link_run (struct link *ln, uint64_t cycles) {
+
+    if (ln->fd >= 0 || !ln->gb[1])
+        return Z80_run (ln->gb[0], cycles);
+
+    gb_t *a = ln->gb[0], *b = ln->gb[1];
+    uint64_t start = elapsed (ln, 0);
+
+    while (elapsed (ln, 0) < start + cycles && a->state.running && b->state.running) {
+
+        uint64_t stop = ln->next < start + cycles? ln->next : start + cycles;
+        for (unsigned i = 0; i < 2; ++i)
+            if (elapsed (ln, i) < stop)
+                Z80_run (ln->gb[i], stop - elapsed (ln, i));
+
+        if (stop == ln->next) {
+            struct end ea = snapshot (ln, 0),
+                       eb = snapshot (ln, 1);
+            settle (a, ea, eb, stop);
+            settle (b, eb, ea, stop);
+            ln->next = next_step (stop, ea, eb);
+            ln->syncs++;
+        }
+    }
+
+    return elapsed (ln, 0) - start;
+}
+
+/* link_run_frame: link_run up to the end of the first end's frame */
+uint64_t link_run_frame (struct link *ln) {
+    return link_run (ln, Z80_frame_left (ln->gb[0]));
+}
+
+/* link_sync: (over a socket) gb's at the end of a step, so sync up with the other end */
+void link_sync (struct link *ln, gb_t *gb) {
+
+    uint64_t time = ln->next;
+    struct end mine = snapshot (ln, 0), theirs;
+
+    BYTE message[MESSAGE_SIZE] = { 0 };
+    uint64_t finish = htole64 (mine.finish);
+    memcpy (message, &finish, 8);
+    message[8] = mine.data;
+    message[9] = mine.waiting;
+
+    if (!send_all (ln->fd, message, sizeof(message)) || !recv_all (ln->fd, message, sizeof(message))) {
+        fprintf (stderr, "the other end of the link cable hung up\n");
+        close (ln->fd);
+        ln->fd = -1;
+        unplug (ln, gb);
+        return;
+    }
+    memcpy (&finish, message, 8);
+    theirs.finish  = le64toh (finish);
+    theirs.data    = message[8];
+    theirs.waiting = message[9] & 1;
+
+    settle (gb, mine, theirs, time);
+    ln->next = next_step (time, mine, theirs);
+    ln->syncs++;
+    gb->serial.due = ln->base[0] + ln->next;
+}
+
+/* link_connected: whether the cable's still plugged in at both ends */
+bool link_connected (struct link *ln) {
+    return ln->fd >= 0 || ln->gb[1];
+}
+
+/* link_syncs: how many times the ends have synced up */
+uint64_t link_syncs (struct link *ln) {
+    return ln->syncs;
+}
@@ -0,0 +1,34 @@
+/*
+ * the link cable
+ *
+ */
+
+#ifndef __LINK_H
+#define __LINK_H
+
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/* a link cable between the serial ports of two instances, in the
+ * same process or over a socket (see link.c) */
+struct link;
+
+
+struct link *link_create (gb_t *a, gb_t *b);
+struct link *link_open (gb_t *gb, const char *address);
+void link_destroy (struct link *ln);
+
+uint64_t link_run (struct link *ln, uint64_t cycles);
+uint64_t link_run_frame (struct link *ln);
+void link_sync (struct link *ln, gb_t *gb);
+
+bool link_connected (struct link *ln);
+uint64_t link_syncs (struct link *ln);
+
+
+#endif
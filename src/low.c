@@ -6,70 +6,127 @@
 
 #include "io.h"
 #include "low.h"
+#include "input.h"
+#include "gb.h"
 #include "Z80.h"
 #include "mem.h"
 #include "common.h"
 #include "logging.h"
 #include "registers.h"
+#include "display.h"
+
+#include <string.h>     /* memcpy, memcmp, memset */
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/XKBlib.h>   /* XkbSetDetectableAutoRepeat */
+#include <X11/keysym.h>
 
 
-#define REAL_W      (SCR_W * G_scale)
-#define REAL_H      (SCR_H * G_scale)
+#define REAL_W      (SCR_W * low->scale)
+#define REAL_H      (SCR_H * low->scale)
 
 
 
-/* TEMP */
-static bool _DEBUG_draw_full_screen = false;
+/* a button press which hasn't changed the screen after this long didn't do anything visible */
+#define LATENCY_TIMEOUT     1.0
 
-void low_clearscreen(void);
-void low_cleanup(void);
+static const char *const colour_names[4] = { "rgb:ff/ff/ff","rgb:aa/aa/aa","rgb:55/55/55","rgb:00/00/00" };
 
+struct low {
+    Display *conn;
+    Window   window;
+    GC       palette[4];
+    Pixmap   buffer;
 
+    unsigned scale;
 
-static Display         *conn = NULL;
-static Window          window;
-static char            *colour_names[4] = { "rgb:ff/ff/ff","rgb:aa/aa/aa","rgb:55/55/55","rgb:00/00/00" };
-static GC              palette[4];
-static GC              white;
-static Pixmap          buffer;
+    /* the keys are kept track of from the window's key events, which
+     * (unlike asking for the keyboard's state) doesn't wait on the server */
+    SIGNED_BYTE keymap[256];        /* keycode -> key (-1 if it isn't bound), made once */
+    bool        keys[_NUM_KEYS],
+                old_keys[_NUM_KEYS];    /* as of the last frame */
 
-static bool initialized = false;
+    /* input latency -- from reading a change in the buttons to
+     * drawing the first frame which looks any different */
+    BYTE          buttons;
+    bool          latency_pending;
+    double        key_time;
+    unsigned      key_frames;   /* drawn since the change */
+    BYTE          key_screen[SCR_H][SCR_W];
 
-static unsigned SCR_W = 160;
-static unsigned SCR_H = 144;
+    unsigned long latency_samples,
+                  latency_frames;
+    double        latency_total,
+                  latency_max;
 
-unsigned int G_scale = 1;   /* TODO: rename G_scale */
+    /* TEMP */
+    bool _DEBUG_draw_full_screen;
+};
 
 
 
-/* low_initdisplay: initialize the display */
-void low_initdisplay(void) {
+/* key_event: a key going down or up */
+static void key_event (struct low *low, KeyCode keycode, bool down) {
+    if (low->keymap[keycode] >= 0)
+        low->keys[low->keymap[keycode]] = down;
+}
+
+/* bind_keys: look up the keycodes of the keys bound in gb's input */
+static void bind_keys (gb_t *gb, struct low *low) {
+
+    memset (low->keymap, -1, sizeof(low->keymap));
+
+    for (unsigned i = 0; i < _NUM_KEYS; ++i) {
+        const char *name = input_keysym (gb->input, i);
+        if (!name)
+            continue;
+
+        KeySym keysym = XStringToKeysym (name);
+        if (keysym == NoSymbol) {
+            fprintf (stderr, "unknown key '%s', so it isn't bound\n", name);
+            continue;
+        }
+
+        /* (keys which aren't on the keyboard are left unbound) */
+        KeyCode keycode = XKeysymToKeycode (low->conn, keysym);
+        if (keycode)
+            low->keymap[keycode] = i;
+    }
+}
 
-    /* setup keybinds */
-    /* TODO: move this? */
-    keybinds[BTN_UP]     = XK_W;
-    keybinds[BTN_DOWN]   = XK_S;
-    keybinds[BTN_LEFT]   = XK_A;
-    keybinds[BTN_RIGHT]  = XK_D;
+/* copy_screen: copy the visible part of the framebuffer */
+static void copy_screen (gb_t *gb, BYTE screen[SCR_H][SCR_W]) {
+    for (unsigned y = 0; y < SCR_H; ++y)
+        memcpy (screen[y], gb->display.framebuffer + (y * FB_WIDTH), SCR_W);
+}
+
+/* screen_changed: whether the visible part of the framebuffer differs from screen */
+static bool screen_changed (gb_t *gb, BYTE screen[SCR_H][SCR_W]) {
+    for (unsigned y = 0; y < SCR_H; ++y)
+        if (memcmp (screen[y], gb->display.framebuffer + (y * FB_WIDTH), SCR_W) != 0)
+            return true;
+    return false;
+}
 
-    keybinds[BTN_A]      = XK_M;
-    keybinds[BTN_B]      = XK_N;
-    keybinds[BTN_START]  = XK_space;
-    keybinds[BTN_SELECT] = XK_Alt_R;
 
-    keybinds[_ZOOMIN]    = XK_plus;
-    keybinds[_ZOOMOUT]   = XK_minus;
-    keybinds[_QUIT]      = XK_Escape;
 
+/* low_initdisplay: initialize the display */
+void low_initdisplay (gb_t *gb) {
+
+    if (!gb->low) {
+        struct low *low = calloc (1, sizeof(*low));
+        if (!low)
+            fatal ("failed to allocate the display");
+
+        low->scale = 1;
 
-    if (!initialized) {
-        conn = XOpenDisplay (NULL);
-        if (!conn)
+        low->conn = XOpenDisplay (NULL);
+        if (!low->conn)
             fatal ("failed to open X connection!\n");
 
+        Display *conn = low->conn;
+
         /* setup colours */
         XColor colours[4];
         for (int i = 0; i < 4; ++i) {
@@ -84,35 +141,37 @@ void low_initdisplay(void) {
 
 
         /* create window */
-        window = XCreateSimpleWindow (conn,
-                                      XDefaultRootWindow (conn),
-                                      0,0,
-                                      REAL_W,REAL_H,
-                                      0,0,
-                                      0);
+        low->window = XCreateSimpleWindow (conn,
+                                           XDefaultRootWindow (conn),
+                                           0,0,
+                                           REAL_W,REAL_H,
+                                           0,0,
+                                           0);
 
         /* create backbuffer */
-        buffer = XCreatePixmap (conn,
-                                window,
-                                256 * G_scale,256 * G_scale,
-                                DefaultDepth (conn, DefaultScreen (conn)));
-
-        white = XCreateGC (conn, window, 0, NULL);
-        XSetForeground (conn, white, BlackPixel (conn, XDefaultScreen (conn)));
+        low->buffer = XCreatePixmap (conn,
+                                     low->window,
+                                     FB_WIDTH * low->scale,FB_HEIGHT * low->scale,
+                                     DefaultDepth (conn, DefaultScreen (conn)));
 
         /* set palette */
         for (int i = 0; i < 4; ++i) {
-            palette[i] = XCreateGC (conn, window, 0, NULL);
-            XSetForeground (conn, palette[i], colours[i].pixel);
+            low->palette[i] = XCreateGC (conn, low->window, 0, NULL);
+            XSetForeground (conn, low->palette[i], colours[i].pixel);
         }
 
         /* map + set up window */
-        XMapWindow (conn, window);
+        XMapWindow (conn, low->window);
 
         XSelectInput (conn,
-                      window,
-                      StructureNotifyMask | KeyPressMask | KeyReleaseMask);
-        XStoreName (conn, window, "GB");
+                      low->window,
+                      StructureNotifyMask | KeyPressMask | KeyReleaseMask | FocusChangeMask);
+        XStoreName (conn, low->window, "GB");
+
+        /* held keys repeat as presses alone, not release + press */
+        XkbSetDetectableAutoRepeat (conn, True, NULL);
+
+        bind_keys (gb, low);
 
         /* wait for window to be mapped */
         XEvent e;
@@ -120,120 +179,160 @@ void low_initdisplay(void) {
             XNextEvent (conn, &e);
         } while (e.type != MapNotify);
 
-        initialized = true;
-
-
-        low_clearscreen();
-        atexit (low_cleanup);
+        gb->low = low;
     }
     else
         error ("attempt to call low_initdisplay after already init!");
 }
 
 /* low_wholeboard: read the state of the controller */
-void low_wholeboard(void) {
-#define KEYSTATE(map, keycode)  (((map)[(keycode)/8] & (1 << ((keycode) % 8)))? true : false)
-    if (!initialized)
+void low_wholeboard (gb_t *gb) {
+#define PRESSED_THIS_FRAME(key) (!low->old_keys[key] && low->keys[key])
+    struct low *low = gb->low;
+    if (!low)
         return;
 
-    char map[32];
-    KeyCode keycode;
+    /* catch up on the key events (only the ones already here) */
+    while (XPending (low->conn)) {
+        XEvent e;
+        XNextEvent (low->conn, &e);
 
-    /* get keyboard state */
-    XQueryKeymap (conn, map);
+        if (e.type == KeyPress || e.type == KeyRelease)
+            key_event (low, e.xkey.keycode, e.type == KeyPress);
 
-    /* get the state of mapped keys */
-    for (unsigned i = 0; i < _NUM_BTNS; ++i) {
-        keycode = XKeysymToKeycode (conn, keybinds[i]);
-        controller[i] = KEYSTATE(map, keycode);
+        /* the release of a key held while losing the focus never comes */
+        else if (e.type == FocusOut)
+            memset (low->keys, 0, sizeof(low->keys));
     }
 
-    /* TEMP */
-    static bool _DEBUG_old_toggle_fullscreen = false;
-    bool _DEBUG_toggle_fullscreen = KEYSTATE(map, XKeysymToKeycode (conn, XK_F));
+    BYTE buttons = 0;
+    for (unsigned i = 0; i < _NUM_BTNS; ++i)
+        if (low->keys[i])
+            SETBIT(buttons, i);
+
+    /* time how long until the change shows (against what's on the screen now) */
+    if (buttons != low->buttons) {
+        low->buttons         = buttons;
+        low->latency_pending = true;
+        low->key_time        = millis();
+        low->key_frames      = 0;
+        copy_screen (gb, low->key_screen);
+    }
 
-    if (_DEBUG_toggle_fullscreen && !_DEBUG_old_toggle_fullscreen)
-        _DEBUG_draw_full_screen = !_DEBUG_draw_full_screen;
-    _DEBUG_old_toggle_fullscreen = _DEBUG_toggle_fullscreen;
+    /* exit when quit button is pressed */
+    if (low->keys[KEY_QUIT])
+        gb->state.running = false;
 
-#undef KEYSTATE
-}
+    /* zoom in/out */
+    if (PRESSED_THIS_FRAME(KEY_ZOOMIN) && low->scale < 10)
+        low->scale++;
+    if (PRESSED_THIS_FRAME(KEY_ZOOMOUT) && low->scale > 1)
+        low->scale--;
 
-/* low_drawpixel: draw a pixel */
-void low_drawpixel (unsigned x, unsigned y, unsigned ind) {
-    if (!initialized)
-        return;
+    /* TEMP */
+    if (PRESSED_THIS_FRAME(KEY_FULLSCREEN))
+        low->_DEBUG_draw_full_screen = !low->_DEBUG_draw_full_screen;
 
-    x %= 256;
-    y %= 256;
-    x *= G_scale;
-    y *= G_scale;
+    memcpy (low->old_keys, low->keys, sizeof(low->keys));
 
-    if (ind > 3)
-        fatal ("invalid color: %d", ind);
+#undef PRESSED_THIS_FRAME
+}
+
+/* low_buttons: the buttons held on the keyboard */
+BYTE low_buttons (gb_t *gb) {
+    return gb->low? gb->low->buttons : 0;
+}
 
-    XFillRectangle (conn,
-                    buffer,
-                    palette[ind],
-                    x,y,
-                    G_scale,G_scale);
+/* low_rewinding: whether the rewind key is held */
+bool low_rewinding (gb_t *gb) {
+    return gb->low && gb->low->keys[KEY_REWIND];
 }
 
-/* low_update: update the screen */
-void low_update(void) {
-    if (!initialized)
+/* low_update: draw the framebuffer to the screen */
+void low_update (gb_t *gb) {
+    struct low *low = gb->low;
+    if (!low)
         return;
 
-    unsigned  width = _DEBUG_draw_full_screen? 256*G_scale : REAL_W,
-             height = _DEBUG_draw_full_screen? 256*G_scale : REAL_H;
+    unsigned  width = low->_DEBUG_draw_full_screen? FB_WIDTH  : SCR_W,
+             height = low->_DEBUG_draw_full_screen? FB_HEIGHT : SCR_H;
+
+    /* the background is the lightest shade, so only draw the rest */
+    XFillRectangle (low->conn,
+                    low->buffer,
+                    low->palette[0],
+                    0,0,
+                    width * low->scale,height * low->scale);
+
+    const BYTE *framebuffer = gb->display.framebuffer;
+    for (unsigned y = 0; y < height; ++y)
+        for (unsigned x = 0; x < width; ++x) {
+            BYTE shade = framebuffer[(y * FB_WIDTH) + x];
+            if (shade)
+                XFillRectangle (low->conn,
+                                low->buffer,
+                                low->palette[shade & 3],
+                                x * low->scale,y * low->scale,
+                                low->scale,low->scale);
+        }
 
-    XCopyArea (conn,
-               buffer, window,
-               palette[0],
+    XCopyArea (low->conn,
+               low->buffer, low->window,
+               low->palette[0],
                0,0,
-               width,height,
+               width * low->scale,height * low->scale,
                0,0);
 
-    XFlush (conn);
+    XFlush (low->conn);
 
-    low_clearscreen();
+    if (low->latency_pending) {
+        double latency = millis() - low->key_time;
+        low->key_frames++;
+
+        if (screen_changed (gb, low->key_screen)) {
+            low->latency_samples++;
+            low->latency_frames += low->key_frames;
+            low->latency_total  += latency;
+            if (latency > low->latency_max)
+                low->latency_max = latency;
+            low->latency_pending = false;
+        }
+        else if (latency > LATENCY_TIMEOUT)
+            low->latency_pending = false;
+    }
 }
 
-/* INTERNAL FNs */
-/* low_clearscreen:  */
-void low_clearscreen(void) {
-    if (!initialized)
+/* low_print_latency: print how long button presses took to show on the screen */
+void low_print_latency (gb_t *gb) {
+    struct low *low = gb->low;
+    if (!low)
         return;
 
-    XFillRectangle (conn,
-                    buffer,
-                    white,
-                    0,0,
-                    REAL_W,REAL_H);
+    if (low->latency_samples == 0) {
+        fputs ("input latency: no button changes showed on the screen\n", stderr);
+        return;
+    }
+    fprintf (stderr, "input latency: %lu changes, %.1f ms (%.2f frames) on average, %.1f ms at most\n",
+             low->latency_samples,
+             low->latency_total * 1000.0 / low->latency_samples,
+             (double)low->latency_frames / low->latency_samples,
+             low->latency_max * 1000.0);
 }
 
 /* low_cleanup: clean up */
-void low_cleanup(void) {
+void low_cleanup (gb_t *gb) {
+    struct low *low = gb->low;
 
-    if (initialized) {
+    if (low) {
 
-        XFreePixmap (conn, buffer);
-        buffer = -1;
+        XFreePixmap (low->conn, low->buffer);
 
-        for (int i = 0; i < 4; ++i) {
-            XFreeGC (conn, palette[i]);
-            palette[i] = NULL;
-        }
-
-        XFreeGC (conn, white);
-        white = NULL;
+        for (int i = 0; i < 4; ++i)
+            XFreeGC (low->conn, low->palette[i]);
 
-        XCloseDisplay (conn);
-        conn = NULL;
+        XCloseDisplay (low->conn);
 
-        initialized = false;
+        free (low);
+        gb->low = NULL;
     }
-    else
-        error ("attempt to call low_cleanup after already cleaned!");
 }
-
@@ -8,24 +8,25 @@
 #define __LOW_H
 
 
-#include <X11/keysym.h>
-#include <X11/X.h>
-#include <stdbool.h>
+#include "common.h"
 
+#include <stdbool.h>
 
 
-typedef KeySym KeyID;
 
+/* the X connection, window, etc. of an emulator instance (see low.c) */
+struct low;
 
-/* defined in low.c, used in Z80.c */
-extern unsigned G_scale;
 
-void low_initdisplay(void);
+void low_initdisplay (gb_t *gb);
+void low_cleanup (gb_t *gb);
 
-void low_wholeboard(void);
+void low_wholeboard (gb_t *gb);
+BYTE low_buttons (gb_t *gb);
+bool low_rewinding (gb_t *gb);
 
-void low_drawpixel (unsigned x, unsigned y, unsigned ind);
-void low_update(void);
+void low_update (gb_t *gb);
+void low_print_latency (gb_t *gb);
 
 
 #endif
@@ -3,37 +3,171 @@
  *
  */
 
-#include "io.h"
+#include "gb.h"
 #include "Z80.h"
-#include "alarm.h"
+#include "low.h"
+#include "input.h"
 #include "common.h"
-#include "display.h"
+#include "debugger.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "movie.h"
+#include "audio.h"
+#include "sync.h"
+#include "link.h"
+#include "serial.h"
+#include "cpu.h"
+
+#include <stdio.h>
 
 
 
 /* Gameboy emulator */
 int main (int argc, char *argv[]) {
 
-    char *ROM_name = Z80_args (argc, argv);
+    gb_t *gb = Z80_create();
+    if (!gb) {
+        fprintf (stderr, "failed to allocate an emulator instance\n");
+        die();
+    }
+
+    char *ROM_name = Z80_args (gb, argc, argv);
     if (!ROM_name)
         die();
 
-    Z80_load (ROM_name);
-    Z80_init();
+    /* (before loading, which prints the ROM's info -- to stderr, if the sound is going to stdout) */
+    struct audio *out = NULL;
+    if (gb->audio_name && !(out = audio_open (gb->audio_name, gb->sample_rate? gb->sample_rate : APU_RATE))) {
+        fprintf (stderr, "failed to open '%s' for the sound\n", gb->audio_name);
+        die();
+    }
+
+    if (!Z80_load (gb, ROM_name)) {
+        fprintf (stderr, "failed to load '%s'\n", ROM_name);
+        die();
+    }
+    if (!Z80_init (gb)) {
+        fprintf (stderr, gb->use_bios? "failed to start up (is the BIOS in errata/DMG_ROM.bin?)\n" : "failed to start up\n");
+        die();
+    }
+
+    /* (which can wait for the other end to turn up) */
+    struct link *ln = NULL;
+    if (gb->link_address) {
+        if (!(ln = link_open (gb, gb->link_address))) {
+            fprintf (stderr, "failed to plug in the link cable at '%s'\n", gb->link_address);
+            die();
+        }
+        /* (the other end can't go back in time) */
+        if (gb->runahead > 0)
+            fprintf (stderr, "running ahead is off with a link cable\n");
+        gb->rewind_budget = 0;
+        if (gb->runahead > 0)
+            gb->runahead = 0;
+    }
+
+    /* the frontend: the key bindings + input sources, an X window + the readline debugger */
+    gb->input = input_create (gb);
+    if (!gb->input)
+        die();
+    low_initdisplay (gb);
+    debug_init (gb);
+    gb->debugger = debug_prompt;
 
-    mkalarm_cycle (456, display_scanline);
+    struct movie *mv = NULL;
+    if (gb->movie_name) {
+        mv = gb->movie_recording? movie_record (gb, gb->movie_name) : movie_play (gb, gb->movie_name);
+        if (!mv) {
+            fprintf (stderr, "failed to %s the movie '%s'\n", gb->movie_recording? "record" : "play", gb->movie_name);
+            die();
+        }
+        gb->replaying = !gb->movie_recording;
+    }
 
+    /* (a movie can't go backwards) */
+    struct rewind *rw = NULL;
+    if (!mv && gb->rewind_budget && !(rw = rewind_create (gb, gb->rewind_budget)))
+        fprintf (stderr, "failed to allocate the rewind buffer, so rewinding is off\n");
+
+    /* the frames are paced by the sound card, if it can say how much it has left to play,
+     * or by the clock */
+    gb->sync = sync_create (out, gb->audio_latency? gb->audio_latency : SYNC_DEFAULT_LATENCY);
+    if (!gb->sync) {
+        fprintf (stderr, "failed to set up the pacing\n");
+        die();
+    }
+
+    struct runahead *ra = NULL;
+    if (gb->runahead > 0 && !(ra = runahead_create (gb, gb->runahead, gb->runahead_thread)))
+        fprintf (stderr, "failed to set up running ahead, so it's off\n");
+
+
+    /* what's sent over serial (a test ROM's results, say) goes to stderr a frame at a time */
+    size_t sent = 0;
 
     /* TODO: fix ^D not exiting debugger properly */
-    while (G_state.running) {
-        Z80_frame();
+    while (gb->state.running) {
+        /* the buttons are only ever read (or recorded) between frames --
+         * the keyboard's + every input source's are held */
+        low_wholeboard (gb);
+        BYTE buttons = low_buttons (gb) | input_frame (gb->input);
+        if (!gb->replaying)
+            IO_set_buttons (gb, buttons);
+        if (!gb->state.running)
+            break;
+
+        /* the framebuffer isn't kept, so each frame of rewinding
+         * loads an older state and runs the frame after it again */
+        bool rewinding = rw && low_rewinding (gb) && rewind_pop (rw, gb);
+
+        if (mv && !movie_frame (mv, gb)) {
+            fprintf (stderr, "the movie is over (%lu frames)\n", movie_length (mv));
+            movie_close (mv);
+            mv = NULL;
+            gb->replaying = false;
+        }
+
+        if (ra)
+            runahead_begin (ra, gb);
+        Z80_frame (gb);
+
+        size_t length;
+        const char *output = serial_output (gb, &length);
+        if (length > sent) {
+            fwrite (output + sent, 1, length - sent, stderr);
+            sent = length;
+        }
+
+        if (rw && !rewinding)
+            rewind_push (rw, gb);
+        if (ra)
+            runahead_frame (ra, gb);
         /* FIXME: stopgap to fix ^D bug */
-        if (G_state.running == false)
+        if (gb->state.running == false)
             break;
-        IO_update();
+        low_update (gb);
     }
-    Z80_cleanup();
+
+    /* (--runahead=0 just measures the latency) */
+    if (gb->runahead >= 0)
+        low_print_latency (gb);
+    sync_print_metrics (gb->sync);
+    if (cpu_locked_up (gb))
+        fprintf (stderr, "the game locked up (%s)\n", cpu_locked_up (gb));
+    else if (serial_stopped (gb))
+        fprintf (stderr, "stopped on '%s'\n", serial_stopped (gb));
+
+    movie_close (mv);
+    sync_destroy (gb->sync);
+    gb->sync = NULL;
+    audio_close (out);
+    link_destroy (ln);
+    runahead_destroy (ra);
+    rewind_destroy (rw);
+    debug_cleanup (gb);
+    low_cleanup (gb);
+    input_destroy (gb->input);
+    Z80_cleanup (gb);
 
     return 0;
 }
-
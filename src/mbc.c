@@ -0,0 +1,538 @@
+/*
+ * Gameboy memory bank controllers
+ *
+ */
+
+#include "mbc.h"
+#include "gb.h"
+#include "alarm.h"      /* get_cycle_count */
+#include "logging.h"
+
+#include <string.h>     /* memset */
+#include <time.h>       /* time */
+
+
+
+/* the mapper state of the instance being run (every function here has a gb) */
+#define regs    (gb->mapper.regs)
+#define rtc     (gb->mapper.rtc)
+
+/* MBC3 real time clock -- it runs off the emulated clock (so it keeps up with
+ * fast-forward, and replays are deterministic), and is only brought up to date
+ * when it's latched or written */
+#define RTC_FREQUENCY   4194304             /* cycles per second */
+#define RTC_DAY         (24 * 60 * 60)
+
+enum rtc_registers { RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH };
+
+
+static void   regs_reset (gb_t *gb);
+static size_t regs_save (gb_t *gb, BYTE *buf);
+static bool   regs_load (gb_t *gb, const BYTE *buf, size_t size);
+
+static void none_reset (gb_t *gb);
+static void none_write (gb_t *gb, WORD location, BYTE byte);
+static void none_map_pages (gb_t *gb);
+
+static void mbc1_write (gb_t *gb, WORD location, BYTE byte);
+static void mbc1_map_ROM (gb_t *gb);
+static void mbc1_map_RAM (gb_t *gb);
+static void mbc1_map_pages (gb_t *gb);
+
+static void mbc2_write (gb_t *gb, WORD location, BYTE byte);
+
+static void mbc3_write (gb_t *gb, WORD location, BYTE byte);
+static void mbc3_map_RAM (gb_t *gb);
+static void mbc3_map_pages (gb_t *gb);
+
+static void   rtc_reset (gb_t *gb);
+static void   rtc_sync (gb_t *gb);
+static void   rtc_get (gb_t *gb, BYTE r[5]);
+static void   rtc_set (gb_t *gb, const BYTE r[5]);
+static bool   rtc_mapped (gb_t *gb);
+static BYTE   rtc_read (gb_t *gb, WORD location);
+static void   rtc_write (gb_t *gb, WORD location, BYTE byte);
+static size_t rtc_save (gb_t *gb, BYTE *buf);
+static bool   rtc_load (gb_t *gb, const BYTE *buf, size_t size);
+static void   rtc_save_footer (gb_t *gb, BYTE *footer);
+static void   rtc_load_footer (gb_t *gb, const BYTE *footer);
+
+static void mbc5_write (gb_t *gb, WORD location, BYTE byte);
+static void rumble_write (gb_t *gb, WORD location, BYTE byte);
+
+static void simple_map_pages (gb_t *gb);
+
+
+
+static const struct mbc mbc_none = {
+    .name = "ROM ONLY", .reset = none_reset, .write = none_write, .map_pages = none_map_pages,
+    .save = regs_save, .load = regs_load,
+};
+static const struct mbc mbc_mbc1 = {
+    .name = "MBC1", .reset = regs_reset, .write = mbc1_write, .map_pages = mbc1_map_pages,
+    .save = regs_save, .load = regs_load,
+};
+static const struct mbc mbc_mbc2 = {
+    .name = "MBC2", .reset = regs_reset, .write = mbc2_write, .map_pages = simple_map_pages,
+    .save = regs_save, .load = regs_load, .builtin_RAM = true,
+};
+static const struct mbc mbc_mbc3 = {
+    .name = "MBC3", .reset = regs_reset, .write = mbc3_write, .map_pages = mbc3_map_pages,
+    .save = regs_save, .load = regs_load,
+};
+static const struct mbc mbc_mbc3_rtc = {
+    .name = "MBC3+TIMER", .reset = rtc_reset, .write = mbc3_write, .map_pages = mbc3_map_pages,
+    .save = rtc_save, .load = rtc_load,
+    .RAM_read = rtc_read, .RAM_write = rtc_write,
+    /* the usual RTC footer: 5 current + 5 latched registers (32 bits each), 64 bit timestamp */
+    .footer_size = 48, .save_footer = rtc_save_footer, .load_footer = rtc_load_footer,
+};
+static const struct mbc mbc_mbc5 = {
+    .name = "MBC5", .reset = regs_reset, .write = mbc5_write, .map_pages = simple_map_pages,
+    .save = regs_save, .load = regs_load,
+};
+static const struct mbc mbc_rumble = {
+    .name = "MBC5+RUMBLE", .reset = regs_reset, .write = rumble_write, .map_pages = simple_map_pages,
+    .save = regs_save, .load = regs_load,
+};
+
+
+
+/* PUBLIC API */
+/* mbc_find: get the mapper for a cart type ($0147), or NULL if it isn't supported */
+const struct mbc *mbc_find (BYTE cart_type, bool *battery) {
+
+    const struct mbc *mbc = NULL;
+    bool batt = false;
+
+    switch (cart_type) {
+    case 0x00:                                          // ROM ONLY
+    case 0x08: mbc = &mbc_none;    break;               // ROM+RAM
+    case 0x09: mbc = &mbc_none;    batt = true; break;  // ROM+RAM+BATTERY
+
+    case 0x01:                                          // ROM+MBC1
+    case 0x02: mbc = &mbc_mbc1;    break;               // ROM+MBC1+RAM
+    case 0x03: mbc = &mbc_mbc1;    batt = true; break;  // ROM+MBC1+RAM+BATT
+
+    case 0x05: mbc = &mbc_mbc2;    break;               // ROM+MBC2
+    case 0x06: mbc = &mbc_mbc2;    batt = true; break;  // ROM+MBC2+BATTERY
+
+    case 0x0F: mbc = &mbc_mbc3_rtc;batt = true; break;  // ROM+MBC3+TIMER+BATT
+    case 0x10: mbc = &mbc_mbc3_rtc;batt = true; break;  // ROM+MBC3+TIMER+RAM+BATT
+    case 0x11:                                          // ROM+MBC3
+    case 0x12: mbc = &mbc_mbc3;    break;               // ROM+MBC3+RAM
+    case 0x13: mbc = &mbc_mbc3;    batt = true; break;  // ROM+MBC3+RAM+BATT
+
+    case 0x19:                                          // ROM+MBC5
+    case 0x1A: mbc = &mbc_mbc5;    break;               // ROM+MBC5+RAM
+    case 0x1B: mbc = &mbc_mbc5;    batt = true; break;  // ROM+MBC5+RAM+BATT
+
+    case 0x1C:                                          // ROM+MBC5+RUMBLE
+    case 0x1D: mbc = &mbc_rumble;  break;               // ROM+MBC5+RUMBLE+SRAM
+    case 0x1E: mbc = &mbc_rumble;  batt = true; break;  // ROM+MBC5+RUMBLE+SRAM+BATT
+
+    case 0xFF: mbc = &mbc_mbc1;    batt = true; break;  // Hudson HuC-1 (basically an MBC1)
+
+    case 0x0B:                                          // ROM+MMM01
+    case 0x0C:                                          // ROM+MMM01+SRAM
+    case 0x0D:                                          // ROM+MMM01+SRAM+BATT
+    case 0x1F:                                          // Pocket Camera
+    case 0xFD:                                          // Bandai TAMA5
+    case 0xFE:                                          // Hudson HuC-3
+        error ("unsupported memory controller ($%.2hhX)", cart_type);
+        return NULL;
+
+    default:
+        error ("unknown memory controller ($%.2hhX)", cart_type);
+        return NULL;
+    }
+
+    *battery = batt;
+    return mbc;
+}
+
+/* mbc_logging:  */
+void mbc_logging (bool enable) {
+    LOG_DOLOG = enable;
+}
+
+
+
+/* INTERNAL FNs */
+/* regs_reset: power-on registers */
+static void regs_reset (gb_t *gb) {
+    memset (&regs, 0, sizeof(regs));
+    regs.ROMbank = 1;
+}
+
+/* regs_save: save the registers */
+static size_t regs_save (gb_t *gb, BYTE *buf) {
+    buf[0] = regs.RAM_enabled;
+    buf[1] = regs.mode;
+    buf[2] = regs.RAMbank;
+    buf[3] = regs.ROMbank & 0xFF;
+    buf[4] = regs.ROMbank >> 8;
+    return 5;
+}
+
+/* regs_load: load saved registers */
+static bool regs_load (gb_t *gb, const BYTE *buf, size_t size) {
+    if (size < 5)
+        return false;
+
+    regs.RAM_enabled = buf[0] & 1;
+    regs.mode        = buf[1] & 1;
+    regs.RAMbank     = buf[2];
+    regs.ROMbank     = buf[3] | (buf[4] << 8);
+    return true;
+}
+
+/* simple_map_pages: one ROM bank register, one RAM bank register */
+static void simple_map_pages (gb_t *gb) {
+    mem_map_ROMbank (gb, regs.ROMbank);
+    mem_map_RAMbank (gb, regs.RAMbank, regs.RAM_enabled);
+}
+
+
+/* ROM only carts can have up to 8kB of RAM, which is always there */
+static void none_reset (gb_t *gb) {
+    regs_reset (gb);
+    regs.RAM_enabled = true;
+}
+
+static void none_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)gb;
+    debug ("ROM ONLY CART! (wrote %.2hhX to %.4hX)", byte, location);
+}
+
+static void none_map_pages (gb_t *gb) {
+    mem_map_ROMbank (gb, 1);
+    mem_map_RAMbank (gb, 0, true);
+}
+
+
+/* MBC1 (and HuC-1): $2000-$3FFF selects bits 0-4 of the ROM bank, and the 2 bits written to
+ * $4000-$5FFF are bits 5-6 of the ROM bank -- and the RAM bank too, in mode 1 */
+static void mbc1_write (gb_t *gb, WORD location, BYTE byte) {
+
+    switch (location >> 13) {
+    /* RAM enable/disable */
+    case 0:
+        regs.RAM_enabled = ((byte & 0xF) == 0xA);
+        debug ("%sabled RAM", regs.RAM_enabled? "en" : "dis");
+        mbc1_map_RAM (gb);
+        break;
+
+    /* ROM bank bits 0-4 (0 and 1 both select bank 1) */
+    case 1:
+        regs.ROMbank = byte & 31;
+        if (regs.ROMbank == 0)
+            regs.ROMbank = 1;
+        mbc1_map_ROM (gb);
+        break;
+
+    /* ROM bank bits 5-6/RAM bank */
+    case 2:
+        regs.RAMbank = byte & 3;
+        mbc1_map_ROM (gb);
+        mbc1_map_RAM (gb);
+        break;
+
+    /* mode select: 0 = 2MB ROM/8kB RAM, 1 = 512kB ROM/32kB RAM */
+    case 3:
+        regs.mode = byte & 1;
+        debug ("SET MBC MODE TO %i", regs.mode);
+        mbc1_map_RAM (gb);
+        break;
+    }
+}
+
+static void mbc1_map_ROM (gb_t *gb) {
+    unsigned bank = (regs.RAMbank << 5) | regs.ROMbank;
+    debug ("SWITCHED TO ROM BANK %u", bank);
+    mem_map_ROMbank (gb, bank);
+}
+
+static void mbc1_map_RAM (gb_t *gb) {
+    unsigned bank = regs.mode? regs.RAMbank : 0;
+    debug ("SWITCHED TO RAM BANK %u", bank);
+    mem_map_RAMbank (gb, bank, regs.RAM_enabled);
+}
+
+static void mbc1_map_pages (gb_t *gb) {
+    mbc1_map_ROM (gb);
+    mbc1_map_RAM (gb);
+}
+
+
+/* MBC2: everything is at $0000-$3FFF, and bit 8 of the
+ * address says whether it's RAM enable or the ROM bank */
+static void mbc2_write (gb_t *gb, WORD location, BYTE byte) {
+
+    if (location >= 0x4000)
+        return;
+
+    if (!GETBIT (location, 8)) {
+        regs.RAM_enabled = ((byte & 0xF) == 0xA);
+        debug ("%sabled RAM", regs.RAM_enabled? "en" : "dis");
+        mem_map_RAMbank (gb, 0, regs.RAM_enabled);
+    }
+    else {
+        regs.ROMbank = byte & 15;
+        if (regs.ROMbank == 0)
+            regs.ROMbank = 1;
+        debug ("SWITCHED TO ROM BANK %u", regs.ROMbank);
+        mem_map_ROMbank (gb, regs.ROMbank);
+    }
+}
+
+
+/* MBC3: 7 bit ROM bank, 2 bit RAM bank -- RAM banks $08-$0C select the clock registers instead */
+static void mbc3_write (gb_t *gb, WORD location, BYTE byte) {
+
+    switch (location >> 13) {
+    case 0:
+        regs.RAM_enabled = ((byte & 0xF) == 0xA);
+        debug ("%sabled RAM", regs.RAM_enabled? "en" : "dis");
+        mbc3_map_RAM (gb);
+        break;
+
+    /* 0 and 1 both select bank 1 */
+    case 1:
+        regs.ROMbank = byte & 127;
+        if (regs.ROMbank == 0)
+            regs.ROMbank = 1;
+        debug ("SWITCHED TO ROM BANK %u", regs.ROMbank);
+        mem_map_ROMbank (gb, regs.ROMbank);
+        break;
+
+    case 2:
+        regs.RAMbank = byte & 15;
+        debug ("SWITCHED TO RAM BANK %u", regs.RAMbank);
+        mbc3_map_RAM (gb);
+        break;
+
+    /* writing 0 then 1 latches the clock */
+    case 3:
+        if (rtc.latch == 0 && byte == 1) {
+            rtc_sync (gb);
+            rtc_get (gb, rtc.latched);
+            debug ("LATCHED RTC");
+        }
+        rtc.latch = byte;
+        break;
+    }
+}
+
+static void mbc3_map_RAM (gb_t *gb) {
+    if (rtc_mapped (gb) && rtc.present)
+        mem_map_RAMregs (gb, regs.RAM_enabled);
+    else
+        mem_map_RAMbank (gb, regs.RAMbank & 3, regs.RAM_enabled);
+}
+
+static void mbc3_map_pages (gb_t *gb) {
+    mem_map_ROMbank (gb, regs.ROMbank);
+    mbc3_map_RAM (gb);
+}
+
+
+/* rtc_reset: power-on registers, with the clock at 0 */
+static void rtc_reset (gb_t *gb) {
+    regs_reset (gb);
+    memset (&rtc, 0, sizeof(rtc));
+    rtc.present = true;
+    rtc.synced  = get_cycle_count (gb);
+}
+
+/* rtc_sync: bring the clock up to date */
+static void rtc_sync (gb_t *gb) {
+
+    uint64_t now = get_cycle_count (gb);
+    if (!rtc.halted)
+        rtc.time += now - rtc.synced;
+    rtc.synced = now;
+
+    /* the day counter is 9 bits */
+    const uint64_t wrap = 512ULL * RTC_DAY * RTC_FREQUENCY;
+    if (rtc.time >= wrap) {
+        rtc.time %= wrap;
+        rtc.carry = true;
+    }
+}
+
+/* rtc_get: the clock registers (as of the last sync) */
+static void rtc_get (gb_t *gb, BYTE r[5]) {
+
+    uint64_t seconds = rtc.time / RTC_FREQUENCY;
+    unsigned days    = seconds / RTC_DAY;
+
+    r[RTC_S ] = seconds % 60;
+    r[RTC_M ] = (seconds / 60) % 60;
+    r[RTC_H ] = (seconds / (60 * 60)) % 24;
+    r[RTC_DL] = days & 0xFF;
+    r[RTC_DH] = ((days >> 8) & 1) | (rtc.halted << 6) | (rtc.carry << 7);
+}
+
+/* rtc_set: set the clock registers (the sub-second count is kept) */
+static void rtc_set (gb_t *gb, const BYTE r[5]) {
+
+    uint64_t days    = r[RTC_DL] | ((r[RTC_DH] & 1) << 8),
+             seconds = (((days * 24) + (r[RTC_H] & 31)) * 60 + (r[RTC_M] & 63)) * 60 + (r[RTC_S] & 63);
+
+    rtc.time   = (seconds * RTC_FREQUENCY) + (rtc.time % RTC_FREQUENCY);
+    rtc.halted = GETBIT (r[RTC_DH], 6);
+    rtc.carry  = GETBIT (r[RTC_DH], 7);
+}
+
+/* rtc_mapped: whether RAMbank selects a clock register ($08-$0C) */
+static bool rtc_mapped (gb_t *gb) {
+    return regs.RAMbank >= 0x08 && regs.RAMbank <= 0x0C;
+}
+
+/* rtc_read: read the latched register ($FF if it's a RAM bank
+ *           the cart doesn't have that's selected instead) */
+static BYTE rtc_read (gb_t *gb, WORD location) {
+    (void)location;
+    return rtc_mapped (gb)? rtc.latched[regs.RAMbank - 0x08] : 0xFF;
+}
+
+/* rtc_write: set one clock register (or nothing, as for rtc_read) */
+static void rtc_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)location;
+
+    if (!rtc_mapped (gb))
+        return;
+
+    BYTE r[5];
+    rtc_sync (gb);
+    rtc_get (gb, r);
+    r[regs.RAMbank - 0x08] = byte;
+    rtc_set (gb, r);
+
+    /* writing the seconds resets the sub-second count */
+    if (regs.RAMbank - 0x08 == RTC_S)
+        rtc.time -= rtc.time % RTC_FREQUENCY;
+
+    rtc.latched[regs.RAMbank - 0x08] = byte;
+}
+
+/* rtc_save: save the registers + clock */
+static size_t rtc_save (gb_t *gb, BYTE *buf) {
+
+    size_t size = regs_save (gb, buf);
+
+    rtc_sync (gb);
+    for (unsigned i = 0; i < 8; ++i)
+        buf[size++] = rtc.time >> (i * 8);
+    buf[size++] = rtc.halted | (rtc.carry << 1);
+    buf[size++] = rtc.latch;
+    memcpy (buf + size, rtc.latched, 5);
+    return size + 5;
+}
+
+/* rtc_load: load saved registers + clock */
+static bool rtc_load (gb_t *gb, const BYTE *buf, size_t size) {
+
+    if (size < 5 + 15 || !regs_load (gb, buf, size))
+        return false;
+    buf += 5;
+
+    rtc.time = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        rtc.time |= (uint64_t)buf[i] << (i * 8);
+    rtc.halted = buf[8] & 1;
+    rtc.carry  = buf[8] & 2;
+    rtc.latch  = buf[9];
+    memcpy (rtc.latched, buf + 10, 5);
+    rtc.synced = get_cycle_count (gb);
+    return true;
+}
+
+/* rtc_save_footer: save the clock into the .sav footer */
+static void rtc_save_footer (gb_t *gb, BYTE *footer) {
+
+    BYTE r[5];
+    rtc_sync (gb);
+    rtc_get (gb, r);
+
+    memset (footer, 0, 48);
+    for (unsigned i = 0; i < 5; ++i) {
+        footer[i * 4     ] = r[i];
+        footer[i * 4 + 20] = rtc.latched[i];
+    }
+
+    uint64_t now = time (NULL);
+    for (unsigned i = 0; i < 8; ++i)
+        footer[40 + i] = now >> (i * 8);
+}
+
+/* rtc_load_footer: load the clock from the .sav footer -- it kept
+ * running in real time while the emulator wasn't */
+static void rtc_load_footer (gb_t *gb, const BYTE *footer) {
+
+    BYTE r[5];
+    for (unsigned i = 0; i < 5; ++i) {
+        r[i]           = footer[i * 4];
+        rtc.latched[i] = footer[i * 4 + 20];
+    }
+    rtc_set (gb, r);
+
+    uint64_t saved = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        saved |= (uint64_t)footer[40 + i] << (i * 8);
+
+    uint64_t now = time (NULL);
+    if (!rtc.halted && now > saved)
+        rtc.time += (now - saved) * RTC_FREQUENCY;
+
+    rtc.synced = get_cycle_count (gb);
+    rtc_sync (gb);
+}
+
+
+/* MBC5: 9 bit ROM bank split between $2000-$2FFF (bits 0-7) and
+ * $3000-$3FFF (bit 8), 4 bit RAM bank -- and bank 0 can be selected */
+static void mbc5_write (gb_t *gb, WORD location, BYTE byte) {
+
+    switch (location >> 12) {
+    case 0: case 1:
+        regs.RAM_enabled = ((byte & 0xF) == 0xA);
+        debug ("%sabled RAM", regs.RAM_enabled? "en" : "dis");
+        mem_map_RAMbank (gb, regs.RAMbank, regs.RAM_enabled);
+        break;
+
+    case 2:
+        regs.ROMbank = (regs.ROMbank & 256) | byte;
+        debug ("SWITCHED TO ROM BANK %u", regs.ROMbank);
+        mem_map_ROMbank (gb, regs.ROMbank);
+        break;
+
+    case 3:
+        regs.ROMbank = (regs.ROMbank & 255) | ((byte & 1) << 8);
+        debug ("SWITCHED TO ROM BANK %u", regs.ROMbank);
+        mem_map_ROMbank (gb, regs.ROMbank);
+        break;
+
+    case 4: case 5:
+        regs.RAMbank = byte & 15;
+        debug ("SWITCHED TO RAM BANK %u", regs.RAMbank);
+        mem_map_RAMbank (gb, regs.RAMbank, regs.RAM_enabled);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* rumble carts are MBC5s with bit 3 of the RAM bank driving the motor */
+static void rumble_write (gb_t *gb, WORD location, BYTE byte) {
+
+    if (between (location, 0x4000, 0x5FFF)) {
+        if (byte & (1 << 3))
+            puts ("--RUMBLE--");
+        byte &= 7;
+    }
+
+    mbc5_write (gb, location, byte);
+}
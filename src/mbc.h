@@ -0,0 +1,88 @@
+/*
+ * Gameboy memory bank controllers
+ *
+ */
+
+#ifndef __MBC_H
+#define __MBC_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/* the most mapper state save() will write */
+#define MBC_STATE_SIZE  64
+
+/* mapper:
+ *  the mapper state of an emulator instance
+ */
+struct mapper {
+    /* mapper registers -- what they mean depends on the mapper, but
+     * every mapper so far has (some of) these */
+    struct {
+        bool     RAM_enabled;
+        bool     mode;
+        unsigned ROMbank;   /* the $2000-$3FFF register(s) */
+        unsigned RAMbank;   /* the $4000-$5FFF register    */
+    } regs;
+
+    /* MBC3 real time clock (see mbc.c) */
+    struct {
+        uint64_t time;      /* cycles counted by the clock... */
+        uint64_t synced;    /* ...as of this cycle count      */
+        bool     present;   /* only MBC3+TIMER carts have one */
+        bool     halted;
+        bool     carry;     /* day counter overflowed */
+        BYTE     latch;     /* last write to $6000-$7FFF */
+        BYTE     latched[5];
+    } rtc;
+};
+
+/* a memory bank controller -- one of these is picked when the cart is loaded,
+ * and it takes care of all writes to $0000-$7FFF */
+struct mbc {
+    const char *name;
+
+    /* reset: power-on state */
+    void   (*reset) (gb_t *gb);
+    /* write: a write to the cart ROM area */
+    void   (*write) (gb_t *gb, WORD location, BYTE byte);
+    /* map_pages: map the current banks (the page tables have just been cleared) */
+    void   (*map_pages) (gb_t *gb);
+    /* save/load: mapper state -- save returns how much of buf it used */
+    size_t (*save) (gb_t *gb, BYTE *buf);
+    bool   (*load) (gb_t *gb, const BYTE *buf, size_t size);
+    /* tick: emulated time has passed (can be NULL) */
+    void   (*tick) (gb_t *gb, unsigned cycles);
+
+    /* RAM_read/RAM_write: registers the mapper has switched
+     * in at $A000-$BFFF instead of a RAM bank (can be NULL) */
+    BYTE   (*RAM_read) (gb_t *gb, WORD location);
+    void   (*RAM_write) (gb_t *gb, WORD location, BYTE byte);
+
+    /* builtin_RAM: the mapper has a RAM bank of its own (MBC2's 512 nibbles) */
+    bool   builtin_RAM;
+
+    /* save_footer/load_footer: state kept after the RAM in the .sav file */
+    size_t footer_size;
+    void   (*save_footer) (gb_t *gb, BYTE *footer);
+    void   (*load_footer) (gb_t *gb, const BYTE *footer);
+};
+
+
+
+const struct mbc *mbc_find (BYTE cart_type, bool *battery);
+void mbc_logging (bool enable);
+
+/* used by the mappers, defined in mem.c */
+void mem_map_ROMbank (gb_t *gb, unsigned bank);
+void mem_map_RAMbank (gb_t *gb, unsigned bank, bool enabled);
+void mem_map_RAMregs (gb_t *gb, bool enabled);
+
+
+#endif
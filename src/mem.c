@@ -5,78 +5,171 @@
 /* FIXME: There seems to be some problems with banking */
 
 #include "mem.h"
+#include "gb.h"
+#include "mbc.h"
+#include "arena.h"
 #include "logging.h"
+#include "registers.h"
 
-#include "io.h"         /* IO_btndown, IO_update */
-#include "cpu.h"        /* cpu_interrupt */
-#include "Z80.h"        /* Z80_update_timer_frequency */
+#include "io.h"         /* struct io */
+#include "cpu.h"        /* cpu_interrupt, cpu_update_interrupts */
+#include "Z80.h"        /* Z80_timer_read, Z80_timer_write */
+#include "apu.h"        /* apu_read, apu_write */
+#include "serial.h"     /* serial_read, serial_write */
+#include "alarm.h"      /* mkalarm_cycle, get_cycle_count */
 
 #include <fcntl.h>      /* open */
 #include <stdlib.h>     /* malloc, etc. */
-#include <string.h>     /* memcmp */
-#include <unistd.h>     /* lseek, close */
-#include <sys/mman.h>   /* mmap */
+#include <stddef.h>     /* offsetof */
+#include <string.h>     /* memcmp, memcpy */
+#include <endian.h>     /* le16toh, htole16 */
+#include <unistd.h>     /* pread, close */
+#include <sys/mman.h>   /* mmap, madvise */
+#include <sys/stat.h>   /* fstat */
 #include <assert.h>     /* assert */
-
-
-/* banking stuff */
-static enum {
-    MMU_UNSUP = -2,
-    MMU_UNKN  = -1,
-    MMU_NONE  =  0,
-
-    MMU_MBC1  =  1,
-    MMU_MBC2  =  2,
-    MMU_MBC3  =  3,
-    MMU_MBC5  =  5,
-
-    MMU_RMBL,   /* rumble carts are basically MBC5s */
-    MMU_HUC1,   /* HUC-1s are basically MBC1s       */
-} MBC_type;
-
-static bool MBC_mode,
-            RAM_enabled = true;
-
-/* memory areas */
-static BYTE **RAMbank;
-static BYTE **ROMbank;
-static BYTE *RAM;
-
-static unsigned ROMbankcount = 0,
-                RAMbankcount = 0,
-                ROMbank_i = 1,
-                RAMbank_i = 0;
-
-static bool MODE_STARTUP = false;
-static BYTE bios[256];
-
-
-static void alloc_memory_regions (BYTE *cart);
+#include <pthread.h>    /* pthread_create, pthread_cond_timedwait */
+#include <stdatomic.h>  /* atomic_bool */
+#include <time.h>       /* clock_gettime */
+
+
+/* MBC5 has 9 bits of ROM bank number */
+#define MAX_ROM_BANKS   512
+
+/* OAM DMA takes 162 (machine) cycles */
+#define DMA_SETUP_CYCLES    8
+#define DMA_CYCLES          (DMA_SETUP_CYCLES + (0xA0 * 4))
+
+/* a thread msyncs the .sav mapping every SAVE_SYNC_SECONDS while it's
+ * dirty, or when the game disables cart RAM (which is how games finish a save) */
+#define SAVE_SYNC_SECONDS   5
+
+
+static inline BYTE *ram_ptr (gb_t *gb, WORD location);
+static inline void mark_dirty (gb_t *gb, const BYTE *p);
+static void dirty_reset (gb_t *gb, bool all);
+static bool map_ROM (gb_t *gb, int fd, off_t file_size);
+static bool copy_ROM (gb_t *gb, const BYTE *rom, size_t size);
+static bool map_cart_RAM (gb_t *gb);
+static void map_save (gb_t *gb, const char *fname);
+static void *save_sync (void *instance);
+static void save_RAM_toggled (gb_t *gb);
+static void map_pages (gb_t *gb);
+static bool alloc_memory_regions (gb_t *gb, const BYTE *cart, off_t file_size);
+static unsigned pow2_mask (unsigned n);
 static void print_ROM_info (BYTE *cart);
-static void trap_register_write (WORD location, BYTE byte);
-static void trap_ROM_write (WORD location, BYTE byte);
-static BYTE readinput (BYTE button_set);
-static BYTE get_serial_byte(void);
-
-
-
-/* mem_cleanup:  */
-static void mem_cleanup(void) {
-
-    free (RAM);
-    RAM = NULL;
-
-    for (unsigned i = 0; i < ROMbankcount; ++i)
-        free (ROMbank[i]);
-    free (ROMbank);
+static BYTE io_read (gb_t *gb, WORD location);
+static void io_write (gb_t *gb, WORD location, BYTE byte);
+static BYTE readinput (gb_t *gb, BYTE button_set);
+
+static void joypad_write (gb_t *gb, WORD location, BYTE byte);
+static void interrupts_write (gb_t *gb, WORD location, BYTE byte);
+static void DMA_write (gb_t *gb, WORD location, BYTE byte);
+static void BIOS_write (gb_t *gb, WORD location, BYTE byte);
+
+static void DMA_finish (gb_t *gb);
+static void DMA_map (gb_t *gb);
+static bool DMA_conflict (gb_t *gb, WORD location);
+static BYTE DMA_conflict_read (gb_t *gb, WORD location);
+
+
+
+/* IO register table for $FF00-$FFFF, indexed by the low byte of the address */
+/* NOTE: the ranges set up the defaults, which the entries after them override */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const struct io_register io_registers[0x100] = {
+    [0x00 ... 0x7F] = { "IO"      , NULL          , NULL            , 0xFF, false },
+    [0x80 ... 0xFE] = { "HRAM"    , NULL          , NULL            , 0xFF, false },
+
+    [R_JOYPAD  & 0xFF] = { "JOYPAD"  , NULL          , joypad_write    , 0x30, true  },
+    [R_SIODATA & 0xFF] = { "SIODATA" , NULL          , NULL            , 0xFF, false },
+    [R_SIOCONT & 0xFF] = { "SIOCONT" , serial_read   , serial_write    , 0x81, true  },
+
+    [R_DIVIDER & 0xFF] = { "DIVIDER" , Z80_timer_read, Z80_timer_write , 0x00, true  },
+    [R_TIMECNT & 0xFF] = { "TIMECNT" , Z80_timer_read, Z80_timer_write , 0xFF, true  },
+    [R_TIMEMOD & 0xFF] = { "TIMEMOD" , NULL          , Z80_timer_write , 0xFF, true  },
+    [R_TIMCONT & 0xFF] = { "TIMCONT" , NULL          , Z80_timer_write , 0x07, true  },
+
+    [R_IFLAGS  & 0xFF] = { "IFLAGS"  , NULL          , interrupts_write, 0x1F, true  },
+    [0x10 ... 0x26]    = { "IO"      , apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG10& 0xFF] = { "SNDREG10", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG11& 0xFF] = { "SNDREG11", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG12& 0xFF] = { "SNDREG12", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG13& 0xFF] = { "SNDREG13", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG14& 0xFF] = { "SNDREG14", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG21& 0xFF] = { "SNDREG21", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG22& 0xFF] = { "SNDREG22", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG23& 0xFF] = { "SNDREG23", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG24& 0xFF] = { "SNDREG24", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG30& 0xFF] = { "SNDREG30", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG31& 0xFF] = { "SNDREG31", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG32& 0xFF] = { "SNDREG32", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG33& 0xFF] = { "SNDREG33", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG34& 0xFF] = { "SNDREG34", apu_read      , apu_write       , 0x00, true  },
+
+    [R_SNDREG41& 0xFF] = { "SNDREG41", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG42& 0xFF] = { "SNDREG42", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG43& 0xFF] = { "SNDREG43", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG44& 0xFF] = { "SNDREG44", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG50& 0xFF] = { "SNDREG50", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG51& 0xFF] = { "SNDREG51", apu_read      , apu_write       , 0x00, true  },
+    [R_SNDREG52& 0xFF] = { "SNDREG52", apu_read      , apu_write       , 0x00, true  },
+    [0x30 ... 0x3F]    = { "WAVERAM" , NULL          , apu_write       , 0x00, true  },
+
+    [R_LCDCONT & 0xFF] = { "LCDCONT" , NULL          , NULL            , 0xFF, false },
+    [R_LCDSTAT & 0xFF] = { "LCDSTAT" , NULL          , NULL            , 0x78, false },
+    [R_SCROLLY & 0xFF] = { "SCROLLY" , NULL          , NULL            , 0xFF, false },
+    [R_SCROLLX & 0xFF] = { "SCROLLX" , NULL          , NULL            , 0xFF, false },
+    [R_CURLINE & 0xFF] = { "CURLINE" , NULL          , NULL            , 0x00, false },
+    [R_CMPLINE & 0xFF] = { "CMPLINE" , NULL          , NULL            , 0xFF, false },
+    [R_DMACONT & 0xFF] = { "DMACONT" , NULL          , DMA_write       , 0xFF, true  },
+    [R_BGRDPAL & 0xFF] = { "BGRDPAL" , NULL          , NULL            , 0xFF, false },
+    [R_OBJ0PAL & 0xFF] = { "OBJ0PAL" , NULL          , NULL            , 0xFF, false },
+    [R_OBJ1PAL & 0xFF] = { "OBJ1PAL" , NULL          , NULL            , 0xFF, false },
+    [R_WNDPOSY & 0xFF] = { "WNDPOSY" , NULL          , NULL            , 0xFF, false },
+    [R_WNDPOSX & 0xFF] = { "WNDPOSX" , NULL          , NULL            , 0xFF, false },
+    [R_BIOSROM & 0xFF] = { "BIOSROM" , NULL          , BIOS_write      , 0xFF, true  },
+
+    [R_ISWITCH & 0xFF] = { "ISWITCH" , NULL          , interrupts_write, 0xFF, true  },
+};
+#pragma GCC diagnostic pop
+
+
+
+/* mem_cleanup: unmap the ROM + flush the save */
+void mem_cleanup (gb_t *gb) {
+
+    if (gb->mem.ROMmap)
+        munmap (gb->mem.ROMmap, gb->mem.ROMmap_size);
+    gb->mem.ROMmap = NULL;
+    free (gb->mem.ROMbank);
+
+    /* stop the sync thread, and flush the save one last time */
+    if (gb->mem.SAVmap) {
+        pthread_mutex_lock (&gb->mem.save_lock);
+        gb->mem.save_quit = true;
+        pthread_cond_signal (&gb->mem.save_kick);
+        pthread_mutex_unlock (&gb->mem.save_lock);
+        if (gb->mem.save_threaded)
+            pthread_join (gb->mem.save_thread, NULL);
+        pthread_cond_destroy  (&gb->mem.save_kick);
+        pthread_mutex_destroy (&gb->mem.save_lock);
+
+        if (gb->mem.SAVfooter)
+            gb->mem.mbc->save_footer (gb, gb->mem.SAVfooter);
+        msync (gb->mem.SAVmap, gb->mem.SAVmap_size, MS_SYNC);
+    }
+    gb->mem.SAVmap = gb->mem.SAVfooter = NULL;
 
-    for (unsigned i = 0; i < RAMbankcount; ++i)
-        free (RAMbank[i]);
-    free (RAMbank);
+    free (gb->mem.RAMbank);
+    gb->mem.ROMbank = gb->mem.RAMbank = NULL;
+    free (gb->mem.dirty);
+    gb->mem.dirty = NULL;
+    arena_destroy (gb);
 }
 
-/* mem_init:  */
-void mem_init (bool use_bootROM) {
+/* mem_init: returns false if the BIOS can't be loaded */
+bool mem_init (gb_t *gb, bool use_bootROM) {
 
     /*          MEMORY MAP
      *          ==========
@@ -110,55 +203,127 @@ void mem_init (bool use_bootROM) {
     if (use_bootROM) {
 
         FILE *biosfile = fopen ("errata/DMG_ROM.bin", "r");
-        if (!biosfile)
-            fatal ("failed to open BIOS");
+        if (!biosfile) {
+            error ("failed to open BIOS");
+            return false;
+        }
 
-        fread (bios, 1, 0x100, biosfile);
+        fread (gb->mem.bios, 1, 0x100, biosfile);
         fclose (biosfile);
 
-        MODE_STARTUP = true;
+        gb->mem.MODE_STARTUP = true;
     }
     else
-        MODE_STARTUP = false;
+        gb->mem.MODE_STARTUP = false;
+
+    gb->mem.DMA_alarm = mkalarm_cycle (gb, -1, DMA_finish);
 
-    atexit (mem_cleanup);
+    map_pages (gb);
+    return true;
 }
 
-/* mem_loadcart: load the cartridge into memory */
-void mem_loadcart (char *fname) {
+/* mem_loadcart: load the cartridge into memory -- returns false if it can't be */
+bool mem_loadcart (gb_t *gb, char *fname) {
 
-    FILE *cart_file = fopen (fname, "r");
-    if (cart_file == NULL)
-        fatal ("failed to load '%s'", fname);
+    int cart_file = open (fname, O_RDONLY);
+    if (cart_file < 0) {
+        error ("failed to open '%s'", fname);
+        return false;
+    }
 
-    /* alloc + read ROM information area */
-    BYTE *buf = calloc (1, 0x150);
-    fseek (cart_file, 0L, SEEK_SET);
-    fread (buf, sizeof(BYTE), 0x150, cart_file);
-    fseek (cart_file, 0L, SEEK_SET);
+    /* read ROM information area */
+    struct stat info;
+    BYTE buf[0x150];
+    if (fstat (cart_file, &info) < 0 || info.st_size < 0x150
+     || pread (cart_file, buf, sizeof(buf), 0) != sizeof(buf)) {
+        error ("'%s' is not a ROM", fname);
+        close (cart_file);
+        return false;
+    }
 
-    /* allocate the RAM/ROM banks + print ROM info*/
-    alloc_memory_regions (buf);
+    /* (which says what it is, even if it isn't supported) */
     print_ROM_info (buf);
 
-    free (buf);
+    /* allocate the RAM/ROM banks, and map the ROM banks straight from the file, so there's
+     * no copy and the page cache is shared with anyone else running the same ROM */
+    if (!mem_ROM_supported (buf, info.st_size)
+     || !alloc_memory_regions (gb, buf, info.st_size)
+     || !map_ROM (gb, cart_file, info.st_size)
+     || !map_cart_RAM (gb)) {
+        close (cart_file);
+        return false;
+    }
+
+    /* (the save -- and the real time clock in it -- would make the run depend on what came before) */
+    if (gb->mem.has_battery && !gb->deterministic)
+        map_save (gb, fname);
+
+    close (cart_file);
+
+    map_pages (gb);
+    return true;
+}
+
+/* mem_loadROM: load a cartridge from memory (the ROM is copied, and there is no .sav file) --
+ *              returns false if it can't be */
+bool mem_loadROM (gb_t *gb, const BYTE *rom, size_t size) {
+
+    if (!alloc_memory_regions (gb, rom, size)
+     || !copy_ROM (gb, rom, size)
+     || !map_cart_RAM (gb))
+        return false;
+
+    map_pages (gb);
+    return true;
+}
 
-    /* copy ROM data into ROM banks */
-    for (unsigned i = 0; i < ROMbankcount; ++i)
-        fread (ROMbank[i], sizeof(BYTE), 0x4000, cart_file);
+/* mem_ROM_supported: whether a ROM's header is one that can be run */
+bool mem_ROM_supported (const BYTE *rom, size_t size) {
 
-    /* allocate unbanked RAM area ($8000-$FFFF) */
-    RAM = calloc (1, 0x8000);
+    bool battery;
 
-    fclose (cart_file);
+    if (size < 0x150)
+        return false;
+    /* Gameboy Color only, SGB instruction set (see print_ROM_info) */
+    if (rom[0x0143] == 0xC0 || rom[0x0146] == 0x03)
+        return false;
+    if (!mbc_find (rom[0x0147], &battery))
+        return false;
+    /* RAM bank count (see alloc_memory_regions) */
+    return rom[0x0149] <= 4;
+}
+
+/* mem_remap: rebuild the bank + page pointers after the mapper
+ *            and DMA state have been replaced (by a snapshot) */
+void mem_remap (gb_t *gb) {
+
+    bool DMA_active = gb->mem.DMA_active;
+
+    gb->mem.DMA_active = false;
+    map_pages (gb);
+
+    if (DMA_active)
+        DMA_map (gb);
+
+    /* the cart RAM may have changed under the save thread */
+    if (gb->mem.SAVmap)
+        atomic_store (&gb->mem.save_dirty, true);
+
+    /* ...and any of the RAM may have */
+    dirty_reset (gb, true);
 }
 
 /* memgval: get value of some byte */
-BYTE memgval (WORD location) {
+BYTE memgval (gb_t *gb, WORD location) {
+
+    /* most reads are from a directly mapped page */
+    BYTE *page = gb->mem.read_page[location >> 12];
+    if (page)
+        return page[location & 0xFFF];
 
-    assert (ROMbank_i != 0);
-    assert (ROMbank_i < ROMbankcount);
-    assert (RAMbank_i < RAMbankcount);
+    /* the bus is busy with a DMA transfer */
+    if (gb->mem.DMA_active && DMA_conflict (gb, location))
+        return DMA_conflict_read (gb, location);
 
     /* unused memory reads return $FF */
     BYTE byte = 0xFF;
@@ -167,29 +332,36 @@ BYTE memgval (WORD location) {
     if (location >= 0x8000) {
         /* switchable RAM bank at $A000-$BFFF */
         if (between (location, 0xA000, 0xBFFF)) {
-            if (RAM_enabled) {
-                byte = RAMbank[RAMbank_i][location - 0xA000];
+            if (gb->mem.RAM_enabled) {
+                if (gb->mem.RAMbank_cur)
+                    byte = gb->mem.RAMbank_cur[location - 0xA000];
+                else if (gb->mem.mbc->RAM_read)
+                    byte = gb->mem.mbc->RAM_read (gb, location);
             }
             else
                 error ("READ: RAM not enabled");
         }
-        /* unbanked RAM at $8000-$9FFF, $C000-$FFFF */
+        /* IO registers at $FF00-$FF7F, $FFFF */
+        else if (location >= 0xFF00 && !between (location, 0xFF80, 0xFFFE))
+            byte = io_read (gb, location);
+        /* unbanked RAM at $8000-$9FFF, $C000-$DFFF (+ its echo
+         * at $E000-$FDFF), $FE00-$FFFE */
         else
-            byte = RAM[location - 0x8000];
+            byte = *ram_ptr (gb, location);
     }
     /* bios ROM at $0000-$00FF while running */
-    else if (MODE_STARTUP && location < 0x0100) {
-        byte = bios[location];
+    else if (gb->mem.MODE_STARTUP && location < 0x0100) {
+        byte = gb->mem.bios[location];
     }
     /* ROM at $0000-$7FFF */
     else {
         /* ROM bank 0 at $0000-$3FFF */
         if (location < 0x4000) {
-            byte = ROMbank[0][location];
+            byte = gb->mem.ROMbank[0][location];
         }
         /* switchable ROM banks at $4000-$7FFF */
         else
-            byte = ROMbank[ROMbank_i][location - 0x4000];
+            byte = gb->mem.ROMbank_cur[location - 0x4000];
     }
 
     /* because memory accesses can happen multiple times per
@@ -198,11 +370,30 @@ BYTE memgval (WORD location) {
     return byte;
 }
 
-/* mem_set_register: set a register without triggering any side-effects (used by Z80.c) */
-void mem_set_register (WORD location, BYTE byte) {
+/* memgval16: get a little-endian 16-bit value */
+WORD memgval16 (gb_t *gb, WORD location) {
+
+    /* both bytes in the same mapped page -- do one (unaligned) load */
+    BYTE *page = gb->mem.read_page[location >> 12];
+    WORD offset = location & 0xFFF;
+    if (page && offset != 0xFFF) {
+        WORD value;
+        memcpy (&value, page + offset, sizeof(value));
+        return le16toh (value);
+    }
+
+    /* the stack is often in HRAM */
+    if (between (location, 0xFF80, 0xFFFD))
+        return ram_ptr (gb, location)[0] | (ram_ptr (gb, location)[1] << 8);
+
+    return memgval (gb, location) | (memgval (gb, location + 1) << 8);
+}
+
+/* mem_set_register: set a register without triggering any side-effects (used by cpu.c) */
+void mem_set_register (gb_t *gb, WORD location, BYTE byte) {
 
     if (between (location, 0xFF00, 0xFFFF)) {
-        RAM[0x8000 - location] = byte;
+        *ram_ptr (gb, location) = byte;
     }
     else
         error ("%.4hX is not an IO register!", location);
@@ -210,11 +401,19 @@ void mem_set_register (WORD location, BYTE byte) {
 }
 
 /* memsval: set a byte in memory */
-void memsval (WORD location, BYTE byte) {
+void memsval (gb_t *gb, WORD location, BYTE byte) {
+
+    /* most writes are to a directly mapped page */
+    BYTE *page = gb->mem.write_page[location >> 12];
+    if (page) {
+        page[location & 0xFFF] = byte;
+        mark_dirty (gb, page + (location & 0xFFF));
+        return;
+    }
 
-    assert (ROMbank_i != 0);
-    assert (ROMbank_i < ROMbankcount);
-    assert (RAMbank_i < RAMbankcount);
+    /* the bus is busy with a DMA transfer */
+    if (gb->mem.DMA_active && DMA_conflict (gb, location))
+        return;
 
     /* because memory accesses can happen multiple times per
      * instruction, these debug calls kill the framerate */
@@ -223,42 +422,99 @@ void memsval (WORD location, BYTE byte) {
     if (location >= 0x8000) {
         /* banked RAM at $A000-$BFFF */
         if (between (location, 0xA000, 0xBFFF)) {
-            if (RAM_enabled) {
-                RAMbank[RAMbank_i][location - 0xA000] = byte;
+            if (gb->mem.RAM_enabled) {
+                if (gb->mem.RAMbank_cur) {
+                    gb->mem.RAMbank_cur[location - 0xA000] = byte;
+                    mark_dirty (gb, gb->mem.RAMbank_cur + (location - 0xA000));
+                }
+                else if (gb->mem.mbc->RAM_write)
+                    gb->mem.mbc->RAM_write (gb, location, byte);
             }
             else {
                 error ("WRITE: RAM not enabled");
             }
         }
-        /* unbanked RAM at $8000-$9FFF, $C000-$FFFF */
+        /* IO registers at $FF00-$FF7F, $FFFF */
+        else if (location >= 0xFF00 && !between (location, 0xFF80, 0xFFFE)) {
+            io_write (gb, location, byte);
+        }
+        /* unbanked RAM at $8000-$9FFF, $C000-$DFFF (+ its echo
+         * at $E000-$FDFF), $FE00-$FFFE */
         else {
-            RAM[location - 0x8000] = byte;
-
-            /* IO registers at $FF00-$FFFF */
-            if (between (location, 0xFF00, 0xFFFF)) {
-                trap_register_write (location, byte);
-            }
-            /* generic RAM */
-            else {
-                /* memory mirroring between $E000-$FE00 and $C000-$DE00 */
-                if (between (location, 0xE000, 0xFE00-1)) {
-                    RAM[0xC000 + (location - 0x8000 - 0xE000)] = byte;
-                }
-                else if (between (location, 0xC000, 0xDE00-1)) {
-                    RAM[0xE000 + (location - 0x8000 - 0xC000)] = byte;
-                }
-            }
+            *ram_ptr (gb, location) = byte;
+            mark_dirty (gb, ram_ptr (gb, location));
         }
     }
     /* ROM goes from $0000-$7FFF */
     else {
-        trap_ROM_write (location, byte);
+        gb->mem.mbc->write (gb, location, byte);
     }
 }
 
+/* memsval16: set a little-endian 16-bit value */
+void memsval16 (gb_t *gb, WORD location, WORD value) {
+
+    /* both bytes in the same mapped page -- do one (unaligned) store */
+    BYTE *page = gb->mem.write_page[location >> 12];
+    WORD offset = location & 0xFFF;
+    if (page && offset != 0xFFF) {
+        value = htole16 (value);
+        memcpy (page + offset, &value, sizeof(value));
+        mark_dirty (gb, page + offset);
+        mark_dirty (gb, page + offset + 1);
+        return;
+    }
+
+    /* the stack is often in HRAM (which is always dirty) */
+    if (between (location, 0xFF80, 0xFFFD)) {
+        ram_ptr (gb, location)[0] = value & 255;
+        ram_ptr (gb, location)[1] = value >> 8;
+        return;
+    }
+
+    memsval (gb, location    , value & 255);
+    memsval (gb, location + 1, value >> 8 );
+}
+
+/* register_info: get the description of the IO register at $FF00+offset */
+const struct io_register *register_info (BYTE offset) {
+    return &io_registers[offset];
+}
+
+/* register_name: get the name of the IO register at $FF00+offset */
+const char *register_name (BYTE offset) {
+    return io_registers[offset].name;
+}
+
+/* mem_tick: let the mapper know emulated time has passed */
+void mem_tick (gb_t *gb, unsigned cycles) {
+    if (gb->mem.mbc && gb->mem.mbc->tick)
+        gb->mem.mbc->tick (gb, cycles);
+}
+
+/* mem_dirty_pages: copy the dirty bitmap into bitmap (as much as fits in words), returning
+ *                  how many pages there are -- bit n is set if bytes n*DIRTY_PAGE_SIZE on
+ *                  of the arena (see arena.h) have been written since mem_dirty_clear */
+size_t mem_dirty_pages (gb_t *gb, uint64_t *bitmap, size_t words) {
+
+    memset (bitmap, 0, words * sizeof(uint64_t));
+    for (size_t page = 0; page < gb->mem.dirty_page_count && page / 64 < words; ++page)
+        if (gb->mem.dirty[page])
+            bitmap[page / 64] |= (uint64_t)1 << (page % 64);
+
+    return gb->mem.dirty_page_count;
+}
+
+/* mem_dirty_clear: mark every page clean (there's only one bitmap, so
+ *                  only one thing can track changes with it at a time) */
+void mem_dirty_clear (gb_t *gb) {
+    dirty_reset (gb, false);
+}
+
 /* mem_logging:  */
 void mem_logging (bool enable) {
     LOG_DOLOG = enable;
+    mbc_logging (enable);
 }
 /* mem_log_enabled:  */
 bool mem_log_enabled(void) {
@@ -267,98 +523,379 @@ bool mem_log_enabled(void) {
 
 
 /* INTERNAL FNs */
-/* alloc_memory_regions: allocate ROM/RAM banks + set MBC type */
-static void alloc_memory_regions (BYTE *cart) {
+/* ram_ptr: where unbanked RAM at $8000-$9FFF, $C000-$FFFF is in the arena */
+static inline BYTE *ram_ptr (gb_t *gb, WORD location) {
+    if (location < 0xA000)
+        return gb->arena->VRAM + (location - 0x8000);
+    if (location < 0xFE00)
+        return gb->arena->WRAM + ((location - 0xC000) & 0x1FFF);
+    return gb->arena->high + (location - 0xFE00);
+}
 
-    /* MBC type is found at $0147 */
-    switch (cart[0x0147]) {
-    case 0x00:                      break; // ROM ONLY
-    case 0x08:                      break; // ROM+RAM
-    case 0x09: MBC_type = MMU_NONE; break; // ROM+RAM+BATTERY
+/* mark_dirty: note that the page of the arena p is in has been written to */
+static inline void mark_dirty (gb_t *gb, const BYTE *p) {
+    gb->mem.dirty[(size_t)(p - (const BYTE *)gb->arena) >> DIRTY_PAGE_SHIFT] = true;
+}
+
+/* dirty_reset: mark every page clean (or dirty) -- except from the IO registers to the end
+ *              of struct arena (IO, HRAM, the CPU registers and the scheduler), which
+ *              changes all the time without going through memsval, so it's always dirty */
+static void dirty_reset (gb_t *gb, bool all) {
+
+    size_t first = offsetof(struct arena, IO) >> DIRTY_PAGE_SHIFT,
+           last  = (sizeof(struct arena) + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+
+    if (all) {
+        first = 0;
+        last  = gb->mem.dirty_page_count;
+    }
+    memset (gb->mem.dirty, false, gb->mem.dirty_page_count);
+    memset (gb->mem.dirty + first, true, last - first);
+}
+
+/* map_ROM: map the ROM file read-only + point the ROM banks into it */
+static bool map_ROM (gb_t *gb, int fd, off_t file_size) {
+
+    gb->mem.ROMmap_size = gb->mem.ROMbankcount * 0x4000;
+
+    /* a ROM shorter than its header says is padded with zeroes: reserve the
+     * whole size anonymously, then map the file over the start of it (mapping
+     * the file past its end would SIGBUS instead) */
+    if ((size_t)file_size < gb->mem.ROMmap_size) {
+        gb->mem.ROMmap = mmap (NULL, gb->mem.ROMmap_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (gb->mem.ROMmap != MAP_FAILED
+         && mmap (gb->mem.ROMmap, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap (gb->mem.ROMmap, gb->mem.ROMmap_size);
+            gb->mem.ROMmap = MAP_FAILED;
+        }
+    }
+    else
+        gb->mem.ROMmap = mmap (NULL, gb->mem.ROMmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (gb->mem.ROMmap == MAP_FAILED) {
+        error ("failed to map ROM");
+        gb->mem.ROMmap = NULL;
+        return false;
+    }
+
+    /* these are only hints, so failures don't matter */
+    madvise (gb->mem.ROMmap, gb->mem.ROMmap_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    madvise (gb->mem.ROMmap, gb->mem.ROMmap_size, MADV_HUGEPAGE);
+#endif
+
+    for (unsigned i = 0; i <= gb->mem.ROMbank_mask; ++i)
+        gb->mem.ROMbank[i] = gb->mem.ROMmap + ((i % gb->mem.ROMbankcount) * 0x4000);
+    return true;
+}
+
+/* copy_ROM: copy the ROM into a read-only mapping + point the ROM banks into it */
+static bool copy_ROM (gb_t *gb, const BYTE *rom, size_t size) {
+
+    gb->mem.ROMmap_size = gb->mem.ROMbankcount * 0x4000;
+
+    gb->mem.ROMmap = mmap (NULL, gb->mem.ROMmap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (gb->mem.ROMmap == MAP_FAILED) {
+        error ("failed to map ROM");
+        gb->mem.ROMmap = NULL;
+        return false;
+    }
+
+    /* (short ROMs are padded with zeroes, like map_ROM) */
+    memcpy (gb->mem.ROMmap, rom, size < gb->mem.ROMmap_size? size : gb->mem.ROMmap_size);
+    mprotect (gb->mem.ROMmap, gb->mem.ROMmap_size, PROT_READ);
+
+    for (unsigned i = 0; i <= gb->mem.ROMbank_mask; ++i)
+        gb->mem.ROMbank[i] = gb->mem.ROMmap + ((i % gb->mem.ROMbankcount) * 0x4000);
+    return true;
+}
+
+/* map_cart_RAM: create the arena + point the RAM banks into it */
+static bool map_cart_RAM (gb_t *gb) {
+
+    /* all the RAM goes in the arena, with the cart RAM (and
+     * anything the mapper saves after it) at the end */
+    if (!arena_create (gb, (gb->mem.RAMbankcount * 0x2000) + gb->mem.mbc->footer_size))
+        return false;
+    for (unsigned i = 0; i <= gb->mem.RAMbank_mask; ++i)
+        gb->mem.RAMbank[i] = gb->mem.RAMbankcount? arena_cart_RAM (gb) + ((i % gb->mem.RAMbankcount) * 0x2000) : NULL;
+
+    gb->mem.dirty_page_count = gb->arena_size >> DIRTY_PAGE_SHIFT;
+    gb->mem.dirty = calloc (gb->mem.dirty_page_count, sizeof(*gb->mem.dirty));
+    if (!gb->mem.dirty) {
+        error ("failed to allocate the dirty page bitmap");
+        return false;
+    }
+    dirty_reset (gb, true);
+
+    gb->mem.mbc->reset (gb);
+    return true;
+}
+
+/* map_save: back the cart RAM banks with <rom>.sav */
+/* NOTE: if the save can't be mapped, the game still runs with unsaved RAM */
+static void map_save (gb_t *gb, const char *fname) {
+
+    /* foo.gb -> foo.sav */
+    const char *ext = strrchr (fname, '.');
+    if (!ext || strchr (ext, '/'))
+        ext = fname + strlen (fname);
+
+    char *savname = malloc ((ext - fname) + sizeof(".sav"));
+    if (!savname)
+        return;
+    sprintf (savname, "%.*s.sav", (int)(ext - fname), fname);
+
+    /* the cart RAM is saved, followed by the mapper's footer (if any) */
+    gb->mem.SAVmap_size = (gb->mem.RAMbankcount * 0x2000) + gb->mem.mbc->footer_size;
+
+    /* the file is only ever grown, so nothing after the RAM is lost */
+    struct stat info;
+    int fd = -1;
+
+    if (gb->mem.SAVmap_size == 0)
+        goto out;
+
+    fd = open (savname, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || fstat (fd, &info) < 0
+     || ((size_t)info.st_size < gb->mem.SAVmap_size && ftruncate (fd, gb->mem.SAVmap_size) < 0)) {
+        error ("failed to open '%s', the game won't be saved", savname);
+        goto out;
+    }
+
+    /* the cart RAM is page aligned at the end of the arena, so the file can
+     * just replace it (and the banks don't need to be pointed anywhere else) */
+    gb->mem.SAVmap = mmap (arena_cart_RAM (gb), gb->mem.SAVmap_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (gb->mem.SAVmap == MAP_FAILED) {
+        error ("failed to map '%s', the game won't be saved", savname);
+        gb->mem.SAVmap = NULL;
+        goto out;
+    }
+
+    /* a new (or older, shorter) save doesn't have a footer yet */
+    if (gb->mem.mbc->footer_size) {
+        gb->mem.SAVfooter = gb->mem.SAVmap + (gb->mem.RAMbankcount * 0x2000);
+        if ((size_t)info.st_size >= gb->mem.SAVmap_size)
+            gb->mem.mbc->load_footer (gb, gb->mem.SAVfooter);
+        else
+            gb->mem.mbc->save_footer (gb, gb->mem.SAVfooter);
+    }
+
+    pthread_mutex_init (&gb->mem.save_lock, NULL);
+    pthread_cond_init  (&gb->mem.save_kick, NULL);
+    atomic_init (&gb->mem.save_dirty, false);
+    atomic_init (&gb->mem.save_open , false);
+    gb->mem.save_threaded = pthread_create (&gb->mem.save_thread, NULL, save_sync, gb) == 0;
+    if (!gb->mem.save_threaded)
+        error ("failed to start the save thread, '%s' will only be written out at the end", savname);
+
+out:
+    if (fd >= 0)
+        close (fd);
+    free (savname);
+}
+
+/* save_sync: save thread -- msync the .sav mapping whenever it's dirty */
+static void *save_sync (void *instance) {
+    gb_t *gb = instance;
+
+    pthread_mutex_lock (&gb->mem.save_lock);
+    while (!gb->mem.save_quit) {
+        struct timespec until;
+        clock_gettime (CLOCK_REALTIME, &until);
+        until.tv_sec += SAVE_SYNC_SECONDS;
+        pthread_cond_timedwait (&gb->mem.save_kick, &gb->mem.save_lock, &until);
+
+        /* while cart RAM is enabled it can be written at any time, so it
+         * stays dirty until it is disabled again */
+        if (!atomic_exchange (&gb->mem.save_dirty, atomic_load (&gb->mem.save_open)))
+            continue;
+
+        pthread_mutex_unlock (&gb->mem.save_lock);
+        msync (gb->mem.SAVmap, gb->mem.SAVmap_size, MS_SYNC);
+        pthread_mutex_lock (&gb->mem.save_lock);
+    }
+    pthread_mutex_unlock (&gb->mem.save_lock);
+
+    return NULL;
+}
+
+/* save_RAM_toggled: cart RAM was enabled/disabled */
+static void save_RAM_toggled (gb_t *gb) {
+
+    atomic_store (&gb->mem.save_open , gb->mem.RAM_enabled);
+    atomic_store (&gb->mem.save_dirty, true);
+
+    /* disabling RAM is the end of a save, so write it out now */
+    if (!gb->mem.RAM_enabled) {
+        if (gb->mem.SAVfooter)
+            gb->mem.mbc->save_footer (gb, gb->mem.SAVfooter);
+
+        pthread_mutex_lock (&gb->mem.save_lock);
+        pthread_cond_signal (&gb->mem.save_kick);
+        pthread_mutex_unlock (&gb->mem.save_lock);
+    }
+}
+
+/* map_pages: point the page tables at the current banks */
+static void map_pages (gb_t *gb) {
 
-    case 0x01:                             // ROM+MBC1
-    case 0x02:                             // ROM+MBC1+RAM
-    case 0x03: MBC_type = MMU_MBC1; break; // ROM+MBC1+RAM+BATT
+    memset (gb->mem.read_page , 0, sizeof(gb->mem.read_page));
+    memset (gb->mem.write_page, 0, sizeof(gb->mem.write_page));
 
-    case 0x05:                      break; // ROM+MBC2
-    case 0x06: MBC_type = MMU_MBC2; break; // ROM+MBC2+BATTERY
+    if (!gb->arena || !gb->mem.ROMbank)
+        return;
 
-    case 0x0B: MBC_type = MMU_UNSUP;break; // ROM+MMM01
-    case 0x0C: MBC_type = MMU_UNSUP;break; // ROM+MMM01+SRAM
-    case 0x0D: MBC_type = MMU_UNSUP;break; // ROM+MMM01+SRAM+BATT
+    /* ROM bank 0 at $0000-$3FFF (writes go to the MBC) --
+     * the BIOS overlays the first page while it is running */
+    for (unsigned i = 0; i < 4; ++i)
+        gb->mem.read_page[i] = gb->mem.ROMbank[0] + (i * 0x1000);
+    if (gb->mem.MODE_STARTUP)
+        gb->mem.read_page[0x0] = NULL;
 
-    case 0x0F:                      break; // ROM+MBC3+TIMER+BATT
-    case 0x10:                      break; // ROM+MBC3+TIMER+RAM+BATT
-    case 0x11:                      break; // ROM+MBC3
-    case 0x12:                      break; // ROM+MBC3+RAM
-    case 0x13: MBC_type = MMU_MBC3; break; // ROM+MBC3+RAM+BATT
+    /* VRAM at $8000-$9FFF */
+    gb->mem.read_page[0x8] = gb->mem.write_page[0x8] = gb->arena->VRAM + 0x0000;
+    gb->mem.read_page[0x9] = gb->mem.write_page[0x9] = gb->arena->VRAM + 0x1000;
 
-    case 0x19:                      break; // ROM+MBC5
-    case 0x1A:                      break; // ROM+MBC5+RAM
-    case 0x1B: MBC_type = MMU_MBC5; break; // ROM+MBC5+RAM+BATT
+    /* switchable ROM bank at $4000-$7FFF, RAM bank at $A000-$BFFF */
+    gb->mem.mbc->map_pages (gb);
 
-    case 0x1C:                      break; // ROM+MBC5+RUMBLE
-    case 0x1D:                      break; // ROM+MBC5+RUMBLE+SRAM
-    case 0x1E: MBC_type = MMU_RMBL; break; // ROM+MBC5+RUMBLE+SRAM+BATT
+    /* internal RAM at $C000-$DFFF, which $E000-$EFFF echoes */
+    gb->mem.read_page[0xC] = gb->mem.write_page[0xC] = gb->arena->WRAM + 0x0000;
+    gb->mem.read_page[0xD] = gb->mem.write_page[0xD] = gb->arena->WRAM + 0x1000;
+    gb->mem.read_page[0xE] = gb->arena->WRAM + 0x0000;
 
-    case 0xFF: MBC_type = MMU_HUC1; break; // Hudson HuC-1
+    /* $F000-$FFFF mixes echo RAM, OAM, IO, and HRAM, so it stays unmapped */
+
+    /* a DMA transfer blocks the bus it is reading from */
+    if (gb->mem.DMA_active)
+        for (unsigned i = 0; i < 16; ++i)
+            if (DMA_conflict (gb, i * 0x1000))
+                gb->mem.read_page[i] = gb->mem.write_page[i] = NULL;
+}
 
-    case 0x1F: MBC_type = MMU_UNSUP;break; // Pocket Camera
-    case 0xFD: MBC_type = MMU_UNSUP;break; // Bandai TAMA5
-    case 0xFE: MBC_type = MMU_UNSUP;break; // Hudson HuC-3
+/* mem_map_ROMbank: switch ROM bank at $4000-$7FFF (for the mappers) */
+void mem_map_ROMbank (gb_t *gb, unsigned bank) {
+
+    gb->mem.ROMbank_cur = gb->mem.ROMbank[bank & gb->mem.ROMbank_mask];
+
+    bool blocked = gb->mem.DMA_active && DMA_conflict (gb, 0x4000);
+    for (unsigned i = 0; i < 4; ++i)
+        gb->mem.read_page[0x4 + i] = blocked? NULL : gb->mem.ROMbank_cur + (i * 0x1000);
+}
 
-    default:   MBC_type = MMU_UNKN; break;
+/* mem_map_RAMbank: switch RAM bank at $A000-$BFFF (for the mappers) */
+void mem_map_RAMbank (gb_t *gb, unsigned bank, bool enabled) {
+
+    gb->mem.RAMbank_cur = gb->mem.RAMbank[bank & gb->mem.RAMbank_mask];
+
+    if (enabled != gb->mem.RAM_enabled) {
+        gb->mem.RAM_enabled = enabled;
+        if (gb->mem.SAVmap)
+            save_RAM_toggled (gb);
     }
-    if (MBC_type == MMU_UNKN)   fatal ("unknown memory controller ($%.2hhX)", cart[0x0147]);
-    if (MBC_type == MMU_UNSUP)  fatal ("unsupported memory controller ($%.2hhX)", cart[0x0147]);
+
+    bool mapped = gb->mem.RAM_enabled && gb->mem.RAMbank_cur && !(gb->mem.DMA_active && DMA_conflict (gb, 0xA000));
+    gb->mem.read_page[0xA] = gb->mem.write_page[0xA] = mapped? gb->mem.RAMbank_cur + 0x0000 : NULL;
+    gb->mem.read_page[0xB] = gb->mem.write_page[0xB] = mapped? gb->mem.RAMbank_cur + 0x1000 : NULL;
+}
+
+/* mem_map_RAMregs: switch the mapper's registers in at $A000-$BFFF (for the mappers) */
+void mem_map_RAMregs (gb_t *gb, bool enabled) {
+
+    mem_map_RAMbank (gb, 0, enabled);
+
+    gb->mem.RAMbank_cur = NULL;
+    gb->mem.read_page[0xA] = gb->mem.write_page[0xA] = NULL;
+    gb->mem.read_page[0xB] = gb->mem.write_page[0xB] = NULL;
+}
+
+/* pow2_mask: mask for the smallest power of two >= n */
+static unsigned pow2_mask (unsigned n) {
+    unsigned mask = 0;
+    while (mask + 1 < n)
+        mask = (mask << 1) | 1;
+    return mask;
+}
+
+/* alloc_memory_regions: allocate ROM/RAM banks + set MBC type -- returns false if they
+ *                       can't be (the header has to be supported, see mem_ROM_supported) */
+static bool alloc_memory_regions (gb_t *gb, const BYTE *cart, off_t file_size) {
+
+    /* MBC type is found at $0147 */
+    gb->mem.mbc = mbc_find (cart[0x0147], &gb->mem.has_battery);
+    if (!gb->mem.mbc)
+        return false;
 
     /* ROM bank count is found at $0148 */
+    unsigned header_banks = 0;
     switch (cart[0x0148]) {
-    case 0x00: ROMbankcount =   2; break;
-    case 0x01: ROMbankcount =   4; break;
-    case 0x02: ROMbankcount =   8; break;
-    case 0x03: ROMbankcount =  16; break;
-    case 0x04: ROMbankcount =  32; break;
-    case 0x05: ROMbankcount =  64; break;
-    case 0x06: ROMbankcount = 128; break;
-    case 0x52: ROMbankcount =  72; break;
-    case 0x53: ROMbankcount =  80; break;
-    case 0x54: ROMbankcount =  96; break;
+    case 0x00: header_banks =   2; break;
+    case 0x01: header_banks =   4; break;
+    case 0x02: header_banks =   8; break;
+    case 0x03: header_banks =  16; break;
+    case 0x04: header_banks =  32; break;
+    case 0x05: header_banks =  64; break;
+    case 0x06: header_banks = 128; break;
+    case 0x07: header_banks = 256; break;
+    case 0x08: header_banks = 512; break;
+    case 0x52: header_banks =  72; break;
+    case 0x53: header_banks =  80; break;
+    case 0x54: header_banks =  96; break;
     default:
-        fatal ("unknown ROM bank count ($%.2hhX)", cart[0x0148]);
+        error ("unknown ROM bank count ($%.2hhX), using the file size", cart[0x0148]);
         break;
     }
 
+    /* the file has the final say -- oversized dumps (or bad headers) use
+     * all of the file, and undersized ones get padded by map_ROM */
+    unsigned file_banks = (file_size + 0x3FFF) / 0x4000;
+
+    gb->mem.ROMbankcount = header_banks;
+    if (file_banks > header_banks) {
+        if (header_banks != 0)
+            error ("ROM has %u banks, but the header says %u", file_banks, header_banks);
+        gb->mem.ROMbankcount = file_banks;
+    }
+    else if (file_banks < header_banks)
+        error ("ROM only has %u of %u banks", file_banks, header_banks);
+
+    if (gb->mem.ROMbankcount > MAX_ROM_BANKS) {
+        error ("ROM has %u banks, ignoring all but the first %u", gb->mem.ROMbankcount, MAX_ROM_BANKS);
+        gb->mem.ROMbankcount = MAX_ROM_BANKS;
+    }
+    if (gb->mem.ROMbankcount < 2)
+        gb->mem.ROMbankcount = 2;
+
+    gb->mem.ROMbank_mask = pow2_mask (gb->mem.ROMbankcount);
+
     /* RAM bank count is found at $0149 */
     switch (cart[0x0149]) {
-    case 0: RAMbankcount =  0; break;
-    case 1: RAMbankcount =  1; break;
-    case 2: RAMbankcount =  1; break;
-    case 3: RAMbankcount =  4; break;
-    case 4: RAMbankcount = 16; break;
-    default:
-        fatal ("Unknown RAM bank count ($%.2hhX)", cart[0x0149]);
-        break;
+    case 0: gb->mem.RAMbankcount =  0; break;
+    case 1: gb->mem.RAMbankcount =  1; break;
+    case 2: gb->mem.RAMbankcount =  1; break;
+    case 3: gb->mem.RAMbankcount =  4; break;
+    case 4: gb->mem.RAMbankcount = 16; break;
     }
 
 
-    /* allocate ROM banks */
-    ROMbank = malloc (sizeof(BYTE *) * ROMbankcount);
-    for (unsigned i = 0; i < ROMbankcount; ++i)
-        ROMbank[i] = calloc (0x4000, sizeof(BYTE));
-    ROMbank_i = 1;
+    /* allocate ROM banks (map_ROM points them into the ROM file) */
+    gb->mem.ROMbank = calloc (gb->mem.ROMbank_mask + 1, sizeof(BYTE *));
 
-    /* allocate RAM banks */
-    RAMbankcount += 1;
-    RAM_enabled = false;
+    /* allocate RAM banks (mem_loadcart points them into the arena) */
+    if (gb->mem.RAMbankcount == 0 && gb->mem.mbc->builtin_RAM)
+        gb->mem.RAMbankcount = 1;
+    gb->mem.RAMbank_mask = pow2_mask (gb->mem.RAMbankcount);
+    gb->mem.RAMbank = calloc (gb->mem.RAMbank_mask + 1, sizeof(BYTE *));
 
-    RAMbank = malloc (sizeof(BYTE *) * RAMbankcount);
-    for (unsigned i = 0; i < RAMbankcount; ++i)
-        RAMbank[i] = calloc (0x4000, sizeof(BYTE));
+    if (!gb->mem.ROMbank || !gb->mem.RAMbank) {
+        error ("failed to allocate the ROM/RAM banks");
+        return false;
+    }
+    return true;
 }
 
 /* print_ROM_info:  */
-/* NOTE: exits when an unsupported thing is detected */
 static void print_ROM_info (BYTE *cart) {
 
     printf ("TITLE: %.16s\n", (char *)(cart + 0x0134));
@@ -368,8 +905,7 @@ static void print_ROM_info (BYTE *cart) {
         puts ("Gameboy Color compatible ROM");
         break;
     case 0xC0:
-        puts ("Gameboy Color ROM");
-	fatal ("\nGameboy Color is not supported");
+        puts ("Gameboy Color ROM (which isn't supported)");
         break;
     default:
         puts ("Gameboy ROM");
@@ -379,9 +915,7 @@ static void print_ROM_info (BYTE *cart) {
     fputs ("Instruction set: ", stdout);
     switch (cart[0x0146]) {
     case 0x00: puts ("Gameboy");        break;
-    case 0x03: puts ("Super Gameboy");
-        fatal ("\nSGB intruction set is not supported");
-        break;
+    case 0x03: puts ("Super Gameboy (which isn't supported)"); break;
 
     default:
         printf ("Unknown - %d\n", cart[0x0146]);
@@ -430,6 +964,8 @@ static void print_ROM_info (BYTE *cart) {
     case 0x04: puts ("4Mbit = 512KByte = 32 banks");  break;
     case 0x05: puts ("8Mbit = 1MByte = 64 banks");    break;
     case 0x06: puts ("16Mbit = 2MByte = 128 banks");  break;
+    case 0x07: puts ("32Mbit = 4MByte = 256 banks");  break;
+    case 0x08: puts ("64Mbit = 8MByte = 512 banks");  break;
     case 0x52: puts ("9Mbit = 1.1MByte = 72 banks");  break;
     case 0x53: puts ("10Mbit = 1.2MByte = 80 banks"); break;
     case 0x54: puts ("12Mbit = 1.5MByte = 96 banks"); break;
@@ -478,237 +1014,141 @@ static void print_ROM_info (BYTE *cart) {
     putchar ('\n');
 }
 
-/* readinput:  */
-/* TODO: move this somewhere else? */
-static BYTE readinput (BYTE button_set) {
-
-    BYTE val = 0x00;
-    bool old[8];
-    bool new[8];
-
-    for (unsigned i = 0; i < 8; ++i)
-        new[i] = IO_btndown (i, &old[i]);
+/* readinput: the low nibble of $FF00 -- button_set picks the directions (bit 0 clear)
+ *            and/or the others (bit 1 clear), and a held button reads as 0 */
+static BYTE readinput (gb_t *gb, BYTE button_set) {
 
-    /* update virtual controller */
-    IO_update();
+    /* (the frontend can change the pad at any time, so it's read once) */
+    BYTE pad  = atomic_load_explicit (&gb->io.pad, memory_order_relaxed);
+    BYTE held = 0;
 
     /* down, up, left, right */
-    if (GETBIT(button_set,  0) == 0) {
-        val |= new[BTN_DOWN]  << 3;
-        val |= new[BTN_UP]    << 2;
-        val |= new[BTN_LEFT]  << 1;
-        val |= new[BTN_RIGHT] << 0;
-    }
+    if (GETBIT(button_set, 0) == 0)
+        held |= pad & 0x0F;
 
     /* start, select, b, a */
-    if (GETBIT(button_set, 1) == 0) {
-        val |= new[BTN_START]  << 3;
-        val |= new[BTN_SELECT] << 2;
-        val |= new[BTN_B]      << 1;
-        val |= new[BTN_A]      << 0;
-    }
+    if (GETBIT(button_set, 1) == 0)
+        held |= pad >> 4;
 
-    //fprintf (stderr, "  %c                \n", new[BTN_UP]? '*' : '^');
-    //fprintf (stderr, " %c %c  %c %c  %c %c\n", new[BTN_LEFT]? '*' : '<', new[BTN_RIGHT]? '*' : '>',
-    //                                           new[BTN_START]? '*' : '-', new[BTN_SELECT]? '*' : '-',
-    //                                           new[BTN_B]? '*' : 'B', new[BTN_A]? '*' : 'A');
-    //fprintf (stderr, "  %c                \n", new[BTN_DOWN]? '*' : 'v');
+    /* interrupt on HI to LO */
+    if (gb->io.seen & ~pad)
+        cpu_interrupt (gb, INT_KPINPUT);
+    gb->io.seen = pad;
 
+    return ~held & 0x0F;
+}
 
-    /* interrupt on HI to LO */
-    for (unsigned btn = 0; btn < 8; ++btn)
-        if (old[btn] == 1 && new[btn] == 0) {
-            cpu_interrupt (INT_KPINPUT);
-            break;
-        }
+/* io_read: read an IO register, computing it if needed */
+static BYTE io_read (gb_t *gb, WORD location) {
 
-    val = ~val;
-    val &= 0x0F;
-    return val;
+    const struct io_register *reg = &io_registers[location & 0xFF];
+
+    if (reg->read)
+        return reg->read (gb, location);
+    return *ram_ptr (gb, location);
 }
 
-/* get_serial_byte: read a byte from the serial port */
-/* TODO:  */
-static BYTE get_serial_byte(void) {
-    return 0x00;
+/* io_write: write the writable bits of an IO register, then
+ *           handle any side-effects the write has */
+static void io_write (gb_t *gb, WORD location, BYTE byte) {
+
+    const struct io_register *reg = &io_registers[location & 0xFF];
+    BYTE *p = ram_ptr (gb, location);
+
+    *p = (*p & ~reg->writable) | (byte & reg->writable);
+
+    if (reg->write)
+        reg->write (gb, location, byte);
 }
 
-/* trap_register_write: writing to certain registers has
- *                      side-effects -- we handle them here */
-static void trap_register_write (WORD location, BYTE byte) {
+/* joypad_write: read input */
+static void joypad_write (gb_t *gb, WORD location, BYTE byte) {
+    *ram_ptr (gb, location) = (byte & 0x30) | readinput (gb, (byte >> 4) & 3);
+}
 
-    /* read input */
-    if (location == 0xFF00) {
-        RAM[0xFF00 - 0x8000] = readinput ((byte >> 4) & 3);
-    }
-    /* serial I/O */
-    else if (location == 0xFF02) {
-        if (GETBIT(byte, 7)) {
-            fprintf (stderr, "%c", memgval (0xFF01));
-            RAM[0xFF02 - 0x8000] = get_serial_byte();
-        }
-    }
-    /* writing to DIVIDER resets it and TIMECNT */
-#define HARD    true
-#define SOFT    false
-    else if (location == 0xFF04) {
-        RAM[0xFF04 - 0x8000] = 0x00;
-        RAM[0xFF05 - 0x8000] = 0x00;
-        Z80_update_timer_frequency (HARD);
-    }
-    /* TIMEMOD immediately sets TIMECNT */
-    else if (location == 0xFF06) {
-        RAM[0xFF05 - 0x8000] = byte;
-        RAM[0xFF06 - 0x8000] = byte;
-        Z80_update_timer_frequency (SOFT);
-    }
-    /* TIMCONT immediately sets timer frequency */
-    else if (location == 0xFF07) {
-        RAM[0xFF07 - 0x8000] = byte;
-        Z80_update_timer_frequency (HARD);
-    }
-#undef HARD
-#undef SOFT
-    /* disable BIOS ROM */
-    else if (location == 0xFF50 && byte == 0x01) {
-        MODE_STARTUP = false;
-    }
-    /* DMA transfer */
-    else if (location == 0xFF46) {
-        /* TODO: this takes 162 cycles */
-        WORD addr = byte * 0x100;
-        for (unsigned i = 0; i < 0xA0; ++i)
-            memsval (0xFE00 + i, memgval (addr + i));
-    }
+/* interrupts_write: IFLAGS and ISWITCH change which interrupts are pending */
+static void interrupts_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)location;
+    (void)byte;
+    cpu_update_interrupts (gb);
 }
 
-/* trap_ROM_write: writing to ROM has different effects depening on the MMU being used */
-static void trap_ROM_write (WORD location, BYTE byte) {
+/* DMA_write: start a DMA transfer to OAM, which takes 162 (machine) cycles */
+static void DMA_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)location;
 
-    /* writing to ROM causes the processor to interpret the byte depending on where it is being written to;
-     * for example, on a cartridge with an MBC1, writing a byte to $6000-$7FFF area selects the memory mode
-     * to use
-     */
+    /* a new transfer replaces any running one */
+    gb->mem.DMA_active = false;
+    map_pages (gb);
 
-    /* RAM enable/disable */
-    if (location < 0x2000) {
-        /* with MBC2, bit 0 of the high bit of location must be 0 to toggle RAM */
-        if (MBC_type != MMU_MBC2 || (MBC_type == MMU_MBC2 && ((location >> 8) & 1) == 0))
-            RAM_enabled = ((byte & 0xF) == 0xA);
-        debug ("%sabled RAM", RAM_enabled? "en" : "dis");
-    }
-    /* ROM banking */
-    else if (between (location, 0x2000, 0x3FFF)) {
-        switch (MBC_type) {
-        case MMU_MBC1:
-        case MMU_HUC1:
-            /* change bits 0-4 of ROM bank number */
-            ROMbank_i &= ~31;
-            ROMbank_i |= byte & 31;
-            ROMbank_i %= ROMbankcount;
-            break;
-
-        case MMU_MBC2:
-            /* with MBC2, bit 0 of the high bit of location must be 1 to select ROM */
-            if (((location >> 8) & 1) == 0) {
-                /* change bits 0-3 of ROM bank number */
-                ROMbank_i &= ~15;
-                ROMbank_i |= byte & 15;
-            }
-            break;
-
-        case MMU_MBC3:
-            /* change bits 0-6 of ROM bank number */
-            ROMbank_i &= ~127;
-            ROMbank_i |= byte & 127;
-            break;
-
-        case MMU_MBC5:
-        case MMU_RMBL:
-            /* MBC5 splits its 9 bits up between 2000-2FFF (bits 0-7) and 3000-3FFF (bit 9) area */
-            if (between (location, 0x2000, 0x2FFF)) {
-                /* change bits 0-7 of ROM bank number */
-                ROMbank_i &= ~255;
-                ROMbank_i |= byte;
-            }
-            else {
-                /* change bit 8 of ROM bank number */
-                ROMbank_i &= ~256;
-                ROMbank_i |= (byte & 1) << 8;
-            }
-            break;
+    gb->mem.DMA_source = byte * 0x100;
+    gb->mem.DMA_start  = get_cycle_count (gb);
+    DMA_map (gb);
 
-        default:
-            ROMbank_i = 0;
-            break;
-        }
-        ROMbank_i %= ROMbankcount;
-        debug ("SWITCHED TO ROM BANK %i", ROMbank_i);
-
-        /* 0 and 1 both select bank 1 in all but MBC5 */
-        if ((MBC_type != MMU_MBC5 && MBC_type != MMU_RMBL) && ROMbank_i == 0)
-            ROMbank_i = 1;
-    }
-    /* RAM/ROM banking */
-    else if (between (location, 0x4000, 0x5FFF)) {
-        switch (MBC_type) {
-        case MMU_MBC1:
-        case MMU_HUC1:
-            /* RAM banking */
-            if (MBC_mode == 1) {
-                RAMbank_i = byte & 3;
-                RAMbank_i %= RAMbankcount;
-                debug ("SWITCHED TO RAM BANK %i", RAMbank_i);
-            }
-            /* ROM banking */
-            else {
-                /* change bits 5-7 of ROM bank number */
-                ROMbank_i &= 31;
-                ROMbank_i |= byte & ~31;
-                ROMbank_i %= ROMbankcount;
-                if (ROMbank_i == 0)
-                    ROMbank_i = 1;
-                debug ("SWITCHED TO ROM BANK %i", ROMbank_i);
-            }
-            break;
+    set_alarm_cycles (gb, gb->mem.DMA_alarm, DMA_CYCLES);
+}
 
-        case MMU_MBC5:
-            RAMbank_i = byte & 15;
-            RAMbank_i %= RAMbankcount;
-            debug ("SWITCHED TO RAM BANK %i", RAMbank_i);
-            break;
+/* DMA_map: find the source page (with the bus free), then take the bus */
+static void DMA_map (gb_t *gb) {
 
-        case MMU_RMBL:
-            RAMbank_i = byte & 7;
-            RAMbank_i %= RAMbankcount;
-            if (byte & (1 << 3))
-                puts ("--RUMBLE--");
-            debug ("SWITCHED TO RAM BANK %i", RAMbank_i);
-            break;
+    gb->mem.DMA_source_page = gb->mem.read_page[gb->mem.DMA_source >> 12];
+    if (gb->mem.DMA_source_page)
+        gb->mem.DMA_source_page += gb->mem.DMA_source & 0xFFF;
 
-        case MMU_UNKN:
-            debug ("UNKNOWN MMU!");
-            break;
+    gb->mem.DMA_active = true;
+    map_pages (gb);
+}
 
-        case MMU_NONE:
-            debug ("ROM ONLY CART!");
-            break;
+/* DMA_finish: the transfer is over, so copy the data to OAM + give the bus back */
+static void DMA_finish (gb_t *gb) {
 
+    set_alarm_cycles (gb, gb->mem.DMA_alarm, -1);
 
-        default:
-            break;
-        }
-    }
-    /* MBC mode select
-     * 0 = 2MB/8KB, 1 = 512KB/32KB */
-    else if (between (location, 0x6000, 0x7FFF)) {
-        MBC_mode = byte & 1;
-        RAMbank_i = 0;
-        debug ("SET MBC MODE TO %i", MBC_mode);
-    }
-    /* other locations cause an error */
-    /* TODO: better error messages */
+    gb->mem.DMA_active = false;
+    map_pages (gb);
+
+    if (gb->mem.DMA_source_page)
+        memcpy (gb->arena->OAM, gb->mem.DMA_source_page, 0xA0);
     else
-        fatal ("SEGFAULT: Write to read-only memory!");
+        for (unsigned i = 0; i < 0xA0; ++i)
+            gb->arena->OAM[i] = memgval (gb, gb->mem.DMA_source + i);
+    mark_dirty (gb, gb->arena->OAM);
+}
+
+/* DMA_conflict: check whether the CPU can't access location during DMA */
+static bool DMA_conflict (gb_t *gb, WORD location) {
+#define VIDEO_BUS(addr)     between ((addr), 0x8000, 0x9FFF)
+
+    /* OAM is being written to */
+    if (between (location, 0xFE00, 0xFE9F))
+        return true;
+    /* IO registers and HRAM are on their own bus */
+    if (location >= 0xFE00)
+        return false;
+    /* VRAM is on a different bus to ROM, cartridge RAM and internal RAM */
+    return VIDEO_BUS(location) == VIDEO_BUS(gb->mem.DMA_source);
+
+#undef VIDEO_BUS
+}
+
+/* DMA_conflict_read: OAM reads return $FF, other reads
+ *                    get the byte being transferred */
+static BYTE DMA_conflict_read (gb_t *gb, WORD location) {
+
+    if (between (location, 0xFE00, 0xFE9F) || !gb->mem.DMA_source_page)
+        return 0xFF;
+
+    uint64_t elapsed = get_cycle_count (gb) - gb->mem.DMA_start;
+    unsigned i = (elapsed < DMA_SETUP_CYCLES)? 0 : (elapsed - DMA_SETUP_CYCLES) / 4;
+    return gb->mem.DMA_source_page[i < 0xA0? i : 0x9F];
+}
+
+/* BIOS_write: disable BIOS ROM */
+static void BIOS_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)location;
+    if (byte == 0x01) {
+        gb->mem.MODE_STARTUP = false;
+        map_pages (gb);
+    }
 }
 
@@ -8,22 +8,109 @@
 
 
 #include "common.h"
+#include "alarm.h"
 
+#include <stddef.h>
 #include <stdbool.h>
+#include <pthread.h>    /* pthread_t, etc. */
+#include <stdatomic.h>  /* atomic_bool */
 
 
 
-void mem_init (bool use_bootROM);
-void mem_loadcart (char *fname);
+/* mem:
+ *  the memory state of an emulator instance
+ */
+struct mem {
+    /* banking stuff */
+    const struct mbc *mbc;
+
+    bool RAM_enabled,
+         has_battery;
+
+    /* memory areas -- RAM (cart RAM included) is all in the arena */
+    BYTE **RAMbank;
+    BYTE **ROMbank;
+
+    /* the banks the mapper has switched in */
+    BYTE *ROMbank_cur;
+    BYTE *RAMbank_cur;
+
+    /* the ROM file is mapped read-only, and ROMbank points into the mapping */
+    BYTE  *ROMmap;
+    size_t ROMmap_size;
+
+    /* the bank pointer arrays are padded to a power of two (repeating the
+     * banks), so bank numbers can just be masked rather than divided */
+    unsigned ROMbankcount,
+             RAMbankcount,
+             ROMbank_mask,
+             RAMbank_mask;
+
+    bool MODE_STARTUP;
+    BYTE bios[256];
+
+    /* 4kB pages which can be accessed directly -- NULL pages have to go
+     * through the slow path (banking, IO registers, echo RAM, etc.) */
+    BYTE *read_page[16];
+    BYTE *write_page[16];
+
+    /* a flag for each DIRTY_PAGE_SIZE bytes of the arena, set when it's written to --
+     * a byte each rather than a bit, so marking a page is a plain store (mem_dirty_pages
+     * packs them into a bitmap) */
+    bool     *dirty;
+    size_t    dirty_page_count;
+
+    /* OAM DMA -- while a transfer is running, the CPU can't use OAM
+     * or the bus the transfer is reading from (see DMA_conflict) */
+    AlarmID  DMA_alarm;
+    bool     DMA_active;
+    WORD     DMA_source;
+    BYTE    *DMA_source_page;   /* NULL if the source isn't a mapped page */
+    uint64_t DMA_start;
+
+    /* battery-backed cart RAM is a shared mapping of the .sav file */
+    BYTE  *SAVmap;
+    size_t SAVmap_size;
+    BYTE  *SAVfooter;   /* mapper state after the RAM, eg. the MBC3 clock */
 
-BYTE  memgval (WORD byte);
-void  memsval (WORD byte, BYTE value);
+    pthread_t       save_thread;
+    bool            save_threaded;  /* (if it didn't start, the save is written at the end) */
+    pthread_mutex_t save_lock;
+    pthread_cond_t  save_kick;
+    bool            save_quit;
+    atomic_bool     save_dirty,     /* may have been written since the last sync */
+                    save_open;      /* cart RAM is enabled, so writes may still come */
+};
 
-void mem_set_register (WORD location, BYTE byte);
+
+
+/* the granularity of the dirty bitmap */
+#define DIRTY_PAGE_SHIFT    8
+#define DIRTY_PAGE_SIZE     (1 << DIRTY_PAGE_SHIFT)
+
+
+
+bool mem_init (gb_t *gb, bool use_bootROM);
+bool mem_loadcart (gb_t *gb, char *fname);
+bool mem_loadROM (gb_t *gb, const BYTE *rom, size_t size);
+bool mem_ROM_supported (const BYTE *rom, size_t size);
+void mem_remap (gb_t *gb);
+void mem_cleanup (gb_t *gb);
+
+BYTE  memgval (gb_t *gb, WORD byte);
+void  memsval (gb_t *gb, WORD byte, BYTE value);
+
+WORD  memgval16 (gb_t *gb, WORD location);
+void  memsval16 (gb_t *gb, WORD location, WORD value);
+
+void mem_set_register (gb_t *gb, WORD location, BYTE byte);
+void mem_tick (gb_t *gb, unsigned cycles);
+
+size_t mem_dirty_pages (gb_t *gb, uint64_t *bitmap, size_t words);
+void   mem_dirty_clear (gb_t *gb);
 
 void mem_logging (bool enable);
 bool mem_log_enabled(void);
 
 
 #endif
-
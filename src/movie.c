@@ -0,0 +1,197 @@
+/*
+ * input movies
+ *
+ */
+
+#include "movie.h"
+#include "gb.h"
+#include "io.h"
+#include "logging.h"
+
+#include <stdio.h>      /* fopen, fread, fwrite */
+#include <string.h>     /* memcmp, memcpy */
+#include <endian.h>     /* htole32, le32toh */
+
+
+
+/*  A movie is the buttons held on each frame from power on, which is
+ *  all it takes to replay a run exactly.  Everything is little endian:
+ *
+ *    "GBmv"
+ *    u32       version (MOVIE_VERSION)
+ *    u8[3]     the ROM's header + global checksums ($014D-$014F)
+ *    u8        (unused)
+ *    u32       length, in frames
+ *
+ *  followed by the button changes, in order:
+ *
+ *    u32       frame
+ *    u8        buttons held from that frame on (bit n = button n)
+ */
+#define MOVIE_VERSION   1
+
+#define HEADER_SIZE     16
+#define LENGTH_OFFSET   12
+#define RECORD_SIZE     5
+
+
+struct movie {
+    FILE         *file;
+    bool          recording;
+
+    unsigned long frame,        /* the next one to run */
+                  length;
+
+    /* recording: the buttons last written */
+    BYTE          buttons;
+
+    /* playing: the next change */
+    bool          has_next;
+    unsigned long next_frame;
+    BYTE          next_buttons;
+};
+
+
+static void read_record (struct movie *mv);
+
+
+
+/* PUBLIC API */
+/* movie_record: start recording gb's buttons to fname (NULL on failure) */
+struct movie *movie_record (gb_t *gb, const char *fname) {
+
+    struct movie *mv = calloc (1, sizeof(*mv));
+    if (!mv)
+        return NULL;
+
+    mv->file = fopen (fname, "wb");
+    if (!mv->file) {
+        error ("failed to open movie '%s'", fname);
+        free (mv);
+        return NULL;
+    }
+    mv->recording = true;
+
+    /* (the length is filled in by movie_close) */
+    BYTE header[HEADER_SIZE] = MOVIE_MAGIC;
+    uint32_t version = htole32 (MOVIE_VERSION);
+    memcpy (header + 4, &version, 4);
+    memcpy (header + 8, gb->mem.ROMbank[0] + 0x014D, 3);
+
+    if (fwrite (header, HEADER_SIZE, 1, mv->file) != 1) {
+        error ("failed to write movie '%s'", fname);
+        fclose (mv->file);
+        free (mv);
+        return NULL;
+    }
+    return mv;
+}
+
+/* movie_play: start playing fname back into gb (NULL if it can't be, or it's for another ROM) */
+struct movie *movie_play (gb_t *gb, const char *fname) {
+
+    struct movie *mv = calloc (1, sizeof(*mv));
+    if (!mv)
+        return NULL;
+
+    mv->file = fopen (fname, "rb");
+    if (!mv->file) {
+        error ("failed to open movie '%s'", fname);
+        free (mv);
+        return NULL;
+    }
+
+    BYTE header[HEADER_SIZE];
+    uint32_t version, length;
+    if (fread (header, HEADER_SIZE, 1, mv->file) != 1 || memcmp (header, MOVIE_MAGIC, 4) != 0) {
+        error ("'%s' is not a movie", fname);
+        movie_close (mv);
+        return NULL;
+    }
+    memcpy (&version, header + 4, 4);
+    memcpy (&length , header + LENGTH_OFFSET, 4);
+
+    if (le32toh (version) != MOVIE_VERSION) {
+        error ("movie version %u isn't supported", le32toh (version));
+        movie_close (mv);
+        return NULL;
+    }
+    if (memcmp (header + 8, gb->mem.ROMbank[0] + 0x014D, 3) != 0) {
+        error ("'%s' was recorded with another ROM", fname);
+        movie_close (mv);
+        return NULL;
+    }
+    mv->length = le32toh (length);
+
+    read_record (mv);
+    return mv;
+}
+
+/* movie_close: finish recording (or playing) */
+void movie_close (struct movie *mv) {
+
+    if (!mv)
+        return;
+
+    if (mv->recording) {
+        uint32_t length = htole32 (mv->frame);
+        if (fseek (mv->file, LENGTH_OFFSET, SEEK_SET) != 0 || fwrite (&length, 4, 1, mv->file) != 1)
+            error ("failed to finish the movie");
+    }
+    fclose (mv->file);
+    free (mv);
+}
+
+/* movie_frame: before each frame, record the buttons (or set them) -- returns false once
+ *              a movie being played is over */
+bool movie_frame (struct movie *mv, gb_t *gb) {
+
+    if (mv->recording) {
+        BYTE buttons = IO_buttons (gb);
+
+        if (mv->frame == 0 || buttons != mv->buttons) {
+            BYTE record[RECORD_SIZE];
+            uint32_t frame = htole32 (mv->frame);
+            memcpy (record, &frame, 4);
+            record[4] = buttons;
+            if (fwrite (record, RECORD_SIZE, 1, mv->file) != 1)
+                error ("failed to write to the movie");
+            mv->buttons = buttons;
+        }
+        mv->frame++;
+        return true;
+    }
+
+    if (mv->frame >= mv->length)
+        return false;
+
+    while (mv->has_next && mv->next_frame <= mv->frame) {
+        IO_set_buttons (gb, mv->next_buttons);
+        read_record (mv);
+    }
+    mv->frame++;
+    return true;
+}
+
+/* movie_length: how many frames have been recorded (or are being played) */
+unsigned long movie_length (struct movie *mv) {
+    return mv->recording? mv->frame : mv->length;
+}
+
+
+
+/* INTERNAL FNs */
+/* read_record: read the next button change */
+static void read_record (struct movie *mv) {
+
+    BYTE record[RECORD_SIZE];
+    uint32_t frame;
+
+    mv->has_next = fread (record, RECORD_SIZE, 1, mv->file) == 1;
+    if (!mv->has_next)
+        return;
+
+    memcpy (&frame, record, 4);
+    mv->next_frame   = le32toh (frame);
+    mv->next_buttons = record[4];
+}
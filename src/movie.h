@@ -0,0 +1,32 @@
+/*
+ * input movies
+ *
+ */
+
+#ifndef __MOVIE_H
+#define __MOVIE_H
+
+
+#include "common.h"
+
+#include <stdbool.h>
+
+
+
+/* the first bytes of a movie file (see movie.c for the format) */
+#define MOVIE_MAGIC     "GBmv"
+
+
+/* a movie being recorded or played back (see movie.c) */
+struct movie;
+
+
+struct movie *movie_record (gb_t *gb, const char *fname);
+struct movie *movie_play (gb_t *gb, const char *fname);
+void movie_close (struct movie *mv);
+
+bool movie_frame (struct movie *mv, gb_t *gb);
+unsigned long movie_length (struct movie *mv);
+
+
+#endif
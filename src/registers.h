@@ -7,6 +7,12 @@
 #define __SPECIAL_REGISTERS_H
 
 
+#include "common.h"
+
+#include <stdbool.h>
+
+
+
 enum {
     R_JOYPAD      = 0xFF00,
     R_SIODATA     = 0xFF01,
@@ -54,71 +60,30 @@ enum {
     R_WNDPOSY     = 0xFF4A,
     R_WNDPOSX     = 0xFF4B,
 
+    R_BIOSROM     = 0xFF50,
+
     R_ISWITCH     = 0xFFFF
 };
 
 
-/* NOTE: this is just used by cpu_print*.c,
- *       so the compiler warns about unused
- *       functions a lot -- these don't matter,
- *       so I disabled them :) */
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-function"
-static char *register_name (unsigned offset) {
-    switch (0xFF00 + offset) {
-    case R_JOYPAD  : return "JOYPAD"  ;
-    case R_SIODATA : return "SIODATA" ;
-    case R_SIOCONT : return "SIOCONT" ;
-
-    case R_DIVIDER : return "DIVIDER" ;
-    case R_TIMECNT : return "TIMECNT" ;
-    case R_TIMEMOD : return "TIMEMOD" ;
-    case R_TIMCONT : return "TIMCONT" ;
-
-    case R_IFLAGS  : return "IFLAGS"  ;
-    case R_SNDREG10: return "SNDREG10";
-    case R_SNDREG11: return "SNDREG11";
-    case R_SNDREG12: return "SNDREG12";
-    case R_SNDREG13: return "SNDREG13";
-    case R_SNDREG14: return "SNDREG14";
-    case R_SNDREG21: return "SNDREG21";
-    case R_SNDREG22: return "SNDREG22";
-    case R_SNDREG23: return "SNDREG23";
-    case R_SNDREG24: return "SNDREG24";
-    case R_SNDREG30: return "SNDREG30";
-    case R_SNDREG31: return "SNDREG31";
-    case R_SNDREG32: return "SNDREG32";
-    case R_SNDREG33: return "SNDREG33";
-    case R_SNDREG34: return "SNDREG34";
-
-    case R_SNDREG41: return "SNDREG41";
-    case R_SNDREG42: return "SNDREG42";
-    case R_SNDREG43: return "SNDREG43";
-    case R_SNDREG44: return "SNDREG44";
-    case R_SNDREG50: return "SNDREG50";
-    case R_SNDREG51: return "SNDREG51";
-    case R_SNDREG52: return "SNDREG52";
-
-    case R_LCDCONT : return "LCDCONT" ;
-    case R_LCDSTAT : return "LCDSTAT" ;
-    case R_SCROLLY : return "SCROLLY" ;
-    case R_SCROLLX : return "SCROLLX" ;
-    case R_CURLINE : return "CURLINE" ;
-    case R_CMPLINE : return "CMPLINE" ;
-    case R_DMACONT : return "DMACONT" ;
-    case R_BGRDPAL : return "BGRDPAL" ;
-    case R_OBJ0PAL : return "OBJ0PAL" ;
-    case R_OBJ1PAL : return "OBJ1PAL" ;
-    case R_WNDPOSY : return "WNDPOSY" ;
-    case R_WNDPOSX : return "WNDPOSX" ;
-
-    case R_ISWITCH : return "ISWITCH" ;
-
-
-    default        : return "RAM"     ;
-    }
-}
-#pragma GCC diagnostic pop
+/* io_register:
+ *  description of an IO register, see io_registers in mem.c
+ */
+struct io_register {
+    const char *name;
+
+    BYTE (*read) (gb_t *gb, WORD location);             /* NULL = read the stored value */
+    void (*write)(gb_t *gb, WORD location, BYTE byte);  /* called after storing the value */
+
+    BYTE writable;      /* bits that writing to the register changes */
+    bool side_effects;  /* accessing the register does more than load/store */
+};
+
+
+/* defined in mem.c */
+const struct io_register *register_info (BYTE offset);
+const char *register_name (BYTE offset);
+
 
 #endif
 
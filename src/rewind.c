@@ -0,0 +1,336 @@
+/*
+ * rewinding
+ *
+ */
+
+#include "rewind.h"
+#include "state.h"
+#include "logging.h"
+
+#include <string.h>     /* memcpy, memset */
+#include <stdint.h>
+#include <sys/mman.h>   /* mmap */
+
+
+
+/* a keyframe (a whole state) is kept every this many frames, and
+ * the frames in between are kept as the difference from it */
+#define KEYFRAME_INTERVAL   60
+
+/* shorter runs of unchanged bytes aren't worth breaking a literal for */
+#define MIN_RUN             4
+
+/* the ring is at least this many states, whatever the budget */
+#define MIN_STATES          4
+
+/* there's room for a frame in the ring's list for every this many bytes of it */
+#define BYTES_PER_ENTRY     256
+
+
+/* a frame in the ring */
+struct entry {
+    size_t offset,
+           size;
+    bool   keyframe;
+};
+
+/*  Each frame's state is XORed with the last keyframe's, and the result
+ *  (which is mostly zeroes) is stored as a list of
+ *
+ *    varint  zero bytes to skip
+ *    varint  literal bytes
+ *    ...     the literal (XORed) bytes
+ *
+ *  Keyframes are stored the same way, XORed with nothing.  The encoded
+ *  frames go in a byte ring, and the oldest ones get dropped to make room
+ *  (a keyframe's deltas go with it).
+ *
+ *  So that making room for a keyframe never drops the newest one (+ every
+ *  frame since), a new one's also started once the frames since the last
+ *  take up half the ring -- which is what happens in a small ring, or with a
+ *  game that changes a lot of its memory every frame.
+ */
+struct rewind {
+    size_t  state_size;     /* the biggest a state can be... */
+    size_t  raw_size;       /* ...and how big they actually are */
+
+    BYTE   *state;          /* the state being pushed/popped */
+    BYTE   *key;            /* the newest keyframe in the ring */
+    BYTE   *encoded;        /* the encoding of state */
+    unsigned since_key;     /* frames pushed since key */
+    size_t  key_used;       /* bytes of the ring key + the frames since take up */
+
+    BYTE   *ring;
+    size_t  ring_size,
+            head;           /* where the next frame goes */
+
+    /* the frames in the ring, oldest first (a ring of its own) */
+    struct entry *entries;
+    size_t  entry_slots,
+            first,
+            count,
+            used;           /* bytes of the ring in use */
+};
+
+
+
+/* put_varint/get_varint: 7 bits a byte, low bits first */
+static inline BYTE *put_varint (BYTE *out, size_t n) {
+    while (n >= 0x80) {
+        *out++ = n | 0x80;
+        n >>= 7;
+    }
+    *out++ = n;
+    return out;
+}
+static inline const BYTE *get_varint (const BYTE *in, const BYTE *end, size_t *n) {
+    *n = 0;
+    for (unsigned shift = 0; in < end && shift < 64; shift += 7) {
+        BYTE byte = *in++;
+        *n |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return in;
+    }
+    return NULL;
+}
+
+/* delta_encode: encode raw XOR base (base can be NULL, for zeroes), returning the size */
+static size_t delta_encode (const BYTE *base, const BYTE *raw, size_t size, BYTE *out) {
+#define DIFF(i)     (base? raw[i] ^ base[i] : raw[i])
+
+    BYTE *start = out;
+    size_t i = 0;
+
+    while (i < size) {
+
+        /* unchanged bytes, a word at a time while we can */
+        size_t run_start = i;
+        if (base)
+            while (i + 8 <= size) {
+                uint64_t a, b;
+                memcpy (&a, raw + i, 8);
+                memcpy (&b, base + i, 8);
+                if (a != b)
+                    break;
+                i += 8;
+            }
+        while (i < size && DIFF(i) == 0)
+            i++;
+        size_t run = i - run_start;
+
+        /* changed bytes, up to the next run worth skipping */
+        size_t literal_start = i;
+        while (i < size) {
+            if (DIFF(i) != 0) {
+                i++;
+                continue;
+            }
+            size_t j = i;
+            while (j < size && j - i < MIN_RUN && DIFF(j) == 0)
+                j++;
+            if (j - i >= MIN_RUN || j == size)
+                break;
+            i = j;
+        }
+
+        out = put_varint (out, run);
+        out = put_varint (out, i - literal_start);
+        for (size_t k = literal_start; k < i; ++k)
+            *out++ = DIFF(k);
+    }
+    return out - start;
+
+#undef DIFF
+}
+
+/* delta_decode: decode in XOR base into out, returning false if it's corrupt */
+static bool delta_decode (const BYTE *base, const BYTE *in, size_t in_size, BYTE *out, size_t size) {
+
+    const BYTE *end = in + in_size;
+    size_t i = 0;
+
+    while (in < end) {
+        size_t run, literal;
+        if (!(in = get_varint (in, end, &run)) || !(in = get_varint (in, end, &literal))
+         || run + literal > size - i || literal > (size_t)(end - in))
+            return false;
+
+        if (base)
+            memcpy (out + i, base + i, run);
+        else
+            memset (out + i, 0, run);
+        i += run;
+
+        for (size_t k = 0; k < literal; ++k, ++i)
+            out[i] = *in++ ^ (base? base[i] : 0);
+    }
+    return i == size;
+}
+
+/* the entries, oldest first */
+#define ENTRY(n)    (rw->entries[(rw->first + (n)) % rw->entry_slots])
+
+/* drop_oldest: drop the oldest frame, along with any deltas which needed it */
+static void drop_oldest (struct rewind *rw) {
+    do {
+        rw->used -= ENTRY(0).size;
+        rw->first = (rw->first + 1) % rw->entry_slots;
+        rw->count--;
+    } while (rw->count > 0 && !ENTRY(0).keyframe);
+}
+
+/* overlaps: whether an entry is in [start, start+size) */
+static bool overlaps (const struct entry *e, size_t start, size_t size) {
+    return e->offset < start + size && start < e->offset + e->size;
+}
+
+/* store: put the encoding of the state in the ring, returning false if it
+ *        had to drop the keyframe it depends on */
+static bool store (struct rewind *rw, size_t size, bool keyframe) {
+
+    size_t start = rw->head;
+
+    /* no room at the end, so wrap around -- everything left
+     * at the end is older than everything at the start */
+    if (start + size > rw->ring_size) {
+        while (rw->count > 0 && ENTRY(0).offset >= start)
+            drop_oldest (rw);
+        start = 0;
+    }
+    while (rw->count > 0 && overlaps (&ENTRY(0), start, size))
+        drop_oldest (rw);
+    if (rw->count == rw->entry_slots)
+        drop_oldest (rw);
+
+    if (!keyframe && rw->count == 0)
+        return false;
+
+    memcpy (rw->ring + start, rw->encoded, size);
+    ENTRY(rw->count) = (struct entry){ .offset=start, .size=size, .keyframe=keyframe };
+    rw->count++;
+    rw->used += size;
+    rw->head  = start + size;
+    rw->key_used = keyframe? size : rw->key_used + size;
+    return true;
+}
+
+
+
+/* PUBLIC API */
+/* rewind_create: a rewind buffer for gb, which uses about budget bytes */
+struct rewind *rewind_create (gb_t *gb, size_t budget) {
+
+    struct rewind *rw = calloc (1, sizeof(*rw));
+    if (!rw)
+        return NULL;
+
+    rw->state_size = state_size (gb);
+
+    /* (an encoding can be a bit bigger than the state) */
+    size_t encoded_size = (rw->state_size * 2) + 16;
+
+    if (budget < encoded_size * MIN_STATES)
+        budget = encoded_size * MIN_STATES;
+    rw->ring_size   = budget;
+    rw->entry_slots = budget / BYTES_PER_ENTRY;
+
+    /* the ring is only backed by memory once it's used */
+    rw->ring = mmap (NULL, rw->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    rw->state   = malloc (rw->state_size);
+    rw->key     = malloc (rw->state_size);
+    rw->encoded = malloc (encoded_size);
+    rw->entries = calloc (rw->entry_slots, sizeof(*rw->entries));
+
+    if (rw->ring == MAP_FAILED || !rw->state || !rw->key || !rw->encoded || !rw->entries) {
+        if (rw->ring == MAP_FAILED)
+            rw->ring = NULL;
+        rewind_destroy (rw);
+        return NULL;
+    }
+    return rw;
+}
+
+/* rewind_destroy:  */
+void rewind_destroy (struct rewind *rw) {
+
+    if (!rw)
+        return;
+
+    if (rw->ring)
+        munmap (rw->ring, rw->ring_size);
+    free (rw->state);
+    free (rw->key);
+    free (rw->encoded);
+    free (rw->entries);
+    free (rw);
+}
+
+/* rewind_push: save the state at the end of a frame */
+void rewind_push (struct rewind *rw, gb_t *gb) {
+
+    rw->raw_size = state_save (gb, rw->state, rw->state_size);
+
+    bool keyframe = rw->count == 0 || rw->since_key >= KEYFRAME_INTERVAL - 1
+                 || rw->since_key >= (rw->entry_slots / 2) - 1;
+
+    if (!keyframe) {
+        size_t size = delta_encode (rw->key, rw->state, rw->raw_size, rw->encoded);
+        if (rw->key_used + size <= rw->ring_size / 2 && store (rw, size, false)) {
+            rw->since_key++;
+            return;
+        }
+        /* the frames since the keyframe are taking up too much of the ring */
+        keyframe = true;
+    }
+
+    size_t size = delta_encode (NULL, rw->state, rw->raw_size, rw->encoded);
+    store (rw, size, true);
+    memcpy (rw->key, rw->state, rw->raw_size);
+    rw->since_key = 0;
+}
+
+/* rewind_pop: go back to the newest saved state, returning false if there isn't one */
+bool rewind_pop (struct rewind *rw, gb_t *gb) {
+
+    if (rw->count == 0)
+        return false;
+
+    struct entry newest = ENTRY(rw->count - 1);
+    bool ok = delta_decode (newest.keyframe? NULL : rw->key,
+                            rw->ring + newest.offset, newest.size,
+                            rw->state, rw->raw_size);
+
+    rw->count--;
+    rw->used    -= newest.size;
+    rw->head     = newest.offset;
+    rw->key_used = newest.keyframe? 0 : rw->key_used - newest.size;
+
+    /* deltas before a keyframe are against the one before it */
+    if (newest.keyframe && rw->count > 0) {
+        size_t key = rw->count - 1;
+        while (!ENTRY(key).keyframe)
+            key--;
+        delta_decode (NULL, rw->ring + ENTRY(key).offset, ENTRY(key).size, rw->key, rw->raw_size);
+        rw->since_key = rw->count - 1 - key;
+        for (size_t i = key; i < rw->count; ++i)
+            rw->key_used += ENTRY(i).size;
+    }
+    else if (!newest.keyframe)
+        rw->since_key--;
+
+    if (!ok) {
+        error ("corrupt rewind frame");
+        return false;
+    }
+    return state_load (gb, rw->state, rw->raw_size);
+}
+
+/* rewind_frames: how many frames can be rewound */
+size_t rewind_frames (struct rewind *rw) {
+    return rw->count;
+}
+
+/* rewind_size: how much of the ring is in use */
+size_t rewind_size (struct rewind *rw) {
+    return rw->used;
+}
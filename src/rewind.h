@@ -0,0 +1,35 @@
+/*
+ * rewinding
+ *
+ */
+
+#ifndef __REWIND_H
+#define __REWIND_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+/* (64MB is several minutes of most games) */
+#define REWIND_DEFAULT_BUDGET   ((size_t)64 << 20)
+
+
+/* a ring of the last however many frames' save states (see rewind.c) */
+struct rewind;
+
+
+struct rewind *rewind_create (gb_t *gb, size_t budget);
+void rewind_destroy (struct rewind *rw);
+
+void rewind_push (struct rewind *rw, gb_t *gb);
+bool rewind_pop (struct rewind *rw, gb_t *gb);
+
+size_t rewind_frames (struct rewind *rw);
+size_t rewind_size (struct rewind *rw);
+
+
+#endif
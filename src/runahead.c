@@ -0,0 +1,230 @@
+/*
+ * running ahead
+ *
+ */
+
+#include "runahead.h"
+#include "gb.h"
+#include "Z80.h"
+#include "mem.h"
+#include "state.h"
+#include "display.h"
+#include "logging.h"
+
+#include <string.h>     /* memcpy */
+#include <pthread.h>    /* pthread_create, pthread_cond_wait */
+
+
+
+/*  Games usually act on a button a frame or two after reading it, so after
+ *  each real frame we save, run a few frames ahead with the same buttons,
+ *  show the last of those, and go back -- the lag is still emulated, it just
+ *  isn't seen.
+ *
+ *  The threaded version does the running ahead on a second instance, at the
+ *  same time as the real frame: before it, the last frame's state and the new
+ *  buttons are handed over, and the thread runs frames+1 frames from there
+ *  (which ends up at the same place).  The real instance never waits for it --
+ *  only showing the frame does.
+ */
+struct runahead {
+    unsigned frames;
+
+    BYTE  *state;       /* the real frame's state (the thread's, while it's busy) */
+    size_t state_size;
+
+    /* threaded */
+    bool            threaded;
+    gb_t           *shadow;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  kick;
+    pthread_cond_t  done;
+    bool            quit,
+                    busy;       /* the thread has a state to run ahead from */
+    size_t          job_size;
+    struct io       job_io;     /* (buttons aren't part of a state) */
+    bool            job_ok;
+    BYTE           *result;     /* the ahead framebuffer */
+};
+
+
+static void *ahead_thread (void *arg);
+
+
+
+/* PUBLIC API */
+/* runahead_create: run frames ahead of gb -- on a second instance + thread if threaded */
+struct runahead *runahead_create (gb_t *gb, unsigned frames, bool threaded) {
+
+    struct runahead *ra = calloc (1, sizeof(*ra));
+    if (!ra)
+        return NULL;
+
+    ra->frames     = frames;
+    ra->state_size = state_size (gb);
+    ra->state      = malloc (ra->state_size);
+    if (!ra->state) {
+        free (ra);
+        return NULL;
+    }
+    if (!threaded)
+        return ra;
+
+    /* the second instance only ever runs states loaded from the first */
+    if (!mem_ROM_supported (gb->mem.ROMmap, gb->mem.ROMmap_size)) {
+        runahead_destroy (ra);
+        return NULL;
+    }
+    ra->shadow = Z80_create();
+    if (!ra->shadow) {
+        runahead_destroy (ra);
+        return NULL;
+    }
+    ra->shadow->use_bios    = gb->use_bios;
+    ra->shadow->speculative = true;
+
+    ra->result = malloc (FB_WIDTH * FB_HEIGHT);
+    if (!mem_loadROM (ra->shadow, gb->mem.ROMmap, gb->mem.ROMmap_size) || !Z80_init (ra->shadow) || !ra->result) {
+        runahead_destroy (ra);
+        return NULL;
+    }
+
+    pthread_mutex_init (&ra->lock, NULL);
+    pthread_cond_init  (&ra->kick, NULL);
+    pthread_cond_init  (&ra->done, NULL);
+    if (pthread_create (&ra->thread, NULL, ahead_thread, ra) != 0) {
+        pthread_cond_destroy  (&ra->done);
+        pthread_cond_destroy  (&ra->kick);
+        pthread_mutex_destroy (&ra->lock);
+        runahead_destroy (ra);
+        return NULL;
+    }
+    ra->threaded = true;
+
+    return ra;
+}
+
+/* runahead_destroy:  */
+void runahead_destroy (struct runahead *ra) {
+
+    if (!ra)
+        return;
+
+    if (ra->threaded) {
+        pthread_mutex_lock (&ra->lock);
+        ra->quit = true;
+        pthread_cond_signal (&ra->kick);
+        pthread_mutex_unlock (&ra->lock);
+        pthread_join (ra->thread, NULL);
+
+        pthread_cond_destroy  (&ra->done);
+        pthread_cond_destroy  (&ra->kick);
+        pthread_mutex_destroy (&ra->lock);
+    }
+    if (ra->shadow)
+        Z80_cleanup (ra->shadow);
+
+    free (ra->state);
+    free (ra->result);
+    free (ra);
+}
+
+/* can_run_ahead: whether to run ahead of this frame -- the debugger (and disassembler) has to see the real thing */
+static bool can_run_ahead (struct runahead *ra, gb_t *gb) {
+    return ra->frames > 0 && !gb->state.debug.enabled && gb->state.state == EMUSTATE_NORMAL && gb->state.running;
+}
+
+/* runahead_begin: before a real frame, once the buttons for it are set */
+void runahead_begin (struct runahead *ra, gb_t *gb) {
+
+    if (!ra->threaded || !can_run_ahead (ra, gb))
+        return;
+
+    pthread_mutex_lock (&ra->lock);
+    while (ra->busy)
+        pthread_cond_wait (&ra->done, &ra->lock);
+
+    ra->job_size = state_save (gb, ra->state, ra->state_size);
+    ra->job_io   = gb->io;
+    ra->busy     = true;
+    pthread_cond_signal (&ra->kick);
+    pthread_mutex_unlock (&ra->lock);
+}
+
+/* runahead_frame: after a real frame, leave the framebuffer showing the frame ahead of it */
+void runahead_frame (struct runahead *ra, gb_t *gb) {
+
+    if (ra->threaded) {
+        pthread_mutex_lock (&ra->lock);
+        while (ra->busy)
+            pthread_cond_wait (&ra->done, &ra->lock);
+
+        /* (the next real frame clears the framebuffer first anyway) */
+        if (ra->job_ok && can_run_ahead (ra, gb))
+            memcpy (gb->display.framebuffer, ra->result, FB_WIDTH * FB_HEIGHT);
+        ra->job_ok = false;
+
+        pthread_mutex_unlock (&ra->lock);
+        return;
+    }
+
+    if (!can_run_ahead (ra, gb))
+        return;
+
+    size_t size = state_save (gb, ra->state, ra->state_size);
+
+    /* the buttons the game has seen aren't part of a state */
+    struct io io = gb->io;
+
+    gb->speculative = true;
+    for (unsigned i = 0; i < ra->frames && gb->state.running; ++i)
+        Z80_run_frame (gb);
+    gb->speculative = false;
+
+    /* (loading doesn't touch the framebuffer, so it's left with the ahead frame) */
+    if (!state_load (gb, ra->state, size)) {
+        error ("failed to go back after running ahead");
+        gb->state.running = false;
+        return;
+    }
+    gb->io = io;
+    gb->state.running = true;
+}
+
+
+
+/* INTERNAL FNs */
+/* ahead_thread: run ahead of each state the real instance hands over */
+static void *ahead_thread (void *arg) {
+
+    struct runahead *ra = arg;
+    gb_t *shadow = ra->shadow;
+
+    pthread_mutex_lock (&ra->lock);
+    while (!ra->quit) {
+
+        if (!ra->busy) {
+            pthread_cond_wait (&ra->kick, &ra->lock);
+            continue;
+        }
+        pthread_mutex_unlock (&ra->lock);
+
+        /* the state is from before the real frame, so run one more */
+        bool ok = state_load (shadow, ra->state, ra->job_size);
+        shadow->io = ra->job_io;
+        for (unsigned i = 0; ok && i <= ra->frames; ++i)
+            Z80_run_frame (shadow);
+        shadow->state.running = true;
+        if (ok)
+            memcpy (ra->result, shadow->display.framebuffer, FB_WIDTH * FB_HEIGHT);
+
+        pthread_mutex_lock (&ra->lock);
+        ra->job_ok = ok;
+        ra->busy   = false;
+        pthread_cond_signal (&ra->done);
+    }
+    pthread_mutex_unlock (&ra->lock);
+
+    return NULL;
+}
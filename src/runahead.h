@@ -0,0 +1,27 @@
+/*
+ * running ahead
+ *
+ */
+
+#ifndef __RUNAHEAD_H
+#define __RUNAHEAD_H
+
+
+#include "common.h"
+
+#include <stdbool.h>
+
+
+
+/* the state + thread for running ahead of the real frame (see runahead.c) */
+struct runahead;
+
+
+struct runahead *runahead_create (gb_t *gb, unsigned frames, bool threaded);
+void runahead_destroy (struct runahead *ra);
+
+void runahead_begin (struct runahead *ra, gb_t *gb);
+void runahead_frame (struct runahead *ra, gb_t *gb);
+
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * input scripts -- the buttons held from each frame on
+ *
+ */
+
+#include "script.h"
+#include "io.h"
+
+#include <stdio.h>      /* fopen, fgets, snprintf */
+#include <string.h>     /* strchr, strcmp, strerror, strtok_r */
+#include <strings.h>    /* strcasecmp */
+#include <errno.h>
+
+
+
+/*  A script (for gb --input script:FILE, or a gb-batch job) has a line for
+ *  each change of the buttons held, eg.
+ *
+ *    0    -          # nothing
+ *    120  A+START    # from frame 120 on
+ *    130  -          # let go
+ *
+ *  counting frames from power on, which can't go backwards.  gb's input
+ *  sockets take the same lines, one at a time.
+ */
+
+/* (longer lines are cut short) */
+#define LINE_SIZE       256
+
+
+/* the buttons, by name */
+static const char *const button_names[_NUM_BTNS] = {
+    [BTN_RIGHT]  = "RIGHT",
+    [BTN_LEFT]   = "LEFT",
+    [BTN_UP]     = "UP",
+    [BTN_DOWN]   = "DOWN",
+    [BTN_A]      = "A",
+    [BTN_B]      = "B",
+    [BTN_SELECT] = "SELECT",
+    [BTN_START]  = "START",
+};
+
+
+
+/* PUBLIC API */
+/* script_parse_buttons: "A+START" -> bits (or "-" for none), returning false if a name is unknown */
+bool script_parse_buttons (const char *str, BYTE *buttons) {
+
+    *buttons = 0;
+    if (strcmp (str, "-") == 0)
+        return true;
+
+    char copy[LINE_SIZE];
+    snprintf (copy, sizeof(copy), "%s", str);
+
+    char *save;
+    for (char *name = strtok_r (copy, "+", &save); name; name = strtok_r (NULL, "+", &save)) {
+        unsigned button;
+        for (button = 0; button < _NUM_BTNS; ++button)
+            if (strcasecmp (name, button_names[button]) == 0)
+                break;
+        if (button == _NUM_BTNS)
+            return false;
+        SETBIT(*buttons, button);
+    }
+    return true;
+}
+
+/* script_parse_line: "FRAME BUTTONS" (or just "BUTTONS", if frame isn't NULL -- which
+ *                    is the frame it's for), returning false if it isn't one */
+bool script_parse_line (const char *line, struct script_change *change, const unsigned long *frame) {
+
+    char first[32], second[LINE_SIZE], extra;
+    int fields = sscanf (line, "%31s %255s %c", first, second, &extra);
+
+    if (fields == 1 && frame) {
+        change->frame = *frame;
+        return script_parse_buttons (first, &change->buttons);
+    }
+    if (fields != 2)
+        return false;
+
+    char *end;
+    change->frame = strtoul (first, &end, 0);
+    return *end == '\0' && script_parse_buttons (second, &change->buttons);
+}
+
+/* script_load: read a script's changes, in order (to be freed) -- NULL (+ a
+ *              message in err) if it can't be read, or has a bad line */
+struct script_change *script_load (const char *fname, size_t *count, char *err, size_t err_size) {
+
+    FILE *file = fopen (fname, "r");
+    if (!file) {
+        snprintf (err, err_size, "%s: %s", fname, strerror (errno));
+        return NULL;
+    }
+
+    size_t allocated = 16;
+    struct script_change *changes = malloc (allocated * sizeof(*changes));
+    *count = 0;
+
+    char line[LINE_SIZE];
+    for (unsigned number = 1; changes && fgets (line, sizeof(line), file); ++number) {
+
+        char *hash = strchr (line, '#');
+        if (hash)
+            *hash = '\0';
+
+        char first;
+        if (sscanf (line, " %c", &first) != 1)
+            continue;
+
+        struct script_change change;
+        if (!script_parse_line (line, &change, NULL)
+         || (*count > 0 && change.frame < changes[*count - 1].frame)) {
+            snprintf (err, err_size, "%s:%u: bad input script line", fname, number);
+            free (changes);
+            fclose (file);
+            return NULL;
+        }
+
+        if (*count == allocated) {
+            allocated *= 2;
+            struct script_change *more = realloc (changes, allocated * sizeof(*changes));
+            if (!more)
+                free (changes);
+            changes = more;
+        }
+        if (changes)
+            changes[(*count)++] = change;
+    }
+
+    fclose (file);
+    if (!changes)
+        snprintf (err, err_size, "%s: out of memory", fname);
+    return changes;
+}
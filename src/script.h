@@ -0,0 +1,32 @@
+/*
+ * input scripts -- the buttons held from each frame on
+ *
+ */
+
+#ifndef __SCRIPT_H
+#define __SCRIPT_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+/* script_change:
+ *  a line of a script -- from frame on, hold buttons (bit n = button n)
+ */
+struct script_change {
+    unsigned long frame;
+    BYTE          buttons;
+};
+
+
+
+bool script_parse_buttons (const char *str, BYTE *buttons);
+bool script_parse_line (const char *line, struct script_change *change, const unsigned long *frame);
+struct script_change *script_load (const char *fname, size_t *count, char *err, size_t err_size);
+
+
+#endif
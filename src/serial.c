@@ -0,0 +1,210 @@
+/*
+ * the serial port (+ the link cable plugged into it)
+ *
+ */
+
+#include "serial.h"
+#include "gb.h"
+#include "cpu.h"        /* cpu_interrupt */
+#include "link.h"       /* link_sync */
+#include "arena.h"
+#include "alarm.h"      /* get_cycle_count */
+#include "registers.h"
+
+#include <stdlib.h>     /* realloc, free */
+#include <string.h>     /* memcmp, memmove, strlen, strdup */
+
+
+
+/*  Setting bit 7 of SIOCONT sends SIODATA out a bit at a time, while the
+ *  other end's SIODATA comes in -- clocked by this end (bit 0 set), which
+ *  takes SERIAL_CYCLES, or by the other end (bit 0 clear), which waits for
+ *  it to start a transfer of its own.  Either way, when the byte's gone,
+ *  bit 7 is cleared and there's a serial interrupt.
+ *
+ *  With nothing plugged in, the bits that come in are all 1s, and a
+ *  transfer clocked by the other end never finishes.  A link cable (see
+ *  link.c) takes care of when transfers finish, and what comes in.
+ *
+ *  Test ROMs (blargg's, mooneye's) send their results out as text, so every
+ *  byte sent is kept (serial_output) -- and as they can be done long before
+ *  whatever's running them would know, the run can stop as soon as the
+ *  text ends with, say, "Passed" (serial_stop_on), or mooneye's tests do
+ *  LD B,B with the registers set to say how it went (serial_magic).  That
+ *  stops it the way the debugger's quit does, by clearing gb->state.running.
+ *
+ *  Running ahead sends nothing, so can't stop anything.
+ */
+
+/* mooneye's LD B,B registers (B, C, D, E, H, L) */
+static const BYTE magic_passed[6] = { 3, 5, 8, 13, 21, 34 },
+                  magic_failed[6] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+
+
+/* reg: an IO register */
+static inline BYTE *reg (gb_t *gb, WORD location) {
+    return &gb->arena->high[location - 0xFE00];
+}
+
+/* stop: stop the run, because of why */
+static void stop (gb_t *gb, const char *why) {
+    gb->serial.stopped = why;
+    gb->state.running  = false;
+}
+
+/* send: keep a byte that's been sent, and stop if it finishes one of the texts */
+static void send (gb_t *gb, BYTE byte) {
+
+    struct serial *s = &gb->serial;
+
+    /* (the output grows as it's needed, up to SERIAL_OUTPUT_MAX) */
+    if (s->output_length + 1 >= s->output_size && s->output_size < SERIAL_OUTPUT_MAX) {
+        size_t size = s->output_size? s->output_size * 2 : 256;
+        char *output = realloc (s->output, size);
+        if (output) {
+            s->output      = output;
+            s->output_size = size;
+        }
+    }
+    if (s->output_length + 1 < s->output_size) {
+        s->output[s->output_length++] = byte;
+        s->output[s->output_length]   = '\0';
+    }
+
+    if (!s->stop_count)
+        return;
+
+    memmove (s->tail, s->tail + 1, SERIAL_STOP_MAX - 1);
+    s->tail[SERIAL_STOP_MAX - 1] = byte;
+
+    for (unsigned i = 0; i < s->stop_count; ++i) {
+        size_t length = strlen (s->stop[i]);
+        if (memcmp (s->tail + SERIAL_STOP_MAX - length, s->stop[i], length) == 0) {
+            stop (gb, s->stop[i]);
+            break;
+        }
+    }
+}
+
+
+
+/* PUBLIC API */
+/* serial_init: start off with no transfer (+ nothing plugged in), keeping
+ *              what the run's been told to stop on */
+void serial_init (gb_t *gb) {
+
+    gb->serial.end  = SERIAL_NEVER;
+    gb->serial.link = NULL;
+    serial_schedule (gb);
+}
+
+/* serial_cleanup: free the output + the texts to stop on */
+void serial_cleanup (gb_t *gb) {
+
+    struct serial *s = &gb->serial;
+
+    for (unsigned i = 0; i < s->stop_count; ++i)
+        free (s->stop[i]);
+    free (s->stop);
+    free (s->output);
+}
+
+/* serial_read: SIOCONT (the unused bits read as 1s) */
+BYTE serial_read (gb_t *gb, WORD location) {
+    return *reg (gb, location) | 0x7E;
+}
+
+/* serial_write: SIOCONT starts (or stops) a transfer */
+void serial_write (gb_t *gb, WORD location, BYTE byte) {
+    (void)location;
+
+    struct serial *s = &gb->serial;
+
+    if (GETBIT(byte, 7) && !gb->speculative)
+        send (gb, *reg (gb, R_SIODATA));
+
+    s->end = GETBIT(byte, 7) && GETBIT(byte, 0)? get_cycle_count (gb) + SERIAL_CYCLES : SERIAL_NEVER;
+    serial_schedule (gb);
+}
+
+/* serial_event: the transfer's done, or (with a link cable) the ends have to sync up */
+void serial_event (gb_t *gb) {
+
+    if (gb->serial.link)
+        link_sync (gb->serial.link, gb);
+    else
+        serial_finish (gb, 0xFF);
+}
+
+/* serial_schedule: work out when serial_event is due (a link cable has its own idea) */
+void serial_schedule (gb_t *gb) {
+    if (!gb->serial.link)
+        gb->serial.due = gb->serial.end;
+}
+
+/* serial_waiting: whether a transfer is waiting for the other end to clock it */
+bool serial_waiting (gb_t *gb) {
+    BYTE control = *reg (gb, R_SIOCONT);
+    return GETBIT(control, 7) && !GETBIT(control, 0);
+}
+
+/* serial_finish: finish the transfer, with in having come in */
+void serial_finish (gb_t *gb, BYTE in) {
+
+    *reg (gb, R_SIODATA) = in;
+    *reg (gb, R_SIOCONT) &= ~0x80;
+    cpu_interrupt (gb, INT_SERIAL);
+
+    gb->serial.end = SERIAL_NEVER;
+    serial_schedule (gb);
+}
+
+/* serial_output: everything that's been sent (up to SERIAL_OUTPUT_MAX), with a
+ *                '\0' after it -- NULL (+ 0) if nothing has */
+const char *serial_output (gb_t *gb, size_t *length) {
+    *length = gb->serial.output_length;
+    return gb->serial.output;
+}
+
+/* serial_stop_on: stop the run as soon as what's been sent ends with text
+ *                 (returning false if it's too long, or on failure) */
+bool serial_stop_on (gb_t *gb, const char *text) {
+
+    struct serial *s = &gb->serial;
+
+    size_t length = strlen (text);
+    if (length == 0 || length > SERIAL_STOP_MAX)
+        return false;
+
+    char **stop = realloc (s->stop, (s->stop_count + 1) * sizeof(*stop));
+    if (!stop)
+        return false;
+    s->stop = stop;
+
+    if (!(stop[s->stop_count] = strdup (text)))
+        return false;
+    s->stop_count++;
+    return true;
+}
+
+/* serial_magic: LD B,B's been run -- stop the run if it's mooneye's pass/fail */
+void serial_magic (gb_t *gb) {
+
+    struct cpu *cpu = &gb->cpu;
+    BYTE regs[6] = { *cpu->B, *cpu->C, *cpu->D, *cpu->E, *cpu->H, *cpu->L };
+
+    if (gb->speculative)
+        return;
+
+    if (memcmp (regs, magic_passed, sizeof(regs)) == 0)
+        stop (gb, "LD B,B passed");
+    else if (memcmp (regs, magic_failed, sizeof(regs)) == 0)
+        stop (gb, "LD B,B failed");
+}
+
+/* serial_stopped: why the run was stopped (the text it ended with, or "LD B,B
+ *                 passed"/"failed") -- NULL if it hasn't been */
+const char *serial_stopped (gb_t *gb) {
+    return gb->serial.stopped;
+}
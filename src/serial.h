@@ -0,0 +1,74 @@
+/*
+ * the serial port (+ the link cable plugged into it)
+ *
+ */
+
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+
+/* a byte takes this many cycles to go out (8 bits at 8192Hz) */
+#define SERIAL_CYCLES       4096
+
+/* (the cycle of something that isn't going to happen) */
+#define SERIAL_NEVER        UINT64_MAX
+
+/* the most of what's been sent that's kept (see serial_output)... */
+#define SERIAL_OUTPUT_MAX   (1 << 20)
+/* ...and the longest text the run can be stopped on (see serial_stop_on) */
+#define SERIAL_STOP_MAX     64
+
+
+struct link;
+
+/* serial:
+ *  the port of an emulator instance -- SIODATA + SIOCONT are in the IO
+ *  registers, and this is when the transfer they start is done
+ */
+struct serial {
+    uint64_t     end;       /* when the transfer this end is clocking finishes */
+    uint64_t     due;       /* when serial_event next has to be run */
+    struct link *link;      /* the cable (NULL if nothing's plugged in) */
+
+    /* every byte sent, for a test ROM's results -- none of this is part of a state */
+    char        *output;
+    size_t       output_length,
+                 output_size;
+
+    /* the run is stopped (see serial_stopped) when the last bytes sent are one of
+     * stop, or (stop_magic) when LD B,B runs with mooneye's pass/fail registers */
+    char       **stop;
+    unsigned     stop_count;
+    bool         stop_magic;
+    char         tail[SERIAL_STOP_MAX];     /* the last bytes sent, oldest first */
+    const char  *stopped;
+};
+
+
+
+void serial_init (gb_t *gb);
+void serial_cleanup (gb_t *gb);
+
+BYTE serial_read (gb_t *gb, WORD location);
+void serial_write (gb_t *gb, WORD location, BYTE byte);
+
+void serial_event (gb_t *gb);
+void serial_schedule (gb_t *gb);
+
+bool serial_waiting (gb_t *gb);
+void serial_finish (gb_t *gb, BYTE in);
+
+const char *serial_output (gb_t *gb, size_t *length);
+bool serial_stop_on (gb_t *gb, const char *text);
+void serial_magic (gb_t *gb);
+const char *serial_stopped (gb_t *gb);
+
+
+#endif
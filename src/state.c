@@ -0,0 +1,405 @@
+/*
+ * emulator save states
+ *
+ */
+
+#include "state.h"
+#include "gb.h"
+#include "mem.h"
+#include "mbc.h"
+#include "cpu.h"
+#include "arena.h"
+#include "alarm.h"
+#include "display.h"
+#include "apu.h"
+#include "serial.h"
+#include "logging.h"
+
+#include <string.h>     /* memcpy, memcmp */
+#include <endian.h>     /* htole16, le16toh, etc. */
+
+
+
+/*          SAVE STATE FORMAT
+ *          =================
+ *
+ * All numbers are little endian.  A state is a header:
+ *
+ *   "GBst"  magic
+ *   u32     version (STATE_VERSION)
+ *
+ * followed by chunks, each of which is:
+ *
+ *   char[4] tag
+ *   u32     size of the data
+ *   ...     data
+ *
+ * Unknown chunks are skipped, so later versions can add chunks without
+ * breaking older readers -- changing what's in a chunk needs a new version.
+ *
+ *   "CPU "  u16 PC, SP, AF, BC, DE, HL, u8 IME, halted
+ *   "RAM "  VRAM ($2000), internal RAM ($2000), $FE00-$FFFF ($200)
+ *   "CART"  cart RAM (only if the cart has some)
+ *   "MBC "  the mapper's own state (see struct mbc)
+ *   "BUS "  u8 BIOS mapped, u8 DMA active, u16 DMA source, u64 DMA start
+ *   "TIMR"  u64 DIVIDER base, u64 TIMECNT base, u8 TIMECNT, u8 TIMCONT
+ *   "PPU "  u8 scanline step, u64 cycles into the frame, u8 framebuffer stale,
+ *           u16 sprites_to_draw[10]
+ *   "SCHD"  u64 cycle count, u32 alarm count, then per alarm
+ *           u64 id, i64 cycles to the next run, i64 period
+ *   "APU "  u64 cycle the channels are run up to, u64 next frame sequencer step,
+ *           u8 frame sequencer step, then per channel u8 on, u16 length, u32 timer,
+ *           u8 step, output, volume, envelope timer, sweep timer, sweep on,
+ *           u16 sweep shadow, LFSR (the registers are in "RAM ")
+ *   "SIO "  u64 cycle the serial transfer this end is clocking finishes
+ *           (all 1s if there isn't one)
+ *
+ * Everything is required except "CART", and "APU " and "SIO " (which older
+ * states don't have -- they load with every channel stopped, and no serial
+ * transfer going).  Alarms are matched up by id,
+ * and keep the functions the instance already has for them (apart from the
+ * scanline alarm, which "PPU " has the step for), so a state can only be
+ * loaded into an instance of the same ROM.
+ *
+ * The IO registers are saved in "RAM " as they're stored, and loaded back
+ * the same way -- not through their hooks in the register table (see
+ * register_info), since writing them would start serial transfers, trigger
+ * sound channels, reset the timer, etc.  What the hooks keep outside the
+ * registers has a chunk of its own ("BUS ", "TIMR", "APU ", "SIO "), or is
+ * worked out again once the state's loaded (the pending interrupts).
+ */
+
+#define STATE_VERSION   1
+
+#define HEADER_SIZE     8
+#define CHUNK_HEADER    8
+
+#define CPU_SIZE        (6 * 2 + 2)
+#define RAM_SIZE        (0x2000 + 0x2000 + 0x200)
+#define BUS_SIZE        (1 + 1 + 2 + 8)
+#define TIMR_SIZE       (8 + 8 + 1 + 1)
+#define PPU_SIZE        (1 + 8 + 1 + 10 * 2)
+#define SCHD_SIZE(n)    (8 + 4 + (n) * (8 + 8 + 8))
+#define APU_SIZE        (8 + 8 + 1 + 4 * (1 + 2 + 4 + 6 + 2 + 2))
+#define SIO_SIZE        8
+
+/* the chunks, in the order they are saved */
+enum { CPU, RAM, CART, MBC, BUS, TIMR, PPU, SCHD, APU, SIO, _NUM_CHUNKS };
+static const char chunk_tags[_NUM_CHUNKS][4] = { "CPU ", "RAM ", "CART", "MBC ", "BUS ", "TIMR", "PPU ", "SCHD", "APU ", "SIO " };
+
+
+
+/* a cursor into a state being written/read */
+struct cursor {
+    BYTE *p;
+};
+
+static inline void put8  (struct cursor *c, BYTE v)     { *c->p++ = v; }
+static inline void put16 (struct cursor *c, WORD v)     { v = htole16 (v); memcpy (c->p, &v, 2); c->p += 2; }
+static inline void put32 (struct cursor *c, uint32_t v) { v = htole32 (v); memcpy (c->p, &v, 4); c->p += 4; }
+static inline void put64 (struct cursor *c, uint64_t v) { v = htole64 (v); memcpy (c->p, &v, 8); c->p += 8; }
+static inline void putmem (struct cursor *c, const void *src, size_t n) { memcpy (c->p, src, n); c->p += n; }
+
+static inline BYTE     get8  (const BYTE **p) { return *(*p)++; }
+static inline WORD     get16 (const BYTE **p) { WORD     v; memcpy (&v, *p, 2); *p += 2; return le16toh (v); }
+static inline uint32_t get32 (const BYTE **p) { uint32_t v; memcpy (&v, *p, 4); *p += 4; return le32toh (v); }
+static inline uint64_t get64 (const BYTE **p) { uint64_t v; memcpy (&v, *p, 8); *p += 8; return le64toh (v); }
+
+/* chunk_start/chunk_end: write a chunk header, then fill in its size */
+static BYTE *chunk_start (struct cursor *c, unsigned chunk) {
+    putmem (c, chunk_tags[chunk], 4);
+    put32 (c, 0);
+    return c->p;
+}
+static void chunk_end (struct cursor *c, BYTE *data) {
+    uint32_t size = htole32 (c->p - data);
+    memcpy (data - 4, &size, 4);
+}
+
+/* cart_RAM_size: how much cart RAM the instance has */
+static size_t cart_RAM_size (gb_t *gb) {
+    return gb->mem.RAMbankcount * 0x2000;
+}
+
+/* apu_chunk_ok: whether an "APU " chunk's frame sequencer is where it could be */
+static bool apu_chunk_ok (const BYTE *p) {
+    uint64_t synced   = get64 (&p),
+             seq_next = get64 (&p);
+    return seq_next > synced && seq_next - synced <= 8192;
+}
+
+/* sio_chunk_ok: whether a "SIO " chunk's transfer finishes when it could (given the "SCHD" chunk) */
+static bool sio_chunk_ok (const BYTE *p, const BYTE *schd) {
+    uint64_t end = get64 (&p),
+             now = get64 (&schd);
+    return end == SERIAL_NEVER || (end > now && end - now <= SERIAL_CYCLES);
+}
+
+
+
+/* state_size: the most space a state of gb can take */
+size_t state_size (gb_t *gb) {
+    return HEADER_SIZE + (_NUM_CHUNKS * CHUNK_HEADER)
+         + CPU_SIZE + RAM_SIZE + cart_RAM_size (gb) + MBC_STATE_SIZE
+         + BUS_SIZE + TIMR_SIZE + PPU_SIZE + SCHD_SIZE(ALARM_SLOTS) + APU_SIZE + SIO_SIZE;
+}
+
+/* state_save: save gb into buf, returning the size (0 if buf is too small) */
+size_t state_save (gb_t *gb, BYTE *buf, size_t size) {
+
+    if (size < state_size (gb))
+        return 0;
+
+    struct cursor c = { buf };
+    BYTE *data;
+
+    putmem (&c, "GBst", 4);
+    put32 (&c, STATE_VERSION);
+
+    data = chunk_start (&c, CPU);
+    put16 (&c, gb->cpu.pc);
+    put16 (&c, gb->cpu.sp);
+    put16 (&c, *gb->cpu.AF);
+    put16 (&c, *gb->cpu.BC);
+    put16 (&c, *gb->cpu.DE);
+    put16 (&c, *gb->cpu.HL);
+    put8  (&c, gb->cpu.IME);
+    put8  (&c, gb->cpu.halted);
+    chunk_end (&c, data);
+
+    data = chunk_start (&c, RAM);
+    putmem (&c, gb->arena->VRAM, sizeof(gb->arena->VRAM));
+    putmem (&c, gb->arena->WRAM, sizeof(gb->arena->WRAM));
+    putmem (&c, gb->arena->high, sizeof(gb->arena->high));
+    chunk_end (&c, data);
+
+    if (cart_RAM_size (gb)) {
+        data = chunk_start (&c, CART);
+        putmem (&c, arena_cart_RAM (gb), cart_RAM_size (gb));
+        chunk_end (&c, data);
+    }
+
+    data = chunk_start (&c, MBC);
+    c.p += gb->mem.mbc->save (gb, c.p);
+    chunk_end (&c, data);
+
+    data = chunk_start (&c, BUS);
+    put8  (&c, gb->mem.MODE_STARTUP);
+    put8  (&c, gb->mem.DMA_active);
+    put16 (&c, gb->mem.DMA_source);
+    put64 (&c, gb->mem.DMA_start);
+    chunk_end (&c, data);
+
+    data = chunk_start (&c, TIMR);
+    put64 (&c, gb->timer.divider_base);
+    put64 (&c, gb->timer.base);
+    put8  (&c, gb->timer.value);
+    put8  (&c, gb->timer.control);
+    chunk_end (&c, data);
+
+    data = chunk_start (&c, PPU);
+    put8  (&c, display_get_step (gb));
+    put64 (&c, gb->display.frame_cycles);
+    put8  (&c, gb->display.stale);
+    for (unsigned i = 0; i < LEN(gb->display.sprites_to_draw); ++i)
+        put16 (&c, gb->display.sprites_to_draw[i]);
+    chunk_end (&c, data);
+
+    const struct scheduler *sched = &gb->arena->sched;
+    data = chunk_start (&c, SCHD);
+    put64 (&c, sched->cycle_count);
+    put32 (&c, sched->alarm_count);
+    for (unsigned i = 0; i < sched->alarm_count; ++i) {
+        put64 (&c, sched->alarms[i].id);
+        put64 (&c, sched->alarms[i].to_next_run);
+        put64 (&c, sched->alarms[i].cyclecount);
+    }
+    chunk_end (&c, data);
+
+    const struct apu *apu = &gb->apu;
+    data = chunk_start (&c, APU);
+    put64 (&c, apu->synced);
+    put64 (&c, apu->seq_next);
+    put8  (&c, apu->seq_step);
+    for (unsigned i = 0; i < LEN(apu->ch); ++i) {
+        const struct channel *ch = &apu->ch[i];
+        put8  (&c, ch->on);
+        put16 (&c, ch->length);
+        put32 (&c, ch->timer);
+        put8  (&c, ch->step);
+        put8  (&c, ch->output);
+        put8  (&c, ch->volume);
+        put8  (&c, ch->env_timer);
+        put8  (&c, ch->sweep_timer);
+        put8  (&c, ch->sweep_on);
+        put16 (&c, ch->shadow);
+        put16 (&c, ch->lfsr);
+    }
+    chunk_end (&c, data);
+
+    data = chunk_start (&c, SIO);
+    put64 (&c, gb->serial.end);
+    chunk_end (&c, data);
+
+    return c.p - buf;
+}
+
+/* state_load: load a state saved by state_save -- gb is untouched if it can't be loaded */
+bool state_load (gb_t *gb, const BYTE *buf, size_t size) {
+
+    const BYTE *chunks[_NUM_CHUNKS] = { NULL };
+    uint32_t    sizes [_NUM_CHUNKS] = { 0 };
+
+    if (size < HEADER_SIZE || memcmp (buf, "GBst", 4) != 0) {
+        error ("not a save state");
+        return false;
+    }
+    const BYTE *p = buf + 4;
+    uint32_t version = get32 (&p);
+    if (version != STATE_VERSION) {
+        error ("save state version %u isn't supported", version);
+        return false;
+    }
+
+    /* find the chunks */
+    while (p < buf + size) {
+
+        if ((size_t)(buf + size - p) < CHUNK_HEADER) {
+            error ("save state is truncated");
+            return false;
+        }
+        const BYTE *tag = p;
+        p += 4;
+        uint32_t chunk_size = get32 (&p);
+        if (chunk_size > (size_t)(buf + size - p)) {
+            error ("save state is truncated");
+            return false;
+        }
+
+        for (unsigned i = 0; i < _NUM_CHUNKS; ++i)
+            if (memcmp (tag, chunk_tags[i], 4) == 0) {
+                chunks[i] = p;
+                sizes[i]  = chunk_size;
+            }
+        p += chunk_size;
+    }
+
+    /* check they all fit this instance before touching it */
+    struct scheduler *sched = &gb->arena->sched;
+    if (!chunks[CPU]  || sizes[CPU]  != CPU_SIZE
+     || !chunks[RAM]  || sizes[RAM]  != RAM_SIZE
+     || (cart_RAM_size (gb) && (!chunks[CART] || sizes[CART] != cart_RAM_size (gb)))
+     || !chunks[MBC]
+     || !chunks[BUS]  || sizes[BUS]  != BUS_SIZE
+     || !chunks[TIMR] || sizes[TIMR] != TIMR_SIZE
+     || !chunks[PPU]  || sizes[PPU]  != PPU_SIZE || chunks[PPU][0] >= DISPLAY_STEPS
+     || !chunks[SCHD] || sizes[SCHD] != SCHD_SIZE(sched->alarm_count)
+     || (chunks[APU] && (sizes[APU] != APU_SIZE || !apu_chunk_ok (chunks[APU])))
+     || (chunks[SIO] && (sizes[SIO] != SIO_SIZE || !sio_chunk_ok (chunks[SIO], chunks[SCHD])))) {
+        error ("save state doesn't match this instance");
+        return false;
+    }
+    p = chunks[SCHD] + 8 + 4;
+    for (unsigned i = 0; i < sched->alarm_count; ++i, p += 16)
+        if (get64 (&p) != sched->alarms[i].id) {
+            error ("save state has different alarms");
+            return false;
+        }
+
+
+    /* the scheduler first, since the mapper's clock syncs to it
+     * (so put it back if the mapper state is no good) */
+    struct scheduler old_sched = *sched;
+    struct mapper    old_mapper = gb->mapper;
+
+    p = chunks[SCHD];
+    sched->cycle_count = get64 (&p);
+    p += 4;
+    for (unsigned i = 0; i < sched->alarm_count; ++i) {
+        p += 8;
+        sched->alarms[i].to_next_run = (int64_t)get64 (&p);
+        sched->alarms[i].cyclecount  = (int64_t)get64 (&p);
+    }
+
+    if (!gb->mem.mbc->load (gb, chunks[MBC], sizes[MBC])) {
+        *sched     = old_sched;
+        gb->mapper = old_mapper;
+        error ("save state has a bad mapper state");
+        return false;
+    }
+
+    p = chunks[CPU];
+    gb->cpu.pc  = get16 (&p);
+    gb->cpu.sp  = get16 (&p);
+   *gb->cpu.AF  = get16 (&p);
+   *gb->cpu.BC  = get16 (&p);
+   *gb->cpu.DE  = get16 (&p);
+   *gb->cpu.HL  = get16 (&p);
+    gb->cpu.IME    = get8 (&p) & 1;
+    gb->cpu.halted = get8 (&p) & 1;
+
+    p = chunks[RAM];
+    memcpy (gb->arena->VRAM, p, sizeof(gb->arena->VRAM));
+    p += sizeof(gb->arena->VRAM);
+    memcpy (gb->arena->WRAM, p, sizeof(gb->arena->WRAM));
+    p += sizeof(gb->arena->WRAM);
+    memcpy (gb->arena->high, p, sizeof(gb->arena->high));
+
+    if (cart_RAM_size (gb))
+        memcpy (arena_cart_RAM (gb), chunks[CART], cart_RAM_size (gb));
+
+    p = chunks[BUS];
+    gb->mem.MODE_STARTUP = get8 (&p) & 1;
+    gb->mem.DMA_active   = get8 (&p) & 1;
+    gb->mem.DMA_source   = get16 (&p);
+    gb->mem.DMA_start    = get64 (&p);
+
+    p = chunks[TIMR];
+    gb->timer.divider_base = get64 (&p);
+    gb->timer.base         = get64 (&p);
+    gb->timer.value        = get8 (&p);
+    gb->timer.control      = get8 (&p) & 7;
+
+    p = chunks[PPU];
+    display_set_step (gb, get8 (&p));
+    gb->display.frame_cycles = get64 (&p);
+    gb->display.stale        = get8 (&p) & 1;
+    for (unsigned i = 0; i < LEN(gb->display.sprites_to_draw); ++i)
+        gb->display.sprites_to_draw[i] = get16 (&p);
+
+    if (chunks[APU]) {
+        struct apu *apu = &gb->apu;
+        p = chunks[APU];
+        apu->synced   = get64 (&p);
+        apu->seq_next = get64 (&p);
+        apu->seq_step = get8 (&p) & 7;
+        for (unsigned i = 0; i < LEN(apu->ch); ++i) {
+            struct channel *ch = &apu->ch[i];
+            ch->on          = get8 (&p) & 1;
+            ch->length      = get16 (&p) & 0x1FF;
+            ch->timer       = get32 (&p);
+            ch->step        = get8 (&p) & 31;
+            ch->output      = get8 (&p) & 15;
+            ch->volume      = get8 (&p) & 15;
+            ch->env_timer   = get8 (&p) & 7;
+            ch->sweep_timer = get8 (&p) & 15;
+            ch->sweep_on    = get8 (&p) & 1;
+            ch->shadow      = get16 (&p) & 0x7FF;
+            ch->lfsr        = get16 (&p) & 0x7FFF;
+        }
+        apu_loaded (gb);
+    }
+    else
+        apu_reset (gb);
+
+    p = chunks[SIO];
+    gb->serial.end = p? get64 (&p) : SERIAL_NEVER;
+    serial_schedule (gb);
+
+    /* the bank pointers + page tables follow the mapper, and the
+     * pending interrupts follow IFLAGS/ISWITCH/IME */
+    mem_remap (gb);
+    cpu_update_interrupts (gb);
+
+    return true;
+}
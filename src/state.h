@@ -0,0 +1,22 @@
+/*
+ * emulator save states
+ *
+ */
+
+#ifndef __STATE_H
+#define __STATE_H
+
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+
+size_t state_size (gb_t *gb);
+size_t state_save (gb_t *gb, BYTE *buf, size_t size);
+bool   state_load (gb_t *gb, const BYTE *buf, size_t size);
+
+
+#endif
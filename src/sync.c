@@ -0,0 +1,199 @@
+/*
+ * keeping the emulation in time with the sound card (or the clock)
+ *
+ */
+
+#include "sync.h"
+#include "gb.h"
+#include "apu.h"
+#include "audio.h"
+
+#include <stdio.h>      /* fprintf */
+#include <stdlib.h>     /* calloc */
+
+
+
+/*  Each frame is due a frame's time after the last one was (so the time
+ *  spent between frames counts too), and the emulation sleeps until then.
+ *  That's all there is to it without a sound card (or one that can't say
+ *  how much it has left to play) -- but a sound card has a clock of its
+ *  own, and however close it is to the real one, the sound it's waiting
+ *  to play slowly builds up (the latency grows) or runs out (it crackles).
+ *
+ *  So after each frame, the buffer (how much the card has left to play)
+ *  is compared with the latency aimed for, and the rate the samples are
+ *  made at is nudged by up to APU_MAX_ADJUST to make up the difference --
+ *  in proportion to the difference, plus however much it's been off for a
+ *  while (so the buffer ends up at the latency, rather than just near it).
+ *  The pitch changes by as much, which isn't something that can be heard.
+ *
+ *  A card that's further off than that can't be kept up with by the rate,
+ *  so the buffer is the pacing: past BUFFER_HIGH of the latency, the next
+ *  frame waits for it to drain to the latency, and below BUFFER_LOW (as
+ *  it is to start with), frames are run straight away until it's built
+ *  back up to the latency.
+ */
+#define BUFFER_HIGH         1.5
+#define BUFFER_LOW          0.5
+
+/* how long it takes for being off to count as much as the difference itself */
+#define SETTLE_TIME         25.0
+
+
+struct sync {
+    struct audio *out;          /* (NULL if there's no sound) */
+    double        latency;
+    long double  *clock;        /* (NULL for the real one -- see clock_now) */
+    long double   frame_due;    /* when the frame should be done */
+    double        drift;        /* how long the buffer's been off for, in SETTLE_TIMEs */
+    bool          filling;      /* running frames straight away, to build the buffer up */
+
+    struct sync_metrics m;
+    double        buffer_sum,
+                  adjust_sum;
+};
+
+
+
+/* sleep_until: sleep until time (if it isn't already) */
+static void sleep_until (struct sync *s, long double time) {
+    clock_sleep (s->clock, time - clock_now (s->clock));
+}
+
+/* adjust_rate: nudge the sample rate to bring the buffer (seconds) to the latency */
+static double adjust_rate (struct sync *s, gb_t *gb, double buffer, double period) {
+
+    double off = (s->latency - buffer) / s->latency;
+    if (off > 1)
+        off = 1;
+    if (off < -1)
+        off = -1;
+
+    s->drift += off * period / SETTLE_TIME;
+    if (s->drift > 1)
+        s->drift = 1;
+    if (s->drift < -1)
+        s->drift = -1;
+
+    apu_set_adjust (gb, APU_MAX_ADJUST * (off + s->drift));
+    return gb->apu.adjust;
+}
+
+/* record: add a frame's buffer + adjustment to the metrics */
+static void record (struct sync *s, double buffer, double adjust) {
+
+    struct sync_metrics *m = &s->m;
+
+    if (m->frames++ == 0) {
+        m->buffer_min = m->buffer_max = buffer;
+        m->adjust_min = m->adjust_max = adjust;
+    }
+    m->buffer = buffer;
+    m->adjust = adjust;
+    s->buffer_sum += buffer;
+    s->adjust_sum += adjust;
+
+    if (buffer < m->buffer_min) m->buffer_min = buffer;
+    if (buffer > m->buffer_max) m->buffer_max = buffer;
+    if (adjust < m->adjust_min) m->adjust_min = adjust;
+    if (adjust > m->adjust_max) m->adjust_max = adjust;
+}
+
+
+
+/* PUBLIC API */
+/* sync_create: pace frames by out (which can be NULL), aiming to keep
+ *              latency seconds of sound waiting to be played */
+struct sync *sync_create (struct audio *out, double latency) {
+
+    struct sync *s = calloc (1, sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->out       = out;
+    s->latency   = latency;
+    s->frame_due = millis();
+    s->filling   = true;        /* (the buffer starts off empty) */
+    s->m.latency = latency;
+    return s;
+}
+
+/* sync_destroy: free s (but not its sound) */
+void sync_destroy (struct sync *s) {
+    free (s);
+}
+
+/* sync_frame: send gb's frame of sound, then wait until the next frame
+ *             should start (period seconds after the last one did) */
+void sync_frame (struct sync *s, gb_t *gb, double period) {
+
+    if (s->out && !audio_take (s->out, gb)) {
+        fprintf (stderr, "failed to write the sound, so it's off\n");
+        s->out = NULL;
+    }
+
+    long queued = s->out? audio_queued (s->out) : -1;
+    s->frame_due += period;
+
+    if (queued < 0)
+        s->m.video_frames++;
+    else {
+        double buffer = (double)queued / gb->apu.rate,
+               adjust = adjust_rate (s, gb, buffer, period);
+        record (s, buffer, adjust);
+        if (buffer >= s->latency)
+            s->filling = false;
+
+        if (buffer > s->latency * BUFFER_HIGH) {
+            s->m.waits++;
+            clock_sleep (s->clock, buffer - s->latency);
+            s->frame_due = clock_now (s->clock);
+            return;
+        }
+        if (buffer < s->latency * BUFFER_LOW || (s->filling && buffer < s->latency)) {
+            s->m.catchups += !s->filling;
+            s->filling = true;
+            s->frame_due = clock_now (s->clock);
+            return;
+        }
+    }
+
+    if (s->frame_due < clock_now (s->clock))
+        s->frame_due = clock_now (s->clock);    /* running behind, so don't try to catch up */
+    else
+        sleep_until (s, s->frame_due);
+}
+
+/* sync_set_clock: pace by clk (see clock_now), starting from now on it */
+void sync_set_clock (struct sync *s, long double *clk) {
+    s->clock     = clk;
+    s->frame_due = clock_now (clk);
+}
+
+/* sync_metrics: how well the sound's been kept up with so far */
+void sync_metrics (struct sync *s, struct sync_metrics *m) {
+
+    *m = s->m;
+    if (m->frames) {
+        m->buffer_avg = s->buffer_sum / m->frames;
+        m->adjust_avg = s->adjust_sum / m->frames;
+    }
+    if (s->out)
+        m->underruns = audio_underruns (s->out);
+}
+
+/* sync_print_metrics: print how well the sound's been kept up with (if it was) */
+void sync_print_metrics (struct sync *s) {
+
+    struct sync_metrics m;
+    sync_metrics (s, &m);
+    if (m.frames == 0)
+        return;
+
+    fprintf (stderr, "sound buffer: %.1f ms on average (%.1f-%.1f, aiming for %.0f), "
+                     "rate adjusted %+.3f%% on average (%+.3f%% to %+.3f%%), "
+                     "%lu underruns, %lu waits, %lu catch-ups\n",
+             m.buffer_avg * 1000.0, m.buffer_min * 1000.0, m.buffer_max * 1000.0, m.latency * 1000.0,
+             m.adjust_avg * 100.0, m.adjust_min * 100.0, m.adjust_max * 100.0,
+             m.underruns, m.waits, m.catchups);
+}
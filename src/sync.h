@@ -0,0 +1,62 @@
+/*
+ * keeping the emulation in time with the sound card (or the clock)
+ *
+ */
+
+#ifndef __SYNC_H
+#define __SYNC_H
+
+
+#include "common.h"
+
+#include <stdbool.h>
+
+
+
+/* how much sound is kept waiting to be played (seconds) */
+#define SYNC_DEFAULT_LATENCY    0.064
+#define SYNC_MIN_LATENCY        0.032
+#define SYNC_MAX_LATENCY        0.200
+
+
+struct audio;
+
+/* the pacing of an emulator instance (see sync.c) */
+struct sync;
+
+/* sync_metrics:
+ *  how well the sound's been kept up with -- the buffer is in seconds,
+ *  and the adjustment is to the rate (see apu_set_adjust)
+ */
+struct sync_metrics {
+    unsigned long frames,       /* paced by the sound... */
+                  video_frames; /* ...and by the clock */
+
+    double        latency,      /* the buffer aimed for */
+                  buffer,
+                  buffer_avg,
+                  buffer_min,
+                  buffer_max;
+
+    double        adjust,
+                  adjust_avg,
+                  adjust_min,
+                  adjust_max;
+
+    unsigned long waits,        /* frames held back for the buffer to drain */
+                  catchups,     /* frames run straight away to fill it */
+                  underruns;    /* times the sound card ran out */
+};
+
+
+struct sync *sync_create (struct audio *out, double latency);
+void sync_destroy (struct sync *s);
+
+void sync_frame (struct sync *s, gb_t *gb, double period);
+void sync_set_clock (struct sync *s, long double *clk);
+
+void sync_metrics (struct sync *s, struct sync_metrics *m);
+void sync_print_metrics (struct sync *s);
+
+
+#endif
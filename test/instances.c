@@ -0,0 +1,69 @@
+/*
+ * instances -- two instances run interleaved, a frame at a time, come out
+ *              exactly the same as each of them run on its own
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define FRAMES      300
+
+
+
+/* buttons: what instance n holds on a frame (they differ, so the runs do too) */
+static uint8_t buttons (unsigned n, unsigned long frame) {
+    if (n == 0)
+        return 0;
+    return (frame / 20) % 2? GB_A | GB_RIGHT : GB_START;
+}
+
+/* solo: run instance n on its own, keeping the hashes after each frame */
+static void solo (const uint8_t *rom, unsigned n, uint64_t *states, uint64_t *screens) {
+
+    gb_t *gb = create (rom);
+    for (unsigned long frame = 0; frame < FRAMES; ++frame) {
+        gb_set_input (gb, buttons (n, frame));
+        gb_run_frame (gb);
+        states[frame]  = state_hash (gb);
+        screens[frame] = screen_hash (gb);
+    }
+    gb_destroy (gb);
+}
+
+
+
+int main (void) {
+
+    uint8_t *rom = rom_busy();
+
+    static uint64_t states[2][FRAMES], screens[2][FRAMES];
+    for (unsigned n = 0; n < 2; ++n)
+        solo (rom, n, states[n], screens[n]);
+
+    bool ok = check ("instances", states[0][FRAMES - 1] != states[1][FRAMES - 1],
+                     "the buttons didn't make any difference");
+
+    gb_t *gb[2] = { create (rom), create (rom) };
+    unsigned long differ = 0;
+    for (unsigned long frame = 0; frame < FRAMES; ++frame)
+        for (unsigned n = 0; n < 2; ++n) {
+            gb_set_input (gb[n], buttons (n, frame));
+            gb_run_frame (gb[n]);
+            if (state_hash (gb[n]) != states[n][frame] || screen_hash (gb[n]) != screens[n][frame])
+                ++differ;
+        }
+    ok &= check ("instances", differ == 0, "the interleaved runs differ from the solo ones");
+
+    gb_destroy (gb[0]);
+    gb_destroy (gb[1]);
+    free (rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("instances: ok (%i frames of 2 instances)\n", FRAMES);
+    return EXIT_SUCCESS;
+}
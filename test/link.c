@@ -0,0 +1,74 @@
+/*
+ * link -- two instances on a link cable swap every byte they send, with a
+ *         serial interrupt at each end for each one, and an instance with
+ *         nothing plugged in gets 1s if it's clocking, or waits forever
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* (32 bytes at 8192 bits a second is a couple of frames) */
+#define FRAMES      10
+#define BYTES       32
+
+
+
+/* received: whether gb got BYTES bytes, first + (n * step), with an interrupt for each */
+static bool received (gb_t *gb, uint8_t first, unsigned step) {
+
+    if (gb_read (gb, 0xC100) != BYTES || gb_read (gb, 0xFF80) != BYTES)
+        return false;
+    for (unsigned n = 0; n < BYTES; ++n)
+        if (gb_read (gb, 0xC000 + n) != (uint8_t)(first + (n * step)))
+            return false;
+    return true;
+}
+
+
+
+int main (void) {
+
+    uint8_t *master_rom = rom_link (true),
+            *slave_rom  = rom_link (false);
+    bool ok = true;
+
+    gb_t *master = create (master_rom),
+         *slave  = create (slave_rom);
+    gb_link_t *ln = gb_link_create (master, slave);
+    if (!ln) {
+        fprintf (stderr, "failed to create a link cable\n");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < FRAMES; ++i)
+        gb_link_run_frame (ln);
+    ok &= check ("link", received (master, 0x80, 1), "the master didn't get what the other end sent");
+    ok &= check ("link", received (slave, 0x00, 1), "the other end didn't get what the master sent");
+
+    gb_link_destroy (ln);
+    gb_destroy (master);
+    gb_destroy (slave);
+
+    /* (with nothing plugged in, the line is high) */
+    master = create (master_rom);
+    slave  = create (slave_rom);
+    for (unsigned i = 0; i < FRAMES; ++i) {
+        gb_run_frame (master);
+        gb_run_frame (slave);
+    }
+    ok &= check ("link", received (master, 0xFF, 0), "unplugged, the master didn't get 1s");
+    ok &= check ("link", gb_read (slave, 0xC100) == 0 && gb_read (slave, 0xFF80) == 0, "unplugged, the other end didn't wait");
+
+    gb_destroy (master);
+    gb_destroy (slave);
+    free (master_rom);
+    free (slave_rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("link: ok (%i bytes each way)\n", BYTES);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * movie -- playing a movie back gives exactly the run it was recorded
+ *          from, and a movie won't play on another ROM
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>     /* close, unlink */
+
+
+#define FRAMES      300
+
+enum mode { NONE, RECORD, PLAY };
+
+
+
+/* buttons: what's held on a frame while recording */
+static uint8_t buttons (unsigned long frame) {
+    switch (frame % 90 / 20) {
+    case 0:  return GB_A;
+    case 1:  return GB_START | GB_DOWN;
+    case 2:  return GB_LEFT;
+    default: return 0;
+    }
+}
+
+/* run: run FRAMES frames with no buttons, recording them to fname, or playing
+ *      fname back -- keeping the hashes after each frame */
+static void run (const uint8_t *rom, enum mode mode, const char *fname, uint64_t *hashes) {
+
+    gb_t *gb = create (rom);
+
+    gb_movie_t *mv = NULL;
+    if (mode != NONE && !(mv = (mode == RECORD)? gb_movie_record (gb, fname) : gb_movie_play (gb, fname))) {
+        fprintf (stderr, "failed to %s '%s'\n", mode == RECORD? "record" : "play", fname);
+        exit (EXIT_FAILURE);
+    }
+
+    for (unsigned long frame = 0; frame < FRAMES; ++frame) {
+        if (mode == RECORD)
+            gb_set_input (gb, buttons (frame));
+        if (mv)
+            gb_movie_frame (mv, gb);
+        gb_run_frame (gb);
+        hashes[frame] = state_hash (gb) ^ screen_hash (gb);
+    }
+
+    gb_movie_close (mv);
+    gb_destroy (gb);
+}
+
+
+
+int main (void) {
+
+    char fname[] = "/tmp/gb-movie-XXXXXX";
+    int fd = mkstemp (fname);
+    if (fd < 0) {
+        perror ("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close (fd);
+
+    uint8_t *rom = rom_busy();
+    bool ok = true;
+
+    static uint64_t recorded[FRAMES], played[FRAMES], none[FRAMES];
+    run (rom, RECORD, fname, recorded);
+    run (rom, PLAY,   fname, played);
+    run (rom, NONE,   NULL,  none);
+
+    unsigned long differ = 0, buttons_differ = 0;
+    for (unsigned long frame = 0; frame < FRAMES; ++frame) {
+        differ         += played[frame] != recorded[frame];
+        buttons_differ += none[frame]   != recorded[frame];
+    }
+    ok &= check ("movie", differ == 0, "the run played back differs from the one recorded");
+    ok &= check ("movie", buttons_differ > 0, "the buttons didn't make any difference");
+
+    /* (the movie's checked against the ROM's checksums) */
+    rom[0x014E] ^= 1;
+    gb_t *gb = create (rom);
+    gb_movie_t *mv = gb_movie_play (gb, fname);
+    ok &= check ("movie", !mv, "the movie played on another ROM");
+    gb_movie_close (mv);
+    gb_destroy (gb);
+
+    unlink (fname);
+    free (rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("movie: ok (%i frames)\n", FRAMES);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/*
+ * rewind -- every frame popped off a rewind buffer is the state it was
+ *           pushed with, and a buffer too small for a whole keyframe's
+ *           worth of frames still keeps a useful amount of history
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define FRAMES      600
+
+/* big enough for every frame, and small enough to be full most of the time... */
+#define BIG_BUDGET      (16 << 20)
+#define SMALL_BUDGET    (300 << 10)
+/* ...which has to keep at least this many frames, once it's full */
+#define MIN_HISTORY     8
+
+
+
+/* run: push FRAMES frames (going back some of the way every so often), checking each one
+ *      popped -- returning how many frames were kept at the least once it's full, and
+ *      (dropped) how many fewer were kept at the end than pushed */
+static size_t run (const uint8_t *rom, size_t budget, unsigned long *bad, size_t *dropped) {
+
+    gb_t *gb = create (rom);
+    gb_rewind_t *rw = gb_rewind_create (gb, budget);
+    if (!rw) {
+        fprintf (stderr, "failed to create a rewind buffer\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* (the hashes of the frames pushed, newest last) */
+    static uint64_t pushed[FRAMES];
+    size_t top = 0, least = FRAMES;
+
+    for (unsigned long frame = 0; frame < FRAMES; ++frame) {
+        gb_set_input (gb, (frame / 15) % 3? 0 : GB_B);
+        gb_run_frame (gb);
+        gb_rewind_push (rw, gb);
+        pushed[top++] = state_hash (gb);
+
+        if (frame >= FRAMES / 4 && gb_rewind_frames (rw) < least)
+            least = gb_rewind_frames (rw);
+
+        /* every so often, go back a few frames (as if the key's been held down) */
+        if (frame % 97 == 96)
+            for (unsigned i = 0; i < 5 && gb_rewind_pop (rw, gb); ++i)
+                if (state_hash (gb) != pushed[--top])
+                    ++*bad;
+    }
+
+    /* then all the way back */
+    *dropped = top - gb_rewind_frames (rw);
+    while (gb_rewind_pop (rw, gb))
+        if (state_hash (gb) != pushed[--top])
+            ++*bad;
+
+    gb_rewind_destroy (rw);
+    gb_destroy (gb);
+    return least;
+}
+
+
+
+int main (void) {
+
+    uint8_t *rom = rom_busy();
+    bool ok = true;
+
+    unsigned long bad = 0;
+    size_t dropped;
+    run (rom, BIG_BUDGET, &bad, &dropped);
+    ok &= check ("rewind", bad == 0, "a frame popped isn't the one pushed");
+    ok &= check ("rewind", dropped == 0, "a big buffer dropped frames");
+
+    size_t small_least = run (rom, SMALL_BUDGET, &bad, &dropped);
+    ok &= check ("rewind", bad == 0, "a frame popped off a full buffer isn't the one pushed");
+    ok &= check ("rewind", small_least >= MIN_HISTORY, "a small buffer's history collapsed");
+
+    free (rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("rewind: ok (a %i KB buffer kept at least %zu frames)\n", SMALL_BUDGET >> 10, small_least);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/*
+ * sync -- frames paced by a (pretend) sound card keep its buffer near the
+ *         latency aimed for: a card that's close to the right rate is kept
+ *         up with by nudging the rate, and one that's further off by
+ *         waiting for it, or running frames straight away
+ *
+ */
+
+#include "test.h"
+#include "gb.h"
+#include "Z80.h"
+#include "apu.h"
+#include "audio.h"
+#include "sync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+
+/* seconds each card is played for (on a pretend clock, which the frames
+ * take no time on -- so the runs are the same every time) */
+#define SECONDS     2.0
+
+
+
+/* run: pace SECONDS of frames by a card playing rate samples a second, returning how it went */
+static struct sync_metrics run (const uint8_t *rom, unsigned rate, double *elapsed) {
+
+    char name[32];
+    snprintf (name, sizeof(name), "sim:%u", rate);
+
+    gb_t *gb = create (rom);
+    struct audio *out = audio_open (name, APU_RATE);
+    if (!out || !(gb->sync = sync_create (out, SYNC_DEFAULT_LATENCY))) {
+        fprintf (stderr, "failed to pace by '%s'\n", name);
+        exit (EXIT_FAILURE);
+    }
+
+    long double clock = 0;
+    audio_set_clock (out, &clock);
+    sync_set_clock (gb->sync, &clock);
+
+    unsigned long frames = SECONDS * 59.73;     /* (frames a second) */
+    for (unsigned long frame = 0; frame < frames; ++frame)
+        Z80_frame (gb);
+    *elapsed = clock;
+
+    struct sync_metrics m;
+    sync_metrics (gb->sync, &m);
+
+    sync_destroy (gb->sync);
+    gb->sync = NULL;
+    audio_close (out);
+    gb_destroy (gb);
+    return m;
+}
+
+
+
+int main (void) {
+
+    uint8_t *rom = rom_busy();
+    bool ok = true;
+    double elapsed;
+
+    /* 0.3% fast or slow, which the rate can make up */
+    struct sync_metrics m, slow = run (rom, APU_RATE * 0.997, &elapsed);
+    m = run (rom, APU_RATE * 1.003, &elapsed);
+    ok &= check ("sync", m.underruns == 0 && m.waits == 0, "a close card needed more than the rate nudging");
+    ok &= check ("sync", fabs (m.buffer - m.latency) < m.latency / 2, "a close card's buffer isn't near the latency");
+    ok &= check ("sync", m.adjust > slow.adjust, "the rate wasn't nudged the right way");
+    ok &= check ("sync", fabs (elapsed + m.latency - SECONDS) < SECONDS / 100,   /* (less filling the buffer) */
+                 "a close card's frames weren't in real time");
+
+    /* 5% slow, so the buffer builds up to where it has to be waited for... */
+    m = run (rom, APU_RATE * 0.95, &elapsed);
+    ok &= check ("sync", m.waits > 0, "a slow card wasn't waited for");
+    ok &= check ("sync", m.buffer_max < m.latency * 2, "a slow card's buffer built up");
+
+    /* ...and 5% fast, so it runs down to where frames have to be run straight away */
+    m = run (rom, APU_RATE * 1.05, &elapsed);
+    ok &= check ("sync", m.catchups > 0, "a fast card wasn't caught up with");
+    ok &= check ("sync", m.underruns == 0, "a fast card ran out");
+
+    free (rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("sync: ok\n");
+    return EXIT_SUCCESS;
+}
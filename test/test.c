@@ -0,0 +1,215 @@
+/*
+ * what the tests share -- the ROMs they run (built in memory), and
+ * hashes to compare runs by
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* rom: a ROM being put together, an instruction at a time */
+struct rom {
+    uint8_t *data;
+    size_t   at;
+};
+
+/* FNV-1a */
+#define FNV1A_START     0xCBF29CE484222325ULL
+#define FNV1A_PRIME     0x100000001B3ULL
+
+
+
+/* emit: put count bytes at r->at */
+static void emit (struct rom *r, unsigned count, const uint8_t *bytes) {
+    memcpy (r->data + r->at, bytes, count);
+    r->at += count;
+}
+#define EMIT(r, ...)    emit ((r), sizeof((uint8_t[]){ __VA_ARGS__ }), (uint8_t[]){ __VA_ARGS__ })
+
+/* jr: JR cc (opcode) to target */
+static void jr (struct rom *r, uint8_t opcode, size_t target) {
+    EMIT (r, opcode, (uint8_t)(target - (r->at + 2)));
+}
+
+/* rom_new: an empty ROM, starting at $0150 */
+static struct rom rom_new (const char *title) {
+
+    struct rom r = { calloc (1, ROM_SIZE), 0x0100 };
+    if (!r.data) {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+
+    EMIT (&r, 0x00, 0xC3, 0x50, 0x01);          /* NOP; JP $0150 */
+    memcpy (r.data + 0x0134, title, strlen (title));
+    r.at = 0x0150;
+    return r;
+}
+
+/* fnv1a: hash size bytes */
+static uint64_t fnv1a (uint64_t hash, const uint8_t *data, size_t size) {
+    while (size--)
+        hash = (hash ^ *data++) * FNV1A_PRIME;
+    return hash;
+}
+
+
+
+/* PUBLIC API */
+/* rom_busy: a ROM that never stops writing VRAM + internal RAM, with bytes made from the
+ *           buttons, DIVIDER and everything it's written before (and a VBLANK interrupt) --
+ *           so a frame changes about a thousand bytes, and depends on every frame before it */
+uint8_t *rom_busy (void) {
+
+    struct rom r = rom_new ("TESTBUSY");
+
+    r.data[0x0040] = 0xD9;                      /* VBLANK: RETI */
+
+    EMIT (&r, 0xF3,                             /* DI */
+              0x31, 0xFE, 0xFF,                 /* LD SP,$FFFE */
+              0x21, 0x00, 0x80,                 /* LD HL,$8000 */
+              0x1E, 0x00,                       /* LD E,0 */
+              0x3E, 0x01, 0xE0, 0xFF,           /* LD A,1; LDH (ISWITCH),A */
+              0xFB);                            /* EI */
+
+    size_t loop = r.at;
+    EMIT (&r, 0x3E, 0x20, 0xE0, 0x00,           /* LD A,$20; LDH (JOYPAD),A -- the directions */
+              0xF0, 0x00, 0x47,                 /* LDH A,(JOYPAD); LD B,A */
+              0x3E, 0x10, 0xE0, 0x00,           /* LD A,$10; LDH (JOYPAD),A -- the others */
+              0xF0, 0x00, 0xCB, 0x37,           /* LDH A,(JOYPAD); SWAP A */
+              0xA8, 0x47,                       /* XOR B; LD B,A */
+              0xF0, 0x04, 0xA8,                 /* LDH A,(DIVIDER); XOR B */
+              0x83, 0x5F,                       /* ADD E; LD E,A */
+              0x22,                             /* LD (HL+),A */
+              0x7C, 0xFE, 0xA0);                /* LD A,H; CP $A0 -- past VRAM... */
+    size_t past_VRAM = r.at + 4;
+    jr (&r, 0x20, past_VRAM);                   /* JR NZ */
+    EMIT (&r, 0x26, 0xC0);                      /* LD H,$C0 -- ...on to internal RAM */
+    EMIT (&r, 0xFE, 0xE0);                      /* CP $E0 -- past internal RAM... */
+    jr (&r, 0x20, loop);                        /* JR NZ */
+    EMIT (&r, 0x26, 0x80);                      /* LD H,$80 -- ...back to VRAM */
+    jr (&r, 0x18, loop);                        /* JR */
+
+    return r.data;
+}
+
+/* rom_link: a ROM that sends 32 bytes over serial (the master 0, 1, 2..., clocking them, and
+ *           the other end $80, $81, $82...), keeping what comes in at $C000, how many at
+ *           $C100, and how many serial interrupts there have been at $FF80 */
+uint8_t *rom_link (bool master) {
+
+    struct rom r = rom_new (master? "TESTLINKM" : "TESTLINKS");
+
+    memcpy (r.data + 0x0058, (uint8_t[]){ 0xF5,                 /* SERIAL: PUSH AF */
+                                          0xF0, 0x80, 0x3C,     /* LDH A,($80); INC A */
+                                          0xE0, 0x80,           /* LDH ($80),A */
+                                          0xF1, 0xD9 }, 8);     /* POP AF; RETI */
+
+    EMIT (&r, 0xF3,                             /* DI */
+              0x31, 0xFE, 0xFF,                 /* LD SP,$FFFE */
+              0x0E, 0x00,                       /* LD C,0 */
+              0x21, 0x00, 0xC0,                 /* LD HL,$C000 */
+              0x3E, 0x08, 0xE0, 0xFF,           /* LD A,8; LDH (ISWITCH),A */
+              0xAF, 0xE0, 0x80, 0xE0, 0x0F,     /* XOR A; LDH ($80),A; LDH (IFLAGS),A */
+              0xFB);                            /* EI */
+
+    size_t loop = r.at;
+    EMIT (&r, 0x79);                            /* LD A,C */
+    if (!master)
+        EMIT (&r, 0xF6, 0x80);                  /* OR $80 */
+    EMIT (&r, 0xE0, 0x01,                       /* LDH (SIODATA),A */
+              0x3E, master? 0x81 : 0x80,        /* LD A,$81/$80 -- start, on our clock or theirs */
+              0xE0, 0x02);                      /* LDH (SIOCONT),A */
+
+    size_t wait = r.at;
+    EMIT (&r, 0xF0, 0x02, 0xCB, 0x7F);          /* LDH A,(SIOCONT); BIT 7,A */
+    jr (&r, 0x20, wait);                        /* JR NZ */
+    EMIT (&r, 0xF0, 0x01, 0x22,                 /* LDH A,(SIODATA); LD (HL+),A */
+              0x0C, 0x79,                       /* INC C; LD A,C */
+              0xEA, 0x00, 0xC1,                 /* LD ($C100),A */
+              0xFE, 32);                        /* CP 32 */
+    jr (&r, 0x20, loop);                        /* JR NZ */
+    jr (&r, 0x18, r.at);                        /* JR to itself */
+
+    return r.data;
+}
+
+/* rom_timer: a ROM that runs the timer as fast as it goes (TIMEMOD $FF, overflowing every
+ *            16 cycles) under 24-cycle CALLs, counting the timer's interrupt requests (with
+ *            interrupts off, polling IFLAGS) at $FF80-$FF81 */
+uint8_t *rom_timer (void) {
+
+    struct rom r = rom_new ("TESTTIMER");
+
+    /* (the subroutine's out of the way, at $0200) */
+    r.data[0x0200] = 0xC9;                      /* RET */
+
+    EMIT (&r, 0xF3,                             /* DI */
+              0x31, 0xFE, 0xFF,                 /* LD SP,$FFFE */
+              0xAF, 0xE0, 0x80, 0xE0, 0x81,     /* XOR A; LDH ($80),A; LDH ($81),A */
+              0xE0, 0x0F,                       /* LDH (IFLAGS),A */
+              0x3E, 0xFF,                       /* LD A,$FF */
+              0xE0, 0x06, 0xE0, 0x05,           /* LDH (TIMEMOD),A; LDH (TIMECNT),A */
+              0x3E, 0x05, 0xE0, 0x07);          /* LD A,5; LDH (TIMCONT),A -- on, every 16 cycles */
+
+    size_t loop = r.at;
+    EMIT (&r, 0xCD, 0x00, 0x02,                 /* CALL $0200 */
+              0xF0, 0x0F, 0xE6, 0x04);          /* LDH A,(IFLAGS); AND 4 */
+    jr (&r, 0x28, loop);                        /* JR Z */
+    EMIT (&r, 0xAF, 0xE0, 0x0F,                 /* XOR A; LDH (IFLAGS),A */
+              0xF0, 0x80, 0xC6, 0x01,           /* LDH A,($80); ADD 1 */
+              0xE0, 0x80,                       /* LDH ($80),A */
+              0xF0, 0x81, 0xCE, 0x00,           /* LDH A,($81); ADC 0 */
+              0xE0, 0x81);                      /* LDH ($81),A */
+    jr (&r, 0x18, loop);                        /* JR */
+
+    return r.data;
+}
+
+/* create: an instance running rom, exiting if it can't be made */
+gb_t *create (const uint8_t *rom) {
+
+    gb_t *gb = gb_create (rom, ROM_SIZE);
+    if (!gb) {
+        fprintf (stderr, "failed to create an instance\n");
+        exit (EXIT_FAILURE);
+    }
+    return gb;
+}
+
+/* state_hash: a hash of the instance's save state */
+uint64_t state_hash (gb_t *gb) {
+
+    size_t size = gb_state_size (gb);
+    uint8_t *state = malloc (size);
+    if (!state || !(size = gb_save_state (gb, state, size))) {
+        fprintf (stderr, "failed to save a state\n");
+        exit (EXIT_FAILURE);
+    }
+
+    uint64_t hash = fnv1a (FNV1A_START, state, size);
+    free (state);
+    return hash;
+}
+
+/* screen_hash: a hash of what's on the screen */
+uint64_t screen_hash (gb_t *gb) {
+
+    const uint8_t *framebuffer = gb_framebuffer (gb);
+    uint64_t hash = FNV1A_START;
+    for (unsigned y = 0; y < GB_SCREEN_H; ++y)
+        hash = fnv1a (hash, framebuffer + (y * GB_FB_STRIDE), GB_SCREEN_W);
+    return hash;
+}
+
+/* check: say what's wrong if it isn't ok, returning ok */
+bool check (const char *test, bool ok, const char *what) {
+    if (!ok)
+        fprintf (stderr, "%s: FAILED: %s\n", test, what);
+    return ok;
+}
@@ -0,0 +1,34 @@
+/*
+ * what the tests share -- the ROMs they run (built in memory), and
+ * hashes to compare runs by
+ *
+ */
+
+#ifndef __TEST_H
+#define __TEST_H
+
+
+#include "libgb.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* the size of each ROM (32 KB, with no memory controller) */
+#define ROM_SIZE    0x8000
+
+
+
+uint8_t *rom_busy (void);
+uint8_t *rom_link (bool master);
+uint8_t *rom_timer (void);
+
+gb_t *create (const uint8_t *rom);
+uint64_t state_hash (gb_t *gb);
+uint64_t screen_hash (gb_t *gb);
+
+bool check (const char *test, bool ok, const char *what);
+
+
+#endif
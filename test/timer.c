@@ -0,0 +1,46 @@
+/*
+ * timer -- the timer keeps interrupting when it overflows again
+ *          before the end of the instruction it overflowed in (the shortest
+ *          period, reloading $FF)
+ *
+ */
+
+#include "test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define FRAMES      10
+
+
+
+/* interrupts: how many timer interrupts the ROM has seen */
+static unsigned interrupts (gb_t *gb) {
+    return gb_read (gb, 0xFF80) | (gb_read (gb, 0xFF81) << 8);
+}
+
+
+
+int main (void) {
+
+    uint8_t *rom = rom_timer();
+    gb_t *gb = create (rom);
+
+    unsigned long stalled = 0;
+    unsigned last = 0;
+    for (unsigned frame = 0; frame < FRAMES; ++frame) {
+        gb_run_frame (gb);
+        stalled += interrupts (gb) == last;
+        last = interrupts (gb);
+    }
+    bool ok = check ("timer", stalled == 0, "the timer stopped interrupting");
+
+    gb_destroy (gb);
+    free (rom);
+
+    if (!ok)
+        return EXIT_FAILURE;
+    printf ("timer: ok (%u interrupts in the last frame)\n", last);
+    return EXIT_SUCCESS;
+}